@@ -30,8 +30,10 @@
 
 #include <vector>
 #include <string>
+#include <deque>
 #include <tr1/memory>
 
+#include <pthread.h>
 #include <png.h>
 #include <GL/gl.h>
 
@@ -110,6 +112,606 @@ public:
   static void calcNormal(float v[3][3], float out[3]);
   static void reduceToUnit(float vector[3]);
   static Vector3 calcNormal(Vector3 a, Vector3 b, Vector3 c);
+  static float parseFloat(const char* begin, const char* end);
+  static int parseInt(const char* begin, const char* end);
+  static unsigned long long hash(const char* data, size_t size);
+  static double getTime();
+  static void multiplyMatrix(const float* a, const float* b, float* result);
+  static void translateMatrix(float* matrix, float x, float y, float z);
+  static void rotateMatrix(float* matrix, float angle, float x, float y, float z);
+  static void scaleMatrix(float* matrix, float x, float y, float z);
+
+};
+
+/// \class MappedFile
+/// \brief A read-only view of a file mapped directly into memory
+///
+/// Allows the loaders to parse a file in place rather than copying it line
+/// by line into strings. The mapping is released when the MappedFile is destroyed.
+class MappedFile
+{
+private:
+  MappedFile(const MappedFile& copy);
+  MappedFile& operator=(const MappedFile& other);
+
+  const char* data; ///< The start of the mapped file contents
+  size_t size; ///< The number of bytes mapped
+
+public:
+  MappedFile(std::string path);
+  ~MappedFile();
+
+  const char* getData();
+  size_t getSize();
+
+};
+
+/// \class Token
+/// \brief A range of characters within a larger buffer
+///
+/// Used by the Tokenizer so that the words of a line can be inspected and
+/// converted to numbers without allocating a std::string for each of them.
+class Token
+{
+private:
+  const char* begin; ///< The first character of the token
+  const char* end; ///< One past the last character of the token
+
+public:
+  Token();
+  Token(const char* begin, const char* end);
+
+  const char* getBegin() const;
+  const char* getEnd() const;
+  size_t getLength() const;
+  bool isEmpty() const;
+  bool equals(const char* text) const;
+  int split(char splitter, Token* output, int max) const;
+  std::string toString() const;
+  float toFloat() const;
+  int toInt() const;
+
+};
+
+/// \class Tokenizer
+/// \brief Splits a buffer into lines of whitespace separated tokens
+///
+/// The whitespace to split by includes r, t and ' ', lines are ended by n.
+class Tokenizer
+{
+private:
+  const char* current; ///< The start of the next line to be read
+  const char* end; ///< One past the last character of the buffer
+
+public:
+  Tokenizer(const char* begin, const char* end);
+
+  bool nextLine(std::vector<Token>* tokens);
+
+};
+
+/// \struct GLStateStats
+/// \brief The OpenGL state changes requested through GLState
+struct GLStateStats
+{
+  size_t issued; ///< The number of calls passed on to OpenGL
+  size_t elided; ///< The number of calls skipped because the state was already set
+  size_t verified; ///< The number of skipped calls checked against OpenGL in debug mode
+
+  GLStateStats();
+
+};
+
+/// \class GLState
+/// \brief Shadows the OpenGL state the library changes and skips redundant calls
+///
+/// Every texture and buffer binding, shader program, client array, array
+/// pointer, capability and current color set by the library goes through
+/// this class. A call which would not change the shadowed state is not
+/// issued and the rest are passed on to the current RenderBackend. State
+/// which has not yet been set is unknown and the first call is always issued.
+///
+/// The shadow belongs to the single rendering context and must only be used
+/// from the thread owning it. If the application changes any of this state
+/// itself it must call invalidate before the library next draws.
+class GLState
+{
+public:
+  static void bindTexture(GLuint texture);
+  static void bindBuffer(GLenum target, GLuint buffer);
+  static void deleteBuffer(GLuint buffer);
+  static void deleteTexture(GLuint texture);
+  static void useProgram(GLuint program);
+  static void deleteProgram(GLuint program);
+  static void bindVertexArray(GLuint array);
+  static void deleteVertexArray(GLuint array);
+
+  static void enableClientState(GLenum array);
+  static void disableClientState(GLenum array);
+  static void enable(GLenum capability);
+  static void disable(GLenum capability);
+  static bool isEnabled(GLenum capability);
+
+  static void vertexPointer(GLint size, GLenum type, GLsizei stride, const GLvoid* pointer);
+  static void normalPointer(GLenum type, GLsizei stride, const GLvoid* pointer);
+  static void texCoordPointer(GLint size, GLenum type, GLsizei stride, const GLvoid* pointer);
+  static void colorPointer(GLint size, GLenum type, GLsizei stride, const GLvoid* pointer);
+  static void color(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha);
+
+  static void restore();
+  static void invalidate();
+
+  static void setDebug(bool debug);
+  static bool isDebug();
+  static GLStateStats getStats();
+  static void resetStats();
+
+};
+
+/// \struct BufferRange
+/// \brief A span of bytes within a buffer handed out by the BufferArena
+struct BufferRange
+{
+  GLenum target; ///< GL_ARRAY_BUFFER_ARB or GL_ELEMENT_ARRAY_BUFFER_ARB
+  GLuint buffer; ///< The buffer holding the range, or 0 if nothing is allocated
+  size_t offset; ///< The first byte of the range within the buffer
+  size_t size; ///< The number of bytes in the range
+  bool dedicated; ///< True if the buffer holds only this range, as when the arena is disabled
+
+  BufferRange();
+  const GLvoid* getPointer(size_t offset) const;
+
+};
+
+/// \struct ArenaStats
+/// \brief The buffers and ranges held by the BufferArena
+struct ArenaStats
+{
+  size_t blocks; ///< The number of shared buffers
+  size_t capacity; ///< The total size of the shared buffers
+  size_t used; ///< The bytes of the shared buffers allocated to ranges
+  size_t ranges; ///< The number of ranges within the shared buffers
+  size_t dedicated; ///< The number of ranges given a buffer of their own
+  size_t flushes; ///< The number of times flush mapped or wrote to a shared buffer
+
+  ArenaStats();
+
+};
+
+/// \class BufferArena
+/// \brief Sub-allocates the vertex and index data of every MaterialGroup from a few large buffers
+///
+/// Once enabled, ranges are allocated first fit from blocks of at least the
+/// block size, one set of blocks for vertices and another for indices, so
+/// groups share buffers and drawing them binds a buffer far less often. The
+/// data written to ranges is staged in memory until flush copies it into each
+/// block through a single glMapBufferRange, or glBufferSubData where mapping
+/// is unsupported. Released ranges are merged with free neighbours and a block
+/// left empty is deleted. While disabled, the default, each range is a buffer
+/// of its own filled directly by write.
+///
+/// Like GLState the arena belongs to the single rendering context.
+class BufferArena
+{
+public:
+  static void setEnabled(bool enabled);
+  static bool isEnabled();
+  static void setBlockSize(size_t size);
+  static size_t getBlockSize();
+
+  static BufferRange allocate(GLenum target, size_t size);
+  static void write(BufferRange* range, const GLvoid* data);
+  static void flush();
+  static void release(BufferRange* range);
+  static ArenaStats getStats();
+
+};
+
+/// \class Shader
+/// \brief A GLSL program built from a vertex and fragment shader
+///
+/// Compile and link errors throw a WavefrontException containing the
+/// driver's log. A rendering context supporting OpenGL 2.0 must be current.
+class Shader
+{
+private:
+  std::tr1::shared_ptr<GLuint> _program; GLuint program; ///< The linked program on the graphics card
+
+  static void deleteProgram(GLuint* program);
+  static GLuint compile(GLenum type, std::string source);
+
+public:
+  Shader(std::string vertexSource, std::string fragmentSource);
+
+  void use();
+  static void unuse();
+  GLuint getId();
+  GLint getAttribute(std::string name);
+  GLint getUniform(std::string name);
+
+  static std::string getFixedVertexSource(std::string source);
+  static std::string getFixedFragmentSource();
+  static void enableInstanceMatrix(GLint location);
+  static void setInstanceMatrixPointer(GLint location, GLsizei stride, size_t offset);
+  static void disableInstanceMatrix(GLint location);
+
+};
+
+/// \class MatrixStack
+/// \brief A stack of column-major matrices kept on the CPU in place of the fixed function stacks
+class MatrixStack
+{
+private:
+  std::vector<float> matrices; ///< 16 floats per level, the last being the current matrix
+
+public:
+  MatrixStack();
+
+  void push();
+  void pop();
+  void loadIdentity();
+  void load(const float* matrix);
+  void multiply(const float* matrix);
+  void translate(float x, float y, float z);
+  void rotate(float angle, float x, float y, float z);
+  void scale(float x, float y, float z);
+  void perspective(float fovy, float aspect, float zNear, float zFar);
+  const float* get();
+
+};
+
+/// \class RenderBackend
+/// \brief The buffer, texture, state, matrix and draw calls the library makes
+///
+/// MaterialGroup, Texture, Animation, AnimatedModel and RenderQueue issue
+/// their calls through the current backend, as does GLState for the state
+/// changes it does not elide. The default is a GLBackend calling OpenGL.
+/// Setting a NullBackend instead lets models be uploaded and drawn without a
+/// rendering context. Shaders are always built with OpenGL, so InstanceBatch
+/// and MatrixPalette fall back to drawing part by part under another backend
+/// and the CorePipeline requires the GLBackend.
+class RenderBackend
+{
+public:
+  virtual ~RenderBackend();
+
+  static RenderBackend* get();
+  static void set(RenderBackend* backend);
+  static bool isDefault();
+
+  virtual void initialize() = 0;
+
+  virtual GLuint genBuffer() = 0;
+  virtual void deleteBuffer(GLuint buffer) = 0;
+  virtual void bindBuffer(GLenum target, GLuint buffer) = 0;
+  virtual void bufferData(GLenum target, size_t size, const GLvoid* data, GLenum usage) = 0;
+  virtual void bufferSubData(GLenum target, size_t offset, size_t size, const GLvoid* data) = 0;
+  virtual void* mapBufferRange(GLenum target, size_t offset, size_t size, GLbitfield access) = 0;
+  virtual bool unmapBuffer(GLenum target) = 0;
+
+  virtual GLuint genTexture() = 0;
+  virtual void deleteTexture(GLuint texture) = 0;
+  virtual void bindTexture(GLuint texture) = 0;
+  virtual void texImage(GLsizei width, GLsizei height, int channels, const GLvoid* pixels) = 0;
+
+  virtual void useProgram(GLuint program) = 0;
+  virtual void deleteProgram(GLuint program) = 0;
+  virtual void bindVertexArray(GLuint array) = 0;
+  virtual void deleteVertexArray(GLuint array) = 0;
+
+  virtual void enableClientState(GLenum array) = 0;
+  virtual void disableClientState(GLenum array) = 0;
+  virtual void enable(GLenum capability) = 0;
+  virtual void disable(GLenum capability) = 0;
+  virtual bool isEnabled(GLenum capability) = 0;
+
+  virtual void vertexPointer(GLint size, GLenum type, GLsizei stride, const GLvoid* pointer) = 0;
+  virtual void normalPointer(GLenum type, GLsizei stride, const GLvoid* pointer) = 0;
+  virtual void texCoordPointer(GLint size, GLenum type, GLsizei stride, const GLvoid* pointer) = 0;
+  virtual void colorPointer(GLint size, GLenum type, GLsizei stride, const GLvoid* pointer) = 0;
+  virtual void color(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha) = 0;
+
+  virtual void matrixMode(GLenum mode) = 0;
+  virtual void pushMatrix() = 0;
+  virtual void popMatrix() = 0;
+  virtual void loadMatrix(const float* matrix) = 0;
+  virtual void translate(float x, float y, float z) = 0;
+  virtual void rotate(float angle, float x, float y, float z) = 0;
+  virtual void scale(float x, float y, float z) = 0;
+  virtual void getModelview(float* matrix) = 0;
+
+  virtual void drawArrays(GLenum mode, GLint first, GLsizei count) = 0;
+  virtual void drawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices) = 0;
+  virtual void drawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instances) = 0;
+  virtual void drawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices, GLsizei instances) = 0;
+
+};
+
+/// \class GLBackend
+/// \brief The default RenderBackend, passing each call on to OpenGL
+class GLBackend : public RenderBackend
+{
+public:
+  virtual void initialize();
+
+  virtual GLuint genBuffer();
+  virtual void deleteBuffer(GLuint buffer);
+  virtual void bindBuffer(GLenum target, GLuint buffer);
+  virtual void bufferData(GLenum target, size_t size, const GLvoid* data, GLenum usage);
+  virtual void bufferSubData(GLenum target, size_t offset, size_t size, const GLvoid* data);
+  virtual void* mapBufferRange(GLenum target, size_t offset, size_t size, GLbitfield access);
+  virtual bool unmapBuffer(GLenum target);
+
+  virtual GLuint genTexture();
+  virtual void deleteTexture(GLuint texture);
+  virtual void bindTexture(GLuint texture);
+  virtual void texImage(GLsizei width, GLsizei height, int channels, const GLvoid* pixels);
+
+  virtual void useProgram(GLuint program);
+  virtual void deleteProgram(GLuint program);
+  virtual void bindVertexArray(GLuint array);
+  virtual void deleteVertexArray(GLuint array);
+
+  virtual void enableClientState(GLenum array);
+  virtual void disableClientState(GLenum array);
+  virtual void enable(GLenum capability);
+  virtual void disable(GLenum capability);
+  virtual bool isEnabled(GLenum capability);
+
+  virtual void vertexPointer(GLint size, GLenum type, GLsizei stride, const GLvoid* pointer);
+  virtual void normalPointer(GLenum type, GLsizei stride, const GLvoid* pointer);
+  virtual void texCoordPointer(GLint size, GLenum type, GLsizei stride, const GLvoid* pointer);
+  virtual void colorPointer(GLint size, GLenum type, GLsizei stride, const GLvoid* pointer);
+  virtual void color(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha);
+
+  virtual void matrixMode(GLenum mode);
+  virtual void pushMatrix();
+  virtual void popMatrix();
+  virtual void loadMatrix(const float* matrix);
+  virtual void translate(float x, float y, float z);
+  virtual void rotate(float angle, float x, float y, float z);
+  virtual void scale(float x, float y, float z);
+  virtual void getModelview(float* matrix);
+
+  virtual void drawArrays(GLenum mode, GLint first, GLsizei count);
+  virtual void drawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices);
+  virtual void drawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instances);
+  virtual void drawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices, GLsizei instances);
+
+};
+
+/// \brief The kinds of call counted by a NullBackend
+enum RenderCommandType
+{
+  COMMAND_BUFFER = 0, ///< Generating, binding or deleting a buffer
+  COMMAND_BUFFER_DATA, ///< Filling a buffer
+  COMMAND_TEXTURE, ///< Generating, binding or deleting a texture
+  COMMAND_TEXTURE_DATA, ///< Filling a texture
+  COMMAND_PROGRAM, ///< Using or deleting a program or vertex array object
+  COMMAND_STATE, ///< Enabling or disabling an array or capability, or setting the color
+  COMMAND_POINTER, ///< Setting a vertex array pointer
+  COMMAND_MATRIX, ///< Changing a matrix or the matrix mode
+  COMMAND_DRAW, ///< Drawing
+  COMMAND_TYPES ///< The number of kinds
+};
+
+/// \struct RenderCommand
+/// \brief One call recorded by a NullBackend
+struct RenderCommand
+{
+  RenderCommandType type; ///< The kind of call
+  GLenum target; ///< The buffer target, capability, matrix mode or primitive, or 0
+  GLuint name; ///< The buffer, texture, program or vertex array object, or 0
+  size_t bytes; ///< The bytes passed to a buffer or texture
+  size_t elements; ///< The vertices or indices drawn, counting every instance
+};
+
+/// \struct BackendStats
+/// \brief The calls received by a NullBackend
+struct BackendStats
+{
+  size_t commands[COMMAND_TYPES]; ///< The number of calls of each RenderCommandType
+  size_t total; ///< The number of calls of all kinds
+  size_t bytes; ///< The bytes passed to buffers and textures
+  size_t elements; ///< The vertices or indices drawn, counting every instance
+
+  BackendStats();
+
+};
+
+/// \class NullBackend
+/// \brief A RenderBackend counting the calls it receives without touching OpenGL
+///
+/// Buffer, texture and other names are handed out from a counter and the
+/// matrices are kept in MatrixStacks, so the library behaves as it would with
+/// OpenGL and the cost of submitting a frame can be measured headlessly. Each
+/// call is also kept in a log when logging is enabled.
+class NullBackend : public RenderBackend
+{
+private:
+  BackendStats stats; ///< The counters since resetStats
+  bool logging; ///< True to keep every call in commands
+  std::vector<RenderCommand> commands; ///< The calls since clearCommands when logging
+  GLuint names; ///< The last name handed out
+  std::vector<std::pair<GLenum, bool> > capabilities; ///< The enabled state of each array and capability changed
+  MatrixStack modelview; ///< The GL_MODELVIEW stack
+  MatrixStack projection; ///< The GL_PROJECTION stack
+  MatrixStack texture; ///< The GL_TEXTURE stack
+  MatrixStack* matrices; ///< The stack selected by matrixMode
+  std::vector<unsigned char> mapped; ///< The memory handed out by mapBufferRange
+
+  void record(RenderCommandType type, GLenum target, GLuint name, size_t bytes, size_t elements);
+  void setEnabled(GLenum capability, bool enabled);
+
+public:
+  NullBackend();
+
+  BackendStats getStats();
+  void resetStats();
+  void setLogging(bool logging);
+  bool isLogging();
+  std::vector<RenderCommand>* getCommands();
+  void clearCommands();
+
+  virtual void initialize();
+
+  virtual GLuint genBuffer();
+  virtual void deleteBuffer(GLuint buffer);
+  virtual void bindBuffer(GLenum target, GLuint buffer);
+  virtual void bufferData(GLenum target, size_t size, const GLvoid* data, GLenum usage);
+  virtual void bufferSubData(GLenum target, size_t offset, size_t size, const GLvoid* data);
+  virtual void* mapBufferRange(GLenum target, size_t offset, size_t size, GLbitfield access);
+  virtual bool unmapBuffer(GLenum target);
+
+  virtual GLuint genTexture();
+  virtual void deleteTexture(GLuint texture);
+  virtual void bindTexture(GLuint texture);
+  virtual void texImage(GLsizei width, GLsizei height, int channels, const GLvoid* pixels);
+
+  virtual void useProgram(GLuint program);
+  virtual void deleteProgram(GLuint program);
+  virtual void bindVertexArray(GLuint array);
+  virtual void deleteVertexArray(GLuint array);
+
+  virtual void enableClientState(GLenum array);
+  virtual void disableClientState(GLenum array);
+  virtual void enable(GLenum capability);
+  virtual void disable(GLenum capability);
+  virtual bool isEnabled(GLenum capability);
+
+  virtual void vertexPointer(GLint size, GLenum type, GLsizei stride, const GLvoid* pointer);
+  virtual void normalPointer(GLenum type, GLsizei stride, const GLvoid* pointer);
+  virtual void texCoordPointer(GLint size, GLenum type, GLsizei stride, const GLvoid* pointer);
+  virtual void colorPointer(GLint size, GLenum type, GLsizei stride, const GLvoid* pointer);
+  virtual void color(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha);
+
+  virtual void matrixMode(GLenum mode);
+  virtual void pushMatrix();
+  virtual void popMatrix();
+  virtual void loadMatrix(const float* matrix);
+  virtual void translate(float x, float y, float z);
+  virtual void rotate(float angle, float x, float y, float z);
+  virtual void scale(float x, float y, float z);
+  virtual void getModelview(float* matrix);
+
+  virtual void drawArrays(GLenum mode, GLint first, GLsizei count);
+  virtual void drawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices);
+  virtual void drawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instances);
+  virtual void drawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices, GLsizei instances);
+
+};
+
+class MaterialGroup;
+
+/// \class CorePipeline
+/// \brief Draws with vertex array objects and a built in shader for core profile contexts
+///
+/// When enabled, MaterialGroups are drawn through a vertex array object each
+/// and a GLSL 3.30 shader taking its transforms and single light from
+/// uniforms, so no deprecated fixed function state is used. The application
+/// sets the matrices with getProjection and getModelview in place of the
+/// OpenGL matrix stacks. The fixed function pipeline remains the default.
+class CorePipeline
+{
+public:
+  static bool isSupported();
+  static void setEnabled(bool enabled);
+  static bool isEnabled();
+
+  static MatrixStack* getProjection();
+  static MatrixStack* getModelview();
+  static void getCurrentMatrix(float* matrix);
+
+  static void setLighting(bool enabled);
+  static void setLight(const float* position, const float* ambient, const float* diffuse);
+  static void setTexturing(bool enabled);
+
+  static void render(MaterialGroup* group);
+  static void release();
+
+};
+
+/// \class Image
+/// \brief A PNG image decoded into memory
+///
+/// Decoding needs no OpenGL context so images can be loaded on any thread
+/// and handed to a Texture to be uploaded later.
+class Image
+{
+private:
+  static void freePngStruct(png_structp png_ptr);
+  static void freeInfoStruct(png_infop info_ptr);
+
+  int width; ///< The width of the image in pixels
+  int height; ///< The height of the image in pixels
+  int channels; ///< 3 for RGB or 4 for RGBA
+  std::vector<unsigned char> pixels; ///< The rows of the image, top to bottom, without padding
+
+public:
+  Image(std::string path);
+
+  int getWidth();
+  int getHeight();
+  int getChannels();
+  unsigned char* getPixels();
+  size_t getSize();
+
+};
+
+/// \class ImageRequest
+/// \brief A handle to an image being decoded by an ImageDecoder
+class ImageRequest
+{
+  friend class ImageDecoder;
+
+private:
+  ImageRequest(const ImageRequest& copy);
+  ImageRequest& operator=(const ImageRequest& other);
+
+  std::string path; ///< The path of the PNG image to decode
+  std::tr1::shared_ptr<Image> image; ///< The decoded image
+  std::string error; ///< The reason decoding failed
+  bool done; ///< True once the image has been decoded or has failed
+  pthread_mutex_t mutex; ///< Guards the result between the decoding and waiting threads
+  pthread_cond_t condition; ///< Signalled when done is set
+
+  ImageRequest(std::string path);
+  void decode();
+
+public:
+  ~ImageRequest();
+
+  std::string getPath();
+  bool isDone();
+  std::tr1::shared_ptr<Image> getImage();
+
+};
+
+/// \class ImageDecoder
+/// \brief Decodes PNG images on a pool of worker threads
+///
+/// Threads are started as images are queued, up to one per processor, and end
+/// once the queue is empty so an idle decoder holds no threads.
+class ImageDecoder
+{
+private:
+  ImageDecoder(const ImageDecoder& copy);
+  ImageDecoder& operator=(const ImageDecoder& other);
+
+  std::vector<pthread_t> threads; ///< Every thread started, joined by the destructor
+  std::deque<std::tr1::shared_ptr<ImageRequest> > queue; ///< Images waiting for a thread
+  size_t running; ///< The number of threads still taking images from the queue
+  size_t maxThreads; ///< The most threads which may run at once
+  pthread_mutex_t mutex; ///< Guards the queue and thread counts
+
+  static void* workerThread(void* decoder);
+  void work();
+
+public:
+  ImageDecoder();
+  ~ImageDecoder();
+
+  std::tr1::shared_ptr<ImageRequest> decode(std::string path);
 
 };
 
@@ -121,23 +723,47 @@ public:
 class Texture
 {
 private:
-  static void freePngStruct(png_structp png_ptr);
-  static void freeInfoStruct(png_infop info_ptr);
-  static void freeRows(png_bytep* rows);
-  static void freeData(unsigned char* data);
+  Texture(const Texture& copy);
+  Texture& operator=(const Texture& other);
+
   static void freeTexture(GLuint* texture);
 
   GLuint texture; std::tr1::shared_ptr<GLuint> _texture; ///< A reference to the texture on the graphics card
+  std::tr1::shared_ptr<Image> image; ///< The decoded image waiting to be uploaded
+  std::tr1::shared_ptr<ImageRequest> request; ///< The image being decoded, if it is not yet in image
+  pthread_mutex_t mutex; ///< Guards image and request when the Texture is shared by models loading on different threads
 
 public:
   Texture(std::string path);
+  Texture(std::tr1::shared_ptr<Image> image);
+  Texture(std::tr1::shared_ptr<ImageRequest> request);
   ~Texture();
 
+  void wait();
+  void upload();
+  bool isUploaded();
+  GLuint getId();
   void bind();
   static void unbind();
 
 };
 
+/// \class TextureCache
+/// \brief A process wide registry of the textures in use
+///
+/// Textures are keyed by their resolved path so every model referencing the
+/// same image shares one decode and one texture on the graphics card. Only
+/// weak references are held, so a texture is freed once no Material uses it,
+/// and an entry whose file has since been modified is replaced.
+class TextureCache
+{
+public:
+  static std::tr1::shared_ptr<Texture> get(std::string path, ImageDecoder* decoder = NULL);
+  static size_t getCount();
+  static void clear();
+
+};
+
 /// \class Material
 /// \brief Stores all information about a given material
 class Material
@@ -151,6 +777,9 @@ public:
   void setName(std::string name);
   Texture* getTexture();
   void setTexture(Texture* texture);
+  void setTexture(std::tr1::shared_ptr<Texture> texture);
+  std::string getTexturePath();
+  void setTexturePath(std::string texturePath);
 
 private:
   std::string name; ///< The name of the material from the .mtl file
@@ -159,10 +788,237 @@ private:
   Vector3 specular; ///< The value for the specular property
   float transparency; ///< The transparency amount for the Material
   std::tr1::shared_ptr<Texture> texture; ///< The texture this material uses
+  std::string texturePath; ///< The path the texture was loaded from
+
+};
+
+/// \brief Options controlling how a Model is loaded
+enum ModelFlags
+{
+  MODEL_DEFAULT = 0, ///< Parse the file serially on the calling thread
+  MODEL_PARALLEL = 1 << 0, ///< Parse sections of the file concurrently, one per processor
+  MODEL_INDEXED = 1 << 1, ///< Weld identical vertices and draw them with an index buffer
+  MODEL_SMOOTH_NORMALS = 1 << 2, ///< Average the normals of faces sharing a position rather than shading each face flat
+  MODEL_CACHE = 1 << 3, ///< Load from (and keep up to date) a compiled .wfb file next to the .obj
+  MODEL_INTERLEAVED = 1 << 4, ///< Store position, normal and texture coordinate in one buffer and color each group with its diffuse color
+  MODEL_QUANTIZED = 1 << 5, ///< As MODEL_INTERLEAVED but with 16-bit positions and texture coordinates and 8-bit normals
+  MODEL_LOD = 1 << 6, ///< Generate simplified levels of detail of every part once loaded, see ModelData::simplify
+  MODEL_OPTIMIZED = 1 << 7 ///< With MODEL_INDEXED, reorder the triangles and vertices for the vertex cache, overdraw and vertex fetch
+};
+
+/// \brief The version written to and expected of .wfb model caches
+static const unsigned int MODEL_CACHE_VERSION = 3;
+
+/// \brief The smallest section of a file parsed by its own thread with MODEL_PARALLEL
+static const size_t MODEL_PARALLEL_MIN_CHUNK = 1024 * 1024;
+
+/// \brief The entries of the first in first out post-transform vertex cache MODEL_OPTIMIZED orders for
+static const size_t MODEL_VERTEX_CACHE_SIZE = 16;
+
+/// \struct UploadStats
+/// \brief The amount of data a MaterialGroup or Part placed on the graphics card
+///
+/// The expanded figures are what the data would have cost with every
+/// triangle corner stored as its own vertex, allowing the saving made by
+/// MODEL_INDEXED to be reported.
+struct UploadStats
+{
+  size_t triangles; ///< The number of triangles drawn
+  size_t vertices; ///< The number of vertices uploaded
+  size_t indices; ///< The number of indices uploaded (0 when not indexed)
+  size_t bytes; ///< The total size of all uploaded buffers
+  size_t expandedVertices; ///< The number of vertices without welding
+  size_t expandedBytes; ///< The total size of all buffers without welding
+
+  UploadStats();
+  void add(const UploadStats& other);
+
+};
+
+/// \struct Quantization
+/// \brief How the vertices of a MaterialGroup were quantized with MODEL_QUANTIZED
+///
+/// Positions are stored as shorts scaled uniformly about the center of the
+/// group's bounds and texture coordinates as shorts scaled about the center
+/// of their range. Drawing applies the inverse through the modelview and
+/// texture matrices. The errors are measured against the float data.
+struct Quantization
+{
+  float positionCenter[3]; ///< The center of the positions
+  float positionScale; ///< The size of one step of a quantized position
+  float coordCenter[2]; ///< The center of the texture coordinates
+  float coordScale[2]; ///< The size of one step of a quantized texture coordinate
+  float maxPositionError; ///< The largest distance between a quantized and float position
+  float maxNormalError; ///< The largest angle in degrees between a quantized and float normal
+  float maxCoordError; ///< The largest difference between a quantized and float texture coordinate
+
+  Quantization();
+  void addError(const Quantization& other);
+
+};
+
+/// \struct VertexCacheStats
+/// \brief How often the indices of a MaterialGroup miss a simulated post-transform vertex cache
+///
+/// ACMR (average cache miss ratio) is the vertices transformed per triangle,
+/// from 3 down to around 0.6 for a well ordered mesh. ATVR (average transformed
+/// vertex ratio) is the vertices transformed per unique vertex, 1 at best.
+/// The figures before are for the triangles in the order they were loaded.
+struct VertexCacheStats
+{
+  size_t triangles; ///< The number of triangles indexed
+  size_t vertices; ///< The number of unique vertices
+  size_t missesBefore; ///< The vertices transformed drawing the triangles in load order
+  size_t missesAfter; ///< The vertices transformed drawing the triangles in the uploaded order
+
+  VertexCacheStats();
+  void add(const VertexCacheStats& other);
+  float getAcmrBefore();
+  float getAcmrAfter();
+  float getAtvrBefore();
+  float getAtvrAfter();
+
+};
+
+/// \struct StreamData
+/// \brief The arrays of a MaterialGroup ready to be sent to the graphics card
+///
+/// The arrays are either built by the MaterialGroup from its faces or point
+/// directly into a mapped model cache.
+struct StreamData
+{
+  static const size_t VERTEX_SIZE = 12 * sizeof(float); ///< The bytes per vertex across all four arrays
+  static const size_t INTERLEAVED_VERTEX_SIZE = 8 * sizeof(float); ///< The bytes per vertex of the interleaved array
+  static const size_t QUANTIZED_VERTEX_SIZE = 16; ///< The bytes per vertex of the quantized array
+
+  const float* vertices; ///< Three floats of position per vertex
+  const float* colors; ///< Four floats of RGBA color per vertex
+  const float* normals; ///< Three floats of normal per vertex
+  const float* coords; ///< Two floats of texture coordinate per vertex
+  const float* interleaved; ///< Position, normal and texture coordinate per vertex, used instead of the four arrays with MODEL_INTERLEAVED
+  const void* quantized; ///< Three shorts of position, two of padding, three bytes of normal, one of padding and two shorts of texture coordinate per vertex with MODEL_QUANTIZED
+  Quantization quantization; ///< How to restore the quantized array
+  VertexCacheStats vertexCache; ///< How well the indices use the vertex cache
+  const void* indices; ///< The indices to draw, NULL when the vertices are drawn in order
+  size_t vertexCount; ///< The number of vertices in each array
+  size_t indexCount; ///< The number of indices
+  GLenum indexType; ///< GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+
+  StreamData();
+  size_t getVertexSize() const;
+  size_t getIndexSize() const;
+
+};
+
+/// \struct CullStats
+/// \brief The bounds tested by a Frustum
+struct CullStats
+{
+  size_t tested; ///< The number of bounds tested
+  size_t culled; ///< The number found to be outside the frustum
+  size_t drawn; ///< The number found to be at least partly inside, and so drawn
+
+  CullStats();
+
+};
+
+/// \class Frustum
+/// \brief The six planes bounding what a matrix projects into view
+///
+/// The planes are extracted from a column-major matrix and are in the space
+/// the matrix transforms from. Built from the projection matrix they are in
+/// eye space, which is what Model::drawVisible and AnimatedModel::drawVisible
+/// expect as they transform the part bounds by the modelview matrix
+/// themselves. Built from the projection multiplied by a view matrix they are
+/// in world space. Every test is counted in the CullStats.
+class Frustum
+{
+private:
+  float planes[24]; ///< Left, right, bottom, top, near and far as a, b, c, d with a unit normal pointing inwards
+  CullStats stats; ///< The counters since resetStats
+
+public:
+  Frustum();
+  Frustum(const float* matrix);
+
+  void set(const float* matrix);
+  const float* getPlane(int plane);
+  bool testSphere(const float* center, float radius);
+  bool testBox(const float* minimum, const float* maximum);
+  size_t testSpheres(const float* x, const float* y, const float* z, const float* radius,
+    size_t count, unsigned char* visible);
+  CullStats getStats();
+  void resetStats();
+
+};
+
+/// \class SphereBatch
+/// \brief Bounding spheres stored component by component to be culled together
+///
+/// Keeping each component in its own array lets Frustum::testSpheres test
+/// four spheres against a plane with each SSE instruction, so thousands of
+/// part bounds can be culled in one call.
+class SphereBatch
+{
+private:
+  std::vector<float> x; ///< The x of each center
+  std::vector<float> y; ///< The y of each center
+  std::vector<float> z; ///< The z of each center
+  std::vector<float> radius; ///< The radius of each sphere
+  std::vector<unsigned char> visible; ///< 1 for each sphere found inside by the last cull
+
+public:
+  void add(const float* center, float radius);
+  void add(const float* center, float radius, const float* matrix);
+  void clear();
+  size_t getSize();
+  size_t cull(Frustum* frustum);
+  bool isVisible(size_t sphere);
+  void getSphere(size_t sphere, float* center, float* radius);
+
+};
+
+/// \struct LevelStats
+/// \brief The size and accuracy of one level of detail
+struct LevelStats
+{
+  size_t triangles; ///< The number of triangles drawn at the level
+  float error; ///< The largest quadric error of the level in model units, 0 for the original triangles
+
+  LevelStats();
+
+};
+
+/// \class LodSelector
+/// \brief Chooses a level of detail for each part from the size it covers on screen
+///
+/// The height of a part's bounding sphere is estimated as a fraction of the
+/// viewport height from its eye space center and the projection matrix. Each
+/// level added is used once the part covers less than its height, so levels
+/// are added from the largest height to the smallest.
+class LodSelector
+{
+private:
+  std::vector<float> heights; ///< The fraction of the viewport height below which each level from 1 is used
+  std::vector<size_t> counts; ///< The number of parts drawn at each level since resetStats
+  float scale; ///< The vertical scale of the projection matrix
+  bool orthographic; ///< True if the size of a part does not depend on its depth
+
+public:
+  LodSelector();
+
+  void setProjection(const float* projection);
+  void addLevel(float height);
+  size_t getLevelCount();
+  size_t select(const float* center, float radius);
+  size_t getCount(size_t level);
+  void resetStats();
 
 };
 
 class CollisionShape;
+class RenderQueue;
+class MatrixPalette;
 
 /// \class Face
 /// \brief Represents a triangular face made up of 3 vectors
@@ -212,6 +1068,34 @@ private:
 
 };
 
+/// \class Geometry
+/// \brief The triangles of a whole Model stored in a few contiguous arrays
+///
+/// Rather than allocating a Face per triangle, a Model keeps every position,
+/// texture coordinate and triangle index in a single Geometry. MaterialGroups
+/// refer to a range of its triangles and Face objects are only built on request.
+class Geometry
+{
+private:
+  std::vector<float> positions; ///< Three floats per .obj vertex
+  std::vector<float> coords; ///< Two floats per .obj texture coordinate
+  std::vector<unsigned int> positionIndices; ///< Three per triangle, indexing positions
+  std::vector<int> coordIndices; ///< Three per triangle, indexing coords or -1 if the corner has none
+
+public:
+  std::vector<float>* getPositions();
+  std::vector<float>* getCoords();
+  std::vector<unsigned int>* getPositionIndices();
+  std::vector<int>* getCoordIndices();
+
+  size_t getFaceCount();
+  const float* getPosition(size_t face, int corner);
+  const float* getCoord(size_t face, int corner);
+  Face getFace(size_t face);
+  size_t getMemoryUsage();
+
+};
+
 /// \class MaterialGroup
 /// \brief A group of faces within a part with the same material
 ///
@@ -222,22 +1106,84 @@ class MaterialGroup
 {
 private:
   Material* material; ///< The reference to the material all the faces in this group use
-  std::vector<std::tr1::shared_ptr<Face> > faces; ///< The collection of faces with the same material
-  std::tr1::shared_ptr<GLuint> _vertexBuffer; GLuint vertexBuffer; ///< The location of the buffer containing vertex positions on the graphics card
-  std::tr1::shared_ptr<GLuint> _normalBuffer; GLuint normalBuffer; ///< The location of the buffer containing normals on the graphics card
-  std::tr1::shared_ptr<GLuint> _colorBuffer; GLuint colorBuffer; ///< The location of the buffer containing colors on the graphics card
-  std::tr1::shared_ptr<GLuint> _coordBuffer; GLuint coordBuffer; ///< The location of the buffer containing texture coordinates on the graphics card
+  Geometry* geometry; ///< The Model's Geometry containing the faces of this group
+  size_t firstFace; ///< The index of the group's first face within the Geometry
+  size_t faceCount; ///< The number of consecutive faces in the group
+  std::tr1::shared_ptr<BufferRange> _vertexRange; BufferRange vertexRange; ///< The location of the vertex positions on the graphics card
+  std::tr1::shared_ptr<BufferRange> _normalRange; BufferRange normalRange; ///< The location of the normals on the graphics card
+  std::tr1::shared_ptr<BufferRange> _colorRange; BufferRange colorRange; ///< The location of the colors on the graphics card
+  std::tr1::shared_ptr<BufferRange> _coordRange; BufferRange coordRange; ///< The location of the texture coordinates on the graphics card
+  std::tr1::shared_ptr<BufferRange> _indexRange; BufferRange indexRange; ///< The location of the indices when uploaded with MODEL_INDEXED
+  std::tr1::shared_ptr<GLuint> _vertexArray; GLuint vertexArray; ///< The vertex array object drawn by the CorePipeline, created on first use
+  GLenum indexType; ///< GL_UNSIGNED_SHORT or GL_UNSIGNED_INT depending on the number of vertices
+  bool interleaved; ///< True if vertexRange holds the interleaved vertices and the other ranges are unused
+  bool quantized; ///< True if vertexRange holds quantized vertices restored by quantization
+  Quantization quantization; ///< How the uploaded vertices were quantized
+  VertexCacheStats vertexCache; ///< How well the uploaded indices use the vertex cache
+  UploadStats stats; ///< The amount of data sent to the graphics card by upload
+  std::vector<float> vertexData; ///< The positions built by build
+  std::vector<float> colorData; ///< The colors built by build
+  std::vector<float> normalData; ///< The normals built by build
+  std::vector<float> coordData; ///< The texture coordinates built by build
+  std::vector<float> interleavedData; ///< The interleaved vertices built by build with MODEL_INTERLEAVED
+  std::vector<unsigned char> quantizedData; ///< The quantized vertices built by build with MODEL_QUANTIZED
+  std::vector<unsigned int> indexData; ///< The 32-bit indices built by build
+  std::vector<unsigned short> shortIndexData; ///< The 16-bit indices built by build
+  StreamData streams; ///< The arrays waiting to be uploaded
+  bool built; ///< True once streams is ready to upload
+  std::vector<std::tr1::shared_ptr<MaterialGroup> > levels; ///< The simplified versions of the group, each with fewer faces than the last
+  float error; ///< The largest quadric error introduced by simplifying, 0 for the original faces
+
+  static void smoothNormals(std::vector<float>* vertices, std::vector<float>* normals);
+  static void weldVertices(std::vector<float>* vertices, std::vector<float>* colors,
+    std::vector<float>* normals, std::vector<float>* coords, std::vector<unsigned int>* indices);
+  static void quantizeVertices(std::vector<float>* vertices, std::vector<float>* normals,
+    std::vector<float>* coords, std::vector<unsigned char>* output, Quantization* quantization);
+  static void optimizeVertices(std::vector<float>* vertices, std::vector<float>* colors,
+    std::vector<float>* normals, std::vector<float>* coords, std::vector<unsigned int>* indices);
+  static size_t countCacheMisses(const std::vector<unsigned int>* indices);
+  void buildStreams(int flags);
 
 public:
-  static void deleteBuffer(GLuint* buffer);
+  static void deleteBuffer(GLuint buffer);
+  static void deleteVertexArray(GLuint array);
 
   MaterialGroup();
 
   void setMaterial(Material* material);
-  void addFace(std::tr1::shared_ptr<Face> face);
-  void upload();
+  Material* getMaterial();
+  void addFaces(Geometry* geometry, size_t first, size_t count);
+  void build(int flags = MODEL_DEFAULT);
+  void merge(std::vector<MaterialGroup*>* groups, int flags = MODEL_DEFAULT);
+  void setStreams(StreamData streams);
+  StreamData getStreams();
+  void upload(int flags = MODEL_DEFAULT);
   void draw();
-  std::vector<std::tr1::shared_ptr<Face> >* getFaces();
+  void render();
+  void setArrays(bool bufferStart = false);
+  void bindVertexArray();
+  void transform();
+  void transformCoords();
+  void drawElements();
+  void drawInstanced(GLsizei instances);
+  bool usesColorArray();
+  bool isQuantized();
+  GLuint getVertexBuffer();
+  GLuint getIndexBuffer();
+  GLenum getIndexType();
+  bool canDrawIndirect();
+  void addIndirectCommand(std::vector<GLuint>* commands, GLuint instances, GLuint baseInstance);
+  Geometry* getGeometry();
+  size_t getFirstFace();
+  size_t getFaceCount();
+  Face getFace(size_t index);
+  UploadStats getStats();
+  Quantization getQuantization();
+  VertexCacheStats getVertexCacheStats();
+  void simplify(size_t levels, float ratio);
+  size_t getLevelCount();
+  MaterialGroup* getLevel(size_t level);
+  float getError();
 
 };
 
@@ -252,6 +1198,11 @@ private:
   std::vector<std::tr1::shared_ptr<MaterialGroup> > materialGroups; ///< The material groups making up the part
   std::string name; ///< The name of the part as specified in the .obj file
   Vector3 center; ///< The center of the part (required for rotations to pivot around part rather than the origin).
+  Vector3 minimum; ///< The smallest x, y and z of the part's vertices
+  Vector3 maximum; ///< The largest x, y and z of the part's vertices
+  float radius; ///< The distance from the center to the furthest vertex
+  bool built; ///< True once the center and MaterialGroup data are ready to upload
+  bool uploaded; ///< True once the MaterialGroups have been sent to the graphics card
 
 public:
   Part();
@@ -260,9 +1211,139 @@ public:
   std::vector<std::tr1::shared_ptr<MaterialGroup> >* getMaterialGroups();
   void setName(std::string name);
   std::string getName();
-  void upload();
+  void build(int flags = MODEL_DEFAULT);
+  void upload(int flags = MODEL_DEFAULT);
   void draw();
+  void render(size_t level = 0);
+  void simplify(size_t levels, float ratio);
+  size_t getLevelCount();
+  LevelStats getLevelStats(size_t level);
   Vector3* getCenter();
+  void setCenter(Vector3 center);
+  Vector3* getMinimum();
+  Vector3* getMaximum();
+  float getRadius();
+  void setBounds(Vector3 minimum, Vector3 maximum, float radius);
+  UploadStats getStats();
+  Quantization getQuantizationError();
+  VertexCacheStats getVertexCacheStats();
+
+};
+
+/// \struct RenderStats
+/// \brief The work done by the last RenderQueue::flush
+struct RenderStats
+{
+  size_t items; ///< The number of MaterialGroups drawn
+  size_t draws; ///< The number of draw calls issued
+  size_t textureBinds; ///< The number of times a texture was bound or unbound
+  size_t materialChanges; ///< The number of times consecutive items used different materials
+  size_t arraySetups; ///< The number of times the vertex arrays were pointed at a different group's data
+  size_t matrixLoads; ///< The number of times the modelview matrix was loaded
+  size_t stateChanges; ///< The number of client states, capabilities and texture matrices changed
+  size_t commands; ///< The number of indirect commands written, one per group for all of its items
+
+  RenderStats();
+
+};
+
+/// \struct RenderItem
+/// \brief A MaterialGroup waiting in a RenderQueue
+struct RenderItem
+{
+  MaterialGroup* group; ///< The group to draw
+  GLuint texture; ///< The texture of the group's material, or 0
+  Material* material; ///< The material of the group
+  GLuint buffer; ///< The buffer holding the group's vertices, shared with other groups by the BufferArena
+  float depth; ///< The distance in front of the eye of the part's center
+  size_t matrix; ///< The offset of the modelview matrix within the queue's matrices
+
+};
+
+/// \class RenderQueue
+/// \brief Collects the parts of many models and draws them with few state changes
+///
+/// Parts are added with the modelview matrix they are to be drawn with. flush
+/// sorts the MaterialGroups by texture, material and buffer, nearest first
+/// within each, and draws them setting only the state which changes between
+/// consecutive groups.
+///
+/// With setIndirect, groups which canDrawIndirect are instead written as
+/// indirect commands, every item of a group becoming one instance, and each
+/// run of groups sharing a texture and buffers is drawn by a single
+/// glMultiDrawElementsIndirect or glMultiDrawArraysIndirect call. A built in
+/// shader reads each instance's modelview matrix through the command's base
+/// instance. Where isIndirectSupported is false the groups are drawn as before.
+class RenderQueue
+{
+private:
+  std::vector<RenderItem> items; ///< The groups waiting to be drawn
+  std::vector<float> matrices; ///< The modelview matrices of the items, 16 floats each
+  RenderStats stats; ///< The counters of the last flush
+  bool indirect; ///< True to draw the groups able to with indirect commands
+  std::tr1::shared_ptr<Shader> shader; ///< The indirect drawing shader, built on the first indirect flush
+  std::tr1::shared_ptr<GLuint> _commandBuffer; GLuint commandBuffer; ///< The buffer the indirect commands are streamed into
+  std::tr1::shared_ptr<GLuint> _instanceBuffer; GLuint instanceBuffer; ///< The buffer the per instance matrices are streamed into
+
+  static bool compareItems(const RenderItem& a, const RenderItem& b);
+  void flushCore();
+  void flushIndirect();
+
+public:
+  static bool isIndirectSupported();
+
+  RenderQueue();
+
+  void setIndirect(bool indirect);
+  bool isIndirect();
+  void add(Part* part);
+  void add(Part* part, const float* matrix, size_t level = 0);
+  void flush();
+  void clear();
+  size_t getSize();
+  RenderStats getStats();
+
+};
+
+/// \class ModelData
+/// \brief The CPU side of a model loaded from a file
+///
+/// Parses the .obj (or its .wfb cache), the .mtl files and the referenced
+/// images and prepares the buffer data of every part without touching OpenGL,
+/// so models can be loaded and inspected without a rendering context.
+/// A Model then uploads the data to the graphics card.
+class ModelData
+{
+private:
+  ModelData(const ModelData& copy);
+  ModelData& operator=(const ModelData& other);
+
+  std::vector<std::tr1::shared_ptr<Material> > materials; ///< A list of materials used by the model
+  std::vector<std::tr1::shared_ptr<Part> > parts; ///< A list of parts contained within the model
+  Geometry geometry; ///< The triangles of every part
+  std::vector<std::string> sources; ///< The .obj and .mtl files the model was loaded from
+  std::tr1::shared_ptr<MappedFile> cache; ///< The mapped .wfb file if the model was loaded from one
+  std::tr1::shared_ptr<ImageDecoder> decoder; ///< Decodes the textures while the model is being loaded
+  int flags; ///< The ModelFlags the model was loaded with
+
+  void _loadObj(std::string path);
+  void _preloadMtl(std::string prefix, const char* begin, const char* end, std::vector<std::string>* loaded);
+  std::tr1::shared_ptr<Texture> _loadTexture(std::string path);
+  bool _loadCache(std::string path);
+  bool _writeCache(std::string path);
+
+public:
+  ModelData(std::string path, int flags = MODEL_DEFAULT);
+  void _loadMtl(std::string prefix, std::string fileName);
+
+  std::vector<std::tr1::shared_ptr<Material> >* getMaterials();
+  std::vector<std::tr1::shared_ptr<Part> >* getParts();
+  Geometry* getGeometry();
+  std::vector<std::string>* getSources();
+  int getFlags();
+  void getBounds(Vector3* min, Vector3* max);
+  void simplify(size_t levels = 3, float ratio = 0.5f);
+  std::vector<LevelStats> getLevelStats();
 
 };
 
@@ -274,16 +1355,117 @@ public:
 class Model
 {
 private:
-  std::vector<std::tr1::shared_ptr<Material> > materials; ///< A list of materials used by the model
-  std::vector<std::tr1::shared_ptr<Part> > parts; ///< A list of parts contained within the model
+  std::tr1::shared_ptr<ModelData> data; ///< The parts, materials and geometry of the model
+  size_t uploadedMaterials; ///< The number of materials whose textures have been sent to the graphics card
+  size_t uploadedParts; ///< The number of parts which have been sent to the graphics card
+  std::tr1::shared_ptr<MatrixPalette> palette; ///< The parts merged per material, built by getMatrixPalette
+  SphereBatch spheres; ///< The bounds of the parts tested by drawVisible
+  LodSelector* selector; ///< Chooses the level of detail of each part, or NULL to draw the original triangles
+  std::tr1::shared_ptr<Part> staticPart; ///< The groups of every part merged per material by optimizeStatic, or NULL
+
+  void boundParts(const float* matrix);
+  size_t selectLevel(size_t part);
 
 public:
-  Model(std::string path);
+  Model(std::string path, int flags = MODEL_DEFAULT);
+  Model(std::tr1::shared_ptr<ModelData> data);
   ~Model();
-  void _loadMtl(std::string prefix, std::string fileName);
 
+  void upload();
+  bool upload(double seconds);
+  bool isUploaded();
   void draw();
+  void draw(RenderQueue* queue);
+  void drawVisible(Frustum* frustum, RenderQueue* queue = NULL);
+  void setLodSelector(LodSelector* selector);
+  LodSelector* getLodSelector();
+  MatrixPalette* getMatrixPalette();
+  void optimizeStatic();
+  bool isStatic();
+  Part* getStaticPart();
+  ModelData* getData();
   std::vector<std::tr1::shared_ptr<Part> >* getParts();
+  Geometry* getGeometry();
+
+};
+
+/// \brief The progress of a model requested from a ModelLoader
+enum LoadState
+{
+  LOAD_QUEUED, ///< Waiting for a worker thread
+  LOAD_LOADING, ///< Being parsed on a worker thread
+  LOAD_UPLOADING, ///< Parsed and waiting to be sent to the graphics card by ModelLoader::update
+  LOAD_READY, ///< The Model can be drawn
+  LOAD_FAILED ///< The model could not be loaded, see ModelRequest::getError
+};
+
+/// \class ModelRequest
+/// \brief A handle to a model being loaded by a ModelLoader
+///
+/// The state may be polled each frame, drawing a placeholder until it becomes
+/// LOAD_READY at which point getModel returns the loaded Model.
+class ModelRequest
+{
+  friend class ModelLoader;
+
+private:
+  ModelRequest(const ModelRequest& copy);
+  ModelRequest& operator=(const ModelRequest& other);
+
+  std::string path; ///< The path of the .obj model to load
+  int flags; ///< The ModelFlags to load the model with
+  LoadState state; ///< How far the load has progressed
+  std::string error; ///< The reason the load failed
+  std::tr1::shared_ptr<ModelData> data; ///< The data parsed by the worker thread
+  std::tr1::shared_ptr<Model> model; ///< The model being uploaded, or ready to draw
+  std::tr1::shared_ptr<pthread_mutex_t> _mutex; pthread_mutex_t mutex; ///< Guards the state between the worker and rendering threads
+
+  static void destroyMutex(pthread_mutex_t* mutex);
+
+  ModelRequest(std::string path, int flags);
+  void setState(LoadState state);
+
+public:
+  LoadState getState();
+  bool isReady();
+  std::string getPath();
+  std::string getError();
+  Model* getModel();
+  std::tr1::shared_ptr<Model> getSharedModel();
+
+};
+
+/// \class ModelLoader
+/// \brief Loads models on background threads
+///
+/// Parsing and image decoding run on the loader's worker threads. Sending the
+/// result to the graphics card must happen on the thread owning the rendering
+/// context, so that thread calls update once per frame with the time it may
+/// spend uploading.
+class ModelLoader
+{
+private:
+  ModelLoader(const ModelLoader& copy);
+  ModelLoader& operator=(const ModelLoader& other);
+
+  std::vector<pthread_t> threads; ///< The worker threads
+  std::deque<std::tr1::shared_ptr<ModelRequest> > queue; ///< Requests waiting for a worker thread
+  std::deque<std::tr1::shared_ptr<ModelRequest> > uploads; ///< Parsed requests waiting for update
+  size_t loading; ///< The number of requests being parsed by the worker threads
+  pthread_mutex_t mutex; ///< Guards the queues
+  pthread_cond_t condition; ///< Signalled when a request is queued or the loader is stopping
+  bool stopping; ///< Set by the destructor to end the worker threads
+
+  static void* workerThread(void* loader);
+  void work();
+
+public:
+  ModelLoader(int threadCount = 1);
+  ~ModelLoader();
+
+  std::tr1::shared_ptr<ModelRequest> load(std::string path, int flags = MODEL_DEFAULT);
+  bool update(double seconds);
+  size_t getPendingCount();
 
 };
 
@@ -313,16 +1495,22 @@ public:
 /// \brief An animation loaded from a .anm file
 ///
 /// Contains all the specified translations, rotations and model references contained
-/// in the animation file.
+/// in the animation file. Frame positions may be fractional, in which case the
+/// parts are sampled between the two neighbouring keyframes.
 class Animation
 {
 private:
   std::vector<std::tr1::shared_ptr<Frame> > frames; ///< The frames in which to manipulate the model
+  int steps; ///< The frame positions between each pair of keyframes, set by interpolate
+  bool join; ///< True if the last keyframe is interpolated back to the first
+
+  bool sample(std::string partName, double frame, Vector3* translation, float* rotation);
 
 public:
   Animation(std::string path);
 
-  void performTransformation(std::string partName, int frame, bool undo);
+  void performTransformation(std::string partName, double frame, bool undo);
+  void transform(std::string partName, double frame, float* matrix);
   int getFrameCount();
   void interpolate(int passes, bool join);
 
@@ -340,6 +1528,12 @@ private:
   Model* model; ///< The model to be used to animate
   std::vector<Animation*> animations; ///< The list of attached animations
   std::vector<double> framePositions; ///< The frame position of the animations
+  bool paletteMode; ///< True to draw with the Model's MatrixPalette
+  SphereBatch spheres; ///< The animated bounds of the parts tested by drawVisible and given to the Model's LodSelector
+
+  void drawParts(RenderQueue* queue, Frustum* frustum);
+  void boundParts();
+  size_t selectLevel(size_t part);
 
 public:
   AnimatedModel(Model* model);
@@ -350,7 +1544,113 @@ public:
   bool animationExists(Animation* animation);
 
   void draw();
+  void draw(RenderQueue* queue);
+  void drawVisible(Frustum* frustum, RenderQueue* queue = NULL);
   void update(double timeDelta);
+  void getPartMatrix(size_t part, const float* modelview, float* matrix);
+  Model* getModel();
+  void setPaletteMode(bool enabled);
+  bool getPaletteMode();
+
+};
+
+/// \struct InstanceStats
+/// \brief The work done by the last InstanceBatch::draw
+struct InstanceStats
+{
+  size_t instances; ///< The number of AnimatedModels drawn
+  size_t draws; ///< The number of draw calls issued
+  size_t bytes; ///< The bytes of instance matrices sent to the graphics card
+  bool instanced; ///< False if instancing was unsupported and each instance was drawn separately
+
+  InstanceStats();
+
+};
+
+/// \class InstanceBatch
+/// \brief Draws many AnimatedModels sharing one Model with a draw call per MaterialGroup
+///
+/// Instances are added with the modelview matrix they are to be drawn with and
+/// the animation state of each of their parts is resolved into a matrix. draw
+/// streams every matrix into one instance buffer and draws each MaterialGroup
+/// once for all of the instances with ARB_draw_instanced, using a built in
+/// shader which mirrors the fixed function pipeline for light 0. Where
+/// instancing is unsupported the instances are drawn one at a time.
+class InstanceBatch
+{
+private:
+  Model* model; ///< The Model shared by every instance
+  std::vector<std::vector<float> > matrices; ///< 16 floats per instance for each part
+  size_t instances; ///< The number of instances added
+  std::tr1::shared_ptr<Shader> shader; ///< The instancing shader, built on the first draw
+  std::tr1::shared_ptr<GLuint> _instanceBuffer; GLuint instanceBuffer; ///< The buffer the matrices are streamed into
+  InstanceStats stats; ///< The counters of the last draw
+
+  void drawSeparately();
+
+public:
+  static bool isSupported();
+
+  InstanceBatch(Model* model);
+
+  void add(AnimatedModel* instance);
+  void add(AnimatedModel* instance, const float* matrix);
+  void draw();
+  void clear();
+  size_t getSize();
+  InstanceStats getStats();
+
+};
+
+/// \struct PaletteBatch
+/// \brief The MaterialGroups of a range of parts sharing a material merged into one buffer
+struct PaletteBatch
+{
+  Material* material; ///< The material every merged group uses
+  size_t firstPart; ///< The index of the first part in the range
+  size_t partCount; ///< The number of parts in the range, each vertex holding its index within it
+  std::tr1::shared_ptr<GLuint> _vertexBuffer; GLuint vertexBuffer; ///< The interleaved vertices followed by a float part index
+  std::tr1::shared_ptr<GLuint> _indexBuffer; GLuint indexBuffer; ///< The indices when the Model was loaded with MODEL_INDEXED
+  GLenum indexType; ///< GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+  size_t vertexCount; ///< The number of vertices
+  size_t indexCount; ///< The number of indices
+
+  PaletteBatch();
+
+};
+
+/// \class MatrixPalette
+/// \brief Draws an animated Model with a single call per material
+///
+/// The MaterialGroups of parts sharing a material are merged into a single
+/// buffer with the index of each vertex's part. The part transforms of an
+/// AnimatedModel are calculated on the CPU and sent as a palette of matrices
+/// to a built in shader, which mirrors the fixed function pipeline for light 0.
+/// Models with more parts than the vertex shader has room for are split into
+/// ranges of parts, each with its own batches.
+class MatrixPalette
+{
+private:
+  MatrixPalette(const MatrixPalette& copy);
+  MatrixPalette& operator=(const MatrixPalette& other);
+
+  Model* model; ///< The Model whose parts are merged
+  size_t paletteSize; ///< The number of part matrices the shader holds
+  std::vector<std::tr1::shared_ptr<PaletteBatch> > batches; ///< The merged groups, ordered by range of parts
+  std::tr1::shared_ptr<Shader> shader; ///< The palette shader
+  std::vector<float> matrices; ///< 16 floats per part of the instance being drawn
+
+  void build(size_t first, size_t count);
+
+public:
+  static bool isSupported();
+
+  MatrixPalette(Model* model);
+
+  void draw(AnimatedModel* instance);
+  void draw(AnimatedModel* instance, const float* matrix);
+  std::vector<std::tr1::shared_ptr<PaletteBatch> >* getBatches();
+  size_t getPaletteSize();
 
 };
 
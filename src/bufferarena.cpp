@@ -0,0 +1,439 @@
+/*********************************************************************************
+ *
+ * Copyright (c) 2012, Sanguine Laboratories
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *********************************************************************************/
+
+#include <algorithm>
+#include <cstring>
+
+#include <GL/glew.h>
+
+#include <wavefront.h>
+
+namespace Wavefront
+{
+
+namespace
+{
+
+/// \brief The alignment of every range, a multiple of the interleaved and quantized vertex sizes so
+/// indirect commands can address a range by the index of its first vertex within the block
+const size_t RANGE_ALIGNMENT = 32;
+
+/// \brief One shared buffer and the spans of it not yet allocated
+struct Block
+{
+  GLenum target; ///< The target the block's ranges are bound to
+  GLuint buffer; ///< The buffer on the graphics card
+  size_t capacity; ///< The size of the buffer
+  std::vector<std::pair<size_t, size_t> > free; ///< The offset and size of each free span, in order of offset
+};
+
+/// \brief Data written to a range and waiting for flush
+struct PendingWrite
+{
+  GLenum target; ///< The target of the range's block
+  GLuint buffer; ///< The block's buffer
+  size_t offset; ///< The offset of the range within the block
+  size_t size; ///< The number of bytes
+  size_t staged; ///< The offset of the bytes within the staging memory
+
+  bool operator<(const PendingWrite& other) const
+  {
+    if(buffer != other.buffer)
+    {
+      return buffer < other.buffer;
+    }
+
+    return offset < other.offset;
+  }
+
+};
+
+/// \brief The blocks and pending writes of the arena
+struct ArenaState
+{
+  bool enabled; ///< True to sub-allocate ranges from blocks
+  size_t blockSize; ///< The smallest size of a new block
+  std::vector<Block> blocks; ///< Every shared buffer
+  std::vector<PendingWrite> pending; ///< The writes waiting for flush
+  std::vector<unsigned char> staging; ///< The bytes of the pending writes
+  ArenaStats stats; ///< The counts of blocks and ranges
+};
+
+/// \brief Obtain the state of the arena
+/// \return The single ArenaState of the rendering thread
+ArenaState* getState()
+{
+  static ArenaState state;
+  static bool initialized = false;
+
+  if(initialized == false)
+  {
+    state.enabled = false;
+    state.blockSize = 4 * 1024 * 1024;
+    initialized = true;
+  }
+
+  return &state;
+}
+
+/// \brief Round a size up to the range alignment
+/// \param size The size in bytes
+/// \return The aligned size, never 0 so every range owns a span of its block
+size_t align(size_t size)
+{
+  size = std::max(size, (size_t)1);
+
+  return (size + RANGE_ALIGNMENT - 1) / RANGE_ALIGNMENT * RANGE_ALIGNMENT;
+}
+
+/// \brief Take a span from the free spans of a block
+/// \param block The block to allocate from
+/// \param size The aligned size
+/// \param offset Receives the offset of the span
+/// \return False if no free span is large enough
+bool allocateFrom(Block* block, size_t size, size_t* offset)
+{
+  for(size_t i = 0; i < block->free.size(); i++)
+  {
+    if(block->free.at(i).second < size)
+    {
+      continue;
+    }
+
+    *offset = block->free.at(i).first;
+    block->free.at(i).first += size;
+    block->free.at(i).second -= size;
+
+    if(block->free.at(i).second == 0)
+    {
+      block->free.erase(block->free.begin() + i);
+    }
+
+    return true;
+  }
+
+  return false;
+}
+
+}
+
+/// \brief Default constructor
+BufferRange::BufferRange()
+{
+  target = GL_ARRAY_BUFFER_ARB;
+  buffer = 0;
+  offset = 0;
+  size = 0;
+  dedicated = false;
+}
+
+/// \brief Obtain the pointer argument addressing a byte of the range while its buffer is bound
+/// \param offset The byte within the range
+/// \return The offset within the buffer, as passed to the gl*Pointer and draw calls
+const GLvoid* BufferRange::getPointer(size_t offset) const
+{
+  return (const GLvoid*)(this->offset + offset);
+}
+
+/// \brief Default constructor
+ArenaStats::ArenaStats()
+{
+  blocks = 0;
+  capacity = 0;
+  used = 0;
+  ranges = 0;
+  dedicated = 0;
+  flushes = 0;
+}
+
+/// \brief Sub-allocate the ranges allocated from now on from shared blocks
+/// \param enabled True to share blocks, false to give each range its own buffer
+///
+/// Ranges allocated before the change are unaffected and are released as they were allocated.
+void BufferArena::setEnabled(bool enabled)
+{
+  getState()->enabled = enabled;
+}
+
+/// \brief Check whether ranges are sub-allocated from shared blocks
+/// \return True if setEnabled(true) was called
+bool BufferArena::isEnabled()
+{
+  return getState()->enabled;
+}
+
+/// \brief Specify the size of the blocks created from now on
+/// \param size The size in bytes; a larger block is created for a range which would not fit
+void BufferArena::setBlockSize(size_t size)
+{
+  getState()->blockSize = align(size);
+}
+
+/// \brief Obtain the size of new blocks
+/// \return The size in bytes, 4MB by default
+size_t BufferArena::getBlockSize()
+{
+  return getState()->blockSize;
+}
+
+/// \brief Allocate space on the graphics card
+/// \param target GL_ARRAY_BUFFER_ARB for vertex data or GL_ELEMENT_ARRAY_BUFFER_ARB for indices
+/// \param size The number of bytes
+/// \return The range, to be filled by write and returned by release
+BufferRange BufferArena::allocate(GLenum target, size_t size)
+{
+  ArenaState* state = getState();
+  BufferRange result;
+  Block block;
+  size_t aligned = align(size);
+
+  result.target = target;
+  result.size = size;
+
+  if(state->enabled == false)
+  {
+    result.buffer = RenderBackend::get()->genBuffer();
+    result.dedicated = true;
+    state->stats.dedicated++;
+
+    return result;
+  }
+
+  for(size_t i = 0; i < state->blocks.size(); i++)
+  {
+    if(state->blocks.at(i).target == target &&
+      allocateFrom(&state->blocks.at(i), aligned, &result.offset) == true)
+    {
+      result.buffer = state->blocks.at(i).buffer;
+      state->stats.used += aligned;
+      state->stats.ranges++;
+
+      return result;
+    }
+  }
+
+  block.target = target;
+  block.capacity = std::max(state->blockSize, aligned);
+  block.buffer = RenderBackend::get()->genBuffer();
+  block.free.push_back(std::make_pair((size_t)0, block.capacity));
+  GLState::bindBuffer(target, block.buffer);
+  RenderBackend::get()->bufferData(target, block.capacity, NULL, GL_STATIC_DRAW_ARB);
+
+  if(target == GL_ELEMENT_ARRAY_BUFFER_ARB)
+  {
+    GLState::bindBuffer(target, 0);
+  }
+
+  allocateFrom(&block, aligned, &result.offset);
+  result.buffer = block.buffer;
+  state->blocks.push_back(block);
+  state->stats.blocks++;
+  state->stats.capacity += block.capacity;
+  state->stats.used += aligned;
+  state->stats.ranges++;
+
+  return result;
+}
+
+/// \brief Fill a range
+/// \param range The range returned by allocate
+/// \param data The range's size in bytes to copy
+///
+/// A dedicated range is filled immediately. A shared range is copied to
+/// staging memory and reaches the graphics card on the next flush.
+void BufferArena::write(BufferRange* range, const GLvoid* data)
+{
+  ArenaState* state = getState();
+  PendingWrite pending;
+
+  if(range->dedicated == true)
+  {
+    GLState::bindBuffer(range->target, range->buffer);
+    RenderBackend::get()->bufferData(range->target, range->size, data, GL_STATIC_DRAW_ARB);
+
+    if(range->target == GL_ELEMENT_ARRAY_BUFFER_ARB)
+    {
+      GLState::bindBuffer(range->target, 0);
+    }
+
+    return;
+  }
+
+  pending.target = range->target;
+  pending.buffer = range->buffer;
+  pending.offset = range->offset;
+  pending.size = range->size;
+  pending.staged = state->staging.size();
+  state->staging.insert(state->staging.end(), (const unsigned char*)data, (const unsigned char*)data + range->size);
+  state->pending.push_back(pending);
+}
+
+/// \brief Copy every pending write to the graphics card
+///
+/// The span of each block covering its pending writes is mapped once and the
+/// writes copied into it. Part::upload flushes once its groups are uploaded;
+/// MaterialGroups uploaded on their own must be flushed before being drawn.
+void BufferArena::flush()
+{
+  ArenaState* state = getState();
+  RenderBackend* backend = RenderBackend::get();
+  unsigned char* mapped = NULL;
+  size_t first = 0;
+  size_t end = 0;
+  size_t last = 0;
+
+  std::sort(state->pending.begin(), state->pending.end());
+
+  for(size_t i = 0; i < state->pending.size(); i = end)
+  {
+    PendingWrite* write = &state->pending.at(i);
+
+    first = write->offset;
+    last = write->offset + write->size;
+
+    for(end = i + 1; end < state->pending.size() && state->pending.at(end).buffer == write->buffer; end++)
+    {
+      last = std::max(last, state->pending.at(end).offset + state->pending.at(end).size);
+    }
+
+    GLState::bindBuffer(write->target, write->buffer);
+    mapped = (unsigned char*)backend->mapBufferRange(write->target, first, last - first, GL_MAP_WRITE_BIT);
+
+    for(size_t w = i; w < end; w++)
+    {
+      PendingWrite* current = &state->pending.at(w);
+
+      if(mapped != NULL)
+      {
+        memcpy(mapped + current->offset - first, &state->staging.at(current->staged), current->size);
+      }
+      else
+      {
+        backend->bufferSubData(current->target, current->offset, current->size, &state->staging.at(current->staged));
+      }
+    }
+
+    if(mapped != NULL)
+    {
+      backend->unmapBuffer(write->target);
+    }
+
+    if(write->target == GL_ELEMENT_ARRAY_BUFFER_ARB)
+    {
+      GLState::bindBuffer(write->target, 0);
+    }
+
+    state->stats.flushes++;
+  }
+
+  state->pending.clear();
+  std::vector<unsigned char>().swap(state->staging);
+}
+
+/// \brief Return a range to the arena
+/// \param range The range returned by allocate, emptied
+///
+/// A dedicated range's buffer is deleted. A shared range is merged with the
+/// free spans either side of it, deleting its block once nothing else is allocated from it.
+void BufferArena::release(BufferRange* range)
+{
+  ArenaState* state = getState();
+  std::vector<std::pair<size_t, size_t> >::iterator position;
+  size_t aligned = align(range->size);
+
+  if(range->buffer == 0)
+  {
+    return;
+  }
+
+  if(range->dedicated == true)
+  {
+    GLState::deleteBuffer(range->buffer);
+    state->stats.dedicated--;
+    *range = BufferRange();
+
+    return;
+  }
+
+  for(size_t i = 0; i < state->pending.size(); i++)
+  {
+    if(state->pending.at(i).buffer == range->buffer && state->pending.at(i).offset == range->offset)
+    {
+      state->pending.erase(state->pending.begin() + i);
+      break;
+    }
+  }
+
+  for(size_t i = 0; i < state->blocks.size(); i++)
+  {
+    Block* block = &state->blocks.at(i);
+
+    if(block->buffer != range->buffer)
+    {
+      continue;
+    }
+
+    position = std::lower_bound(block->free.begin(), block->free.end(), std::make_pair(range->offset, (size_t)0));
+    position = block->free.insert(position, std::make_pair(range->offset, aligned));
+
+    if(position + 1 != block->free.end() && position->first + position->second == (position + 1)->first)
+    {
+      position->second += (position + 1)->second;
+      block->free.erase(position + 1);
+    }
+
+    if(position != block->free.begin() && (position - 1)->first + (position - 1)->second == position->first)
+    {
+      (position - 1)->second += position->second;
+      block->free.erase(position);
+    }
+
+    state->stats.used -= aligned;
+    state->stats.ranges--;
+
+    if(block->free.size() == 1 && block->free.at(0).second == block->capacity)
+    {
+      GLState::deleteBuffer(block->buffer);
+      state->stats.blocks--;
+      state->stats.capacity -= block->capacity;
+      state->blocks.erase(state->blocks.begin() + i);
+    }
+
+    break;
+  }
+
+  *range = BufferRange();
+}
+
+/// \brief Obtain the blocks and ranges held by the arena
+/// \return The current counts, with flushes counted since the arena was created
+ArenaStats BufferArena::getStats()
+{
+  return getState()->stats;
+}
+
+}
@@ -0,0 +1,678 @@
+/*********************************************************************************
+ *
+ * Copyright (c) 2012, Sanguine Laboratories
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *********************************************************************************/
+
+#include <cstdio>
+#include <cstring>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <wavefront.h>
+
+namespace Wavefront
+{
+
+namespace
+{
+
+/// \brief The identifying bytes at the start of every .wfb file
+const char CACHE_MAGIC[4] = { 'W', 'F', 'B', '\n' };
+
+/// \brief Written after the magic so caches from a machine of different endianness are rejected
+const unsigned int CACHE_BYTE_ORDER = 0x01020304;
+
+/// \brief Builds the contents of a .wfb file in memory
+///
+/// Arrays are aligned to four bytes so that they can be used directly from the
+/// mapped file when it is read back.
+class CacheWriter
+{
+private:
+  std::vector<char> buffer; ///< The data written so far
+
+public:
+  void write(const void* data, size_t size)
+  {
+    buffer.insert(buffer.end(), (const char*)data, (const char*)data + size);
+  }
+
+  void align()
+  {
+    while(buffer.size() % 4 != 0)
+    {
+      buffer.push_back(0);
+    }
+  }
+
+  void writeInt(unsigned int value)
+  {
+    write(&value, sizeof(value));
+  }
+
+  void writeLong(unsigned long long value)
+  {
+    write(&value, sizeof(value));
+  }
+
+  void writeFloat(float value)
+  {
+    write(&value, sizeof(value));
+  }
+
+  void writeFloats(const float* values, size_t count)
+  {
+    write(values, count * sizeof(float));
+  }
+
+  void writeString(std::string value)
+  {
+    writeInt(value.length());
+    write(value.c_str(), value.length());
+    align();
+  }
+
+  void writeArray(const void* data, size_t count, size_t size)
+  {
+    writeInt(count);
+
+    if(count > 0)
+    {
+      write(data, count * size);
+    }
+
+    align();
+  }
+
+  template<class T>
+  void writeVector(std::vector<T>* data)
+  {
+    writeArray(data->empty() ? NULL : &data->front(), data->size(), sizeof(T));
+  }
+
+  bool save(std::string path)
+  {
+    std::string temporary = path + ".tmp";
+    FILE* file = fopen(temporary.c_str(), "wb");
+    bool success = false;
+
+    if(file == NULL)
+    {
+      return false;
+    }
+
+    success = fwrite(&buffer[0], 1, buffer.size(), file) == buffer.size();
+    success = (fclose(file) == 0) && success;
+
+    // Renaming means a reader never sees a partially written cache
+    if(success == false || rename(temporary.c_str(), path.c_str()) != 0)
+    {
+      remove(temporary.c_str());
+      return false;
+    }
+
+    return true;
+  }
+};
+
+/// \brief Reads the contents of a mapped .wfb file
+///
+/// Every read is checked against the end of the file and throws a
+/// WavefrontException if the file is truncated.
+class CacheReader
+{
+private:
+  const char* begin; ///< The first byte of the file
+  const char* current; ///< The next byte to be read
+  const char* end; ///< One past the last byte of the file
+
+public:
+  CacheReader(const char* begin, const char* end)
+  {
+    this->begin = begin;
+    current = begin;
+    this->end = end;
+  }
+
+  const char* read(size_t size)
+  {
+    const char* result = current;
+
+    if(size > (size_t)(end - current))
+    {
+      throw WavefrontException("Model cache is truncated");
+    }
+
+    current += size;
+
+    return result;
+  }
+
+  void align()
+  {
+    while((current - begin) % 4 != 0 && current < end)
+    {
+      current++;
+    }
+  }
+
+  unsigned int readInt()
+  {
+    unsigned int result = 0;
+
+    memcpy(&result, read(sizeof(result)), sizeof(result));
+
+    return result;
+  }
+
+  unsigned long long readLong()
+  {
+    unsigned long long result = 0;
+
+    memcpy(&result, read(sizeof(result)), sizeof(result));
+
+    return result;
+  }
+
+  float readFloat()
+  {
+    float result = 0;
+
+    memcpy(&result, read(sizeof(result)), sizeof(result));
+
+    return result;
+  }
+
+  void readFloats(float* values, size_t count)
+  {
+    memcpy(values, read(count * sizeof(float)), count * sizeof(float));
+  }
+
+  std::string readString()
+  {
+    unsigned int length = readInt();
+    std::string result(read(length), length);
+
+    align();
+
+    return result;
+  }
+
+  const void* readArray(size_t* count, size_t size)
+  {
+    const void* result = NULL;
+
+    *count = readInt();
+    result = read(*count * size);
+    align();
+
+    return result;
+  }
+
+  template<class T>
+  void readVector(std::vector<T>* output)
+  {
+    size_t count = 0;
+    const T* data = (const T*)readArray(&count, sizeof(T));
+
+    output->assign(data, data + count);
+  }
+};
+
+/// \brief Check that every face of a Geometry refers to an existing position and texture coordinate
+/// \param geometry The Geometry read from a cache
+/// \return False if an index is out of range or the index arrays differ in length
+bool geometryInRange(Geometry* geometry)
+{
+  std::vector<unsigned int>* positionIndices = geometry->getPositionIndices();
+  std::vector<int>* coordIndices = geometry->getCoordIndices();
+  size_t positionCount = geometry->getPositions()->size() / 3;
+  int coordCount = geometry->getCoords()->size() / 2;
+
+  if(positionIndices->size() != coordIndices->size())
+  {
+    return false;
+  }
+
+  for(size_t i = 0; i < positionIndices->size(); i++)
+  {
+    // A coordinate index of -1 marks a corner without a texture coordinate
+    if(positionIndices->at(i) >= positionCount ||
+      coordIndices->at(i) < -1 || coordIndices->at(i) >= coordCount)
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/// \brief Check that every element index of a group's streams refers to one of its vertices
+/// \param streams The streams read from a cache
+/// \return False if the index type is unknown or an index is out of range
+bool indicesInRange(const StreamData& streams)
+{
+  const unsigned int* indices = (const unsigned int*)streams.indices;
+  const unsigned short* shortIndices = (const unsigned short*)streams.indices;
+
+  if(streams.indexType != GL_UNSIGNED_INT && streams.indexType != GL_UNSIGNED_SHORT)
+  {
+    return false;
+  }
+
+  for(size_t i = 0; i < streams.indexCount; i++)
+  {
+    if((streams.indexType == GL_UNSIGNED_INT ? indices[i] : shortIndices[i]) >= streams.vertexCount)
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/// \brief Check whether a source file is unchanged since a cache was written
+/// \param path The path of the source file
+/// \param size The size recorded in the cache
+/// \param modified The modification time recorded in the cache
+/// \param hash The content hash recorded in the cache
+/// \param touched Set to true if the file matches but its modification time differs
+/// \return True if the file still matches
+///
+/// The content is only hashed when the modification time differs, so an
+/// untouched file costs a single stat.
+bool sourceUnchanged(std::string path, unsigned long long size, unsigned long long modified,
+  unsigned long long hash, bool* touched)
+{
+  struct stat info;
+
+  if(stat(path.c_str(), &info) != 0 || (unsigned long long)info.st_size != size)
+  {
+    return false;
+  }
+
+  if((unsigned long long)info.st_mtime == modified)
+  {
+    return true;
+  }
+
+  MappedFile file(path);
+
+  if(Util::hash(file.getData(), file.getSize()) != hash)
+  {
+    return false;
+  }
+
+  *touched = true;
+
+  return true;
+}
+
+}
+
+/// \brief Load the model from a compiled .wfb file
+/// \param path The path of the .wfb file
+/// \return False if the file is missing, stale, corrupt or was built with different flags
+///
+/// The file is mapped into memory and the buffer data of each MaterialGroup is
+/// handed to it by MaterialGroup::setStreams as pointers into the mapping, so
+/// nothing is copied before being uploaded. If a source file was touched
+/// without its content changing, the cache is rewritten with the new
+/// modification time so later loads do not hash the source again.
+bool ModelData::_loadCache(std::string path)
+{
+  std::tr1::shared_ptr<MappedFile> file;
+  std::tr1::shared_ptr<Material> material;
+  std::tr1::shared_ptr<Part> part;
+  std::tr1::shared_ptr<MaterialGroup> materialGroup;
+  StreamData streams;
+  std::vector<std::string> cacheSources;
+  std::string sourcePath;
+  std::string texturePath;
+  unsigned long long size = 0;
+  unsigned long long modified = 0;
+  unsigned long long hash = 0;
+  unsigned int count = 0;
+  unsigned int groupCount = 0;
+  unsigned int materialIndex = 0;
+  size_t first = 0;
+  size_t faceCount = 0;
+  size_t arrayCount = 0;
+  bool countsMatch = true;
+  float x = 0;
+  float y = 0;
+  float z = 0;
+  float bounds[7] = { 0 };
+  bool touched = false;
+
+  if(access(path.c_str(), R_OK) != 0)
+  {
+    return false;
+  }
+
+  try
+  {
+    file.reset(new MappedFile(path));
+    CacheReader reader(file->getData(), file->getData() + file->getSize());
+
+    if(memcmp(reader.read(sizeof(CACHE_MAGIC)), CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+      reader.readInt() != CACHE_BYTE_ORDER ||
+      reader.readInt() != MODEL_CACHE_VERSION ||
+      reader.readInt() != (unsigned int)(flags & ~(MODEL_PARALLEL | MODEL_CACHE)))
+    {
+      return false;
+    }
+
+    count = reader.readInt();
+
+    for(unsigned int i = 0; i < count; i++)
+    {
+      sourcePath = reader.readString();
+      size = reader.readLong();
+      modified = reader.readLong();
+      hash = reader.readLong();
+
+      if(sourceUnchanged(sourcePath, size, modified, hash, &touched) == false)
+      {
+        return false;
+      }
+
+      cacheSources.push_back(sourcePath);
+    }
+
+    count = reader.readInt();
+
+    for(unsigned int i = 0; i < count; i++)
+    {
+      material.reset(new Material());
+      material->setName(reader.readString());
+      x = reader.readFloat();
+      y = reader.readFloat();
+      z = reader.readFloat();
+      material->setDiffuse(Vector3(x, y, z));
+      texturePath = reader.readString();
+
+      if(texturePath != "")
+      {
+        material->setTexture(_loadTexture(texturePath));
+        material->setTexturePath(texturePath);
+      }
+
+      materials.push_back(material);
+    }
+
+    reader.readVector(geometry.getPositions());
+    reader.readVector(geometry.getCoords());
+    reader.readVector(geometry.getPositionIndices());
+    reader.readVector(geometry.getCoordIndices());
+
+    if(geometryInRange(&geometry) == false)
+    {
+      throw WavefrontException("Model cache is corrupt");
+    }
+
+    count = reader.readInt();
+
+    for(unsigned int i = 0; i < count; i++)
+    {
+      part.reset(new Part());
+      part->setName(reader.readString());
+      x = reader.readFloat();
+      y = reader.readFloat();
+      z = reader.readFloat();
+      part->setCenter(Vector3(x, y, z));
+      reader.readFloats(bounds, 7);
+      part->setBounds(Vector3(bounds[0], bounds[1], bounds[2]), Vector3(bounds[3], bounds[4], bounds[5]), bounds[6]);
+      groupCount = reader.readInt();
+
+      for(unsigned int g = 0; g < groupCount; g++)
+      {
+        materialGroup.reset(new MaterialGroup());
+        materialIndex = reader.readInt();
+        first = reader.readInt();
+        faceCount = reader.readInt();
+
+        if(materialIndex >= materials.size() || first + faceCount > geometry.getFaceCount())
+        {
+          throw WavefrontException("Model cache is corrupt");
+        }
+
+        materialGroup->setMaterial(materials.at(materialIndex).get());
+        materialGroup->addFaces(&geometry, first, faceCount);
+
+        streams = StreamData();
+        countsMatch = true;
+        streams.indexType = reader.readInt();
+        streams.vertexCache.triangles = reader.readInt();
+        streams.vertexCache.vertices = reader.readInt();
+        streams.vertexCache.missesBefore = reader.readInt();
+        streams.vertexCache.missesAfter = reader.readInt();
+
+        if((flags & MODEL_QUANTIZED) != 0)
+        {
+          reader.readFloats(streams.quantization.positionCenter, 3);
+          streams.quantization.positionScale = reader.readFloat();
+          reader.readFloats(streams.quantization.coordCenter, 2);
+          reader.readFloats(streams.quantization.coordScale, 2);
+          streams.quantization.maxPositionError = reader.readFloat();
+          streams.quantization.maxNormalError = reader.readFloat();
+          streams.quantization.maxCoordError = reader.readFloat();
+          streams.quantized = reader.readArray(&streams.vertexCount, StreamData::QUANTIZED_VERTEX_SIZE);
+        }
+        else if((flags & MODEL_INTERLEAVED) != 0)
+        {
+          streams.interleaved = (const float*)reader.readArray(&streams.vertexCount, StreamData::INTERLEAVED_VERTEX_SIZE);
+        }
+        else
+        {
+          streams.vertices = (const float*)reader.readArray(&streams.vertexCount, sizeof(float) * 3);
+
+          streams.colors = (const float*)reader.readArray(&arrayCount, sizeof(float) * 4);
+          countsMatch = arrayCount == streams.vertexCount;
+          streams.normals = (const float*)reader.readArray(&arrayCount, sizeof(float) * 3);
+          countsMatch = countsMatch && arrayCount == streams.vertexCount;
+          streams.coords = (const float*)reader.readArray(&arrayCount, sizeof(float) * 2);
+          countsMatch = countsMatch && arrayCount == streams.vertexCount;
+        }
+
+        if(streams.indexType == GL_UNSIGNED_INT)
+        {
+          streams.indices = reader.readArray(&streams.indexCount, sizeof(unsigned int));
+        }
+        else
+        {
+          streams.indices = reader.readArray(&streams.indexCount, sizeof(unsigned short));
+        }
+
+        if(streams.indexCount == 0)
+        {
+          streams.indices = NULL;
+        }
+
+        if(countsMatch == false || indicesInRange(streams) == false)
+        {
+          throw WavefrontException("Model cache is corrupt");
+        }
+
+        materialGroup->setStreams(streams);
+        part->addMaterialGroup(materialGroup);
+      }
+
+      parts.push_back(part);
+    }
+  }
+  catch(WavefrontException& e)
+  {
+    // A corrupt cache is treated like a stale one and rebuilt
+    materials.clear();
+    parts.clear();
+    geometry = Geometry();
+
+    return false;
+  }
+
+  sources = cacheSources;
+  cache = file;
+
+  // The mapping stays valid as _writeCache replaces the file by renaming
+  if(touched == true)
+  {
+    _writeCache(path);
+  }
+
+  return true;
+}
+
+/// \brief Write the model to a compiled .wfb file
+/// \param path The path of the .wfb file
+/// \return False if the file could not be written
+///
+/// Must be called after the parts have been built but before they are uploaded
+/// so that the buffer data of each MaterialGroup is still available.
+bool ModelData::_writeCache(std::string path)
+{
+  CacheWriter writer;
+  StreamData streams;
+  MaterialGroup* materialGroup = NULL;
+  struct stat info;
+  unsigned int materialIndex = 0;
+
+  writer.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+  writer.writeInt(CACHE_BYTE_ORDER);
+  writer.writeInt(MODEL_CACHE_VERSION);
+  writer.writeInt(flags & ~(MODEL_PARALLEL | MODEL_CACHE));
+  writer.writeInt(sources.size());
+
+  for(int i = 0; i < sources.size(); i++)
+  {
+    if(stat(sources.at(i).c_str(), &info) != 0)
+    {
+      return false;
+    }
+
+    MappedFile file(sources.at(i));
+
+    writer.writeString(sources.at(i));
+    writer.writeLong(info.st_size);
+    writer.writeLong(info.st_mtime);
+    writer.writeLong(Util::hash(file.getData(), file.getSize()));
+  }
+
+  writer.writeInt(materials.size());
+
+  for(int i = 0; i < materials.size(); i++)
+  {
+    writer.writeString(materials.at(i)->getName());
+    writer.writeFloat(materials.at(i)->getDiffuse().getX());
+    writer.writeFloat(materials.at(i)->getDiffuse().getY());
+    writer.writeFloat(materials.at(i)->getDiffuse().getZ());
+    writer.writeString(materials.at(i)->getTexturePath());
+  }
+
+  writer.writeVector(geometry.getPositions());
+  writer.writeVector(geometry.getCoords());
+  writer.writeVector(geometry.getPositionIndices());
+  writer.writeVector(geometry.getCoordIndices());
+
+  writer.writeInt(parts.size());
+
+  for(int i = 0; i < parts.size(); i++)
+  {
+    writer.writeString(parts.at(i)->getName());
+    writer.writeFloat(parts.at(i)->getCenter()->getX());
+    writer.writeFloat(parts.at(i)->getCenter()->getY());
+    writer.writeFloat(parts.at(i)->getCenter()->getZ());
+    writer.writeFloat(parts.at(i)->getMinimum()->getX());
+    writer.writeFloat(parts.at(i)->getMinimum()->getY());
+    writer.writeFloat(parts.at(i)->getMinimum()->getZ());
+    writer.writeFloat(parts.at(i)->getMaximum()->getX());
+    writer.writeFloat(parts.at(i)->getMaximum()->getY());
+    writer.writeFloat(parts.at(i)->getMaximum()->getZ());
+    writer.writeFloat(parts.at(i)->getRadius());
+    writer.writeInt(parts.at(i)->getMaterialGroups()->size());
+
+    for(int g = 0; g < parts.at(i)->getMaterialGroups()->size(); g++)
+    {
+      materialGroup = parts.at(i)->getMaterialGroups()->at(g).get();
+      streams = materialGroup->getStreams();
+      materialIndex = 0;
+
+      for(int m = 0; m < materials.size(); m++)
+      {
+        if(materials.at(m).get() == materialGroup->getMaterial())
+        {
+          materialIndex = m;
+        }
+      }
+
+      writer.writeInt(materialIndex);
+      writer.writeInt(materialGroup->getFirstFace());
+      writer.writeInt(materialGroup->getFaceCount());
+      writer.writeInt(streams.indexType);
+      writer.writeInt(streams.vertexCache.triangles);
+      writer.writeInt(streams.vertexCache.vertices);
+      writer.writeInt(streams.vertexCache.missesBefore);
+      writer.writeInt(streams.vertexCache.missesAfter);
+
+      if(streams.quantized != NULL)
+      {
+        writer.writeFloats(streams.quantization.positionCenter, 3);
+        writer.writeFloat(streams.quantization.positionScale);
+        writer.writeFloats(streams.quantization.coordCenter, 2);
+        writer.writeFloats(streams.quantization.coordScale, 2);
+        writer.writeFloat(streams.quantization.maxPositionError);
+        writer.writeFloat(streams.quantization.maxNormalError);
+        writer.writeFloat(streams.quantization.maxCoordError);
+        writer.writeArray(streams.quantized, streams.vertexCount, StreamData::QUANTIZED_VERTEX_SIZE);
+      }
+      else if(streams.interleaved != NULL)
+      {
+        writer.writeArray(streams.interleaved, streams.vertexCount, StreamData::INTERLEAVED_VERTEX_SIZE);
+      }
+      else
+      {
+        writer.writeArray(streams.vertices, streams.vertexCount, sizeof(float) * 3);
+        writer.writeArray(streams.colors, streams.vertexCount, sizeof(float) * 4);
+        writer.writeArray(streams.normals, streams.vertexCount, sizeof(float) * 3);
+        writer.writeArray(streams.coords, streams.vertexCount, sizeof(float) * 2);
+      }
+
+      if(streams.indexType == GL_UNSIGNED_INT)
+      {
+        writer.writeArray(streams.indices, streams.indexCount, sizeof(unsigned int));
+      }
+      else
+      {
+        writer.writeArray(streams.indices, streams.indexCount, sizeof(unsigned short));
+      }
+    }
+  }
+
+  return writer.save(path);
+}
+
+}
@@ -0,0 +1,434 @@
+/*********************************************************************************
+ *
+ * Copyright (c) 2012, Sanguine Laboratories
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *********************************************************************************/
+
+#include <cmath>
+#include <cstring>
+
+#include <GL/glew.h>
+
+#include <wavefront.h>
+
+namespace Wavefront
+{
+
+namespace
+{
+
+/// \brief Transforms and lights each vertex from uniforms rather than fixed function state
+const char* vertexSource =
+  "#version 330 core\n"
+  "layout(location = 0) in vec3 position;\n"
+  "layout(location = 1) in vec3 normal;\n"
+  "layout(location = 2) in vec2 coord;\n"
+  "layout(location = 3) in vec4 color;\n"
+  "uniform mat4 projection;\n"
+  "uniform mat4 modelview;\n"
+  "uniform mat3 normalMatrix;\n"
+  "uniform vec4 coordTransform;\n"
+  "uniform bool lighting;\n"
+  "uniform vec4 lightPosition;\n"
+  "uniform vec4 lightAmbient;\n"
+  "uniform vec4 lightDiffuse;\n"
+  "out vec4 vertexColor;\n"
+  "out vec2 vertexCoord;\n"
+  "void main()\n"
+  "{\n"
+  "  vec4 eye = modelview * vec4(position, 1.0);\n"
+  "  vertexColor = color;\n"
+  "  if(lighting)\n"
+  "  {\n"
+  "    vec3 light = normalize(lightPosition.xyz - eye.xyz * lightPosition.w);\n"
+  "    float diffuse = max(dot(normalize(normalMatrix * normal), light), 0.0);\n"
+  "    vertexColor = vec4(min((lightAmbient.rgb + lightDiffuse.rgb * diffuse) * color.rgb, 1.0), color.a);\n"
+  "  }\n"
+  "  vertexCoord = coordTransform.xy + coord * coordTransform.zw;\n"
+  "  gl_Position = projection * eye;\n"
+  "}\n";
+
+/// \brief Modulates the texture by the vertex color as GL_MODULATE does
+const char* fragmentSource =
+  "#version 330 core\n"
+  "uniform sampler2D diffuseMap;\n"
+  "uniform bool textured;\n"
+  "in vec4 vertexColor;\n"
+  "in vec2 vertexCoord;\n"
+  "out vec4 fragmentColor;\n"
+  "void main()\n"
+  "{\n"
+  "  fragmentColor = textured ? texture(diffuseMap, vertexCoord) * vertexColor : vertexColor;\n"
+  "}\n";
+
+/// \brief The state of the core pipeline for the single rendering context
+struct PipelineState
+{
+  bool enabled; ///< True if the library draws through the core pipeline
+  MatrixStack projection; ///< The projection matrix the application has set
+  MatrixStack modelview; ///< The modelview matrix the application has set
+  bool lighting; ///< True to light vertices with the single light
+  bool texturing; ///< True to apply the materials' textures
+  float lightPosition[4]; ///< The light's position in eye space, w of 0 for a directional light
+  float lightAmbient[4]; ///< The ambient intensity, including any scene ambient
+  float lightDiffuse[4]; ///< The diffuse intensity
+  std::tr1::shared_ptr<Shader> shader; ///< The built in shader, built on first use
+  GLint projectionLocation; ///< The location of the projection uniform
+  GLint modelviewLocation; ///< The location of the modelview uniform
+  GLint normalMatrixLocation; ///< The location of the normalMatrix uniform
+  GLint coordTransformLocation; ///< The location of the coordTransform uniform
+  GLint lightingLocation; ///< The location of the lighting uniform
+  GLint lightPositionLocation; ///< The location of the lightPosition uniform
+  GLint lightAmbientLocation; ///< The location of the lightAmbient uniform
+  GLint lightDiffuseLocation; ///< The location of the lightDiffuse uniform
+  GLint texturedLocation; ///< The location of the textured uniform
+
+  PipelineState()
+  {
+    float position[4] = { 0, 0, 1, 0 };
+    float ambient[4] = { 0.2f, 0.2f, 0.2f, 1 };
+    float diffuse[4] = { 1, 1, 1, 1 };
+
+    enabled = false;
+    lighting = false;
+    texturing = true;
+    memcpy(lightPosition, position, sizeof(position));
+    memcpy(lightAmbient, ambient, sizeof(ambient));
+    memcpy(lightDiffuse, diffuse, sizeof(diffuse));
+  }
+
+};
+
+/// \brief Obtain the state of the core pipeline
+/// \return The single PipelineState of the rendering thread
+PipelineState* getState()
+{
+  static PipelineState state;
+
+  return &state;
+}
+
+/// \brief Build the built in shader and find its uniforms
+/// \param state The PipelineState to store them in
+void createShader(PipelineState* state)
+{
+  state->shader.reset(new Shader(vertexSource, fragmentSource));
+  state->projectionLocation = state->shader->getUniform("projection");
+  state->modelviewLocation = state->shader->getUniform("modelview");
+  state->normalMatrixLocation = state->shader->getUniform("normalMatrix");
+  state->coordTransformLocation = state->shader->getUniform("coordTransform");
+  state->lightingLocation = state->shader->getUniform("lighting");
+  state->lightPositionLocation = state->shader->getUniform("lightPosition");
+  state->lightAmbientLocation = state->shader->getUniform("lightAmbient");
+  state->lightDiffuseLocation = state->shader->getUniform("lightDiffuse");
+  state->texturedLocation = state->shader->getUniform("textured");
+
+  state->shader->use();
+  glUniform1i(state->shader->getUniform("diffuseMap"), 0);
+}
+
+/// \brief Calculate the matrix transforming normals, the inverse transpose of the upper 3x3
+/// \param matrix The column-major modelview matrix
+/// \param normal The 9 floats to receive the column-major normal matrix
+void getNormalMatrix(const float* matrix, float* normal)
+{
+  float a = matrix[0], b = matrix[4], c = matrix[8];
+  float d = matrix[1], e = matrix[5], f = matrix[9];
+  float g = matrix[2], h = matrix[6], i = matrix[10];
+  float determinant = a * (e * i - f * h) - b * (d * i - f * g) + c * (d * h - e * g);
+
+  if(determinant == 0)
+  {
+    determinant = 1;
+  }
+
+  // The transpose of the inverse is the cofactor matrix over the determinant
+  normal[0] = (e * i - f * h) / determinant;
+  normal[1] = (c * h - b * i) / determinant;
+  normal[2] = (b * f - c * e) / determinant;
+  normal[3] = (f * g - d * i) / determinant;
+  normal[4] = (a * i - c * g) / determinant;
+  normal[5] = (c * d - a * f) / determinant;
+  normal[6] = (d * h - e * g) / determinant;
+  normal[7] = (b * g - a * h) / determinant;
+  normal[8] = (a * e - b * d) / determinant;
+}
+
+}
+
+/// \brief Constructor, the stack holding a single identity matrix
+MatrixStack::MatrixStack()
+{
+  matrices.resize(16);
+  loadIdentity();
+}
+
+/// \brief Duplicate the current matrix, the equivalent of glPushMatrix
+void MatrixStack::push()
+{
+  matrices.insert(matrices.end(), matrices.end() - 16, matrices.end());
+}
+
+/// \brief Return to the matrix before the last push, the equivalent of glPopMatrix
+void MatrixStack::pop()
+{
+  if(matrices.size() <= 16)
+  {
+    throw WavefrontException("Matrix stack underflow");
+  }
+
+  matrices.resize(matrices.size() - 16);
+}
+
+/// \brief Replace the current matrix with the identity
+void MatrixStack::loadIdentity()
+{
+  float identity[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+
+  load(identity);
+}
+
+/// \brief Replace the current matrix
+/// \param matrix The 16 floats of the column-major matrix
+void MatrixStack::load(const float* matrix)
+{
+  memcpy(&matrices[matrices.size() - 16], matrix, 16 * sizeof(float));
+}
+
+/// \brief Multiply the current matrix by another, the equivalent of glMultMatrixf
+/// \param matrix The 16 floats of the column-major matrix
+void MatrixStack::multiply(const float* matrix)
+{
+  Util::multiplyMatrix(get(), matrix, &matrices[matrices.size() - 16]);
+}
+
+/// \brief Multiply the current matrix by a translation, the equivalent of glTranslatef
+/// \param x The translation along the x axis
+/// \param y The translation along the y axis
+/// \param z The translation along the z axis
+void MatrixStack::translate(float x, float y, float z)
+{
+  Util::translateMatrix(&matrices[matrices.size() - 16], x, y, z);
+}
+
+/// \brief Multiply the current matrix by a rotation, the equivalent of glRotatef
+/// \param angle The angle in degrees
+/// \param x The x component of the unit axis
+/// \param y The y component of the unit axis
+/// \param z The z component of the unit axis
+void MatrixStack::rotate(float angle, float x, float y, float z)
+{
+  Util::rotateMatrix(&matrices[matrices.size() - 16], angle, x, y, z);
+}
+
+/// \brief Multiply the current matrix by a scale, the equivalent of glScalef
+/// \param x The scale along the x axis
+/// \param y The scale along the y axis
+/// \param z The scale along the z axis
+void MatrixStack::scale(float x, float y, float z)
+{
+  Util::scaleMatrix(&matrices[matrices.size() - 16], x, y, z);
+}
+
+/// \brief Multiply the current matrix by a perspective projection, the equivalent of gluPerspective
+/// \param fovy The vertical field of view in degrees
+/// \param aspect The width of the view divided by its height
+/// \param zNear The distance to the near clipping plane
+/// \param zFar The distance to the far clipping plane
+void MatrixStack::perspective(float fovy, float aspect, float zNear, float zFar)
+{
+  float f = 1.0f / (float)tan(fovy * (float)M_PI / 360.0f);
+  float projection[16] =
+  {
+    f / aspect, 0, 0, 0,
+    0, f, 0, 0,
+    0, 0, (zFar + zNear) / (zNear - zFar), -1,
+    0, 0, 2 * zFar * zNear / (zNear - zFar), 0
+  };
+
+  multiply(projection);
+}
+
+/// \brief Obtain the current matrix
+/// \return The 16 floats of the column-major matrix, valid until the stack next changes
+const float* MatrixStack::get()
+{
+  return &matrices[matrices.size() - 16];
+}
+
+/// \brief Check whether the rendering context can run the core pipeline
+/// \return True if OpenGL 3.3 is available
+bool CorePipeline::isSupported()
+{
+  return GLEW_VERSION_3_3;
+}
+
+/// \brief Select the pipeline the library draws with
+/// \param enabled True to draw with vertex array objects and the built in shader,
+/// false for the fixed function pipeline
+///
+/// Must be set before the first Model is uploaded, and must be true for a
+/// core profile context.
+void CorePipeline::setEnabled(bool enabled)
+{
+  getState()->enabled = enabled;
+}
+
+/// \brief Check which pipeline the library draws with
+/// \return True if setEnabled(true) was called
+bool CorePipeline::isEnabled()
+{
+  return getState()->enabled;
+}
+
+/// \brief Obtain the projection matrix used by the core pipeline
+/// \return The MatrixStack to set it with
+MatrixStack* CorePipeline::getProjection()
+{
+  return &getState()->projection;
+}
+
+/// \brief Obtain the modelview matrix used by the core pipeline
+/// \return The MatrixStack to set it with
+MatrixStack* CorePipeline::getModelview()
+{
+  return &getState()->modelview;
+}
+
+/// \brief Obtain the current modelview matrix of whichever pipeline is selected
+/// \param matrix The 16 floats to receive the column-major matrix
+void CorePipeline::getCurrentMatrix(float* matrix)
+{
+  if(getState()->enabled == true)
+  {
+    memcpy(matrix, getState()->modelview.get(), 16 * sizeof(float));
+  }
+  else
+  {
+    RenderBackend::get()->getModelview(matrix);
+  }
+}
+
+/// \brief Light the models with the single light, the equivalent of GL_LIGHTING with GL_COLOR_MATERIAL
+/// \param enabled True to light, false to draw the unlit colors
+void CorePipeline::setLighting(bool enabled)
+{
+  getState()->lighting = enabled;
+}
+
+/// \brief Set the light used when lighting is enabled
+/// \param position The position in eye space, with w of 0 for a directional light
+/// \param ambient The RGBA ambient intensity, including any scene ambient
+/// \param diffuse The RGBA diffuse intensity
+///
+/// The default is the fixed function default: a white directional light along
+/// the viewing axis with an ambient intensity of 0.2.
+void CorePipeline::setLight(const float* position, const float* ambient, const float* diffuse)
+{
+  memcpy(getState()->lightPosition, position, 4 * sizeof(float));
+  memcpy(getState()->lightAmbient, ambient, 4 * sizeof(float));
+  memcpy(getState()->lightDiffuse, diffuse, 4 * sizeof(float));
+}
+
+/// \brief Apply the materials' textures, the equivalent of GL_TEXTURE_2D
+/// \param enabled True to texture, the default
+void CorePipeline::setTexturing(bool enabled)
+{
+  getState()->texturing = enabled;
+}
+
+/// \brief Draw a MaterialGroup with the current modelview matrix
+/// \param group The uploaded MaterialGroup
+///
+/// The group's vertex array object and the built in shader are left bound;
+/// GLState::restore must be called once the last group has been drawn.
+void CorePipeline::render(MaterialGroup* group)
+{
+  PipelineState* state = getState();
+  Material* material = group->getMaterial();
+  Quantization quantization = group->getQuantization();
+  float modelview[16] = { 0 };
+  float normal[9] = { 0 };
+  float coordTransform[4] = { 0, 0, 1, 1 };
+
+  if(state->shader.get() == NULL)
+  {
+    createShader(state);
+  }
+
+  memcpy(modelview, state->modelview.get(), sizeof(modelview));
+  getNormalMatrix(modelview, normal);
+
+  if(group->isQuantized() == true)
+  {
+    Util::translateMatrix(modelview, quantization.positionCenter[0], quantization.positionCenter[1], quantization.positionCenter[2]);
+    Util::scaleMatrix(modelview, quantization.positionScale, quantization.positionScale, quantization.positionScale);
+    coordTransform[0] = quantization.coordCenter[0];
+    coordTransform[1] = quantization.coordCenter[1];
+    coordTransform[2] = quantization.coordScale[0];
+    coordTransform[3] = quantization.coordScale[1];
+  }
+
+  state->shader->use();
+  glUniformMatrix4fv(state->projectionLocation, 1, GL_FALSE, state->projection.get());
+  glUniformMatrix4fv(state->modelviewLocation, 1, GL_FALSE, modelview);
+  glUniformMatrix3fv(state->normalMatrixLocation, 1, GL_FALSE, normal);
+  glUniform4fv(state->coordTransformLocation, 1, coordTransform);
+  glUniform1i(state->lightingLocation, state->lighting);
+  glUniform4fv(state->lightPositionLocation, 1, state->lightPosition);
+  glUniform4fv(state->lightAmbientLocation, 1, state->lightAmbient);
+  glUniform4fv(state->lightDiffuseLocation, 1, state->lightDiffuse);
+  glUniform1i(state->texturedLocation, state->texturing == true && material->getTexture() != NULL);
+
+  if(material->getTexture() != NULL)
+  {
+    material->getTexture()->bind();
+  }
+  else
+  {
+    Texture::unbind();
+  }
+
+  group->bindVertexArray();
+
+  // Groups without a color array take the diffuse color from the disabled attribute
+  if(group->usesColorArray() == false)
+  {
+    glVertexAttrib4f(3, material->getDiffuse().getX(), material->getDiffuse().getY(), material->getDiffuse().getZ(), 1);
+  }
+
+  group->drawElements();
+}
+
+/// \brief Delete the built in shader
+///
+/// Must be called before the rendering context is destroyed if the core
+/// pipeline has been used.
+void CorePipeline::release()
+{
+  getState()->shader.reset();
+}
+
+}
+
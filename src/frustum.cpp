@@ -0,0 +1,347 @@
+/*********************************************************************************
+ *
+ * Copyright (c) 2012, Sanguine Laboratories
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *********************************************************************************/
+
+#include <cmath>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#include <GL/glew.h>
+
+#include <wavefront.h>
+
+namespace Wavefront
+{
+
+/// \brief Default constructor
+CullStats::CullStats()
+{
+  tested = 0;
+  culled = 0;
+  drawn = 0;
+}
+
+/// \brief Default constructor, accepting everything until set is called
+Frustum::Frustum()
+{
+  for(int i = 0; i < 24; i++)
+  {
+    planes[i] = 0;
+  }
+}
+
+/// \brief Constructor
+/// \param matrix The column-major matrix to extract the planes from
+Frustum::Frustum(const float* matrix)
+{
+  set(matrix);
+}
+
+/// \brief Extract the planes from a matrix
+/// \param matrix The column-major matrix, typically a projection or view-projection
+///
+/// Each plane is the sum or difference of the fourth row of the matrix and
+/// one of the others, normalized so distances to it can be compared with radii.
+void Frustum::set(const float* matrix)
+{
+  float length = 0;
+
+  for(int i = 0; i < 6; i++)
+  {
+    float sign = (i % 2 == 0) ? 1.0f : -1.0f;
+    int row = i / 2;
+
+    for(int c = 0; c < 4; c++)
+    {
+      planes[i * 4 + c] = matrix[c * 4 + 3] + sign * matrix[c * 4 + row];
+    }
+
+    length = sqrt(planes[i * 4] * planes[i * 4] + planes[i * 4 + 1] * planes[i * 4 + 1] +
+      planes[i * 4 + 2] * planes[i * 4 + 2]);
+
+    if(length > 0)
+    {
+      for(int c = 0; c < 4; c++)
+      {
+        planes[i * 4 + c] /= length;
+      }
+    }
+  }
+}
+
+/// \brief Obtain one of the planes
+/// \param plane 0 to 5 for left, right, bottom, top, near and far
+/// \return The a, b, c and d of the plane
+const float* Frustum::getPlane(int plane)
+{
+  return &planes[plane * 4];
+}
+
+/// \brief Test a sphere against the planes
+/// \param center The x, y and z of the center
+/// \param radius The radius
+/// \return False if the sphere is entirely outside one of the planes
+bool Frustum::testSphere(const float* center, float radius)
+{
+  const float* plane = NULL;
+
+  stats.tested++;
+
+  for(int i = 0; i < 6; i++)
+  {
+    plane = &planes[i * 4];
+
+    if(plane[0] * center[0] + plane[1] * center[1] + plane[2] * center[2] + plane[3] < -radius)
+    {
+      stats.culled++;
+      return false;
+    }
+  }
+
+  stats.drawn++;
+
+  return true;
+}
+
+/// \brief Test an axis aligned box against the planes
+/// \param minimum The smallest x, y and z of the box
+/// \param maximum The largest x, y and z of the box
+/// \return False if the box is entirely outside one of the planes
+///
+/// Only the corner furthest along each plane's normal is tested.
+bool Frustum::testBox(const float* minimum, const float* maximum)
+{
+  const float* plane = NULL;
+  float corner[3] = { 0 };
+
+  stats.tested++;
+
+  for(int i = 0; i < 6; i++)
+  {
+    plane = &planes[i * 4];
+
+    for(int c = 0; c < 3; c++)
+    {
+      corner[c] = plane[c] >= 0 ? maximum[c] : minimum[c];
+    }
+
+    if(plane[0] * corner[0] + plane[1] * corner[1] + plane[2] * corner[2] + plane[3] < 0)
+    {
+      stats.culled++;
+      return false;
+    }
+  }
+
+  stats.drawn++;
+
+  return true;
+}
+
+/// \brief Test many spheres against the planes
+/// \param x The x of each center
+/// \param y The y of each center
+/// \param z The z of each center
+/// \param radius The radius of each sphere
+/// \param count The number of spheres
+/// \param visible Receives 1 for each sphere at least partly inside and 0 for the rest
+/// \return The number of spheres at least partly inside
+///
+/// With SSE four spheres are tested against each plane at once.
+size_t Frustum::testSpheres(const float* x, const float* y, const float* z, const float* radius,
+  size_t count, unsigned char* visible)
+{
+  const float* plane = NULL;
+  size_t result = 0;
+  size_t i = 0;
+
+#ifdef __SSE__
+  for(; i + 4 <= count; i += 4)
+  {
+    __m128 sx = _mm_loadu_ps(x + i);
+    __m128 sy = _mm_loadu_ps(y + i);
+    __m128 sz = _mm_loadu_ps(z + i);
+    __m128 limit = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(radius + i));
+    __m128 outside = _mm_setzero_ps();
+    int mask = 0;
+
+    for(int p = 0; p < 6; p++)
+    {
+      plane = &planes[p * 4];
+
+      __m128 distance = _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(sx, _mm_set1_ps(plane[0])), _mm_mul_ps(sy, _mm_set1_ps(plane[1]))),
+        _mm_add_ps(_mm_mul_ps(sz, _mm_set1_ps(plane[2])), _mm_set1_ps(plane[3])));
+
+      outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, limit));
+    }
+
+    mask = _mm_movemask_ps(outside);
+
+    for(int s = 0; s < 4; s++)
+    {
+      visible[i + s] = (mask & (1 << s)) == 0;
+      result += visible[i + s];
+    }
+  }
+#endif
+
+  for(; i < count; i++)
+  {
+    visible[i] = 1;
+
+    for(int p = 0; p < 6; p++)
+    {
+      plane = &planes[p * 4];
+
+      if(plane[0] * x[i] + plane[1] * y[i] + plane[2] * z[i] + plane[3] < -radius[i])
+      {
+        visible[i] = 0;
+        break;
+      }
+    }
+
+    result += visible[i];
+  }
+
+  stats.tested += count;
+  stats.culled += count - result;
+  stats.drawn += result;
+
+  return result;
+}
+
+/// \brief Obtain the counters since the last call to resetStats
+/// \return The CullStats
+CullStats Frustum::getStats()
+{
+  return stats;
+}
+
+/// \brief Reset the counters, typically at the start of each frame
+void Frustum::resetStats()
+{
+  stats = CullStats();
+}
+
+/// \brief Add a sphere
+/// \param center The x, y and z of the center
+/// \param radius The radius
+void SphereBatch::add(const float* center, float radius)
+{
+  x.push_back(center[0]);
+  y.push_back(center[1]);
+  z.push_back(center[2]);
+  this->radius.push_back(radius);
+}
+
+/// \brief Add a sphere after transforming it
+/// \param center The x, y and z of the center
+/// \param radius The radius
+/// \param matrix The column-major matrix to transform by
+///
+/// The radius is scaled by the largest scale of the matrix so the sphere
+/// still encloses the transformed bounds.
+void SphereBatch::add(const float* center, float radius, const float* matrix)
+{
+  float transformed[3] = { 0 };
+  float scale = 0;
+  float length = 0;
+
+  for(int r = 0; r < 3; r++)
+  {
+    transformed[r] = matrix[r] * center[0] + matrix[4 + r] * center[1] +
+      matrix[8 + r] * center[2] + matrix[12 + r];
+  }
+
+  for(int c = 0; c < 3; c++)
+  {
+    length = matrix[c * 4] * matrix[c * 4] + matrix[c * 4 + 1] * matrix[c * 4 + 1] +
+      matrix[c * 4 + 2] * matrix[c * 4 + 2];
+
+    if(length > scale)
+    {
+      scale = length;
+    }
+  }
+
+  add(transformed, radius * sqrt(scale));
+}
+
+/// \brief Remove every sphere
+void SphereBatch::clear()
+{
+  x.clear();
+  y.clear();
+  z.clear();
+  radius.clear();
+  visible.clear();
+}
+
+/// \brief Obtain the number of spheres
+/// \return The number added since clear
+size_t SphereBatch::getSize()
+{
+  return x.size();
+}
+
+/// \brief Test every sphere against a frustum
+/// \param frustum The frustum, which counts the spheres tested
+/// \return The number of spheres at least partly inside
+size_t SphereBatch::cull(Frustum* frustum)
+{
+  visible.resize(x.size());
+
+  if(x.empty() == true)
+  {
+    return 0;
+  }
+
+  return frustum->testSpheres(&x.at(0), &y.at(0), &z.at(0), &radius.at(0), x.size(), &visible.at(0));
+}
+
+/// \brief Check the result of the last cull
+/// \param sphere The index of the sphere in the order added
+/// \return True if the sphere was at least partly inside the frustum
+bool SphereBatch::isVisible(size_t sphere)
+{
+  return visible.at(sphere) != 0;
+}
+
+/// \brief Obtain one of the spheres
+/// \param sphere The index of the sphere in the order added
+/// \param center The three floats to receive the transformed center
+/// \param radius Receives the scaled radius
+void SphereBatch::getSphere(size_t sphere, float* center, float* radius)
+{
+  center[0] = x.at(sphere);
+  center[1] = y.at(sphere);
+  center[2] = z.at(sphere);
+  *radius = this->radius.at(sphere);
+}
+
+}
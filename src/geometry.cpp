@@ -0,0 +1,130 @@
+/*********************************************************************************
+ *
+ * Copyright (c) 2012, Sanguine Laboratories
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *********************************************************************************/
+
+#include <wavefront.h>
+
+namespace Wavefront
+{
+
+/// \brief Obtain the positions of every .obj vertex
+/// \return A pointer to the positions, three floats per vertex
+std::vector<float>* Geometry::getPositions()
+{
+  return &positions;
+}
+
+/// \brief Obtain the texture coordinates of every .obj vertex
+/// \return A pointer to the coordinates, two floats per vertex
+std::vector<float>* Geometry::getCoords()
+{
+  return &coords;
+}
+
+/// \brief Obtain the position indices of every triangle
+/// \return A pointer to the indices, three per triangle
+std::vector<unsigned int>* Geometry::getPositionIndices()
+{
+  return &positionIndices;
+}
+
+/// \brief Obtain the texture coordinate indices of every triangle
+/// \return A pointer to the indices, three per triangle (-1 for none)
+std::vector<int>* Geometry::getCoordIndices()
+{
+  return &coordIndices;
+}
+
+/// \brief Obtain the number of triangles stored
+/// \return The number of faces
+size_t Geometry::getFaceCount()
+{
+  return positionIndices.size() / 3;
+}
+
+/// \brief Obtain the position of one corner of a face
+/// \param face The index of the face
+/// \param corner The corner (0 to 2) of the face
+/// \return A pointer to the x, y and z of the position
+const float* Geometry::getPosition(size_t face, int corner)
+{
+  return &positions[positionIndices[face * 3 + corner] * 3];
+}
+
+/// \brief Obtain the texture coordinate of one corner of a face
+/// \param face The index of the face
+/// \param corner The corner (0 to 2) of the face
+/// \return A pointer to the u and v of the coordinate, or to zeros if the corner has none
+const float* Geometry::getCoord(size_t face, int corner)
+{
+  static const float none[2] = { 0, 0 };
+  int index = coordIndices[face * 3 + corner];
+
+  if(index < 0)
+  {
+    return none;
+  }
+
+  return &coords[index * 2];
+}
+
+/// \brief Build a Face from the stored data
+/// \param face The index of the face
+/// \return A Face containing copies of the positions and texture coordinates
+Face Geometry::getFace(size_t face)
+{
+  Face result;
+  const float* position = NULL;
+  const float* coord = NULL;
+
+  position = getPosition(face, 0);
+  result.setA(Vector3(position[0], position[1], position[2]));
+  position = getPosition(face, 1);
+  result.setB(Vector3(position[0], position[1], position[2]));
+  position = getPosition(face, 2);
+  result.setC(Vector3(position[0], position[1], position[2]));
+
+  coord = getCoord(face, 0);
+  result.setTa(Vector3(coord[0], coord[1], 0));
+  coord = getCoord(face, 1);
+  result.setTb(Vector3(coord[0], coord[1], 0));
+  coord = getCoord(face, 2);
+  result.setTc(Vector3(coord[0], coord[1], 0));
+
+  return result;
+}
+
+/// \brief Obtain the amount of memory used by the stored arrays
+/// \return The size in bytes
+size_t Geometry::getMemoryUsage()
+{
+  return positions.capacity() * sizeof(float) +
+    coords.capacity() * sizeof(float) +
+    positionIndices.capacity() * sizeof(unsigned int) +
+    coordIndices.capacity() * sizeof(int);
+}
+
+}
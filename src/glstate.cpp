@@ -0,0 +1,684 @@
+/*********************************************************************************
+ *
+ * Copyright (c) 2012, Sanguine Laboratories
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *********************************************************************************/
+
+#include <cstring>
+#include <map>
+
+#include <GL/glew.h>
+
+#include <wavefront.h>
+
+namespace Wavefront
+{
+
+namespace
+{
+
+/// \brief The shadowed state of one vertex array pointer
+struct PointerState
+{
+  bool known; ///< False until the pointer has been set through GLState
+  GLuint buffer; ///< The array buffer bound when the pointer was set
+  GLint size; ///< The number of components per vertex
+  GLenum type; ///< The type of each component
+  GLsizei stride; ///< The bytes between consecutive vertices
+  const GLvoid* pointer; ///< The offset into the buffer
+};
+
+/// \brief The state last set through GLState
+struct ShadowState
+{
+  bool textureKnown; ///< False if the bound texture is unknown
+  GLuint texture; ///< The texture bound to GL_TEXTURE_2D
+  bool arrayBufferKnown; ///< False if the bound array buffer is unknown
+  GLuint arrayBuffer; ///< The buffer bound to GL_ARRAY_BUFFER
+  bool elementBufferKnown; ///< False if the bound element buffer is unknown
+  GLuint elementBuffer; ///< The buffer bound to GL_ELEMENT_ARRAY_BUFFER
+  bool programKnown; ///< False if the current program is unknown
+  GLuint program; ///< The program in use
+  bool vertexArrayKnown; ///< False if the bound vertex array object is unknown
+  GLuint vertexArray; ///< The bound vertex array object
+  bool colorKnown; ///< False if the current color is unknown
+  GLfloat color[4]; ///< The current color
+  PointerState vertexPointer; ///< The vertex array pointer
+  PointerState normalPointer; ///< The normal array pointer
+  PointerState coordPointer; ///< The texture coordinate array pointer
+  PointerState colorPointer; ///< The color array pointer
+  std::map<GLenum, bool> enabled; ///< The client states and capabilities known to be enabled or disabled
+  bool debug; ///< Verify elided calls against the real state
+  GLStateStats stats; ///< The counters since resetStats
+};
+
+/// \brief Obtain the shadowed state
+/// \return The single ShadowState of the rendering thread
+ShadowState* getShadow()
+{
+  static ShadowState shadow;
+  static bool initialized = false;
+
+  if(initialized == false)
+  {
+    memset(&shadow.vertexPointer, 0, sizeof(PointerState));
+    memset(&shadow.normalPointer, 0, sizeof(PointerState));
+    memset(&shadow.coordPointer, 0, sizeof(PointerState));
+    memset(&shadow.colorPointer, 0, sizeof(PointerState));
+    shadow.textureKnown = false;
+    shadow.arrayBufferKnown = false;
+    shadow.elementBufferKnown = false;
+    shadow.programKnown = false;
+    shadow.vertexArrayKnown = false;
+    shadow.colorKnown = false;
+    shadow.debug = false;
+    initialized = true;
+  }
+
+  return &shadow;
+}
+
+/// \brief Count an elided call, checking the real state in debug mode
+/// \param matches Evaluated only in debug mode, true if the real state agrees with the shadow
+/// \param argument The expected state passed to matches
+/// \param what A description of the state for the exception message
+void elide(bool (*matches)(const void*), const void* argument, const char* what)
+{
+  ShadowState* shadow = getShadow();
+
+  shadow->stats.elided++;
+
+  // Only OpenGL itself can be queried
+  if(shadow->debug == false || RenderBackend::isDefault() == false)
+  {
+    return;
+  }
+
+  shadow->stats.verified++;
+
+  if(matches(argument) == false)
+  {
+    throw WavefrontException(std::string("GL state changed outside of GLState: ") + what);
+  }
+}
+
+/// \brief Check the real bound texture
+/// \param texture The GLuint expected
+bool textureMatches(const void* texture)
+{
+  GLint actual = 0;
+
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &actual);
+
+  return (GLuint)actual == *(const GLuint*)texture;
+}
+
+/// \brief Check the real bound array buffer
+/// \param buffer The GLuint expected
+bool arrayBufferMatches(const void* buffer)
+{
+  GLint actual = 0;
+
+  glGetIntegerv(GL_ARRAY_BUFFER_BINDING_ARB, &actual);
+
+  return (GLuint)actual == *(const GLuint*)buffer;
+}
+
+/// \brief Check the real bound element buffer
+/// \param buffer The GLuint expected
+bool elementBufferMatches(const void* buffer)
+{
+  GLint actual = 0;
+
+  glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING_ARB, &actual);
+
+  return (GLuint)actual == *(const GLuint*)buffer;
+}
+
+/// \brief Check the real program in use
+/// \param program The GLuint expected
+bool programMatches(const void* program)
+{
+  GLint actual = 0;
+
+  glGetIntegerv(GL_CURRENT_PROGRAM, &actual);
+
+  return (GLuint)actual == *(const GLuint*)program;
+}
+
+/// \brief Check the real bound vertex array object
+/// \param array The GLuint expected
+bool vertexArrayMatches(const void* array)
+{
+  GLint actual = 0;
+
+  glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &actual);
+
+  return (GLuint)actual == *(const GLuint*)array;
+}
+
+/// \brief Forget the state stored in the bound vertex array object
+///
+/// The element buffer binding, client arrays and pointers belong to the
+/// vertex array object, so change with it.
+void forgetVertexArrayState()
+{
+  ShadowState* shadow = getShadow();
+
+  shadow->elementBufferKnown = false;
+  shadow->vertexPointer.known = false;
+  shadow->normalPointer.known = false;
+  shadow->coordPointer.known = false;
+  shadow->colorPointer.known = false;
+  shadow->enabled.erase(GL_VERTEX_ARRAY);
+  shadow->enabled.erase(GL_NORMAL_ARRAY);
+  shadow->enabled.erase(GL_TEXTURE_COORD_ARRAY);
+  shadow->enabled.erase(GL_COLOR_ARRAY);
+}
+
+/// \brief Check whether a client state or capability is really enabled
+/// \param capability A pair of the GLenum and the expected bool
+bool enabledMatches(const void* capability)
+{
+  const std::pair<GLenum, bool>* expected = (const std::pair<GLenum, bool>*)capability;
+
+  return (glIsEnabled(expected->first) == GL_TRUE) == expected->second;
+}
+
+/// \brief Check the real current color
+/// \param color The four GLfloats expected
+bool colorMatches(const void* color)
+{
+  GLfloat actual[4] = { 0 };
+
+  glGetFloatv(GL_CURRENT_COLOR, actual);
+
+  return memcmp(actual, color, sizeof(actual)) == 0;
+}
+
+/// \brief Check a real vertex array pointer
+/// \param pointer A pair of the array GLenum and the expected PointerState
+bool pointerMatches(const void* pointer)
+{
+  const std::pair<GLenum, PointerState>* expected = (const std::pair<GLenum, PointerState>*)pointer;
+  GLenum bindings[4][3] =
+  {
+    { GL_VERTEX_ARRAY, GL_VERTEX_ARRAY_BUFFER_BINDING_ARB, GL_VERTEX_ARRAY_POINTER },
+    { GL_NORMAL_ARRAY, GL_NORMAL_ARRAY_BUFFER_BINDING_ARB, GL_NORMAL_ARRAY_POINTER },
+    { GL_TEXTURE_COORD_ARRAY, GL_TEXTURE_COORD_ARRAY_BUFFER_BINDING_ARB, GL_TEXTURE_COORD_ARRAY_POINTER },
+    { GL_COLOR_ARRAY, GL_COLOR_ARRAY_BUFFER_BINDING_ARB, GL_COLOR_ARRAY_POINTER }
+  };
+  GLint buffer = 0;
+  GLvoid* actual = NULL;
+
+  for(int i = 0; i < 4; i++)
+  {
+    if(bindings[i][0] == expected->first)
+    {
+      glGetIntegerv(bindings[i][1], &buffer);
+      glGetPointerv(bindings[i][2], &actual);
+
+      return (GLuint)buffer == expected->second.buffer && actual == expected->second.pointer;
+    }
+  }
+
+  return false;
+}
+
+/// \brief Set a vertex array pointer unless it is already set
+/// \param array GL_VERTEX_ARRAY, GL_NORMAL_ARRAY, GL_TEXTURE_COORD_ARRAY or GL_COLOR_ARRAY
+/// \param current The shadowed state of the pointer
+/// \param size The number of components per vertex (ignored for normals)
+/// \param type The type of each component
+/// \param stride The bytes between consecutive vertices
+/// \param pointer The offset into the bound array buffer
+void setPointer(GLenum array, PointerState* current, GLint size, GLenum type, GLsizei stride, const GLvoid* pointer)
+{
+  ShadowState* shadow = getShadow();
+  PointerState requested;
+  std::pair<GLenum, PointerState> expected;
+
+  requested.known = true;
+  requested.buffer = shadow->arrayBuffer;
+  requested.size = size;
+  requested.type = type;
+  requested.stride = stride;
+  requested.pointer = pointer;
+
+  if(shadow->arrayBufferKnown == true && current->known == true &&
+    current->buffer == requested.buffer && current->size == size &&
+    current->type == type && current->stride == stride && current->pointer == pointer)
+  {
+    expected = std::make_pair(array, requested);
+    elide(pointerMatches, &expected, "vertex array pointer");
+    return;
+  }
+
+  if(array == GL_VERTEX_ARRAY)
+  {
+    RenderBackend::get()->vertexPointer(size, type, stride, pointer);
+  }
+  else if(array == GL_NORMAL_ARRAY)
+  {
+    RenderBackend::get()->normalPointer(type, stride, pointer);
+  }
+  else if(array == GL_TEXTURE_COORD_ARRAY)
+  {
+    RenderBackend::get()->texCoordPointer(size, type, stride, pointer);
+  }
+  else
+  {
+    RenderBackend::get()->colorPointer(size, type, stride, pointer);
+  }
+
+  // A pointer set while the bound buffer is unknown cannot be compared later
+  requested.known = shadow->arrayBufferKnown;
+  *current = requested;
+  shadow->stats.issued++;
+}
+
+/// \brief Enable or disable a client state or capability unless it already is
+/// \param capability The GLenum to change
+/// \param client True for a client state, false for a capability
+/// \param enable True to enable
+void setEnabled(GLenum capability, bool client, bool enable)
+{
+  ShadowState* shadow = getShadow();
+  std::map<GLenum, bool>::iterator it = shadow->enabled.find(capability);
+  std::pair<GLenum, bool> expected(capability, enable);
+
+  if(it != shadow->enabled.end() && it->second == enable)
+  {
+    elide(enabledMatches, &expected, "enabled state");
+    return;
+  }
+
+  RenderBackend* backend = RenderBackend::get();
+
+  if(client == true && enable == true) { backend->enableClientState(capability); }
+  else if(client == true) { backend->disableClientState(capability); }
+  else if(enable == true) { backend->enable(capability); }
+  else { backend->disable(capability); }
+
+  // Drawing with the color array leaves the current color undefined
+  if(capability == GL_COLOR_ARRAY)
+  {
+    shadow->colorKnown = false;
+  }
+
+  shadow->enabled[capability] = enable;
+  shadow->stats.issued++;
+}
+
+}
+
+/// \brief Default constructor
+GLStateStats::GLStateStats()
+{
+  issued = 0;
+  elided = 0;
+  verified = 0;
+}
+
+/// \brief Bind a texture to GL_TEXTURE_2D unless it is already bound
+/// \param texture The texture name, or 0 to unbind
+void GLState::bindTexture(GLuint texture)
+{
+  ShadowState* shadow = getShadow();
+
+  if(shadow->textureKnown == true && shadow->texture == texture)
+  {
+    elide(textureMatches, &texture, "texture binding");
+    return;
+  }
+
+  RenderBackend::get()->bindTexture(texture);
+  shadow->textureKnown = true;
+  shadow->texture = texture;
+  shadow->stats.issued++;
+}
+
+/// \brief Bind a buffer unless it is already bound
+/// \param target GL_ARRAY_BUFFER_ARB or GL_ELEMENT_ARRAY_BUFFER_ARB
+/// \param buffer The buffer name, or 0 to unbind
+void GLState::bindBuffer(GLenum target, GLuint buffer)
+{
+  ShadowState* shadow = getShadow();
+  bool* known = &shadow->arrayBufferKnown;
+  GLuint* current = &shadow->arrayBuffer;
+
+  if(target == GL_ELEMENT_ARRAY_BUFFER_ARB)
+  {
+    known = &shadow->elementBufferKnown;
+    current = &shadow->elementBuffer;
+  }
+
+  if(*known == true && *current == buffer)
+  {
+    elide(target == GL_ELEMENT_ARRAY_BUFFER_ARB ? elementBufferMatches : arrayBufferMatches,
+      &buffer, "buffer binding");
+    return;
+  }
+
+  RenderBackend::get()->bindBuffer(target, buffer);
+  *known = true;
+  *current = buffer;
+  shadow->stats.issued++;
+}
+
+/// \brief Delete a buffer, forgetting it if it is bound
+/// \param buffer The buffer name
+void GLState::deleteBuffer(GLuint buffer)
+{
+  ShadowState* shadow = getShadow();
+
+  RenderBackend::get()->deleteBuffer(buffer);
+
+  // Deleting a bound buffer binds 0 in its place
+  if(shadow->arrayBuffer == buffer)
+  {
+    shadow->arrayBuffer = 0;
+  }
+
+  if(shadow->elementBuffer == buffer)
+  {
+    shadow->elementBuffer = 0;
+  }
+
+  // A new buffer may be given the same name so pointers into this one are forgotten
+  if(shadow->vertexPointer.buffer == buffer) { shadow->vertexPointer.known = false; }
+  if(shadow->normalPointer.buffer == buffer) { shadow->normalPointer.known = false; }
+  if(shadow->coordPointer.buffer == buffer) { shadow->coordPointer.known = false; }
+  if(shadow->colorPointer.buffer == buffer) { shadow->colorPointer.known = false; }
+}
+
+/// \brief Delete a texture, forgetting it if it is bound
+/// \param texture The texture name
+void GLState::deleteTexture(GLuint texture)
+{
+  ShadowState* shadow = getShadow();
+
+  RenderBackend::get()->deleteTexture(texture);
+
+  if(shadow->texture == texture)
+  {
+    shadow->texture = 0;
+  }
+}
+
+/// \brief Use a shader program unless it is already in use
+/// \param program The program name, or 0 for the fixed function pipeline
+void GLState::useProgram(GLuint program)
+{
+  ShadowState* shadow = getShadow();
+
+  if(shadow->programKnown == true && shadow->program == program)
+  {
+    elide(programMatches, &program, "current program");
+    return;
+  }
+
+  RenderBackend::get()->useProgram(program);
+  shadow->programKnown = true;
+  shadow->program = program;
+  shadow->stats.issued++;
+}
+
+/// \brief Delete a shader program, forgetting it if it is in use
+/// \param program The program name
+///
+/// A program in use is only deleted once it is no longer in use, so the
+/// fixed function pipeline is restored first.
+void GLState::deleteProgram(GLuint program)
+{
+  ShadowState* shadow = getShadow();
+
+  if(shadow->programKnown == true && shadow->program == program)
+  {
+    useProgram(0);
+  }
+
+  RenderBackend::get()->deleteProgram(program);
+}
+
+/// \brief Bind a vertex array object unless it is already bound
+/// \param array The vertex array object name, or 0 to unbind
+void GLState::bindVertexArray(GLuint array)
+{
+  ShadowState* shadow = getShadow();
+
+  if(shadow->vertexArrayKnown == true && shadow->vertexArray == array)
+  {
+    elide(vertexArrayMatches, &array, "vertex array binding");
+    return;
+  }
+
+  RenderBackend::get()->bindVertexArray(array);
+  shadow->vertexArrayKnown = true;
+  shadow->vertexArray = array;
+  shadow->stats.issued++;
+  forgetVertexArrayState();
+}
+
+/// \brief Delete a vertex array object, forgetting it if it is bound
+/// \param array The vertex array object name
+void GLState::deleteVertexArray(GLuint array)
+{
+  ShadowState* shadow = getShadow();
+
+  RenderBackend::get()->deleteVertexArray(array);
+
+  // Deleting the bound vertex array object binds 0 in its place
+  if(shadow->vertexArray == array)
+  {
+    shadow->vertexArray = 0;
+    forgetVertexArrayState();
+  }
+}
+
+/// \brief Enable a client array unless it is already enabled
+/// \param array GL_VERTEX_ARRAY, GL_NORMAL_ARRAY, GL_TEXTURE_COORD_ARRAY or GL_COLOR_ARRAY
+void GLState::enableClientState(GLenum array)
+{
+  setEnabled(array, true, true);
+}
+
+/// \brief Disable a client array unless it is already disabled
+/// \param array GL_VERTEX_ARRAY, GL_NORMAL_ARRAY, GL_TEXTURE_COORD_ARRAY or GL_COLOR_ARRAY
+void GLState::disableClientState(GLenum array)
+{
+  setEnabled(array, true, false);
+}
+
+/// \brief Enable a capability unless it is already enabled
+/// \param capability The capability, such as GL_RESCALE_NORMAL
+void GLState::enable(GLenum capability)
+{
+  setEnabled(capability, false, true);
+}
+
+/// \brief Disable a capability unless it is already disabled
+/// \param capability The capability, such as GL_RESCALE_NORMAL
+void GLState::disable(GLenum capability)
+{
+  setEnabled(capability, false, false);
+}
+
+/// \brief Check whether a capability is enabled
+/// \param capability The capability, such as GL_RESCALE_NORMAL
+/// \return The shadowed value, or the real value if it is not yet known
+bool GLState::isEnabled(GLenum capability)
+{
+  ShadowState* shadow = getShadow();
+  std::map<GLenum, bool>::iterator it = shadow->enabled.find(capability);
+
+  if(it == shadow->enabled.end())
+  {
+    shadow->enabled[capability] = RenderBackend::get()->isEnabled(capability);
+
+    return shadow->enabled[capability];
+  }
+
+  return it->second;
+}
+
+/// \brief Set the vertex position array unless it is already set
+/// \param size The number of components per vertex
+/// \param type The type of each component
+/// \param stride The bytes between consecutive vertices
+/// \param pointer The offset into the bound array buffer
+void GLState::vertexPointer(GLint size, GLenum type, GLsizei stride, const GLvoid* pointer)
+{
+  setPointer(GL_VERTEX_ARRAY, &getShadow()->vertexPointer, size, type, stride, pointer);
+}
+
+/// \brief Set the normal array unless it is already set
+/// \param type The type of each component
+/// \param stride The bytes between consecutive vertices
+/// \param pointer The offset into the bound array buffer
+void GLState::normalPointer(GLenum type, GLsizei stride, const GLvoid* pointer)
+{
+  setPointer(GL_NORMAL_ARRAY, &getShadow()->normalPointer, 3, type, stride, pointer);
+}
+
+/// \brief Set the texture coordinate array unless it is already set
+/// \param size The number of components per vertex
+/// \param type The type of each component
+/// \param stride The bytes between consecutive vertices
+/// \param pointer The offset into the bound array buffer
+void GLState::texCoordPointer(GLint size, GLenum type, GLsizei stride, const GLvoid* pointer)
+{
+  setPointer(GL_TEXTURE_COORD_ARRAY, &getShadow()->coordPointer, size, type, stride, pointer);
+}
+
+/// \brief Set the color array unless it is already set
+/// \param size The number of components per vertex
+/// \param type The type of each component
+/// \param stride The bytes between consecutive vertices
+/// \param pointer The offset into the bound array buffer
+void GLState::colorPointer(GLint size, GLenum type, GLsizei stride, const GLvoid* pointer)
+{
+  setPointer(GL_COLOR_ARRAY, &getShadow()->colorPointer, size, type, stride, pointer);
+}
+
+/// \brief Set the current color unless it is already set
+/// \param red The red component
+/// \param green The green component
+/// \param blue The blue component
+/// \param alpha The alpha component
+void GLState::color(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha)
+{
+  ShadowState* shadow = getShadow();
+  GLfloat requested[4] = { red, green, blue, alpha };
+
+  if(shadow->colorKnown == true && memcmp(shadow->color, requested, sizeof(requested)) == 0)
+  {
+    elide(colorMatches, requested, "current color");
+    return;
+  }
+
+  RenderBackend::get()->color(red, green, blue, alpha);
+  memcpy(shadow->color, requested, sizeof(requested));
+  shadow->colorKnown = true;
+  shadow->stats.issued++;
+}
+
+/// \brief Return the state changed by drawing to what the application expects
+///
+/// Disables the client arrays and unbinds the texture and element buffer,
+/// which is the state MaterialGroup::draw has always left behind. Called once
+/// after a batch of groups rather than after each one. With the CorePipeline
+/// the vertex array object, program and texture are unbound instead.
+void GLState::restore()
+{
+  if(CorePipeline::isEnabled() == true)
+  {
+    bindVertexArray(0);
+    useProgram(0);
+    bindTexture(0);
+    return;
+  }
+
+  disableClientState(GL_TEXTURE_COORD_ARRAY);
+  disableClientState(GL_NORMAL_ARRAY);
+  disableClientState(GL_COLOR_ARRAY);
+  disableClientState(GL_VERTEX_ARRAY);
+  bindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB, 0);
+  bindTexture(0);
+}
+
+/// \brief Forget all shadowed state
+///
+/// Must be called if the application changes any of the tracked state itself,
+/// or the rendering context is recreated.
+void GLState::invalidate()
+{
+  ShadowState* shadow = getShadow();
+
+  shadow->textureKnown = false;
+  shadow->arrayBufferKnown = false;
+  shadow->elementBufferKnown = false;
+  shadow->programKnown = false;
+  shadow->vertexArrayKnown = false;
+  shadow->colorKnown = false;
+  shadow->vertexPointer.known = false;
+  shadow->normalPointer.known = false;
+  shadow->coordPointer.known = false;
+  shadow->colorPointer.known = false;
+  shadow->enabled.clear();
+}
+
+/// \brief Check every elided call against the real state
+/// \param debug True to query OpenGL whenever a call is elided
+///
+/// A WavefrontException is thrown if the real state differs from the shadow,
+/// which means the state was changed without going through GLState. Nothing
+/// is checked while a RenderBackend other than the GLBackend is set.
+void GLState::setDebug(bool debug)
+{
+  getShadow()->debug = debug;
+}
+
+/// \brief Check whether elided calls are being verified
+/// \return True if setDebug(true) was called
+bool GLState::isDebug()
+{
+  return getShadow()->debug;
+}
+
+/// \brief Obtain the counters since the last call to resetStats
+/// \return The GLStateStats
+GLStateStats GLState::getStats()
+{
+  return getShadow()->stats;
+}
+
+/// \brief Reset the counters, typically at the start of each frame
+void GLState::resetStats()
+{
+  getShadow()->stats = GLStateStats();
+}
+
+}
+
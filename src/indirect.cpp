@@ -0,0 +1,381 @@
+/*********************************************************************************
+ *
+ * Copyright (c) 2012, Sanguine Laboratories
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *********************************************************************************/
+
+#include <algorithm>
+#include <tr1/functional>
+
+#include <GL/glew.h>
+
+#include <wavefront.h>
+
+namespace Wavefront
+{
+
+namespace
+{
+
+/// \brief The floats per instance: the modelview matrix, the color and the texture coordinate scale and offset
+const size_t INSTANCE_FLOATS = 24;
+
+/// \brief Transforms each vertex by its command's instance attributes, completed by Shader::getFixedVertexSource
+const char* vertexSource =
+  "attribute mat4 drawMatrix;\n"
+  "attribute vec4 drawColor;\n"
+  "attribute vec4 drawCoords;\n"
+  "varying vec4 color;\n"
+  "varying vec2 coord;\n"
+  "void main()\n"
+  "{\n"
+  "  vec4 position = drawMatrix * gl_Vertex;\n"
+  "  vec3 normal = normalize(mat3(drawMatrix[0].xyz, drawMatrix[1].xyz, drawMatrix[2].xyz) * gl_Normal);\n"
+  "  color = lightVertex(position, normal, drawColor);\n"
+  "  coord = (gl_TextureMatrix[0] * vec4(drawCoords.zw + drawCoords.xy * gl_MultiTexCoord0.xy, 0.0, 1.0)).xy;\n"
+  "  gl_Position = gl_ProjectionMatrix * position;\n"
+  "}\n";
+
+/// \brief Consecutive indirect commands drawn by one call
+struct IndirectRun
+{
+  MaterialGroup* group; ///< The first group, whose arrays every command of the run shares
+  Material* material; ///< The material of the first group, for its texture
+  GLuint texture; ///< The texture of every group of the run, or 0
+  size_t offset; ///< The offset in bytes of the first command within the command buffer
+  GLsizei count; ///< The number of commands
+
+  IndirectRun(const RenderItem& item, size_t offset)
+  {
+    group = item.group;
+    material = item.material;
+    texture = item.texture;
+    this->offset = offset;
+    count = 0;
+  }
+
+  bool contains(const RenderItem& item) const
+  {
+    return item.texture == texture && item.buffer == group->getVertexBuffer() &&
+      item.group->isQuantized() == group->isQuantized() &&
+      item.group->getIndexBuffer() == group->getIndexBuffer() &&
+      item.group->getIndexType() == group->getIndexType();
+  }
+
+};
+
+/// \brief Check whether an item can be drawn by an indirect command
+/// \param item The queued item
+/// \return True if the item's group can
+bool isIndirectItem(const RenderItem& item)
+{
+  return item.group->canDrawIndirect();
+}
+
+/// \brief Order items so that those sharing a texture and buffers form runs, with the items of each group together
+/// \param a The first item
+/// \param b The second item
+/// \return True if a should be drawn before b
+bool compareIndirect(const RenderItem& a, const RenderItem& b)
+{
+  if(a.texture != b.texture)
+  {
+    return a.texture < b.texture;
+  }
+
+  if(a.buffer != b.buffer)
+  {
+    return a.buffer < b.buffer;
+  }
+
+  if(a.group->isQuantized() != b.group->isQuantized())
+  {
+    return a.group->isQuantized() == false;
+  }
+
+  if(a.group->getIndexBuffer() != b.group->getIndexBuffer())
+  {
+    return a.group->getIndexBuffer() < b.group->getIndexBuffer();
+  }
+
+  if(a.group->getIndexType() != b.group->getIndexType())
+  {
+    return a.group->getIndexType() < b.group->getIndexType();
+  }
+
+  if(a.group != b.group)
+  {
+    return a.group < b.group;
+  }
+
+  return a.depth < b.depth;
+}
+
+}
+
+/// \brief Check whether the group can be drawn by an indirect command
+/// \return True if it was uploaded with MODEL_INTERLEAVED or MODEL_QUANTIZED,
+/// whose single vertex stream can be addressed by the index of its first
+/// vertex within the buffer
+bool MaterialGroup::canDrawIndirect()
+{
+  size_t vertexSize = StreamData::INTERLEAVED_VERTEX_SIZE;
+  size_t indexSize = sizeof(GLushort);
+
+  if(vertexRange.buffer == 0 || (interleaved == false && quantized == false))
+  {
+    return false;
+  }
+
+  if(quantized == true)
+  {
+    vertexSize = StreamData::QUANTIZED_VERTEX_SIZE;
+  }
+
+  if(indexType == GL_UNSIGNED_INT)
+  {
+    indexSize = sizeof(GLuint);
+  }
+
+  return vertexRange.offset % vertexSize == 0 && (indexRange.buffer == 0 || indexRange.offset % indexSize == 0);
+}
+
+/// \brief Append the indirect command drawing the group
+/// \param commands The command words, receiving a DrawElementsIndirectCommand
+/// of five words if the group is indexed or a DrawArraysIndirectCommand of four
+/// \param instances The number of instances to draw
+/// \param baseInstance The first instance, selecting the instanced attributes
+///
+/// The arrays must be set by setArrays(true). Requires canDrawIndirect.
+void MaterialGroup::addIndirectCommand(std::vector<GLuint>* commands, GLuint instances, GLuint baseInstance)
+{
+  size_t vertexSize = StreamData::INTERLEAVED_VERTEX_SIZE;
+  size_t indexSize = sizeof(GLushort);
+
+  if(quantized == true)
+  {
+    vertexSize = StreamData::QUANTIZED_VERTEX_SIZE;
+  }
+
+  if(indexType == GL_UNSIGNED_INT)
+  {
+    indexSize = sizeof(GLuint);
+  }
+
+  if(indexRange.buffer != 0)
+  {
+    commands->push_back(stats.indices);
+    commands->push_back(instances);
+    commands->push_back(indexRange.offset / indexSize);
+    commands->push_back(vertexRange.offset / vertexSize);
+    commands->push_back(baseInstance);
+  }
+  else
+  {
+    commands->push_back(faceCount * 3);
+    commands->push_back(instances);
+    commands->push_back(vertexRange.offset / vertexSize);
+    commands->push_back(baseInstance);
+  }
+}
+
+/// \brief Check whether the rendering context can draw a RenderQueue with indirect commands
+/// \return True if OpenGL 4.3, or ARB_multi_draw_indirect and ARB_base_instance,
+/// and ARB_instanced_arrays are available through the GLBackend and the fixed
+/// function pipeline, whose state the shader reads, is selected
+bool RenderQueue::isIndirectSupported()
+{
+  return RenderBackend::isDefault() == true && GLEW_VERSION_2_0 && GLEW_ARB_instanced_arrays &&
+    (GLEW_VERSION_4_3 || (GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance)) &&
+    CorePipeline::isEnabled() == false;
+}
+
+/// \brief Draw the items able to with indirect commands and remove them
+///
+/// Each group becomes one command drawing an instance per item, and the
+/// commands of each run sharing a texture and buffers are drawn by one call.
+/// The groups share few buffers when the BufferArena is enabled, so a scene
+/// takes roughly a call per texture. The instances' matrices, and the color
+/// and texture coordinate scale the fixed function path takes from the
+/// current state, are streamed into one buffer read with a divisor of one.
+void RenderQueue::flushIndirect()
+{
+  std::vector<RenderItem>::iterator end = std::stable_partition(items.begin(), items.end(), isIndirectItem);
+  std::vector<RenderItem>::iterator next;
+  std::vector<IndirectRun> runs;
+  std::vector<GLuint> commands;
+  std::vector<float> instances;
+  MatrixStack matrix;
+  Quantization quantization;
+  Vector3 diffuse;
+  GLuint lastTexture = 0;
+  GLint location = -1;
+  GLint color = -1;
+  GLint coords = -1;
+  GLint textured = -1;
+  bool texturing = false;
+
+  if(end == items.begin())
+  {
+    return;
+  }
+
+  std::sort(items.begin(), end, compareIndirect);
+
+  for(std::vector<RenderItem>::iterator item = items.begin(); item != end; item = next)
+  {
+    for(next = item; next != end && next->group == item->group; next++) { }
+
+    if(runs.size() < 1 || runs.back().contains(*item) == false)
+    {
+      runs.push_back(IndirectRun(*item, commands.size() * sizeof(GLuint)));
+    }
+
+    item->group->addIndirectCommand(&commands, next - item, instances.size() / INSTANCE_FLOATS);
+    runs.back().count++;
+    stats.commands++;
+    quantization = item->group->getQuantization();
+    diffuse = item->material->getDiffuse();
+
+    if(item->group->isQuantized() == false)
+    {
+      quantization.coordScale[0] = 1;
+      quantization.coordScale[1] = 1;
+      quantization.coordCenter[0] = 0;
+      quantization.coordCenter[1] = 0;
+    }
+
+    for(std::vector<RenderItem>::iterator instance = item; instance != next; instance++)
+    {
+      matrix.load(&matrices.at(instance->matrix));
+
+      if(item->group->isQuantized() == true)
+      {
+        matrix.translate(quantization.positionCenter[0], quantization.positionCenter[1], quantization.positionCenter[2]);
+        matrix.scale(quantization.positionScale, quantization.positionScale, quantization.positionScale);
+      }
+
+      instances.insert(instances.end(), matrix.get(), matrix.get() + 16);
+      instances.push_back(diffuse.getX());
+      instances.push_back(diffuse.getY());
+      instances.push_back(diffuse.getZ());
+      instances.push_back(1);
+      instances.push_back(quantization.coordScale[0]);
+      instances.push_back(quantization.coordScale[1]);
+      instances.push_back(quantization.coordCenter[0]);
+      instances.push_back(quantization.coordCenter[1]);
+      stats.items++;
+    }
+  }
+
+  if(shader.get() == NULL)
+  {
+    shader.reset(new Shader(Shader::getFixedVertexSource(vertexSource), Shader::getFixedFragmentSource()));
+  }
+
+  if(commandBuffer == 0)
+  {
+    glGenBuffersARB(1, &commandBuffer);
+    _commandBuffer.reset(&commandBuffer, std::tr1::bind(MaterialGroup::deleteBuffer, commandBuffer));
+    glGenBuffersARB(1, &instanceBuffer);
+    _instanceBuffer.reset(&instanceBuffer, std::tr1::bind(MaterialGroup::deleteBuffer, instanceBuffer));
+  }
+
+  // GLState tracks only the array and element bindings, so the indirect binding is made directly
+  glBindBufferARB(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+  glBufferDataARB(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(GLuint), &commands.at(0), GL_STREAM_DRAW_ARB);
+  GLState::bindBuffer(GL_ARRAY_BUFFER_ARB, instanceBuffer);
+  glBufferDataARB(GL_ARRAY_BUFFER_ARB, instances.size() * sizeof(float), &instances.at(0), GL_STREAM_DRAW_ARB);
+  texturing = GLState::isEnabled(GL_TEXTURE_2D);
+
+  shader->use();
+  glUniform1i(shader->getUniform("diffuseMap"), 0);
+  glUniform1i(shader->getUniform("lighting"), GLState::isEnabled(GL_LIGHTING));
+  textured = shader->getUniform("textured");
+  location = shader->getAttribute("drawMatrix");
+  color = shader->getAttribute("drawColor");
+  coords = shader->getAttribute("drawCoords");
+
+  Shader::enableInstanceMatrix(location);
+  Shader::setInstanceMatrixPointer(location, INSTANCE_FLOATS * sizeof(float), 0);
+  glEnableVertexAttribArray(color);
+  glVertexAttribDivisorARB(color, 1);
+  glVertexAttribPointer(color, 4, GL_FLOAT, GL_FALSE, INSTANCE_FLOATS * sizeof(float), (GLvoid*)(16 * sizeof(float)));
+  glEnableVertexAttribArray(coords);
+  glVertexAttribDivisorARB(coords, 1);
+  glVertexAttribPointer(coords, 4, GL_FLOAT, GL_FALSE, INSTANCE_FLOATS * sizeof(float), (GLvoid*)(20 * sizeof(float)));
+
+  GLState::enableClientState(GL_VERTEX_ARRAY);
+  GLState::enableClientState(GL_NORMAL_ARRAY);
+  GLState::enableClientState(GL_TEXTURE_COORD_ARRAY);
+  GLState::disableClientState(GL_COLOR_ARRAY);
+  stats.stateChanges += 3;
+
+  for(size_t i = 0; i < runs.size(); i++)
+  {
+    if(i == 0 || runs.at(i).texture != lastTexture)
+    {
+      if(runs.at(i).texture != 0)
+      {
+        runs.at(i).material->getTexture()->bind();
+      }
+      else
+      {
+        Texture::unbind();
+      }
+
+      glUniform1i(textured, texturing == true && runs.at(i).texture != 0);
+      lastTexture = runs.at(i).texture;
+      stats.textureBinds++;
+    }
+
+    runs.at(i).group->setArrays(true);
+    stats.arraySetups++;
+
+    if(runs.at(i).group->getIndexBuffer() != 0)
+    {
+      GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB, runs.at(i).group->getIndexBuffer());
+      glMultiDrawElementsIndirect(GL_TRIANGLES, runs.at(i).group->getIndexType(),
+        (const GLvoid*)runs.at(i).offset, runs.at(i).count, 0);
+    }
+    else
+    {
+      glMultiDrawArraysIndirect(GL_TRIANGLES, (const GLvoid*)runs.at(i).offset, runs.at(i).count, 0);
+    }
+
+    stats.draws++;
+  }
+
+  Shader::disableInstanceMatrix(location);
+  glVertexAttribDivisorARB(color, 0);
+  glDisableVertexAttribArray(color);
+  glVertexAttribDivisorARB(coords, 0);
+  glDisableVertexAttribArray(coords);
+  glBindBufferARB(GL_DRAW_INDIRECT_BUFFER, 0);
+  Shader::unuse();
+  GLState::restore();
+  items.erase(items.begin(), end);
+}
+
+}
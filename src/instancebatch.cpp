@@ -0,0 +1,338 @@
+/*********************************************************************************
+ *
+ * Copyright (c) 2012, Sanguine Laboratories
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *********************************************************************************/
+
+#include <cstring>
+#include <tr1/functional>
+
+#include <GL/glew.h>
+
+#include <wavefront.h>
+
+namespace Wavefront
+{
+
+namespace
+{
+
+/// \brief Transforms each vertex by its instance's matrix, completed by Shader::getFixedVertexSource
+const char* vertexSource =
+  "attribute mat4 instanceMatrix;\n"
+  "uniform mat4 groupMatrix;\n"
+  "varying vec4 color;\n"
+  "varying vec2 coord;\n"
+  "void main()\n"
+  "{\n"
+  "  vec4 position = instanceMatrix * groupMatrix * gl_Vertex;\n"
+  "  vec3 normal = normalize(mat3(instanceMatrix[0].xyz, instanceMatrix[1].xyz, instanceMatrix[2].xyz) * gl_Normal);\n"
+  "  color = lightVertex(position, normal, gl_Color);\n"
+  "  coord = (gl_TextureMatrix[0] * gl_MultiTexCoord0).xy;\n"
+  "  gl_Position = gl_ProjectionMatrix * position;\n"
+  "}\n";
+
+/// \brief Build the matrix restoring a group's quantized positions
+/// \param group The MaterialGroup to draw
+/// \param matrix The 16 floats to receive the matrix, the identity unless the group is quantized
+void getGroupMatrix(MaterialGroup* group, float* matrix)
+{
+  Quantization quantization = group->getQuantization();
+  float scale = 1;
+
+  memset(matrix, 0, 16 * sizeof(float));
+
+  if(group->isQuantized() == true)
+  {
+    scale = quantization.positionScale;
+    matrix[12] = quantization.positionCenter[0];
+    matrix[13] = quantization.positionCenter[1];
+    matrix[14] = quantization.positionCenter[2];
+  }
+
+  matrix[0] = scale;
+  matrix[5] = scale;
+  matrix[10] = scale;
+  matrix[15] = 1;
+}
+
+}
+
+/// \brief Default constructor
+InstanceStats::InstanceStats()
+{
+  instances = 0;
+  draws = 0;
+  bytes = 0;
+  instanced = false;
+}
+
+/// \brief Check whether the rendering context can draw instances in one call
+/// \return True if OpenGL 2.0, ARB_draw_instanced and ARB_instanced_arrays are
+/// available through the GLBackend and the fixed function pipeline, whose state
+/// the shader reads, is selected
+bool InstanceBatch::isSupported()
+{
+  return RenderBackend::isDefault() == true && GLEW_VERSION_2_0 && GLEW_ARB_draw_instanced &&
+    GLEW_ARB_instanced_arrays && CorePipeline::isEnabled() == false;
+}
+
+/// \brief Constructor
+/// \param model The Model every instance added must be drawing
+InstanceBatch::InstanceBatch(Model* model)
+{
+  this->model = model;
+  instances = 0;
+  instanceBuffer = 0;
+}
+
+/// \brief Add an instance to be drawn with the current modelview matrix
+/// \param instance The AnimatedModel, which must use the batch's Model
+void InstanceBatch::add(AnimatedModel* instance)
+{
+  float matrix[16] = { 0 };
+
+  CorePipeline::getCurrentMatrix(matrix);
+  add(instance, matrix);
+}
+
+/// \brief Add an instance to be drawn with the specified modelview matrix
+/// \param instance The AnimatedModel, which must use the batch's Model
+/// \param matrix The 16 floats of the column-major modelview matrix
+///
+/// The animation state is captured now, so the instance may be updated
+/// again before draw is called.
+void InstanceBatch::add(AnimatedModel* instance, const float* matrix)
+{
+  size_t parts = model->getParts()->size();
+
+  if(instance->getModel() != model)
+  {
+    throw WavefrontException("The AnimatedModel does not use the Model of the InstanceBatch");
+  }
+
+  matrices.resize(parts);
+
+  for(size_t p = 0; p < parts; p++)
+  {
+    matrices.at(p).resize((instances + 1) * 16);
+    instance->getPartMatrix(p, matrix, &matrices.at(p).at(instances * 16));
+  }
+
+  instances++;
+}
+
+/// \brief Draw and remove every instance
+///
+/// Each MaterialGroup is drawn once for all of the instances. The matrices
+/// of every part of every instance are streamed into a single buffer which
+/// the built in shader reads with a divisor of one. The texture matrix and
+/// the state tracked by GLState are restored afterwards.
+void InstanceBatch::draw()
+{
+  std::vector<std::tr1::shared_ptr<Part> >* parts = model->getParts();
+  std::vector<std::tr1::shared_ptr<MaterialGroup> >* groups = NULL;
+  MaterialGroup* group = NULL;
+  size_t partSize = instances * 16 * sizeof(float);
+  float groupMatrix[16] = { 0 };
+  GLint location = -1;
+  GLint textured = -1;
+  GLint groupLocation = -1;
+  bool texturing = false;
+
+  stats = InstanceStats();
+  stats.instances = instances;
+
+  if(instances < 1)
+  {
+    clear();
+    return;
+  }
+
+  model->upload();
+
+  if(isSupported() == false)
+  {
+    drawSeparately();
+    clear();
+    return;
+  }
+
+  if(shader.get() == NULL)
+  {
+    shader.reset(new Shader(Shader::getFixedVertexSource(vertexSource), Shader::getFixedFragmentSource()));
+  }
+
+  if(instanceBuffer == 0)
+  {
+    glGenBuffersARB(1, &instanceBuffer);
+    _instanceBuffer.reset(&instanceBuffer, std::tr1::bind(MaterialGroup::deleteBuffer, instanceBuffer));
+  }
+
+  // Orphan the last batch's data so the driver need not wait for it to be drawn
+  GLState::bindBuffer(GL_ARRAY_BUFFER_ARB, instanceBuffer);
+  glBufferDataARB(GL_ARRAY_BUFFER_ARB, parts->size() * partSize, NULL, GL_STREAM_DRAW_ARB);
+
+  for(size_t p = 0; p < parts->size(); p++)
+  {
+    glBufferSubDataARB(GL_ARRAY_BUFFER_ARB, p * partSize, partSize, &matrices.at(p).at(0));
+  }
+
+  stats.bytes = parts->size() * partSize;
+  stats.instanced = true;
+  texturing = GLState::isEnabled(GL_TEXTURE_2D);
+
+  shader->use();
+  glUniform1i(shader->getUniform("diffuseMap"), 0);
+  glUniform1i(shader->getUniform("lighting"), GLState::isEnabled(GL_LIGHTING));
+  location = shader->getAttribute("instanceMatrix");
+  textured = shader->getUniform("textured");
+  groupLocation = shader->getUniform("groupMatrix");
+
+  Shader::enableInstanceMatrix(location);
+
+  for(size_t p = 0; p < parts->size(); p++)
+  {
+    groups = parts->at(p)->getMaterialGroups();
+    GLState::bindBuffer(GL_ARRAY_BUFFER_ARB, instanceBuffer);
+
+    Shader::setInstanceMatrixPointer(location, 16 * sizeof(float), p * partSize);
+
+    for(size_t g = 0; g < groups->size(); g++)
+    {
+      group = groups->at(g).get();
+
+      GLState::enableClientState(GL_VERTEX_ARRAY);
+      GLState::enableClientState(GL_NORMAL_ARRAY);
+      GLState::enableClientState(GL_TEXTURE_COORD_ARRAY);
+
+      if(group->usesColorArray() == true)
+      {
+        GLState::enableClientState(GL_COLOR_ARRAY);
+      }
+      else
+      {
+        GLState::disableClientState(GL_COLOR_ARRAY);
+      }
+
+      if(group->getMaterial()->getTexture() != NULL)
+      {
+        group->getMaterial()->getTexture()->bind();
+      }
+      else
+      {
+        Texture::unbind();
+      }
+
+      glUniform1i(textured, texturing == true && group->getMaterial()->getTexture() != NULL);
+      getGroupMatrix(group, groupMatrix);
+      glUniformMatrix4fv(groupLocation, 1, GL_FALSE, groupMatrix);
+
+      if(group->isQuantized() == true)
+      {
+        glMatrixMode(GL_TEXTURE);
+        glPushMatrix();
+        group->transformCoords();
+        glMatrixMode(GL_MODELVIEW);
+      }
+
+      group->setArrays();
+      group->drawInstanced(instances);
+      stats.draws++;
+
+      if(group->isQuantized() == true)
+      {
+        glMatrixMode(GL_TEXTURE);
+        glPopMatrix();
+        glMatrixMode(GL_MODELVIEW);
+      }
+    }
+  }
+
+  Shader::disableInstanceMatrix(location);
+
+  Shader::unuse();
+  GLState::restore();
+  clear();
+}
+
+/// \brief Draw every instance with its own draw calls where instancing is unsupported
+void InstanceBatch::drawSeparately()
+{
+  std::vector<std::tr1::shared_ptr<Part> >* parts = model->getParts();
+  MatrixStack* modelview = CorePipeline::getModelview();
+
+  for(size_t i = 0; i < instances; i++)
+  {
+    for(size_t p = 0; p < parts->size(); p++)
+    {
+      if(CorePipeline::isEnabled() == true)
+      {
+        modelview->push();
+        modelview->load(&matrices.at(p).at(i * 16));
+        parts->at(p)->render();
+        modelview->pop();
+      }
+      else
+      {
+        RenderBackend::get()->pushMatrix();
+        RenderBackend::get()->loadMatrix(&matrices.at(p).at(i * 16));
+        parts->at(p)->render();
+        RenderBackend::get()->popMatrix();
+      }
+
+      stats.draws += parts->at(p)->getMaterialGroups()->size();
+    }
+  }
+
+  GLState::restore();
+}
+
+/// \brief Remove every instance without drawing
+void InstanceBatch::clear()
+{
+  for(size_t p = 0; p < matrices.size(); p++)
+  {
+    matrices.at(p).clear();
+  }
+
+  instances = 0;
+}
+
+/// \brief Obtain the number of instances waiting to be drawn
+/// \return The number of instances added since the last draw or clear
+size_t InstanceBatch::getSize()
+{
+  return instances;
+}
+
+/// \brief Obtain the work done by the last draw
+/// \return The InstanceStats
+InstanceStats InstanceBatch::getStats()
+{
+  return stats;
+}
+
+}
+
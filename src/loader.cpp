@@ -0,0 +1,525 @@
+/*********************************************************************************
+ *
+ * Copyright (c) 2012, Sanguine Laboratories
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *********************************************************************************/
+
+#include <tr1/functional>
+
+#include <unistd.h>
+
+#include <wavefront.h>
+
+namespace Wavefront
+{
+
+/// \brief Constructor
+/// \param path The path of the PNG image to decode
+ImageRequest::ImageRequest(std::string path)
+{
+  this->path = path;
+  done = false;
+  pthread_mutex_init(&mutex, NULL);
+  pthread_cond_init(&condition, NULL);
+}
+
+/// \brief Destructor
+ImageRequest::~ImageRequest()
+{
+  pthread_cond_destroy(&condition);
+  pthread_mutex_destroy(&mutex);
+}
+
+/// \brief Decode the image and wake any threads waiting for it
+///
+/// A failure is stored rather than thrown so it can be reported by getImage
+/// on the waiting thread.
+void ImageRequest::decode()
+{
+  std::tr1::shared_ptr<Image> result;
+  std::string message;
+
+  try
+  {
+    result.reset(new Image(path));
+  }
+  catch(std::exception& e)
+  {
+    message = e.what();
+  }
+
+  pthread_mutex_lock(&mutex);
+  image = result;
+  error = message;
+  done = true;
+  pthread_cond_broadcast(&condition);
+  pthread_mutex_unlock(&mutex);
+}
+
+/// \brief Obtain the path of the image being decoded
+/// \return The path passed to ImageDecoder::decode
+std::string ImageRequest::getPath()
+{
+  return path;
+}
+
+/// \brief Check whether decoding has finished
+/// \return True once getImage will not block
+bool ImageRequest::isDone()
+{
+  bool result = false;
+
+  pthread_mutex_lock(&mutex);
+  result = done;
+  pthread_mutex_unlock(&mutex);
+
+  return result;
+}
+
+/// \brief Wait for the image to be decoded
+/// \return The decoded image
+///
+/// Throws a WavefrontException if the image could not be decoded.
+std::tr1::shared_ptr<Image> ImageRequest::getImage()
+{
+  std::tr1::shared_ptr<Image> result;
+  std::string message;
+
+  pthread_mutex_lock(&mutex);
+
+  while(done == false)
+  {
+    pthread_cond_wait(&condition, &mutex);
+  }
+
+  result = image;
+  message = error;
+  pthread_mutex_unlock(&mutex);
+
+  if(result.get() == NULL)
+  {
+    throw WavefrontException(message);
+  }
+
+  return result;
+}
+
+/// \brief Constructor
+///
+/// No threads are started until an image is queued.
+ImageDecoder::ImageDecoder()
+{
+  long processors = sysconf(_SC_NPROCESSORS_ONLN);
+
+  running = 0;
+  maxThreads = processors < 1 ? 1 : processors;
+  pthread_mutex_init(&mutex, NULL);
+}
+
+/// \brief Destructor
+///
+/// Waits for every queued image to be decoded.
+ImageDecoder::~ImageDecoder()
+{
+  for(int i = 0; i < threads.size(); i++)
+  {
+    pthread_join(threads.at(i), NULL);
+  }
+
+  pthread_mutex_destroy(&mutex);
+}
+
+/// \brief Thread entry point for the worker threads
+/// \param decoder The ImageDecoder owning the thread
+void* ImageDecoder::workerThread(void* decoder)
+{
+  ((ImageDecoder*)decoder)->work();
+
+  return NULL;
+}
+
+/// \brief Decode queued images until the queue is empty
+void ImageDecoder::work()
+{
+  std::tr1::shared_ptr<ImageRequest> request;
+
+  while(true)
+  {
+    pthread_mutex_lock(&mutex);
+
+    if(queue.size() < 1)
+    {
+      running--;
+      pthread_mutex_unlock(&mutex);
+      return;
+    }
+
+    request = queue.front();
+    queue.pop_front();
+    pthread_mutex_unlock(&mutex);
+
+    request->decode();
+    request.reset();
+  }
+}
+
+/// \brief Queue an image to be decoded
+/// \param path The path of the PNG image to decode
+/// \return The handle through which to wait for the image
+///
+/// If no thread can be started the image is decoded on the calling thread.
+std::tr1::shared_ptr<ImageRequest> ImageDecoder::decode(std::string path)
+{
+  std::tr1::shared_ptr<ImageRequest> request(new ImageRequest(path));
+  pthread_t thread;
+  bool started = false;
+
+  pthread_mutex_lock(&mutex);
+  queue.push_back(request);
+
+  if(running >= maxThreads)
+  {
+    pthread_mutex_unlock(&mutex);
+    return request;
+  }
+
+  running++;
+
+  if(pthread_create(&thread, NULL, ImageDecoder::workerThread, this) == 0)
+  {
+    threads.push_back(thread);
+    started = true;
+  }
+
+  pthread_mutex_unlock(&mutex);
+
+  // Take the place of the thread which could not be started
+  if(started == false)
+  {
+    work();
+  }
+
+  return request;
+}
+
+/// \brief Destroy the mutex of a ModelRequest
+/// \param mutex The mutex to destroy
+void ModelRequest::destroyMutex(pthread_mutex_t* mutex)
+{
+  pthread_mutex_destroy(mutex);
+}
+
+/// \brief Constructor
+/// \param path The path of the .obj model to load
+/// \param flags The ModelFlags to load the model with
+ModelRequest::ModelRequest(std::string path, int flags)
+{
+  this->path = path;
+  this->flags = flags;
+  state = LOAD_QUEUED;
+  pthread_mutex_init(&mutex, NULL);
+  _mutex.reset(&mutex, std::tr1::bind(ModelRequest::destroyMutex, &mutex));
+}
+
+/// \brief Move the request on to the specified state
+/// \param state The new state
+void ModelRequest::setState(LoadState state)
+{
+  pthread_mutex_lock(&mutex);
+  this->state = state;
+  pthread_mutex_unlock(&mutex);
+}
+
+/// \brief Obtain how far the load has progressed
+/// \return The current LoadState
+LoadState ModelRequest::getState()
+{
+  LoadState result;
+
+  pthread_mutex_lock(&mutex);
+  result = state;
+  pthread_mutex_unlock(&mutex);
+
+  return result;
+}
+
+/// \brief Check whether the model can be drawn
+/// \return True once the state is LOAD_READY
+bool ModelRequest::isReady()
+{
+  return getState() == LOAD_READY;
+}
+
+/// \brief Obtain the path of the model being loaded
+/// \return The path passed to ModelLoader::load
+std::string ModelRequest::getPath()
+{
+  return path;
+}
+
+/// \brief Obtain the reason the load failed
+/// \return The message of the exception thrown while loading, or an empty string
+std::string ModelRequest::getError()
+{
+  std::string result;
+
+  pthread_mutex_lock(&mutex);
+  result = error;
+  pthread_mutex_unlock(&mutex);
+
+  return result;
+}
+
+/// \brief Obtain the loaded model
+/// \return The Model, or NULL if the state is not yet LOAD_READY
+Model* ModelRequest::getModel()
+{
+  return getSharedModel().get();
+}
+
+/// \brief Obtain the loaded model so that it may outlive the request
+/// \return The Model, or an empty pointer if the state is not yet LOAD_READY
+std::tr1::shared_ptr<Model> ModelRequest::getSharedModel()
+{
+  if(isReady() == false)
+  {
+    return std::tr1::shared_ptr<Model>();
+  }
+
+  return model;
+}
+
+/// \brief Constructor
+/// \param threadCount The number of worker threads to start
+ModelLoader::ModelLoader(int threadCount)
+{
+  pthread_t thread;
+
+  stopping = false;
+  loading = 0;
+  pthread_mutex_init(&mutex, NULL);
+  pthread_cond_init(&condition, NULL);
+
+  for(int i = 0; i < threadCount; i++)
+  {
+    if(pthread_create(&thread, NULL, ModelLoader::workerThread, this) == 0)
+    {
+      threads.push_back(thread);
+    }
+  }
+
+  if(threads.size() < 1)
+  {
+    pthread_cond_destroy(&condition);
+    pthread_mutex_destroy(&mutex);
+    throw WavefrontException("Failed to start a model loading thread");
+  }
+}
+
+/// \brief Destructor
+///
+/// Waits for the models currently being parsed. Requests which have not
+/// started, and parsed requests which were never uploaded by update, are
+/// marked as failed.
+ModelLoader::~ModelLoader()
+{
+  pthread_mutex_lock(&mutex);
+  stopping = true;
+  pthread_cond_broadcast(&condition);
+  pthread_mutex_unlock(&mutex);
+
+  for(int i = 0; i < threads.size(); i++)
+  {
+    pthread_join(threads.at(i), NULL);
+  }
+
+  // The workers have stopped, so uploads now includes every model they finished
+  queue.insert(queue.end(), uploads.begin(), uploads.end());
+  uploads.clear();
+
+  for(int i = 0; i < queue.size(); i++)
+  {
+    pthread_mutex_lock(&queue.at(i)->mutex);
+    queue.at(i)->error = "The loader was destroyed";
+    queue.at(i)->state = LOAD_FAILED;
+    pthread_mutex_unlock(&queue.at(i)->mutex);
+  }
+
+  pthread_cond_destroy(&condition);
+  pthread_mutex_destroy(&mutex);
+}
+
+/// \brief Thread entry point for the worker threads
+/// \param loader The ModelLoader owning the thread
+void* ModelLoader::workerThread(void* loader)
+{
+  ((ModelLoader*)loader)->work();
+
+  return NULL;
+}
+
+/// \brief Parse queued requests until the loader is destroyed
+///
+/// Exceptions thrown while loading are caught and reported through the
+/// request rather than ending the thread.
+void ModelLoader::work()
+{
+  std::tr1::shared_ptr<ModelRequest> request;
+
+  while(true)
+  {
+    pthread_mutex_lock(&mutex);
+
+    while(queue.size() < 1 && stopping == false)
+    {
+      pthread_cond_wait(&condition, &mutex);
+    }
+
+    if(stopping == true)
+    {
+      pthread_mutex_unlock(&mutex);
+      return;
+    }
+
+    request = queue.front();
+    queue.pop_front();
+    loading++;
+    pthread_mutex_unlock(&mutex);
+
+    request->setState(LOAD_LOADING);
+
+    try
+    {
+      request->data.reset(new ModelData(request->path, request->flags));
+    }
+    catch(std::exception& e)
+    {
+      pthread_mutex_lock(&request->mutex);
+      request->error = e.what();
+      request->state = LOAD_FAILED;
+      pthread_mutex_unlock(&request->mutex);
+      pthread_mutex_lock(&mutex);
+      loading--;
+      pthread_mutex_unlock(&mutex);
+      request.reset();
+      continue;
+    }
+
+    request->setState(LOAD_UPLOADING);
+    pthread_mutex_lock(&mutex);
+    uploads.push_back(request);
+    loading--;
+    pthread_mutex_unlock(&mutex);
+    request.reset();
+  }
+}
+
+/// \brief Queue a model to be loaded in the background
+/// \param path The path of the .obj model to load
+/// \param flags A combination of ModelFlags
+/// \return The handle through which to follow the load and obtain the Model
+std::tr1::shared_ptr<ModelRequest> ModelLoader::load(std::string path, int flags)
+{
+  std::tr1::shared_ptr<ModelRequest> request(new ModelRequest(path, flags));
+
+  pthread_mutex_lock(&mutex);
+  queue.push_back(request);
+  pthread_cond_signal(&condition);
+  pthread_mutex_unlock(&mutex);
+
+  return request;
+}
+
+/// \brief Send parsed models to the graphics card
+/// \param seconds The time which may be spent uploading, or a negative value for no limit
+/// \return True if no parsed model is left waiting to be uploaded
+///
+/// Must be called on the thread owning the rendering context, typically once
+/// per frame. Models are uploaded in the order they finished parsing and a
+/// model too large for one call is continued on the next.
+bool ModelLoader::update(double seconds)
+{
+  std::tr1::shared_ptr<ModelRequest> request;
+  double start = Util::getTime();
+  double remaining = seconds;
+  bool done = false;
+
+  while(true)
+  {
+    pthread_mutex_lock(&mutex);
+
+    if(uploads.size() < 1)
+    {
+      pthread_mutex_unlock(&mutex);
+      return true;
+    }
+
+    request = uploads.front();
+    pthread_mutex_unlock(&mutex);
+
+    if(request->model.get() == NULL)
+    {
+      request->model.reset(new Model(request->data));
+      request->data.reset();
+    }
+
+    if(request->model->upload(remaining) == true)
+    {
+      request->setState(LOAD_READY);
+      pthread_mutex_lock(&mutex);
+      uploads.pop_front();
+      pthread_mutex_unlock(&mutex);
+    }
+
+    if(seconds >= 0)
+    {
+      remaining = seconds - (Util::getTime() - start);
+
+      if(remaining <= 0)
+      {
+        pthread_mutex_lock(&mutex);
+        done = uploads.size() < 1;
+        pthread_mutex_unlock(&mutex);
+
+        return done;
+      }
+    }
+  }
+}
+
+/// \brief Obtain the number of requests which are not yet ready or failed
+/// \return The number of requests queued, being parsed or waiting to be uploaded
+size_t ModelLoader::getPendingCount()
+{
+  size_t result = 0;
+
+  pthread_mutex_lock(&mutex);
+  result = queue.size() + loading + uploads.size();
+  pthread_mutex_unlock(&mutex);
+
+  return result;
+}
+
+}
+
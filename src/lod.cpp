@@ -0,0 +1,806 @@
+/*********************************************************************************
+ *
+ * Copyright (c) 2012, Sanguine Laboratories
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *********************************************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+#include <GL/glew.h>
+
+#include <wavefront.h>
+
+namespace Wavefront
+{
+
+namespace
+{
+
+/// \brief The area weighted sum of squared distances to the planes of a set of triangles
+struct Quadric
+{
+  double terms[10]; ///< The upper triangle of the symmetric 4x4 matrix, row by row
+  double weight; ///< The total area of the triangles added
+
+};
+
+/// \brief A candidate edge collapse moving one vertex onto another
+struct Collapse
+{
+  double cost; ///< The mean squared distance of the merged quadric at the kept vertex
+  unsigned int from; ///< The vertex removed
+  unsigned int to; ///< The vertex kept
+
+  bool operator<(const Collapse& other) const
+  {
+    return cost < other.cost;
+  }
+
+};
+
+/// \brief The triangles of a MaterialGroup being simplified
+struct Mesh
+{
+  std::vector<const float*> points; ///< The position of each vertex
+  std::vector<unsigned int> positions; ///< The index of each vertex's position within the Geometry
+  std::vector<Quadric> quadrics; ///< The quadric of each vertex
+  std::vector<unsigned char> seams; ///< 1 for each vertex with more than one texture coordinate
+  std::vector<unsigned int> triangles; ///< Three vertices per triangle
+  std::vector<int> coords; ///< The texture coordinate index of each corner
+  std::vector<unsigned char> removed; ///< 1 for each triangle collapsed during the current pass
+  double error; ///< The largest cost of any collapse performed
+
+};
+
+/// \brief Calculate the cross product of two edges of a triangle
+/// \param a The first corner
+/// \param b The second corner
+/// \param c The third corner
+/// \param normal The three doubles to receive the unnormalized normal
+void triangleNormal(const float* a, const float* b, const float* c, double* normal)
+{
+  double u[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+  double v[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+
+  normal[0] = u[1] * v[2] - u[2] * v[1];
+  normal[1] = u[2] * v[0] - u[0] * v[2];
+  normal[2] = u[0] * v[1] - u[1] * v[0];
+}
+
+/// \brief Add the plane of a triangle to a quadric
+/// \param quadric The quadric to add to
+/// \param a The first corner
+/// \param b The second corner
+/// \param c The third corner
+void addTriangle(Quadric* quadric, const float* a, const float* b, const float* c)
+{
+  double normal[3] = { 0 };
+  double length = 0;
+  double plane[4] = { 0 };
+  double area = 0;
+  int term = 0;
+
+  triangleNormal(a, b, c, normal);
+  length = sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+
+  if(length <= 0)
+  {
+    return;
+  }
+
+  plane[0] = normal[0] / length;
+  plane[1] = normal[1] / length;
+  plane[2] = normal[2] / length;
+  plane[3] = -(plane[0] * a[0] + plane[1] * a[1] + plane[2] * a[2]);
+  area = length / 2;
+
+  for(int row = 0; row < 4; row++)
+  {
+    for(int column = row; column < 4; column++)
+    {
+      quadric->terms[term] += plane[row] * plane[column] * area;
+      term++;
+    }
+  }
+
+  quadric->weight += area;
+}
+
+/// \brief Add the plane through a border edge at right angles to its triangle to a quadric
+/// \param quadric The quadric to add to
+/// \param a The first end of the edge
+/// \param b The second end of the edge
+/// \param normal The unnormalized normal of the triangle using the edge
+///
+/// Without it, vertices on an open border could slide away from it at no cost.
+void addBorder(Quadric* quadric, const float* a, const float* b, const double* normal)
+{
+  double edge[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+  double plane[4] = { 0 };
+  double length = 0;
+  double weight = edge[0] * edge[0] + edge[1] * edge[1] + edge[2] * edge[2];
+  int term = 0;
+
+  plane[0] = edge[1] * normal[2] - edge[2] * normal[1];
+  plane[1] = edge[2] * normal[0] - edge[0] * normal[2];
+  plane[2] = edge[0] * normal[1] - edge[1] * normal[0];
+  length = sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+
+  if(length <= 0)
+  {
+    return;
+  }
+
+  plane[0] /= length;
+  plane[1] /= length;
+  plane[2] /= length;
+  plane[3] = -(plane[0] * a[0] + plane[1] * a[1] + plane[2] * a[2]);
+
+  for(int row = 0; row < 4; row++)
+  {
+    for(int column = row; column < 4; column++)
+    {
+      quadric->terms[term] += plane[row] * plane[column] * weight;
+      term++;
+    }
+  }
+
+  quadric->weight += weight;
+}
+
+/// \brief Add one quadric to another
+/// \param quadric The quadric to add to
+/// \param other The quadric to add
+void addQuadric(Quadric* quadric, const Quadric& other)
+{
+  for(int i = 0; i < 10; i++)
+  {
+    quadric->terms[i] += other.terms[i];
+  }
+
+  quadric->weight += other.weight;
+}
+
+/// \brief Calculate the mean squared distance from a point to the planes of a quadric
+/// \param quadric The quadric
+/// \param point The x, y and z of the point
+/// \return The area weighted mean of the squared distances
+double evaluate(const Quadric& quadric, const float* point)
+{
+  const double* t = quadric.terms;
+  double x = point[0];
+  double y = point[1];
+  double z = point[2];
+  double result = 0;
+
+  if(quadric.weight <= 0)
+  {
+    return 0;
+  }
+
+  result = t[0] * x * x + 2 * t[1] * x * y + 2 * t[2] * x * z + 2 * t[3] * x +
+           t[4] * y * y + 2 * t[5] * y * z + 2 * t[6] * y +
+           t[7] * z * z + 2 * t[8] * z + t[9];
+
+  return std::max(result, 0.0) / quadric.weight;
+}
+
+/// \brief Check whether a vertex may be collapsed onto a neighbour
+/// \param mesh The mesh
+/// \param borders 1 for each vertex on an edge used by a single triangle
+/// \param locked 1 for each vertex on an edge used by more than two triangles
+/// \param from The vertex to remove
+/// \param to The vertex to keep
+/// \param uses The number of triangles using the edge between them
+/// \return True if the collapse keeps seams, borders and non-manifold edges in place
+bool canCollapse(Mesh* mesh, std::vector<unsigned char>& borders,
+  std::vector<unsigned char>& locked, unsigned int from, unsigned int to, size_t uses)
+{
+  if(mesh->seams.at(from) != 0 || locked.at(from) != 0)
+  {
+    return false;
+  }
+
+  // A border vertex may only slide along the border
+  if(borders.at(from) != 0 && (uses != 1 || borders.at(to) == 0))
+  {
+    return false;
+  }
+
+  return true;
+}
+
+/// \brief Collapse the cheapest edges not sharing a vertex with an earlier collapse of the pass
+/// \param mesh The mesh, with removed set for every triangle collapsed
+/// \param live The number of triangles in the mesh
+/// \param target The number of triangles to stop at
+/// \return The number of triangles removed
+size_t collapsePass(Mesh* mesh, size_t live, size_t target)
+{
+  size_t vertexCount = mesh->points.size();
+  size_t triangleCount = mesh->triangles.size() / 3;
+  std::vector<size_t> offsets(vertexCount + 1, 0);
+  std::vector<size_t> cursors;
+  std::vector<unsigned int> adjacency(triangleCount * 3);
+  std::vector<std::pair<unsigned int, unsigned int> > edges;
+  std::vector<unsigned char> borders(vertexCount, 0);
+  std::vector<unsigned char> locked(vertexCount, 0);
+  std::vector<unsigned char> touched(vertexCount, 0);
+  std::vector<Collapse> collapses;
+  std::vector<unsigned int> fromNeighbours;
+  std::vector<unsigned int> toNeighbours;
+  std::vector<unsigned int> common;
+  Collapse collapse;
+  Collapse reverse;
+  Quadric merged;
+  size_t removed = 0;
+  size_t end = 0;
+
+  for(size_t i = 0; i < mesh->triangles.size(); i++)
+  {
+    offsets.at(mesh->triangles.at(i) + 1)++;
+  }
+
+  for(size_t i = 0; i < vertexCount; i++)
+  {
+    offsets.at(i + 1) += offsets.at(i);
+  }
+
+  cursors.assign(offsets.begin(), offsets.end() - 1);
+
+  for(size_t i = 0; i < mesh->triangles.size(); i++)
+  {
+    adjacency.at(cursors.at(mesh->triangles.at(i))++) = i / 3;
+  }
+
+  for(size_t t = 0; t < triangleCount; t++)
+  {
+    for(int c = 0; c < 3; c++)
+    {
+      unsigned int a = mesh->triangles.at(t * 3 + c);
+      unsigned int b = mesh->triangles.at(t * 3 + (c + 1) % 3);
+
+      edges.push_back(std::make_pair(std::min(a, b), std::max(a, b)));
+    }
+  }
+
+  std::sort(edges.begin(), edges.end());
+
+  for(size_t i = 0; i < edges.size(); i = end)
+  {
+    for(end = i + 1; end < edges.size() && edges.at(end) == edges.at(i); end++) { }
+
+    if(end - i == 1)
+    {
+      borders.at(edges.at(i).first) = 1;
+      borders.at(edges.at(i).second) = 1;
+    }
+    else if(end - i > 2)
+    {
+      locked.at(edges.at(i).first) = 1;
+      locked.at(edges.at(i).second) = 1;
+    }
+  }
+
+  for(size_t i = 0; i < edges.size(); i = end)
+  {
+    unsigned int a = edges.at(i).first;
+    unsigned int b = edges.at(i).second;
+
+    for(end = i + 1; end < edges.size() && edges.at(end) == edges.at(i); end++) { }
+
+    merged = mesh->quadrics.at(a);
+    addQuadric(&merged, mesh->quadrics.at(b));
+    collapse.from = a;
+    collapse.to = b;
+    collapse.cost = evaluate(merged, mesh->points.at(b));
+    reverse.from = b;
+    reverse.to = a;
+    reverse.cost = evaluate(merged, mesh->points.at(a));
+
+    if(canCollapse(mesh, borders, locked, a, b, end - i) == false)
+    {
+      collapse.cost = -1;
+    }
+
+    if(canCollapse(mesh, borders, locked, b, a, end - i) == true &&
+      (collapse.cost < 0 || reverse.cost < collapse.cost))
+    {
+      collapse = reverse;
+    }
+
+    if(collapse.cost >= 0)
+    {
+      collapses.push_back(collapse);
+    }
+  }
+
+  std::sort(collapses.begin(), collapses.end());
+
+  for(size_t i = 0; i < collapses.size() && live - removed > target; i++)
+  {
+    unsigned int from = collapses.at(i).from;
+    unsigned int to = collapses.at(i).to;
+    int coord = -2;
+    size_t shared = 0;
+    bool valid = true;
+
+    if(touched.at(from) != 0 || touched.at(to) != 0)
+    {
+      continue;
+    }
+
+    fromNeighbours.clear();
+    toNeighbours.clear();
+
+    // Faces across the edge must agree on the coordinate the removed vertex takes
+    for(size_t a = offsets.at(from); a < offsets.at(from + 1); a++)
+    {
+      size_t t = adjacency.at(a);
+
+      if(mesh->removed.at(t) != 0)
+      {
+        continue;
+      }
+
+      for(int c = 0; c < 3; c++)
+      {
+        if(mesh->triangles.at(t * 3 + c) == to)
+        {
+          if(coord != -2 && coord != mesh->coords.at(t * 3 + c))
+          {
+            valid = false;
+          }
+
+          coord = mesh->coords.at(t * 3 + c);
+          shared++;
+        }
+
+        if(mesh->triangles.at(t * 3 + c) != from)
+        {
+          fromNeighbours.push_back(mesh->triangles.at(t * 3 + c));
+        }
+      }
+    }
+
+    if(valid == false || shared == 0)
+    {
+      continue;
+    }
+
+    // The vertices may share no neighbours but the corners of the faces across the edge
+    for(size_t a = offsets.at(to); a < offsets.at(to + 1); a++)
+    {
+      size_t t = adjacency.at(a);
+
+      if(mesh->removed.at(t) != 0)
+      {
+        continue;
+      }
+
+      for(int c = 0; c < 3; c++)
+      {
+        if(mesh->triangles.at(t * 3 + c) != to)
+        {
+          toNeighbours.push_back(mesh->triangles.at(t * 3 + c));
+        }
+      }
+    }
+
+    std::sort(fromNeighbours.begin(), fromNeighbours.end());
+    fromNeighbours.erase(std::unique(fromNeighbours.begin(), fromNeighbours.end()), fromNeighbours.end());
+    std::sort(toNeighbours.begin(), toNeighbours.end());
+    toNeighbours.erase(std::unique(toNeighbours.begin(), toNeighbours.end()), toNeighbours.end());
+    common.clear();
+    std::set_intersection(fromNeighbours.begin(), fromNeighbours.end(),
+      toNeighbours.begin(), toNeighbours.end(), std::back_inserter(common));
+
+    if(common.size() != shared)
+    {
+      continue;
+    }
+
+    // Moving the vertex must not turn any remaining face over
+    for(size_t a = offsets.at(from); a < offsets.at(from + 1) && valid == true; a++)
+    {
+      size_t t = adjacency.at(a);
+      const float* before[3] = { 0 };
+      const float* after[3] = { 0 };
+      double oldNormal[3] = { 0 };
+      double newNormal[3] = { 0 };
+      bool adjacent = false;
+
+      if(mesh->removed.at(t) != 0)
+      {
+        continue;
+      }
+
+      for(int c = 0; c < 3; c++)
+      {
+        before[c] = mesh->points.at(mesh->triangles.at(t * 3 + c));
+        after[c] = before[c];
+
+        if(mesh->triangles.at(t * 3 + c) == from)
+        {
+          after[c] = mesh->points.at(to);
+        }
+        else if(mesh->triangles.at(t * 3 + c) == to)
+        {
+          adjacent = true;
+        }
+      }
+
+      if(adjacent == true)
+      {
+        continue;
+      }
+
+      triangleNormal(before[0], before[1], before[2], oldNormal);
+      triangleNormal(after[0], after[1], after[2], newNormal);
+
+      // Turning a face by more than about 75 degrees risks folding it over in a later pass
+      if(oldNormal[0] * newNormal[0] + oldNormal[1] * newNormal[1] + oldNormal[2] * newNormal[2] <=
+        0.25 * sqrt((oldNormal[0] * oldNormal[0] + oldNormal[1] * oldNormal[1] + oldNormal[2] * oldNormal[2]) *
+        (newNormal[0] * newNormal[0] + newNormal[1] * newNormal[1] + newNormal[2] * newNormal[2])))
+      {
+        valid = false;
+      }
+    }
+
+    if(valid == false)
+    {
+      continue;
+    }
+
+    for(size_t a = offsets.at(from); a < offsets.at(from + 1); a++)
+    {
+      size_t t = adjacency.at(a);
+      bool adjacent = false;
+
+      if(mesh->removed.at(t) != 0)
+      {
+        continue;
+      }
+
+      for(int c = 0; c < 3; c++)
+      {
+        if(mesh->triangles.at(t * 3 + c) == to)
+        {
+          adjacent = true;
+        }
+      }
+
+      if(adjacent == true)
+      {
+        mesh->removed.at(t) = 1;
+        removed++;
+        continue;
+      }
+
+      for(int c = 0; c < 3; c++)
+      {
+        if(mesh->triangles.at(t * 3 + c) == from)
+        {
+          mesh->triangles.at(t * 3 + c) = to;
+          mesh->coords.at(t * 3 + c) = coord;
+        }
+      }
+    }
+
+    addQuadric(&mesh->quadrics.at(to), mesh->quadrics.at(from));
+    mesh->error = std::max(mesh->error, collapses.at(i).cost);
+    touched.at(from) = 1;
+    touched.at(to) = 1;
+  }
+
+  return removed;
+}
+
+/// \brief Remove the triangles collapsed by the last pass
+/// \param mesh The mesh to compact
+void compact(Mesh* mesh)
+{
+  size_t kept = 0;
+
+  for(size_t t = 0; t < mesh->removed.size(); t++)
+  {
+    if(mesh->removed.at(t) != 0)
+    {
+      continue;
+    }
+
+    for(int c = 0; c < 3; c++)
+    {
+      mesh->triangles.at(kept * 3 + c) = mesh->triangles.at(t * 3 + c);
+      mesh->coords.at(kept * 3 + c) = mesh->coords.at(t * 3 + c);
+    }
+
+    kept++;
+  }
+
+  mesh->triangles.resize(kept * 3);
+  mesh->coords.resize(kept * 3);
+  mesh->removed.assign(kept, 0);
+}
+
+}
+
+/// \brief Default constructor
+LevelStats::LevelStats()
+{
+  triangles = 0;
+  error = 0;
+}
+
+/// \brief Default constructor
+///
+/// Until setProjection is called the projection is assumed to have a 90 degree
+/// vertical field of view.
+LodSelector::LodSelector()
+{
+  scale = 1;
+  orthographic = false;
+  counts.push_back(0);
+}
+
+/// \brief Specify the projection the parts are drawn with
+/// \param projection The column-major projection matrix
+void LodSelector::setProjection(const float* projection)
+{
+  scale = projection[5];
+  orthographic = projection[11] == 0;
+}
+
+/// \brief Add the next level of detail
+/// \param height The fraction of the viewport height below which the level is used
+void LodSelector::addLevel(float height)
+{
+  heights.push_back(height);
+  counts.push_back(0);
+}
+
+/// \brief Obtain the number of levels chosen between, including the original triangles
+/// \return One more than the number of levels added
+size_t LodSelector::getLevelCount()
+{
+  return heights.size() + 1;
+}
+
+/// \brief Choose the level of detail of a bounding sphere
+/// \param center The eye space center of the sphere
+/// \param radius The eye space radius of the sphere
+/// \return 0 for the original triangles, otherwise the number of levels whose height the sphere is below
+///
+/// Spheres reaching the eye are always drawn with the original triangles.
+size_t LodSelector::select(const float* center, float radius)
+{
+  float depth = -center[2];
+  float height = radius * scale;
+  size_t level = 0;
+
+  if(orthographic == false)
+  {
+    if(depth <= radius)
+    {
+      counts.at(0)++;
+
+      return 0;
+    }
+
+    height /= depth;
+  }
+
+  for(size_t i = 0; i < heights.size(); i++)
+  {
+    if(height < heights.at(i))
+    {
+      level++;
+    }
+  }
+
+  counts.at(level)++;
+
+  return level;
+}
+
+/// \brief Obtain the number of times a level was selected
+/// \param level The level of detail
+/// \return The number of spheres given the level since resetStats
+size_t LodSelector::getCount(size_t level)
+{
+  return counts.at(level);
+}
+
+/// \brief Set the selection counts back to zero
+void LodSelector::resetStats()
+{
+  counts.assign(counts.size(), 0);
+}
+
+/// \brief Generate simplified versions of the group's faces
+/// \param levels The most levels of detail to generate
+/// \param ratio The fraction of the previous level's triangles each level aims for
+///
+/// Vertices are collapsed onto their neighbours in order of the quadric error
+/// metric, reusing the existing positions and texture coordinates so each
+/// level is only a new set of faces appended to the Geometry. Vertices on a
+/// texture seam, on an open border (except along it) or on a non-manifold edge
+/// are never removed and collapses which would fold a face over are skipped.
+/// Fewer levels are generated if the faces cannot be simplified far enough.
+/// The levels cannot be generated again, as their faces are already in the Geometry.
+void MaterialGroup::simplify(size_t levels, float ratio)
+{
+  Mesh mesh;
+  std::vector<int> firstCoords;
+  std::vector<std::pair<std::pair<unsigned int, unsigned int>, size_t> > edges;
+  std::vector<unsigned int>* positionIndices = geometry == NULL ? NULL : geometry->getPositionIndices();
+  std::vector<int>* coordIndices = geometry == NULL ? NULL : geometry->getCoordIndices();
+  std::tr1::shared_ptr<MaterialGroup> level;
+  Quadric empty = { { 0 }, 0 };
+  double target = 0;
+  size_t previous = 0;
+  size_t first = 0;
+
+  if(ratio <= 0 || ratio >= 1)
+  {
+    throw WavefrontException("The ratio between levels of detail must be between 0 and 1");
+  }
+
+  if(this->levels.empty() == false)
+  {
+    throw WavefrontException("Levels of detail have already been generated");
+  }
+
+  if(faceCount == 0)
+  {
+    return;
+  }
+
+  mesh.positions.assign(positionIndices->begin() + firstFace * 3,
+    positionIndices->begin() + (firstFace + faceCount) * 3);
+  std::sort(mesh.positions.begin(), mesh.positions.end());
+  mesh.positions.erase(std::unique(mesh.positions.begin(), mesh.positions.end()), mesh.positions.end());
+
+  for(size_t i = 0; i < mesh.positions.size(); i++)
+  {
+    mesh.points.push_back(&geometry->getPositions()->at(mesh.positions.at(i) * 3));
+  }
+
+  mesh.quadrics.assign(mesh.positions.size(), empty);
+  mesh.seams.assign(mesh.positions.size(), 0);
+  firstCoords.assign(mesh.positions.size(), -2);
+  mesh.error = 0;
+
+  for(size_t f = firstFace; f < firstFace + faceCount; f++)
+  {
+    unsigned int vertices[3] = { 0 };
+
+    for(int c = 0; c < 3; c++)
+    {
+      vertices[c] = std::lower_bound(mesh.positions.begin(), mesh.positions.end(),
+        positionIndices->at(f * 3 + c)) - mesh.positions.begin();
+    }
+
+    if(vertices[0] == vertices[1] || vertices[1] == vertices[2] || vertices[0] == vertices[2])
+    {
+      continue;
+    }
+
+    for(int c = 0; c < 3; c++)
+    {
+      int coord = coordIndices->at(f * 3 + c);
+
+      if(firstCoords.at(vertices[c]) == -2)
+      {
+        firstCoords.at(vertices[c]) = coord;
+      }
+      else if(firstCoords.at(vertices[c]) != coord)
+      {
+        mesh.seams.at(vertices[c]) = 1;
+      }
+
+      mesh.triangles.push_back(vertices[c]);
+      mesh.coords.push_back(coord);
+      addTriangle(&mesh.quadrics.at(vertices[c]), mesh.points.at(vertices[0]),
+        mesh.points.at(vertices[1]), mesh.points.at(vertices[2]));
+    }
+  }
+
+  for(size_t t = 0; t < mesh.triangles.size() / 3; t++)
+  {
+    for(int c = 0; c < 3; c++)
+    {
+      unsigned int a = mesh.triangles.at(t * 3 + c);
+      unsigned int b = mesh.triangles.at(t * 3 + (c + 1) % 3);
+
+      edges.push_back(std::make_pair(std::make_pair(std::min(a, b), std::max(a, b)), t));
+    }
+  }
+
+  std::sort(edges.begin(), edges.end());
+
+  for(size_t i = 0; i < edges.size(); i++)
+  {
+    if((i > 0 && edges.at(i - 1).first == edges.at(i).first) ||
+      (i + 1 < edges.size() && edges.at(i + 1).first == edges.at(i).first))
+    {
+      continue;
+    }
+
+    size_t t = edges.at(i).second;
+    double normal[3] = { 0 };
+    const float* a = mesh.points.at(edges.at(i).first.first);
+    const float* b = mesh.points.at(edges.at(i).first.second);
+
+    triangleNormal(mesh.points.at(mesh.triangles.at(t * 3)), mesh.points.at(mesh.triangles.at(t * 3 + 1)),
+      mesh.points.at(mesh.triangles.at(t * 3 + 2)), normal);
+    addBorder(&mesh.quadrics.at(edges.at(i).first.first), a, b, normal);
+    addBorder(&mesh.quadrics.at(edges.at(i).first.second), a, b, normal);
+  }
+
+  mesh.removed.assign(mesh.triangles.size() / 3, 0);
+  previous = mesh.triangles.size() / 3;
+  target = previous;
+
+  for(size_t l = 0; l < levels; l++)
+  {
+    target *= ratio;
+
+    while(mesh.triangles.size() / 3 > (size_t)target)
+    {
+      size_t removed = collapsePass(&mesh, mesh.triangles.size() / 3, (size_t)target);
+
+      compact(&mesh);
+
+      if(removed == 0)
+      {
+        break;
+      }
+    }
+
+    if(mesh.triangles.size() / 3 >= previous)
+    {
+      break;
+    }
+
+    first = geometry->getFaceCount();
+
+    for(size_t i = 0; i < mesh.triangles.size(); i++)
+    {
+      positionIndices->push_back(mesh.positions.at(mesh.triangles.at(i)));
+      coordIndices->push_back(mesh.coords.at(i));
+    }
+
+    level.reset(new MaterialGroup());
+    level->setMaterial(material);
+    level->addFaces(geometry, first, mesh.triangles.size() / 3);
+    level->error = sqrt(mesh.error);
+    this->levels.push_back(level);
+    previous = mesh.triangles.size() / 3;
+  }
+}
+
+}
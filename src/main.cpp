@@ -13,6 +13,7 @@ int currentWidth = 0;
 int currentHeight = 0;
 double deltaTime = 0;
 float rotation = 0;
+bool core = false;
 
 std::auto_ptr<Wavefront::Model> modelData;
 std::auto_ptr<Wavefront::Animation> runAnimation;
@@ -35,6 +36,23 @@ void display()
 {
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+  if(core == true)
+  {
+    Wavefront::MatrixStack* modelview = Wavefront::CorePipeline::getModelview();
+
+    modelview->loadIdentity();
+    modelview->translate(0, 0, -10);
+    modelview->rotate(rotation, 0, 1, 0);
+    glEnable(GL_DEPTH_TEST);
+    model->draw();
+    glDisable(GL_DEPTH_TEST);
+
+    glutSwapBuffers();
+    frameCount++;
+
+    return;
+  }
+
   glLoadIdentity();
   glPushMatrix();
   glTranslatef(0, 0, -10);
@@ -56,6 +74,15 @@ void resize(int width, int height)
   currentWidth = width;
   currentHeight = height;
   glViewport(0, 0, currentWidth, currentHeight);
+
+  if(core == true)
+  {
+    Wavefront::CorePipeline::getProjection()->loadIdentity();
+    Wavefront::CorePipeline::getProjection()->perspective(60, (GLfloat)width / (GLfloat)height, 0.1, 100.0);
+
+    return;
+  }
+
   glMatrixMode(GL_PROJECTION);
   glLoadIdentity();
   gluPerspective(60, (GLfloat)width / (GLfloat)height, 0.1, 100.0);
@@ -77,15 +104,125 @@ void timer(int tick)
   glutTimerFunc(250, timer, 0);
 }
 
+void benchmark()
+{
+  Wavefront::NullBackend backend;
+  Wavefront::BackendStats stats;
+  Wavefront::ArenaStats arena;
+  double start = 0;
+  int frames = 1000;
+
+  Wavefront::RenderBackend::set(&backend);
+
+  modelData.reset(new Wavefront::Model("curuthers/curuthers.obj"));
+  model.reset(new Wavefront::AnimatedModel(modelData.get()));
+  runAnimation.reset(new Wavefront::Animation("curuthers/run.anm"));
+  runAnimation->interpolate(2, true);
+  model->addAnimation(runAnimation.get());
+  modelData->upload();
+  backend.resetStats();
+  start = Wavefront::Util::getTime();
+
+  for(int i = 0; i < frames; i++)
+  {
+    model->update(1);
+    model->draw();
+  }
+
+  stats = backend.getStats();
+
+  std::cout << "Frames: " << frames
+            << " Time: " << Wavefront::Util::getTime() - start
+            << " Calls: " << stats.total / frames
+            << " Draws: " << stats.commands[Wavefront::COMMAND_DRAW] / frames
+            << " Elements: " << stats.elements / frames << std::endl;
+
+  if(Wavefront::BufferArena::isEnabled() == true)
+  {
+    arena = Wavefront::BufferArena::getStats();
+
+    std::cout << "Blocks: " << arena.blocks
+              << " Ranges: " << arena.ranges
+              << " Used: " << arena.used << " / " << arena.capacity << std::endl;
+  }
+
+  Wavefront::RenderBackend::set(NULL);
+}
+
+void lodReport()
+{
+  Wavefront::ModelData data("curuthers/curuthers.obj", Wavefront::MODEL_LOD);
+  std::vector<Wavefront::LevelStats> levels = data.getLevelStats();
+
+  for(size_t i = 0; i < levels.size(); i++)
+  {
+    std::cout << "Level: " << i
+              << " Triangles: " << levels.at(i).triangles
+              << " Error: " << levels.at(i).error << std::endl;
+  }
+}
+
+void optimizeReport()
+{
+  Wavefront::ModelData data("curuthers/curuthers.obj", Wavefront::MODEL_INDEXED | Wavefront::MODEL_SMOOTH_NORMALS | Wavefront::MODEL_OPTIMIZED);
+  Wavefront::VertexCacheStats total;
+  Wavefront::VertexCacheStats stats;
+
+  for(size_t i = 0; i < data.getParts()->size(); i++)
+  {
+    stats = data.getParts()->at(i)->getVertexCacheStats();
+    total.add(stats);
+
+    std::cout << data.getParts()->at(i)->getName()
+              << " ACMR: " << stats.getAcmrBefore() << " -> " << stats.getAcmrAfter()
+              << " ATVR: " << stats.getAtvrBefore() << " -> " << stats.getAtvrAfter() << std::endl;
+  }
+
+  std::cout << "Total ACMR: " << total.getAcmrBefore() << " -> " << total.getAcmrAfter()
+            << " ATVR: " << total.getAtvrBefore() << " -> " << total.getAtvrAfter() << std::endl;
+}
+
 void safe_main(int argc, char* argv[])
 {
   int result = 0;
 
+  for(int i = 1; i < argc; i++)
+  {
+    if(std::string(argv[i]) == "--core")
+    {
+      core = true;
+    }
+    else if(std::string(argv[i]) == "--arena")
+    {
+      Wavefront::BufferArena::setEnabled(true);
+    }
+    else if(std::string(argv[i]) == "--null")
+    {
+      benchmark();
+      return;
+    }
+    else if(std::string(argv[i]) == "--lod")
+    {
+      lodReport();
+      return;
+    }
+    else if(std::string(argv[i]) == "--optimize")
+    {
+      optimizeReport();
+      return;
+    }
+  }
+
   glutInit(&argc, argv);
- 
-  //glutInitContextVersion(4, 0);
-  //glutInitContextFlags(GLUT_FORWARD_COMPATIBLE);
-  //glutInitContextProfile(GLUT_CORE_PROFILE);
+
+  if(core == true)
+  {
+    glutInitContextVersion(3, 3);
+    glutInitContextFlags(GLUT_FORWARD_COMPATIBLE);
+    glutInitContextProfile(GLUT_CORE_PROFILE);
+    Wavefront::CorePipeline::setEnabled(true);
+    glewExperimental = GL_TRUE;
+  }
 
   glutSetOption(
     GLUT_ACTION_ON_WINDOW_CLOSE,
@@ -0,0 +1,343 @@
+/*********************************************************************************
+ *
+ * Copyright (c) 2012, Sanguine Laboratories
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *********************************************************************************/
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <tr1/functional>
+
+#include <GL/glew.h>
+
+#include <wavefront.h>
+
+namespace Wavefront
+{
+
+namespace
+{
+
+/// \brief The bytes per merged vertex: the interleaved position, normal and texture coordinate followed by the part index
+const size_t PALETTE_VERTEX_SIZE = StreamData::INTERLEAVED_VERTEX_SIZE + sizeof(float);
+
+/// \brief Selects each vertex's part matrix from the palette, completed by Shader::getFixedVertexSource
+const char* vertexSource =
+  "attribute float part;\n"
+  "uniform mat4 palette[PALETTE_SIZE];\n"
+  "varying vec4 color;\n"
+  "varying vec2 coord;\n"
+  "void main()\n"
+  "{\n"
+  "  mat4 matrix = palette[int(part)];\n"
+  "  vec4 position = matrix * gl_Vertex;\n"
+  "  vec3 normal = normalize(mat3(matrix[0].xyz, matrix[1].xyz, matrix[2].xyz) * gl_Normal);\n"
+  "  color = lightVertex(position, normal, gl_Color);\n"
+  "  coord = (gl_TextureMatrix[0] * gl_MultiTexCoord0).xy;\n"
+  "  gl_Position = gl_ProjectionMatrix * position;\n"
+  "}\n";
+
+/// \brief The uniform components kept free for the built in uniforms the shader reads
+const GLint RESERVED_COMPONENTS = 128;
+
+}
+
+/// \brief Default constructor
+PaletteBatch::PaletteBatch()
+{
+  material = NULL;
+  firstPart = 0;
+  partCount = 0;
+  vertexBuffer = 0;
+  indexBuffer = 0;
+  indexType = GL_UNSIGNED_SHORT;
+  vertexCount = 0;
+  indexCount = 0;
+}
+
+/// \brief Check whether the rendering context can draw with a matrix palette
+/// \return True if OpenGL 2.0 is available through the GLBackend and the fixed
+/// function pipeline, whose state the shader reads, is selected
+bool MatrixPalette::isSupported()
+{
+  return RenderBackend::isDefault() == true && GLEW_VERSION_2_0 && CorePipeline::isEnabled() == false;
+}
+
+/// \brief Constructor
+/// \param model The uploaded Model to merge the parts of
+///
+/// Merges the parts into PaletteBatches and sends them to the graphics card,
+/// so a rendering context must be current.
+MatrixPalette::MatrixPalette(Model* model)
+{
+  GLint components = 0;
+  size_t parts = model->getParts()->size();
+  std::string source = vertexSource;
+  std::stringstream size;
+
+  this->model = model;
+
+  // Each part matrix takes 16 of the vertex shader's uniform components
+  glGetIntegerv(GL_MAX_VERTEX_UNIFORM_COMPONENTS, &components);
+  paletteSize = std::max<GLint>(1, (components - RESERVED_COMPONENTS) / 16);
+  paletteSize = std::min(paletteSize, std::max<size_t>(1, parts));
+
+  for(size_t first = 0; first < parts; first += paletteSize)
+  {
+    build(first, std::min(paletteSize, parts - first));
+  }
+
+  size << paletteSize;
+  source.replace(source.find("PALETTE_SIZE"), strlen("PALETTE_SIZE"), size.str());
+  shader.reset(new Shader(Shader::getFixedVertexSource(source), Shader::getFixedFragmentSource()));
+}
+
+/// \brief Merge the MaterialGroups of a range of parts into a batch per material
+/// \param first The index of the first part
+/// \param count The number of parts, no more than the palette size
+///
+/// Each group is rebuilt from the Geometry with the Model's MODEL_INDEXED and
+/// MODEL_SMOOTH_NORMALS flags into the interleaved layout, and every vertex is
+/// given the index of its part within the range.
+void MatrixPalette::build(size_t first, size_t count)
+{
+  std::vector<Material*> materials;
+  std::vector<std::tr1::shared_ptr<MaterialGroup> >* groups = NULL;
+  int flags = (model->getData()->getFlags() & (MODEL_INDEXED | MODEL_SMOOTH_NORMALS)) | MODEL_INTERLEAVED;
+
+  for(size_t p = first; p < first + count; p++)
+  {
+    groups = model->getParts()->at(p)->getMaterialGroups();
+
+    for(size_t g = 0; g < groups->size(); g++)
+    {
+      if(std::find(materials.begin(), materials.end(), groups->at(g)->getMaterial()) == materials.end())
+      {
+        materials.push_back(groups->at(g)->getMaterial());
+      }
+    }
+  }
+
+  for(size_t m = 0; m < materials.size(); m++)
+  {
+    std::tr1::shared_ptr<PaletteBatch> batch(new PaletteBatch());
+    std::vector<float> vertices;
+    std::vector<unsigned int> indices;
+
+    for(size_t p = first; p < first + count; p++)
+    {
+      groups = model->getParts()->at(p)->getMaterialGroups();
+
+      for(size_t g = 0; g < groups->size(); g++)
+      {
+        MaterialGroup* group = groups->at(g).get();
+        MaterialGroup merged;
+        StreamData streams;
+        size_t base = vertices.size() / 9;
+
+        if(group->getMaterial() != materials.at(m) || group->getFaceCount() < 1)
+        {
+          continue;
+        }
+
+        merged.setMaterial(group->getMaterial());
+        merged.addFaces(group->getGeometry(), group->getFirstFace(), group->getFaceCount());
+        merged.build(flags);
+        streams = merged.getStreams();
+
+        for(size_t v = 0; v < streams.vertexCount; v++)
+        {
+          vertices.insert(vertices.end(), streams.interleaved + v * 8, streams.interleaved + v * 8 + 8);
+          vertices.push_back(p - first);
+        }
+
+        for(size_t i = 0; i < streams.indexCount; i++)
+        {
+          if(streams.indexType == GL_UNSIGNED_SHORT)
+          {
+            indices.push_back(base + ((const unsigned short*)streams.indices)[i]);
+          }
+          else
+          {
+            indices.push_back(base + ((const unsigned int*)streams.indices)[i]);
+          }
+        }
+      }
+    }
+
+    if(vertices.size() < 1)
+    {
+      continue;
+    }
+
+    batch->material = materials.at(m);
+    batch->firstPart = first;
+    batch->partCount = count;
+    batch->vertexCount = vertices.size() / 9;
+    batch->indexCount = indices.size();
+
+    glGenBuffersARB(1, &batch->vertexBuffer);
+    batch->_vertexBuffer.reset(&batch->vertexBuffer, std::tr1::bind(MaterialGroup::deleteBuffer, batch->vertexBuffer));
+    GLState::bindBuffer(GL_ARRAY_BUFFER_ARB, batch->vertexBuffer);
+    glBufferDataARB(GL_ARRAY_BUFFER_ARB, vertices.size() * sizeof(float), &vertices[0], GL_STATIC_DRAW_ARB);
+
+    if(indices.size() > 0)
+    {
+      std::vector<unsigned short> shortIndices;
+
+      glGenBuffersARB(1, &batch->indexBuffer);
+      batch->_indexBuffer.reset(&batch->indexBuffer, std::tr1::bind(MaterialGroup::deleteBuffer, batch->indexBuffer));
+      GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB, batch->indexBuffer);
+
+      if(batch->vertexCount <= 65536)
+      {
+        shortIndices.assign(indices.begin(), indices.end());
+        batch->indexType = GL_UNSIGNED_SHORT;
+        glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER_ARB, shortIndices.size() * sizeof(unsigned short), &shortIndices[0], GL_STATIC_DRAW_ARB);
+      }
+      else
+      {
+        batch->indexType = GL_UNSIGNED_INT;
+        glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER_ARB, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW_ARB);
+      }
+
+      GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB, 0);
+    }
+
+    batches.push_back(batch);
+  }
+}
+
+/// \brief Draw an instance with the current modelview matrix
+/// \param instance The AnimatedModel, which must use the palette's Model
+void MatrixPalette::draw(AnimatedModel* instance)
+{
+  float matrix[16] = { 0 };
+
+  CorePipeline::getCurrentMatrix(matrix);
+  draw(instance, matrix);
+}
+
+/// \brief Draw an instance with a draw call per batch
+/// \param instance The AnimatedModel, which must use the palette's Model
+/// \param matrix The 16 floats of the column-major modelview matrix
+///
+/// The matrix of every part is calculated on the CPU and each range of parts
+/// is sent to the shader once, however many materials it contains.
+void MatrixPalette::draw(AnimatedModel* instance, const float* matrix)
+{
+  std::vector<std::tr1::shared_ptr<Part> >* parts = model->getParts();
+  PaletteBatch* batch = NULL;
+  GLint partLocation = -1;
+  GLint paletteLocation = -1;
+  GLint textured = -1;
+  bool texturing = GLState::isEnabled(GL_TEXTURE_2D);
+  size_t lastPart = (size_t)-1;
+
+  if(instance->getModel() != model)
+  {
+    throw WavefrontException("The AnimatedModel does not use the Model of the MatrixPalette");
+  }
+
+  matrices.resize(parts->size() * 16);
+
+  for(size_t p = 0; p < parts->size(); p++)
+  {
+    instance->getPartMatrix(p, matrix, &matrices.at(p * 16));
+  }
+
+  shader->use();
+  glUniform1i(shader->getUniform("diffuseMap"), 0);
+  glUniform1i(shader->getUniform("lighting"), GLState::isEnabled(GL_LIGHTING));
+  partLocation = shader->getAttribute("part");
+  paletteLocation = shader->getUniform("palette");
+  textured = shader->getUniform("textured");
+
+  GLState::enableClientState(GL_VERTEX_ARRAY);
+  GLState::enableClientState(GL_NORMAL_ARRAY);
+  GLState::enableClientState(GL_TEXTURE_COORD_ARRAY);
+  GLState::disableClientState(GL_COLOR_ARRAY);
+  glEnableVertexAttribArray(partLocation);
+
+  for(size_t b = 0; b < batches.size(); b++)
+  {
+    batch = batches.at(b).get();
+
+    if(batch->firstPart != lastPart)
+    {
+      glUniformMatrix4fv(paletteLocation, batch->partCount, GL_FALSE, &matrices.at(batch->firstPart * 16));
+      lastPart = batch->firstPart;
+    }
+
+    if(batch->material->getTexture() != NULL)
+    {
+      batch->material->getTexture()->bind();
+    }
+    else
+    {
+      Texture::unbind();
+    }
+
+    glUniform1i(textured, texturing == true && batch->material->getTexture() != NULL);
+    GLState::color(batch->material->getDiffuse().getX(), batch->material->getDiffuse().getY(), batch->material->getDiffuse().getZ(), 1);
+
+    GLState::bindBuffer(GL_ARRAY_BUFFER_ARB, batch->vertexBuffer);
+    GLState::vertexPointer(3, GL_FLOAT, PALETTE_VERTEX_SIZE, NULL);
+    GLState::normalPointer(GL_FLOAT, PALETTE_VERTEX_SIZE, (GLvoid*)(3 * sizeof(float)));
+    GLState::texCoordPointer(2, GL_FLOAT, PALETTE_VERTEX_SIZE, (GLvoid*)(6 * sizeof(float)));
+    glVertexAttribPointer(partLocation, 1, GL_FLOAT, GL_FALSE, PALETTE_VERTEX_SIZE, (GLvoid*)(8 * sizeof(float)));
+
+    if(batch->indexBuffer != 0)
+    {
+      GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB, batch->indexBuffer);
+      glDrawElements(GL_TRIANGLES, batch->indexCount, batch->indexType, NULL);
+    }
+    else
+    {
+      glDrawArrays(GL_TRIANGLES, 0, batch->vertexCount);
+    }
+  }
+
+  glDisableVertexAttribArray(partLocation);
+  Shader::unuse();
+  GLState::restore();
+}
+
+/// \brief Obtain the merged batches, each drawn with one call
+/// \return A pointer to the PaletteBatches
+std::vector<std::tr1::shared_ptr<PaletteBatch> >* MatrixPalette::getBatches()
+{
+  return &batches;
+}
+
+/// \brief Obtain the number of part matrices the shader holds at once
+/// \return The palette size, limited by the vertex shader's uniform space
+size_t MatrixPalette::getPaletteSize()
+{
+  return paletteSize;
+}
+
+}
+
@@ -0,0 +1,505 @@
+/*********************************************************************************
+ *
+ * Copyright (c) 2012, Sanguine Laboratories
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *********************************************************************************/
+
+#include <GL/glew.h>
+
+#include <wavefront.h>
+
+namespace Wavefront
+{
+
+/// \brief Default constructor
+BackendStats::BackendStats()
+{
+  for(int i = 0; i < COMMAND_TYPES; i++)
+  {
+    commands[i] = 0;
+  }
+
+  total = 0;
+  bytes = 0;
+  elements = 0;
+}
+
+/// \brief Default constructor, counting without logging
+NullBackend::NullBackend()
+{
+  logging = false;
+  names = 0;
+  matrices = &modelview;
+}
+
+/// \brief Count a call, logging it if enabled
+/// \param type The kind of call
+/// \param target The buffer target, capability, matrix mode or primitive, or 0
+/// \param name The buffer, texture, program or vertex array object, or 0
+/// \param bytes The bytes passed to a buffer or texture
+/// \param elements The vertices or indices drawn
+void NullBackend::record(RenderCommandType type, GLenum target, GLuint name, size_t bytes, size_t elements)
+{
+  RenderCommand command;
+
+  stats.commands[type]++;
+  stats.total++;
+  stats.bytes += bytes;
+  stats.elements += elements;
+
+  if(logging == false)
+  {
+    return;
+  }
+
+  command.type = type;
+  command.target = target;
+  command.name = name;
+  command.bytes = bytes;
+  command.elements = elements;
+  commands.push_back(command);
+}
+
+/// \brief Remember whether an array or capability is enabled
+/// \param capability The array or capability
+/// \param enabled True if enabled
+void NullBackend::setEnabled(GLenum capability, bool enabled)
+{
+  for(size_t i = 0; i < capabilities.size(); i++)
+  {
+    if(capabilities.at(i).first == capability)
+    {
+      capabilities.at(i).second = enabled;
+      return;
+    }
+  }
+
+  capabilities.push_back(std::make_pair(capability, enabled));
+}
+
+/// \brief Obtain the counters since the last call to resetStats
+/// \return The BackendStats
+BackendStats NullBackend::getStats()
+{
+  return stats;
+}
+
+/// \brief Reset the counters, typically at the start of each frame
+void NullBackend::resetStats()
+{
+  stats = BackendStats();
+}
+
+/// \brief Keep every call in the log as well as counting it
+/// \param logging True to log
+void NullBackend::setLogging(bool logging)
+{
+  this->logging = logging;
+}
+
+/// \brief Check whether calls are being logged
+/// \return True if setLogging(true) was called
+bool NullBackend::isLogging()
+{
+  return logging;
+}
+
+/// \brief Obtain the calls logged since the last call to clearCommands
+/// \return The RenderCommands in the order they were received
+std::vector<RenderCommand>* NullBackend::getCommands()
+{
+  return &commands;
+}
+
+/// \brief Empty the log
+void NullBackend::clearCommands()
+{
+  commands.clear();
+}
+
+/// \brief Does nothing as there are no entry points to look up
+void NullBackend::initialize()
+{
+
+}
+
+/// \brief Count generating a buffer
+/// \return A new name
+GLuint NullBackend::genBuffer()
+{
+  names++;
+  record(COMMAND_BUFFER, 0, names, 0, 0);
+
+  return names;
+}
+
+/// \brief Count deleting a buffer
+/// \param buffer The buffer name
+void NullBackend::deleteBuffer(GLuint buffer)
+{
+  record(COMMAND_BUFFER, 0, buffer, 0, 0);
+}
+
+/// \brief Count binding a buffer
+/// \param target GL_ARRAY_BUFFER_ARB or GL_ELEMENT_ARRAY_BUFFER_ARB
+/// \param buffer The buffer name, or 0 to unbind
+void NullBackend::bindBuffer(GLenum target, GLuint buffer)
+{
+  record(COMMAND_BUFFER, target, buffer, 0, 0);
+}
+
+/// \brief Count filling a buffer
+/// \param target GL_ARRAY_BUFFER_ARB or GL_ELEMENT_ARRAY_BUFFER_ARB
+/// \param size The size in bytes
+/// \param data Ignored
+/// \param usage Ignored
+void NullBackend::bufferData(GLenum target, size_t size, const GLvoid* data, GLenum usage)
+{
+  record(COMMAND_BUFFER_DATA, target, 0, size, 0);
+}
+
+/// \brief Count replacing part of a buffer
+/// \param target GL_ARRAY_BUFFER_ARB or GL_ELEMENT_ARRAY_BUFFER_ARB
+/// \param offset Ignored
+/// \param size The number of bytes
+/// \param data Ignored
+void NullBackend::bufferSubData(GLenum target, size_t offset, size_t size, const GLvoid* data)
+{
+  record(COMMAND_BUFFER_DATA, target, 0, size, 0);
+}
+
+/// \brief Count mapping part of a buffer
+/// \param target GL_ARRAY_BUFFER_ARB or GL_ELEMENT_ARRAY_BUFFER_ARB
+/// \param offset Ignored
+/// \param size The number of bytes
+/// \param access Ignored
+/// \return Scratch memory of the size requested, discarded by the next map
+void* NullBackend::mapBufferRange(GLenum target, size_t offset, size_t size, GLbitfield access)
+{
+  record(COMMAND_BUFFER_DATA, target, 0, size, 0);
+  mapped.resize(size);
+
+  if(mapped.empty() == true)
+  {
+    return NULL;
+  }
+
+  return &mapped.at(0);
+}
+
+/// \brief Count unmapping a buffer
+/// \param target GL_ARRAY_BUFFER_ARB or GL_ELEMENT_ARRAY_BUFFER_ARB
+/// \return Always true
+bool NullBackend::unmapBuffer(GLenum target)
+{
+  record(COMMAND_BUFFER, target, 0, 0, 0);
+
+  return true;
+}
+
+/// \brief Count generating a texture
+/// \return A new name
+GLuint NullBackend::genTexture()
+{
+  names++;
+  record(COMMAND_TEXTURE, 0, names, 0, 0);
+
+  return names;
+}
+
+/// \brief Count deleting a texture
+/// \param texture The texture name
+void NullBackend::deleteTexture(GLuint texture)
+{
+  record(COMMAND_TEXTURE, 0, texture, 0, 0);
+}
+
+/// \brief Count binding a texture
+/// \param texture The texture name, or 0 to unbind
+void NullBackend::bindTexture(GLuint texture)
+{
+  record(COMMAND_TEXTURE, GL_TEXTURE_2D, texture, 0, 0);
+}
+
+/// \brief Count filling a texture
+/// \param width The width in pixels
+/// \param height The height in pixels
+/// \param channels 3 for RGB or 4 for RGBA
+/// \param pixels Ignored
+void NullBackend::texImage(GLsizei width, GLsizei height, int channels, const GLvoid* pixels)
+{
+  record(COMMAND_TEXTURE_DATA, GL_TEXTURE_2D, 0, (size_t)width * height * channels, 0);
+}
+
+/// \brief Count using a shader program
+/// \param program The program name, or 0 for the fixed function pipeline
+void NullBackend::useProgram(GLuint program)
+{
+  record(COMMAND_PROGRAM, 0, program, 0, 0);
+}
+
+/// \brief Count deleting a shader program
+/// \param program The program name
+void NullBackend::deleteProgram(GLuint program)
+{
+  record(COMMAND_PROGRAM, 0, program, 0, 0);
+}
+
+/// \brief Count binding a vertex array object
+/// \param array The vertex array object name, or 0 to unbind
+void NullBackend::bindVertexArray(GLuint array)
+{
+  record(COMMAND_PROGRAM, 0, array, 0, 0);
+}
+
+/// \brief Count deleting a vertex array object
+/// \param array The vertex array object name
+void NullBackend::deleteVertexArray(GLuint array)
+{
+  record(COMMAND_PROGRAM, 0, array, 0, 0);
+}
+
+/// \brief Count enabling a client array
+/// \param array GL_VERTEX_ARRAY, GL_NORMAL_ARRAY, GL_TEXTURE_COORD_ARRAY or GL_COLOR_ARRAY
+void NullBackend::enableClientState(GLenum array)
+{
+  setEnabled(array, true);
+  record(COMMAND_STATE, array, 0, 0, 0);
+}
+
+/// \brief Count disabling a client array
+/// \param array GL_VERTEX_ARRAY, GL_NORMAL_ARRAY, GL_TEXTURE_COORD_ARRAY or GL_COLOR_ARRAY
+void NullBackend::disableClientState(GLenum array)
+{
+  setEnabled(array, false);
+  record(COMMAND_STATE, array, 0, 0, 0);
+}
+
+/// \brief Count enabling a capability
+/// \param capability The capability, such as GL_RESCALE_NORMAL
+void NullBackend::enable(GLenum capability)
+{
+  setEnabled(capability, true);
+  record(COMMAND_STATE, capability, 0, 0, 0);
+}
+
+/// \brief Count disabling a capability
+/// \param capability The capability, such as GL_RESCALE_NORMAL
+void NullBackend::disable(GLenum capability)
+{
+  setEnabled(capability, false);
+  record(COMMAND_STATE, capability, 0, 0, 0);
+}
+
+/// \brief Check whether a client array or capability was enabled through this backend
+/// \param capability The array or capability
+/// \return True if last enabled, false if last disabled or never changed
+bool NullBackend::isEnabled(GLenum capability)
+{
+  for(size_t i = 0; i < capabilities.size(); i++)
+  {
+    if(capabilities.at(i).first == capability)
+    {
+      return capabilities.at(i).second;
+    }
+  }
+
+  return false;
+}
+
+/// \brief Count setting the vertex position array
+/// \param size Ignored
+/// \param type Ignored
+/// \param stride Ignored
+/// \param pointer Ignored
+void NullBackend::vertexPointer(GLint size, GLenum type, GLsizei stride, const GLvoid* pointer)
+{
+  record(COMMAND_POINTER, GL_VERTEX_ARRAY, 0, 0, 0);
+}
+
+/// \brief Count setting the normal array
+/// \param type Ignored
+/// \param stride Ignored
+/// \param pointer Ignored
+void NullBackend::normalPointer(GLenum type, GLsizei stride, const GLvoid* pointer)
+{
+  record(COMMAND_POINTER, GL_NORMAL_ARRAY, 0, 0, 0);
+}
+
+/// \brief Count setting the texture coordinate array
+/// \param size Ignored
+/// \param type Ignored
+/// \param stride Ignored
+/// \param pointer Ignored
+void NullBackend::texCoordPointer(GLint size, GLenum type, GLsizei stride, const GLvoid* pointer)
+{
+  record(COMMAND_POINTER, GL_TEXTURE_COORD_ARRAY, 0, 0, 0);
+}
+
+/// \brief Count setting the color array
+/// \param size Ignored
+/// \param type Ignored
+/// \param stride Ignored
+/// \param pointer Ignored
+void NullBackend::colorPointer(GLint size, GLenum type, GLsizei stride, const GLvoid* pointer)
+{
+  record(COMMAND_POINTER, GL_COLOR_ARRAY, 0, 0, 0);
+}
+
+/// \brief Count setting the current color
+/// \param red Ignored
+/// \param green Ignored
+/// \param blue Ignored
+/// \param alpha Ignored
+void NullBackend::color(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha)
+{
+  record(COMMAND_STATE, GL_CURRENT_COLOR, 0, 0, 0);
+}
+
+/// \brief Select the matrix stack changed by the matrix calls
+/// \param mode GL_MODELVIEW, GL_PROJECTION or GL_TEXTURE
+void NullBackend::matrixMode(GLenum mode)
+{
+  if(mode == GL_PROJECTION)
+  {
+    matrices = &projection;
+  }
+  else if(mode == GL_TEXTURE)
+  {
+    matrices = &texture;
+  }
+  else
+  {
+    matrices = &modelview;
+  }
+
+  record(COMMAND_MATRIX, mode, 0, 0, 0);
+}
+
+/// \brief Push a copy of the current matrix
+void NullBackend::pushMatrix()
+{
+  matrices->push();
+  record(COMMAND_MATRIX, 0, 0, 0, 0);
+}
+
+/// \brief Pop the current matrix
+void NullBackend::popMatrix()
+{
+  matrices->pop();
+  record(COMMAND_MATRIX, 0, 0, 0, 0);
+}
+
+/// \brief Replace the current matrix
+/// \param matrix 16 floats in column-major order
+void NullBackend::loadMatrix(const float* matrix)
+{
+  matrices->load(matrix);
+  record(COMMAND_MATRIX, 0, 0, 0, 0);
+}
+
+/// \brief Multiply the current matrix by a translation
+/// \param x The distance along the x axis
+/// \param y The distance along the y axis
+/// \param z The distance along the z axis
+void NullBackend::translate(float x, float y, float z)
+{
+  matrices->translate(x, y, z);
+  record(COMMAND_MATRIX, 0, 0, 0, 0);
+}
+
+/// \brief Multiply the current matrix by a rotation
+/// \param angle The angle in degrees
+/// \param x The x component of the axis
+/// \param y The y component of the axis
+/// \param z The z component of the axis
+void NullBackend::rotate(float angle, float x, float y, float z)
+{
+  matrices->rotate(angle, x, y, z);
+  record(COMMAND_MATRIX, 0, 0, 0, 0);
+}
+
+/// \brief Multiply the current matrix by a scale
+/// \param x The factor along the x axis
+/// \param y The factor along the y axis
+/// \param z The factor along the z axis
+void NullBackend::scale(float x, float y, float z)
+{
+  matrices->scale(x, y, z);
+  record(COMMAND_MATRIX, 0, 0, 0, 0);
+}
+
+/// \brief Read the current modelview matrix
+/// \param matrix Receives 16 floats in column-major order
+void NullBackend::getModelview(float* matrix)
+{
+  const float* current = modelview.get();
+
+  for(int i = 0; i < 16; i++)
+  {
+    matrix[i] = current[i];
+  }
+}
+
+/// \brief Count drawing vertices in order
+/// \param mode The primitive, such as GL_TRIANGLES
+/// \param first Ignored
+/// \param count The number of vertices
+void NullBackend::drawArrays(GLenum mode, GLint first, GLsizei count)
+{
+  record(COMMAND_DRAW, mode, 0, 0, count);
+}
+
+/// \brief Count drawing indexed vertices
+/// \param mode The primitive, such as GL_TRIANGLES
+/// \param count The number of indices
+/// \param type Ignored
+/// \param indices Ignored
+void NullBackend::drawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices)
+{
+  record(COMMAND_DRAW, mode, 0, 0, count);
+}
+
+/// \brief Count drawing vertices in order many times
+/// \param mode The primitive, such as GL_TRIANGLES
+/// \param first Ignored
+/// \param count The number of vertices
+/// \param instances The number of instances
+void NullBackend::drawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instances)
+{
+  record(COMMAND_DRAW, mode, 0, 0, (size_t)count * instances);
+}
+
+/// \brief Count drawing indexed vertices many times
+/// \param mode The primitive, such as GL_TRIANGLES
+/// \param count The number of indices
+/// \param type Ignored
+/// \param indices Ignored
+/// \param instances The number of instances
+void NullBackend::drawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices, GLsizei instances)
+{
+  record(COMMAND_DRAW, mode, 0, 0, (size_t)count * instances);
+}
+
+}
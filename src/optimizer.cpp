@@ -0,0 +1,485 @@
+/*********************************************************************************
+ *
+ * Copyright (c) 2012, Sanguine Laboratories
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *********************************************************************************/
+
+#include <algorithm>
+#include <cmath>
+
+#include <GL/glew.h>
+
+#include <wavefront.h>
+
+namespace Wavefront
+{
+
+namespace
+{
+
+/// \brief A run of triangles drawn between two restarts of the cache ordering
+struct Cluster
+{
+  size_t first; ///< The first triangle of the cluster
+  size_t count; ///< The number of triangles in the cluster
+  float sort; ///< How far the cluster faces out from the center of the mesh
+
+};
+
+/// \brief Order clusters facing furthest out from the center first
+/// \param a The first cluster
+/// \param b The second cluster
+/// \return True if a should be drawn before b
+bool compareClusters(const Cluster& a, const Cluster& b)
+{
+  return a.sort > b.sort;
+}
+
+/// \brief Choose the vertex to fan around next
+/// \param candidates The vertices of the triangles just emitted
+/// \param live The number of triangles not yet emitted using each vertex
+/// \param stamps The time each vertex last entered the cache
+/// \param time The current time
+/// \param deadEnds The vertices of emitted triangles, most recent last
+/// \param cursor The next vertex to try once the dead ends are exhausted
+/// \param restarted Set to true if no candidate had triangles left
+/// \return The vertex, or -1 once every triangle has been emitted
+///
+/// Prefers the candidate which will stay in the cache longest while its
+/// remaining triangles are emitted. A vertex taken from deadEnds or cursor
+/// starts a new cluster.
+int nextVertex(std::vector<unsigned int>& candidates, std::vector<unsigned int>& live,
+  std::vector<size_t>& stamps, size_t time, std::vector<unsigned int>& deadEnds, size_t* cursor,
+  bool* restarted)
+{
+  int best = -1;
+  long priority = -1;
+  long current = 0;
+
+  *restarted = false;
+
+  for(size_t i = 0; i < candidates.size(); i++)
+  {
+    unsigned int vertex = candidates.at(i);
+
+    if(live.at(vertex) == 0)
+    {
+      continue;
+    }
+
+    current = 0;
+
+    if(time - stamps.at(vertex) + 2 * live.at(vertex) <= MODEL_VERTEX_CACHE_SIZE)
+    {
+      current = time - stamps.at(vertex);
+    }
+
+    if(current > priority)
+    {
+      priority = current;
+      best = vertex;
+    }
+  }
+
+  if(best != -1)
+  {
+    return best;
+  }
+
+  *restarted = true;
+
+  while(deadEnds.empty() == false)
+  {
+    unsigned int vertex = deadEnds.back();
+
+    deadEnds.pop_back();
+
+    if(live.at(vertex) > 0)
+    {
+      return vertex;
+    }
+  }
+
+  for(; *cursor < live.size(); (*cursor)++)
+  {
+    if(live.at(*cursor) > 0)
+    {
+      return *cursor;
+    }
+  }
+
+  return -1;
+}
+
+/// \brief Reorder triangles to reuse recently transformed vertices with the Tipsify algorithm
+/// \param indices The triangles, replaced by the reordered triangles
+/// \param vertexCount The number of vertices indexed
+/// \param clusters Receives the runs of triangles between restarts
+void tipsify(std::vector<unsigned int>* indices, size_t vertexCount, std::vector<Cluster>* clusters)
+{
+  size_t triangleCount = indices->size() / 3;
+  std::vector<unsigned int> offsets(vertexCount + 1, 0);
+  std::vector<unsigned int> adjacency(indices->size());
+  std::vector<unsigned int> cursors;
+  std::vector<unsigned int> live(vertexCount, 0);
+  std::vector<size_t> stamps(vertexCount, 0);
+  std::vector<unsigned char> emitted(triangleCount, 0);
+  std::vector<unsigned int> deadEnds;
+  std::vector<unsigned int> candidates;
+  std::vector<unsigned int> output;
+  Cluster cluster = { 0, 0, 0 };
+  size_t time = MODEL_VERTEX_CACHE_SIZE + 1;
+  size_t cursor = 0;
+  bool restarted = false;
+  int fan = 0;
+
+  for(size_t i = 0; i < indices->size(); i++)
+  {
+    live.at(indices->at(i))++;
+  }
+
+  for(size_t i = 0; i < vertexCount; i++)
+  {
+    offsets.at(i + 1) = offsets.at(i) + live.at(i);
+  }
+
+  cursors.assign(offsets.begin(), offsets.end() - 1);
+
+  for(size_t i = 0; i < indices->size(); i++)
+  {
+    adjacency.at(cursors.at(indices->at(i))++) = i / 3;
+  }
+
+  output.reserve(indices->size());
+  fan = nextVertex(candidates, live, stamps, time, deadEnds, &cursor, &restarted);
+
+  while(fan >= 0)
+  {
+    if(restarted == true && cluster.count > 0)
+    {
+      clusters->push_back(cluster);
+      cluster.first += cluster.count;
+      cluster.count = 0;
+    }
+
+    candidates.clear();
+
+    for(unsigned int a = offsets.at(fan); a < offsets.at(fan + 1); a++)
+    {
+      unsigned int triangle = adjacency.at(a);
+
+      if(emitted.at(triangle) != 0)
+      {
+        continue;
+      }
+
+      for(int c = 0; c < 3; c++)
+      {
+        unsigned int vertex = indices->at(triangle * 3 + c);
+
+        output.push_back(vertex);
+        deadEnds.push_back(vertex);
+        candidates.push_back(vertex);
+        live.at(vertex)--;
+
+        if(time - stamps.at(vertex) > MODEL_VERTEX_CACHE_SIZE)
+        {
+          stamps.at(vertex) = time;
+          time++;
+        }
+      }
+
+      emitted.at(triangle) = 1;
+      cluster.count++;
+    }
+
+    fan = nextVertex(candidates, live, stamps, time, deadEnds, &cursor, &restarted);
+  }
+
+  if(cluster.count > 0)
+  {
+    clusters->push_back(cluster);
+  }
+
+  indices->swap(output);
+}
+
+/// \brief Reorder clusters of triangles so those likely to hide others are drawn first
+/// \param indices The triangles, replaced by the reordered triangles
+/// \param vertices The positions, three per vertex
+/// \param clusters The runs of triangles to move as a whole
+///
+/// Clusters are sorted by how far their area weighted center lies out from
+/// the center of the mesh along their average normal, as those facing out
+/// from the outside of a mesh are the ones in front from most directions.
+void sortClusters(std::vector<unsigned int>* indices, const std::vector<float>* vertices,
+  std::vector<Cluster>* clusters)
+{
+  std::vector<unsigned int> output;
+  std::vector<float> centers(clusters->size() * 3, 0);
+  std::vector<float> normals(clusters->size() * 3, 0);
+  float meshCenter[3] = { 0 };
+  float meshArea = 0;
+
+  for(size_t i = 0; i < clusters->size(); i++)
+  {
+    Cluster* cluster = &clusters->at(i);
+    float area = 0;
+
+    for(size_t t = cluster->first; t < cluster->first + cluster->count; t++)
+    {
+      const float* a = &vertices->at(indices->at(t * 3) * 3);
+      const float* b = &vertices->at(indices->at(t * 3 + 1) * 3);
+      const float* c = &vertices->at(indices->at(t * 3 + 2) * 3);
+      float u[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+      float v[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+      float normal[3] = { u[1] * v[2] - u[2] * v[1], u[2] * v[0] - u[0] * v[2], u[0] * v[1] - u[1] * v[0] };
+      float length = sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+
+      for(int k = 0; k < 3; k++)
+      {
+        centers.at(i * 3 + k) += (a[k] + b[k] + c[k]) / 3 * length;
+        normals.at(i * 3 + k) += normal[k];
+      }
+
+      area += length;
+    }
+
+    for(int k = 0; k < 3; k++)
+    {
+      meshCenter[k] += centers.at(i * 3 + k);
+
+      if(area > 0)
+      {
+        centers.at(i * 3 + k) /= area;
+      }
+    }
+
+    meshArea += area;
+  }
+
+  if(meshArea <= 0)
+  {
+    return;
+  }
+
+  for(int k = 0; k < 3; k++)
+  {
+    meshCenter[k] /= meshArea;
+  }
+
+  for(size_t i = 0; i < clusters->size(); i++)
+  {
+    float* normal = &normals.at(i * 3);
+    float length = sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+
+    clusters->at(i).sort = 0;
+
+    if(length <= 0)
+    {
+      continue;
+    }
+
+    for(int k = 0; k < 3; k++)
+    {
+      clusters->at(i).sort += (centers.at(i * 3 + k) - meshCenter[k]) * normal[k] / length;
+    }
+  }
+
+  std::stable_sort(clusters->begin(), clusters->end(), compareClusters);
+  output.reserve(indices->size());
+
+  for(size_t i = 0; i < clusters->size(); i++)
+  {
+    output.insert(output.end(), indices->begin() + clusters->at(i).first * 3,
+      indices->begin() + (clusters->at(i).first + clusters->at(i).count) * 3);
+  }
+
+  indices->swap(output);
+}
+
+/// \brief Reorder the elements of a vertex array
+/// \param values The array, replaced by the reordered array
+/// \param order The old index of each vertex in its new position
+void remapArray(std::vector<float>* values, const std::vector<unsigned int>& order)
+{
+  std::vector<float> output;
+  size_t stride = 0;
+
+  if(values->empty() == true || order.empty() == true)
+  {
+    return;
+  }
+
+  stride = values->size() / order.size();
+  output.reserve(values->size());
+
+  for(size_t i = 0; i < order.size(); i++)
+  {
+    output.insert(output.end(), values->begin() + order.at(i) * stride,
+      values->begin() + (order.at(i) + 1) * stride);
+  }
+
+  values->swap(output);
+}
+
+}
+
+/// \brief Default constructor
+VertexCacheStats::VertexCacheStats()
+{
+  triangles = 0;
+  vertices = 0;
+  missesBefore = 0;
+  missesAfter = 0;
+}
+
+/// \brief Add the figures of another group
+/// \param other The VertexCacheStats to add
+void VertexCacheStats::add(const VertexCacheStats& other)
+{
+  triangles += other.triangles;
+  vertices += other.vertices;
+  missesBefore += other.missesBefore;
+  missesAfter += other.missesAfter;
+}
+
+/// \brief Obtain the vertices transformed per triangle in load order
+/// \return The ACMR, or 0 without triangles
+float VertexCacheStats::getAcmrBefore()
+{
+  return triangles == 0 ? 0 : (float)missesBefore / triangles;
+}
+
+/// \brief Obtain the vertices transformed per triangle in the uploaded order
+/// \return The ACMR, or 0 without triangles
+float VertexCacheStats::getAcmrAfter()
+{
+  return triangles == 0 ? 0 : (float)missesAfter / triangles;
+}
+
+/// \brief Obtain the vertices transformed per unique vertex in load order
+/// \return The ATVR, or 0 without vertices
+float VertexCacheStats::getAtvrBefore()
+{
+  return vertices == 0 ? 0 : (float)missesBefore / vertices;
+}
+
+/// \brief Obtain the vertices transformed per unique vertex in the uploaded order
+/// \return The ATVR, or 0 without vertices
+float VertexCacheStats::getAtvrAfter()
+{
+  return vertices == 0 ? 0 : (float)missesAfter / vertices;
+}
+
+/// \brief Count the vertices transformed drawing indexed triangles
+/// \param indices The indices, three per triangle
+/// \return The number of indices missing a first in first out cache of MODEL_VERTEX_CACHE_SIZE entries
+size_t MaterialGroup::countCacheMisses(const std::vector<unsigned int>* indices)
+{
+  std::vector<unsigned int> cache(MODEL_VERTEX_CACHE_SIZE, (unsigned int)-1);
+  size_t next = 0;
+  size_t misses = 0;
+
+  for(size_t i = 0; i < indices->size(); i++)
+  {
+    if(std::find(cache.begin(), cache.end(), indices->at(i)) != cache.end())
+    {
+      continue;
+    }
+
+    cache.at(next) = indices->at(i);
+    next = (next + 1) % MODEL_VERTEX_CACHE_SIZE;
+    misses++;
+  }
+
+  return misses;
+}
+
+/// \brief Reorder the welded triangles and vertices for drawing with MODEL_OPTIMIZED
+/// \param vertices The positions, three per vertex, reordered
+/// \param colors The colors, four per vertex or empty, reordered
+/// \param normals The normals, three per vertex, reordered
+/// \param coords The texture coordinates, two per vertex, reordered
+/// \param indices The indices, three per triangle, reordered and renumbered
+///
+/// The triangles are first ordered with Tipsify (Sander, Nehab and Barczak)
+/// for the post-transform cache. The runs between the points where it had to
+/// restart away from the last triangles are then sorted so that those facing
+/// out of the mesh are drawn first, reducing overdraw. Finally the vertices
+/// are renumbered in the order they are first used so that fetching them
+/// walks forward through the vertex buffer. The triangles are left in their
+/// original order should that miss the cache less.
+void MaterialGroup::optimizeVertices(std::vector<float>* vertices, std::vector<float>* colors,
+  std::vector<float>* normals, std::vector<float>* coords, std::vector<unsigned int>* indices)
+{
+  size_t vertexCount = vertices->size() / 3;
+  std::vector<Cluster> clusters;
+  std::vector<unsigned int> remap(vertexCount, (unsigned int)-1);
+  std::vector<unsigned int> order;
+  std::vector<unsigned int> original(*indices);
+  std::vector<unsigned int> ordered;
+  size_t misses = 0;
+
+  if(indices->empty() == true)
+  {
+    return;
+  }
+
+  tipsify(indices, vertexCount, &clusters);
+  ordered = *indices;
+  misses = countCacheMisses(indices);
+  sortClusters(indices, vertices, &clusters);
+
+  // Overdraw is only traded for a few more cache misses, and small meshes may already be well ordered
+  if(countCacheMisses(indices) > misses + misses / 20)
+  {
+    indices->swap(ordered);
+  }
+
+  if(countCacheMisses(indices) > countCacheMisses(&original))
+  {
+    indices->swap(original);
+  }
+
+  order.reserve(vertexCount);
+
+  for(size_t i = 0; i < indices->size(); i++)
+  {
+    if(remap.at(indices->at(i)) == (unsigned int)-1)
+    {
+      remap.at(indices->at(i)) = order.size();
+      order.push_back(indices->at(i));
+    }
+
+    indices->at(i) = remap.at(indices->at(i));
+  }
+
+  remapArray(vertices, order);
+  remapArray(colors, order);
+  remapArray(normals, order);
+  remapArray(coords, order);
+}
+
+}
@@ -0,0 +1,461 @@
+/*********************************************************************************
+ *
+ * Copyright (c) 2012, Sanguine Laboratories
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *********************************************************************************/
+
+#include <GL/glew.h>
+
+#include <wavefront.h>
+
+namespace Wavefront
+{
+
+namespace
+{
+
+/// \brief The backend receiving the library's calls
+struct BackendState
+{
+  GLBackend gl; ///< The default backend
+  RenderBackend* current; ///< The backend in use
+};
+
+/// \brief Obtain the backend state
+/// \return The single BackendState of the rendering thread
+BackendState* getState()
+{
+  static BackendState state;
+  static bool initialized = false;
+
+  if(initialized == false)
+  {
+    state.current = &state.gl;
+    initialized = true;
+  }
+
+  return &state;
+}
+
+}
+
+/// \brief Destructor
+RenderBackend::~RenderBackend()
+{
+
+}
+
+/// \brief Obtain the backend the library calls
+/// \return The backend set with set, or the GLBackend
+RenderBackend* RenderBackend::get()
+{
+  return getState()->current;
+}
+
+/// \brief Send the library's calls to another backend
+/// \param backend The backend, which the caller keeps alive while it is set, or NULL for the GLBackend
+///
+/// The GLState shadow is invalidated as it describes the previous backend.
+/// Models uploaded through one backend must not be drawn through another.
+void RenderBackend::set(RenderBackend* backend)
+{
+  BackendState* state = getState();
+
+  if(backend == NULL)
+  {
+    backend = &state->gl;
+  }
+
+  state->current = backend;
+  GLState::invalidate();
+}
+
+/// \brief Check whether the calls are going to OpenGL
+/// \return True if the default GLBackend is in use
+bool RenderBackend::isDefault()
+{
+  BackendState* state = getState();
+
+  return state->current == &state->gl;
+}
+
+/// \brief Look up the OpenGL entry points with GLEW
+void GLBackend::initialize()
+{
+  // GLEW cannot find the entry points of a core profile from the extension string
+  if(CorePipeline::isEnabled() == true)
+  {
+    glewExperimental = GL_TRUE;
+  }
+
+  glewInit();
+}
+
+/// \brief Generate a buffer name
+/// \return The new name
+GLuint GLBackend::genBuffer()
+{
+  GLuint buffer = 0;
+
+  glGenBuffersARB(1, &buffer);
+
+  return buffer;
+}
+
+/// \brief Delete a buffer
+/// \param buffer The buffer name
+void GLBackend::deleteBuffer(GLuint buffer)
+{
+  glDeleteBuffersARB(1, &buffer);
+}
+
+/// \brief Bind a buffer
+/// \param target GL_ARRAY_BUFFER_ARB or GL_ELEMENT_ARRAY_BUFFER_ARB
+/// \param buffer The buffer name, or 0 to unbind
+void GLBackend::bindBuffer(GLenum target, GLuint buffer)
+{
+  glBindBufferARB(target, buffer);
+}
+
+/// \brief Fill the bound buffer
+/// \param target GL_ARRAY_BUFFER_ARB or GL_ELEMENT_ARRAY_BUFFER_ARB
+/// \param size The size in bytes
+/// \param data The bytes to copy, or NULL to leave the buffer undefined
+/// \param usage The usage hint, such as GL_STATIC_DRAW_ARB
+void GLBackend::bufferData(GLenum target, size_t size, const GLvoid* data, GLenum usage)
+{
+  glBufferDataARB(target, size, data, usage);
+}
+
+/// \brief Replace part of the bound buffer
+/// \param target GL_ARRAY_BUFFER_ARB or GL_ELEMENT_ARRAY_BUFFER_ARB
+/// \param offset The first byte to replace
+/// \param size The number of bytes to replace
+/// \param data The bytes to copy
+void GLBackend::bufferSubData(GLenum target, size_t offset, size_t size, const GLvoid* data)
+{
+  glBufferSubDataARB(target, offset, size, data);
+}
+
+/// \brief Map part of the bound buffer into memory
+/// \param target GL_ARRAY_BUFFER_ARB or GL_ELEMENT_ARRAY_BUFFER_ARB
+/// \param offset The first byte to map
+/// \param size The number of bytes to map
+/// \param access The GL_MAP_* bits
+/// \return The mapped memory, or NULL if OpenGL 3.0 and ARB_map_buffer_range are unsupported
+void* GLBackend::mapBufferRange(GLenum target, size_t offset, size_t size, GLbitfield access)
+{
+  if(GLEW_VERSION_3_0 == false && GLEW_ARB_map_buffer_range == false)
+  {
+    return NULL;
+  }
+
+  return glMapBufferRange(target, offset, size, access);
+}
+
+/// \brief Release the memory mapped by mapBufferRange
+/// \param target The target the buffer was mapped through
+/// \return False if the buffer's contents were lost while mapped
+bool GLBackend::unmapBuffer(GLenum target)
+{
+  return glUnmapBufferARB(target) == GL_TRUE;
+}
+
+/// \brief Generate a texture name
+/// \return The new name
+GLuint GLBackend::genTexture()
+{
+  GLuint texture = 0;
+
+  glGenTextures(1, &texture);
+
+  return texture;
+}
+
+/// \brief Delete a texture
+/// \param texture The texture name
+void GLBackend::deleteTexture(GLuint texture)
+{
+  glDeleteTextures(1, &texture);
+}
+
+/// \brief Bind a texture to GL_TEXTURE_2D
+/// \param texture The texture name, or 0 to unbind
+void GLBackend::bindTexture(GLuint texture)
+{
+  glBindTexture(GL_TEXTURE_2D, texture);
+}
+
+/// \brief Fill the bound texture, setting the filtering and wrapping used by the library
+/// \param width The width in pixels
+/// \param height The height in pixels
+/// \param channels 3 for RGB or 4 for RGBA
+/// \param pixels The tightly packed rows
+void GLBackend::texImage(GLsizei width, GLsizei height, int channels, const GLvoid* pixels)
+{
+  // The core pipeline's shader modulates the texture itself
+  if(CorePipeline::isEnabled() == false)
+  {
+    glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+  }
+
+  //glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  //glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+  // The rows are tightly packed, which for RGB is not always 4 byte aligned
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+  if(channels == 3)
+  {
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+  }
+  else
+  {
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+  }
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+/// \brief Use a shader program
+/// \param program The program name, or 0 for the fixed function pipeline
+void GLBackend::useProgram(GLuint program)
+{
+  glUseProgram(program);
+}
+
+/// \brief Delete a shader program
+/// \param program The program name
+void GLBackend::deleteProgram(GLuint program)
+{
+  glDeleteProgram(program);
+}
+
+/// \brief Bind a vertex array object
+/// \param array The vertex array object name, or 0 to unbind
+void GLBackend::bindVertexArray(GLuint array)
+{
+  glBindVertexArray(array);
+}
+
+/// \brief Delete a vertex array object
+/// \param array The vertex array object name
+void GLBackend::deleteVertexArray(GLuint array)
+{
+  glDeleteVertexArrays(1, &array);
+}
+
+/// \brief Enable a client array
+/// \param array GL_VERTEX_ARRAY, GL_NORMAL_ARRAY, GL_TEXTURE_COORD_ARRAY or GL_COLOR_ARRAY
+void GLBackend::enableClientState(GLenum array)
+{
+  glEnableClientState(array);
+}
+
+/// \brief Disable a client array
+/// \param array GL_VERTEX_ARRAY, GL_NORMAL_ARRAY, GL_TEXTURE_COORD_ARRAY or GL_COLOR_ARRAY
+void GLBackend::disableClientState(GLenum array)
+{
+  glDisableClientState(array);
+}
+
+/// \brief Enable a capability
+/// \param capability The capability, such as GL_RESCALE_NORMAL
+void GLBackend::enable(GLenum capability)
+{
+  glEnable(capability);
+}
+
+/// \brief Disable a capability
+/// \param capability The capability, such as GL_RESCALE_NORMAL
+void GLBackend::disable(GLenum capability)
+{
+  glDisable(capability);
+}
+
+/// \brief Query whether a client array or capability is enabled
+/// \param capability The array or capability
+/// \return True if enabled
+bool GLBackend::isEnabled(GLenum capability)
+{
+  return glIsEnabled(capability) == GL_TRUE;
+}
+
+/// \brief Set the vertex position array
+/// \param size The number of components per vertex
+/// \param type The type of each component
+/// \param stride The bytes between consecutive vertices
+/// \param pointer The offset into the bound array buffer
+void GLBackend::vertexPointer(GLint size, GLenum type, GLsizei stride, const GLvoid* pointer)
+{
+  glVertexPointer(size, type, stride, pointer);
+}
+
+/// \brief Set the normal array
+/// \param type The type of each component
+/// \param stride The bytes between consecutive vertices
+/// \param pointer The offset into the bound array buffer
+void GLBackend::normalPointer(GLenum type, GLsizei stride, const GLvoid* pointer)
+{
+  glNormalPointer(type, stride, pointer);
+}
+
+/// \brief Set the texture coordinate array
+/// \param size The number of components per vertex
+/// \param type The type of each component
+/// \param stride The bytes between consecutive vertices
+/// \param pointer The offset into the bound array buffer
+void GLBackend::texCoordPointer(GLint size, GLenum type, GLsizei stride, const GLvoid* pointer)
+{
+  glTexCoordPointer(size, type, stride, pointer);
+}
+
+/// \brief Set the color array
+/// \param size The number of components per vertex
+/// \param type The type of each component
+/// \param stride The bytes between consecutive vertices
+/// \param pointer The offset into the bound array buffer
+void GLBackend::colorPointer(GLint size, GLenum type, GLsizei stride, const GLvoid* pointer)
+{
+  glColorPointer(size, type, stride, pointer);
+}
+
+/// \brief Set the current color
+/// \param red The red component
+/// \param green The green component
+/// \param blue The blue component
+/// \param alpha The alpha component
+void GLBackend::color(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha)
+{
+  glColor4f(red, green, blue, alpha);
+}
+
+/// \brief Select the matrix stack changed by the matrix calls
+/// \param mode GL_MODELVIEW, GL_PROJECTION or GL_TEXTURE
+void GLBackend::matrixMode(GLenum mode)
+{
+  glMatrixMode(mode);
+}
+
+/// \brief Push a copy of the current matrix
+void GLBackend::pushMatrix()
+{
+  glPushMatrix();
+}
+
+/// \brief Pop the current matrix
+void GLBackend::popMatrix()
+{
+  glPopMatrix();
+}
+
+/// \brief Replace the current matrix
+/// \param matrix 16 floats in column-major order
+void GLBackend::loadMatrix(const float* matrix)
+{
+  glLoadMatrixf(matrix);
+}
+
+/// \brief Multiply the current matrix by a translation
+/// \param x The distance along the x axis
+/// \param y The distance along the y axis
+/// \param z The distance along the z axis
+void GLBackend::translate(float x, float y, float z)
+{
+  glTranslatef(x, y, z);
+}
+
+/// \brief Multiply the current matrix by a rotation
+/// \param angle The angle in degrees
+/// \param x The x component of the axis
+/// \param y The y component of the axis
+/// \param z The z component of the axis
+void GLBackend::rotate(float angle, float x, float y, float z)
+{
+  glRotatef(angle, x, y, z);
+}
+
+/// \brief Multiply the current matrix by a scale
+/// \param x The factor along the x axis
+/// \param y The factor along the y axis
+/// \param z The factor along the z axis
+void GLBackend::scale(float x, float y, float z)
+{
+  glScalef(x, y, z);
+}
+
+/// \brief Read the current modelview matrix
+/// \param matrix Receives 16 floats in column-major order
+void GLBackend::getModelview(float* matrix)
+{
+  glGetFloatv(GL_MODELVIEW_MATRIX, matrix);
+}
+
+/// \brief Draw vertices in order
+/// \param mode The primitive, such as GL_TRIANGLES
+/// \param first The first vertex
+/// \param count The number of vertices
+void GLBackend::drawArrays(GLenum mode, GLint first, GLsizei count)
+{
+  glDrawArrays(mode, first, count);
+}
+
+/// \brief Draw indexed vertices
+/// \param mode The primitive, such as GL_TRIANGLES
+/// \param count The number of indices
+/// \param type GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+/// \param indices The offset into the bound element buffer
+void GLBackend::drawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices)
+{
+  glDrawElements(mode, count, type, indices);
+}
+
+/// \brief Draw vertices in order many times
+/// \param mode The primitive, such as GL_TRIANGLES
+/// \param first The first vertex
+/// \param count The number of vertices
+/// \param instances The number of instances
+void GLBackend::drawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instances)
+{
+  glDrawArraysInstancedARB(mode, first, count, instances);
+}
+
+/// \brief Draw indexed vertices many times
+/// \param mode The primitive, such as GL_TRIANGLES
+/// \param count The number of indices
+/// \param type GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+/// \param indices The offset into the bound element buffer
+/// \param instances The number of instances
+void GLBackend::drawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices, GLsizei instances)
+{
+  glDrawElementsInstancedARB(mode, count, type, indices, instances);
+}
+
+}
@@ -0,0 +1,357 @@
+/*********************************************************************************
+ *
+ * Copyright (c) 2012, Sanguine Laboratories
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *********************************************************************************/
+
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#include <wavefront.h>
+
+namespace Wavefront
+{
+
+/// \brief Default constructor
+RenderStats::RenderStats()
+{
+  items = 0;
+  draws = 0;
+  textureBinds = 0;
+  materialChanges = 0;
+  arraySetups = 0;
+  matrixLoads = 0;
+  stateChanges = 0;
+  commands = 0;
+}
+
+/// \brief Default constructor
+RenderQueue::RenderQueue()
+{
+  indirect = false;
+  commandBuffer = 0;
+  instanceBuffer = 0;
+}
+
+/// \brief Specify whether to draw with indirect commands
+/// \param indirect True to draw the groups able to with multi-draw-indirect
+/// calls where isIndirectSupported, false to draw every group separately
+void RenderQueue::setIndirect(bool indirect)
+{
+  this->indirect = indirect;
+}
+
+/// \brief Check whether the queue draws with indirect commands
+/// \return True if setIndirect(true) was called
+bool RenderQueue::isIndirect()
+{
+  return indirect;
+}
+
+/// \brief Order items so that those sharing state are drawn together
+/// \param a The first item
+/// \param b The second item
+/// \return True if a should be drawn before b
+bool RenderQueue::compareItems(const RenderItem& a, const RenderItem& b)
+{
+  if(a.texture != b.texture)
+  {
+    return a.texture < b.texture;
+  }
+
+  if(a.material != b.material)
+  {
+    return a.material < b.material;
+  }
+
+  if(a.buffer != b.buffer)
+  {
+    return a.buffer < b.buffer;
+  }
+
+  if(a.group != b.group)
+  {
+    return a.group < b.group;
+  }
+
+  return a.depth < b.depth;
+}
+
+/// \brief Add a part to be drawn with the current modelview matrix
+/// \param part The uploaded Part to draw
+void RenderQueue::add(Part* part)
+{
+  float matrix[16] = { 0 };
+
+  CorePipeline::getCurrentMatrix(matrix);
+  add(part, matrix);
+}
+
+/// \brief Add a part to be drawn with the specified modelview matrix
+/// \param part The uploaded Part to draw
+/// \param matrix The column major modelview matrix to draw the part with
+/// \param level The level of detail to draw, 0 for the original faces
+void RenderQueue::add(Part* part, const float* matrix, size_t level)
+{
+  RenderItem item;
+  Vector3* center = part->getCenter();
+  MaterialGroup* group = NULL;
+
+  item.matrix = matrices.size();
+  item.depth = -(matrix[2] * center->getX() + matrix[6] * center->getY() +
+    matrix[10] * center->getZ() + matrix[14]);
+  matrices.insert(matrices.end(), matrix, matrix + 16);
+
+  for(int i = 0; i < part->getMaterialGroups()->size(); i++)
+  {
+    group = part->getMaterialGroups()->at(i)->getLevel(level);
+    item.group = group;
+    item.material = group->getMaterial();
+    item.texture = 0;
+    item.buffer = group->getVertexBuffer();
+
+    if(item.material->getTexture() != NULL)
+    {
+      item.texture = item.material->getTexture()->getId();
+    }
+
+    items.push_back(item);
+  }
+}
+
+/// \brief Draw the sorted items with the CorePipeline and remove them
+///
+/// Each group is drawn with its own modelview matrix uniform; GLState elides
+/// the texture, program and vertex array bindings shared by consecutive items.
+void RenderQueue::flushCore()
+{
+  MatrixStack* modelview = CorePipeline::getModelview();
+  RenderItem* item = NULL;
+
+  modelview->push();
+
+  for(size_t i = 0; i < items.size(); i++)
+  {
+    item = &items.at(i);
+    modelview->load(&matrices.at(item->matrix));
+    item->group->render();
+    stats.items++;
+    stats.draws++;
+  }
+
+  modelview->pop();
+  GLState::restore();
+  clear();
+}
+
+/// \brief Draw and remove every queued item
+///
+/// The modelview and texture matrices, the client states and
+/// GL_RESCALE_NORMAL are restored afterwards. With setIndirect the groups
+/// able to are drawn with indirect commands first.
+void RenderQueue::flush()
+{
+  RenderBackend* backend = RenderBackend::get();
+  RenderItem* item = NULL;
+  MaterialGroup* lastGroup = NULL;
+  MaterialGroup* lastArrays = NULL;
+  Material* lastMaterial = NULL;
+  GLuint lastTexture = 0;
+  size_t lastMatrix = 0;
+  bool first = true;
+  bool colorArray = false;
+  bool quantized = false;
+  bool rescaleNormal = false;
+
+  stats = RenderStats();
+
+  if(items.size() < 1)
+  {
+    clear();
+    return;
+  }
+
+  if(indirect == true && isIndirectSupported() == true)
+  {
+    flushIndirect();
+
+    if(items.size() < 1)
+    {
+      clear();
+      return;
+    }
+  }
+
+  std::sort(items.begin(), items.end(), RenderQueue::compareItems);
+
+  if(CorePipeline::isEnabled() == true)
+  {
+    flushCore();
+    return;
+  }
+
+  rescaleNormal = GLState::isEnabled(GL_RESCALE_NORMAL);
+
+  backend->matrixMode(GL_TEXTURE);
+  backend->pushMatrix();
+  backend->matrixMode(GL_MODELVIEW);
+  backend->pushMatrix();
+
+  GLState::enableClientState(GL_VERTEX_ARRAY);
+  GLState::enableClientState(GL_NORMAL_ARRAY);
+  GLState::enableClientState(GL_TEXTURE_COORD_ARRAY);
+  GLState::disableClientState(GL_COLOR_ARRAY);
+  stats.stateChanges += 3;
+
+  for(size_t i = 0; i < items.size(); i++)
+  {
+    item = &items.at(i);
+    stats.items++;
+
+    if(first == true || item->texture != lastTexture)
+    {
+      if(item->texture != 0)
+      {
+        item->material->getTexture()->bind();
+      }
+      else
+      {
+        Texture::unbind();
+      }
+
+      lastTexture = item->texture;
+      stats.textureBinds++;
+    }
+
+    if(item->material != lastMaterial)
+    {
+      lastMaterial = item->material;
+      stats.materialChanges++;
+    }
+
+    if(item->group->usesColorArray() != colorArray)
+    {
+      colorArray = item->group->usesColorArray();
+
+      if(colorArray == true)
+      {
+        GLState::enableClientState(GL_COLOR_ARRAY);
+      }
+      else
+      {
+        GLState::disableClientState(GL_COLOR_ARRAY);
+      }
+
+      stats.stateChanges++;
+    }
+
+    // Groups sharing a BufferArena block still point the arrays at their own ranges
+    if(item->group != lastArrays)
+    {
+      item->group->setArrays();
+      lastArrays = item->group;
+      stats.arraySetups++;
+    }
+
+    // Quantized groups each need their own texture matrix and rescaled normals
+    if(item->group != lastGroup && (quantized == true || item->group->isQuantized() == true))
+    {
+      backend->matrixMode(GL_TEXTURE);
+      backend->popMatrix();
+      backend->pushMatrix();
+      item->group->transformCoords();
+      backend->matrixMode(GL_MODELVIEW);
+      stats.stateChanges++;
+
+      if(quantized != item->group->isQuantized())
+      {
+        if(item->group->isQuantized() == true)
+        {
+          GLState::enable(GL_RESCALE_NORMAL);
+        }
+        else if(rescaleNormal == false)
+        {
+          GLState::disable(GL_RESCALE_NORMAL);
+        }
+
+        stats.stateChanges++;
+      }
+    }
+
+    // A quantized group leaves its scale on the matrix so the next group must reload it
+    if(first == true || item->matrix != lastMatrix || quantized == true || item->group->isQuantized() == true)
+    {
+      backend->loadMatrix(&matrices.at(item->matrix));
+      item->group->transform();
+      lastMatrix = item->matrix;
+      stats.matrixLoads++;
+    }
+
+    quantized = item->group->isQuantized();
+    lastGroup = item->group;
+    first = false;
+
+    item->group->drawElements();
+    stats.draws++;
+  }
+
+  GLState::restore();
+
+  if(rescaleNormal == false)
+  {
+    GLState::disable(GL_RESCALE_NORMAL);
+  }
+
+  backend->matrixMode(GL_TEXTURE);
+  backend->popMatrix();
+  backend->matrixMode(GL_MODELVIEW);
+  backend->popMatrix();
+
+  clear();
+}
+
+/// \brief Remove every queued item without drawing it
+void RenderQueue::clear()
+{
+  items.clear();
+  matrices.clear();
+}
+
+/// \brief Obtain the number of queued items
+/// \return The number of MaterialGroups waiting to be drawn
+size_t RenderQueue::getSize()
+{
+  return items.size();
+}
+
+/// \brief Obtain the counters of the last flush
+/// \return The RenderStats
+RenderStats RenderQueue::getStats()
+{
+  return stats;
+}
+
+}
+
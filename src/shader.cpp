@@ -0,0 +1,241 @@
+/*********************************************************************************
+ *
+ * Copyright (c) 2012, Sanguine Laboratories
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *********************************************************************************/
+
+#include <tr1/functional>
+
+#include <GL/glew.h>
+
+#include <wavefront.h>
+
+namespace Wavefront
+{
+
+namespace
+{
+
+/// \brief Lights a vertex with light 0 like the fixed function pipeline
+const char* fixedLightingSource =
+  "#version 120\n"
+  "uniform bool lighting;\n"
+  "vec4 lightVertex(vec4 position, vec3 normal, vec4 color)\n"
+  "{\n"
+  "  if(!lighting)\n"
+  "  {\n"
+  "    return color;\n"
+  "  }\n"
+  "  vec3 light = normalize(gl_LightSource[0].position.xyz - position.xyz * gl_LightSource[0].position.w);\n"
+  "  vec4 intensity = gl_LightModel.ambient + gl_LightSource[0].ambient + gl_LightSource[0].diffuse * max(dot(normal, light), 0.0);\n"
+  "  return vec4(min(intensity.rgb * color.rgb, 1.0), color.a);\n"
+  "}\n";
+
+/// \brief Modulates the texture by the vertex color as GL_MODULATE does
+const char* fixedFragmentSource =
+  "#version 120\n"
+  "uniform sampler2D diffuseMap;\n"
+  "uniform bool textured;\n"
+  "varying vec4 color;\n"
+  "varying vec2 coord;\n"
+  "void main()\n"
+  "{\n"
+  "  gl_FragColor = textured ? texture2D(diffuseMap, coord) * color : color;\n"
+  "}\n";
+
+}
+
+/// \brief Delete the program stored on the graphics card
+/// \param program Reference of the program to delete
+void Shader::deleteProgram(GLuint* program)
+{
+  GLState::deleteProgram(*program);
+}
+
+/// \brief Compile a single shader stage
+/// \param type GL_VERTEX_SHADER or GL_FRAGMENT_SHADER
+/// \param source The GLSL source code
+/// \return The name of the compiled shader
+GLuint Shader::compile(GLenum type, std::string source)
+{
+  GLuint shader = glCreateShader(type);
+  const GLchar* text = source.c_str();
+  GLint status = GL_FALSE;
+  GLint length = 0;
+  std::string log;
+
+  glShaderSource(shader, 1, &text, NULL);
+  glCompileShader(shader);
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+
+  if(status == GL_FALSE)
+  {
+    glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+    log.resize(length > 0 ? length : 1);
+    glGetShaderInfoLog(shader, log.size(), NULL, &log[0]);
+    glDeleteShader(shader);
+    throw WavefrontException("Failed to compile shader: " + log);
+  }
+
+  return shader;
+}
+
+/// \brief Constructor
+/// \param vertexSource The GLSL source of the vertex shader
+/// \param fragmentSource The GLSL source of the fragment shader
+///
+/// Requires a current rendering context supporting OpenGL 2.0.
+Shader::Shader(std::string vertexSource, std::string fragmentSource)
+{
+  GLuint vertex = compile(GL_VERTEX_SHADER, vertexSource);
+  GLuint fragment = 0;
+  GLint status = GL_FALSE;
+  GLint length = 0;
+  std::string log;
+
+  try
+  {
+    fragment = compile(GL_FRAGMENT_SHADER, fragmentSource);
+  }
+  catch(std::exception&)
+  {
+    glDeleteShader(vertex);
+    throw;
+  }
+
+  program = glCreateProgram();
+  _program.reset(&program, std::tr1::bind(Shader::deleteProgram, &program));
+  glAttachShader(program, vertex);
+  glAttachShader(program, fragment);
+  glLinkProgram(program);
+
+  // The program keeps the stages alive for as long as they are attached
+  glDeleteShader(vertex);
+  glDeleteShader(fragment);
+
+  glGetProgramiv(program, GL_LINK_STATUS, &status);
+
+  if(status == GL_FALSE)
+  {
+    glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+    log.resize(length > 0 ? length : 1);
+    glGetProgramInfoLog(program, log.size(), NULL, &log[0]);
+    throw WavefrontException("Failed to link shader: " + log);
+  }
+}
+
+/// \brief Draw subsequent geometry with this program
+void Shader::use()
+{
+  GLState::useProgram(program);
+}
+
+/// \brief Return to the fixed function pipeline
+void Shader::unuse()
+{
+  GLState::useProgram(0);
+}
+
+/// \brief Obtain the name of the program on the graphics card
+/// \return The program name
+GLuint Shader::getId()
+{
+  return program;
+}
+
+/// \brief Obtain the location of a vertex attribute
+/// \param name The name of the attribute in the vertex shader
+/// \return The location, or -1 if the attribute is not active
+GLint Shader::getAttribute(std::string name)
+{
+  return glGetAttribLocation(program, name.c_str());
+}
+
+/// \brief Obtain the location of a uniform
+/// \param name The name of the uniform
+/// \return The location, or -1 if the uniform is not active
+GLint Shader::getUniform(std::string name)
+{
+  return glGetUniformLocation(program, name.c_str());
+}
+
+/// \brief Complete a vertex shader drawing in place of the fixed function pipeline
+/// \param source The GLSL 1.20 source, without a version, writing the color and coord varyings
+/// \return The source preceded by the version and the lightVertex function
+///
+/// lightVertex(position, normal, color) returns the color lit by light 0 in
+/// eye space while the bool uniform lighting is set, and the color unchanged
+/// otherwise.
+std::string Shader::getFixedVertexSource(std::string source)
+{
+  return fixedLightingSource + source;
+}
+
+/// \brief Obtain the fragment shader paired with getFixedVertexSource
+/// \return The GLSL source texturing with the diffuseMap sampler while the bool uniform textured is set
+std::string Shader::getFixedFragmentSource()
+{
+  return fixedFragmentSource;
+}
+
+/// \brief Enable a mat4 attribute advancing once per instance
+/// \param location The location of the attribute
+///
+/// A mat4 attribute occupies four consecutive locations, one per column.
+/// Requires ARB_instanced_arrays.
+void Shader::enableInstanceMatrix(GLint location)
+{
+  for(int column = 0; column < 4; column++)
+  {
+    glEnableVertexAttribArray(location + column);
+    glVertexAttribDivisorARB(location + column, 1);
+  }
+}
+
+/// \brief Point a mat4 attribute at column-major matrices in the bound array buffer
+/// \param location The location of the attribute
+/// \param stride The bytes from one instance's matrix to the next
+/// \param offset The offset in bytes of the first matrix within the buffer
+void Shader::setInstanceMatrixPointer(GLint location, GLsizei stride, size_t offset)
+{
+  for(int column = 0; column < 4; column++)
+  {
+    glVertexAttribPointer(location + column, 4, GL_FLOAT, GL_FALSE, stride,
+      (GLvoid*)(offset + column * 4 * sizeof(float)));
+  }
+}
+
+/// \brief Disable a mat4 attribute enabled by enableInstanceMatrix
+/// \param location The location of the attribute
+void Shader::disableInstanceMatrix(GLint location)
+{
+  for(int column = 0; column < 4; column++)
+  {
+    glVertexAttribDivisorARB(location + column, 0);
+    glDisableVertexAttribArray(location + column);
+  }
+}
+
+}
+
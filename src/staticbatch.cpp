@@ -0,0 +1,183 @@
+/*********************************************************************************
+ *
+ * Copyright (c) 2012, Sanguine Laboratories
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *********************************************************************************/
+
+#include <algorithm>
+#include <cmath>
+
+#include <GL/glew.h>
+
+#include <wavefront.h>
+
+namespace Wavefront
+{
+
+/// \brief Build the group from the faces of several groups
+/// \param groups The groups to merge, whose faces need not be consecutive
+/// \param flags The ModelFlags the Model was loaded with
+///
+/// The vertices of each group are expanded as build would, so normals are
+/// only smoothed within a group, and are then indexed, optimized, quantized or
+/// interleaved together. The group takes the material of the first group. It
+/// has no Geometry of its own, so must not be built again or asked for faces.
+void MaterialGroup::merge(std::vector<MaterialGroup*>* groups, int flags)
+{
+  StreamData source;
+  bool colors = (flags & (MODEL_INTERLEAVED | MODEL_QUANTIZED)) == 0;
+
+  vertexData.clear();
+  colorData.clear();
+  normalData.clear();
+  coordData.clear();
+  interleavedData.clear();
+  indexData.clear();
+  shortIndexData.clear();
+  geometry = NULL;
+  firstFace = 0;
+  faceCount = 0;
+
+  for(size_t g = 0; g < groups->size(); g++)
+  {
+    MaterialGroup expanded;
+
+    expanded.setMaterial(groups->at(g)->getMaterial());
+    expanded.addFaces(groups->at(g)->getGeometry(), groups->at(g)->getFirstFace(), groups->at(g)->getFaceCount());
+    expanded.build(flags & MODEL_SMOOTH_NORMALS);
+    source = expanded.getStreams();
+
+    vertexData.insert(vertexData.end(), source.vertices, source.vertices + source.vertexCount * 3);
+    normalData.insert(normalData.end(), source.normals, source.normals + source.vertexCount * 3);
+    coordData.insert(coordData.end(), source.coords, source.coords + source.vertexCount * 2);
+
+    if(colors == true)
+    {
+      colorData.insert(colorData.end(), source.colors, source.colors + source.vertexCount * 4);
+    }
+
+    faceCount += groups->at(g)->getFaceCount();
+  }
+
+  if(groups->size() > 0)
+  {
+    material = groups->at(0)->getMaterial();
+  }
+
+  buildStreams(flags);
+}
+
+/// \brief Merge the groups of every part sharing a material for drawing as a static prop
+///
+/// From now on draw, drawVisible and draw(RenderQueue*) draw one MaterialGroup
+/// per material in place of the parts, which keep their names, bounds and
+/// buffers for queries and for other Models sharing the ModelData. The .obj
+/// positions are already in model space so the faces need no transforming.
+/// Levels of detail are ignored, and AnimatedModels using the Model still
+/// draw the parts. Calling it again does nothing.
+void Model::optimizeStatic()
+{
+  std::vector<std::tr1::shared_ptr<Part> >* parts = data->getParts();
+  std::vector<std::tr1::shared_ptr<MaterialGroup> >* groups = NULL;
+  std::vector<Material*> materials;
+  std::vector<std::vector<MaterialGroup*> > merged;
+  std::vector<Material*>::iterator material;
+  Vector3 minimum(999999, 999999, 999999);
+  Vector3 maximum(-999999, -999999, -999999);
+  Vector3 center;
+  Vector3* partCenter = NULL;
+  float distance = 0;
+  float radius = 0;
+
+  if(staticPart.get() != NULL)
+  {
+    return;
+  }
+
+  for(size_t p = 0; p < parts->size(); p++)
+  {
+    groups = parts->at(p)->getMaterialGroups();
+
+    for(size_t g = 0; g < groups->size(); g++)
+    {
+      if(groups->at(g)->getFaceCount() < 1)
+      {
+        continue;
+      }
+
+      material = std::find(materials.begin(), materials.end(), groups->at(g)->getMaterial());
+
+      if(material == materials.end())
+      {
+        materials.push_back(groups->at(g)->getMaterial());
+        merged.push_back(std::vector<MaterialGroup*>());
+        material = materials.end() - 1;
+      }
+
+      merged.at(material - materials.begin()).push_back(groups->at(g).get());
+    }
+
+    minimum = Vector3(std::min(minimum.getX(), parts->at(p)->getMinimum()->getX()),
+      std::min(minimum.getY(), parts->at(p)->getMinimum()->getY()),
+      std::min(minimum.getZ(), parts->at(p)->getMinimum()->getZ()));
+    maximum = Vector3(std::max(maximum.getX(), parts->at(p)->getMaximum()->getX()),
+      std::max(maximum.getY(), parts->at(p)->getMaximum()->getY()),
+      std::max(maximum.getZ(), parts->at(p)->getMaximum()->getZ()));
+  }
+
+  staticPart.reset(new Part());
+  staticPart->setName("static");
+
+  for(size_t m = 0; m < merged.size(); m++)
+  {
+    std::tr1::shared_ptr<MaterialGroup> group(new MaterialGroup());
+
+    group->merge(&merged.at(m), data->getFlags());
+    staticPart->addMaterialGroup(group);
+  }
+
+  center = Vector3((minimum.getX() + maximum.getX()) / 2,
+    (minimum.getY() + maximum.getY()) / 2,
+    (minimum.getZ() + maximum.getZ()) / 2);
+
+  // The sphere around the box's center enclosing every part's sphere
+  for(size_t p = 0; p < parts->size(); p++)
+  {
+    partCenter = parts->at(p)->getCenter();
+    distance = sqrt((partCenter->getX() - center.getX()) * (partCenter->getX() - center.getX()) +
+      (partCenter->getY() - center.getY()) * (partCenter->getY() - center.getY()) +
+      (partCenter->getZ() - center.getZ()) * (partCenter->getZ() - center.getZ()));
+    radius = std::max(radius, distance + parts->at(p)->getRadius());
+  }
+
+  staticPart->setCenter(center);
+  staticPart->setBounds(minimum, maximum, radius);
+
+  if(isUploaded() == true)
+  {
+    staticPart->upload(data->getFlags());
+  }
+}
+
+}
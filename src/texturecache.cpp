@@ -0,0 +1,204 @@
+/*********************************************************************************
+ *
+ * Copyright (c) 2012, Sanguine Laboratories
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *********************************************************************************/
+
+#include <cstdlib>
+#include <climits>
+#include <map>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <wavefront.h>
+
+namespace Wavefront
+{
+
+namespace
+{
+
+/// \brief A texture held by the TextureCache
+struct TextureEntry
+{
+  std::tr1::weak_ptr<Texture> texture; ///< The texture, expired once no Material uses it
+  time_t modified; ///< The modification time of the file when it was loaded
+  off_t size; ///< The size of the file when it was loaded
+};
+
+/// \brief Guards the cached textures, which may be requested by several loading threads
+pthread_mutex_t textureCacheMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/// \brief Obtain the cached textures keyed by resolved path
+/// \return The map of entries
+std::map<std::string, TextureEntry>* getTextureEntries()
+{
+  static std::map<std::string, TextureEntry> entries;
+
+  return &entries;
+}
+
+/// \brief Find a cached texture still in use
+/// \param entries The map of entries
+/// \param resolved The resolved path of the image
+/// \param info The current status of the file
+/// \return The texture, or NULL if it is not cached, no longer used or the file has changed
+std::tr1::shared_ptr<Texture> findTexture(std::map<std::string, TextureEntry>* entries,
+  std::string resolved, const struct stat& info)
+{
+  std::map<std::string, TextureEntry>::iterator it = entries->find(resolved);
+
+  if(it != entries->end() && it->second.modified == info.st_mtime &&
+    it->second.size == info.st_size)
+  {
+    return it->second.texture.lock();
+  }
+
+  return std::tr1::shared_ptr<Texture>();
+}
+
+/// \brief Remove the entries whose textures are no longer used
+/// \param entries The map of entries
+void removeExpiredTextures(std::map<std::string, TextureEntry>* entries)
+{
+  std::map<std::string, TextureEntry>::iterator it = entries->begin();
+
+  while(it != entries->end())
+  {
+    if(it->second.texture.expired() == true)
+    {
+      entries->erase(it++);
+    }
+    else
+    {
+      it++;
+    }
+  }
+}
+
+}
+
+/// \brief Obtain the texture for the specified image, loading it if it is not in use
+/// \param path The path of the PNG image
+/// \param decoder The ImageDecoder to decode a new texture with, or NULL to decode it immediately
+/// \return The shared Texture
+///
+/// If the file cannot be resolved the texture is created without being cached,
+/// so the error is reported when it is decoded. An image decoded immediately
+/// is decoded without holding the cache's lock; if another thread cached the
+/// same image meanwhile, its texture is returned instead.
+std::tr1::shared_ptr<Texture> TextureCache::get(std::string path, ImageDecoder* decoder)
+{
+  char resolved[PATH_MAX] = { 0 };
+  struct stat info;
+  std::map<std::string, TextureEntry>* entries = getTextureEntries();
+  std::tr1::shared_ptr<Texture> result;
+  std::tr1::shared_ptr<Image> image;
+  TextureEntry entry;
+
+  if(realpath(path.c_str(), resolved) == NULL || stat(resolved, &info) != 0)
+  {
+    if(decoder == NULL)
+    {
+      return std::tr1::shared_ptr<Texture>(new Texture(std::tr1::shared_ptr<Image>(new Image(path))));
+    }
+
+    return std::tr1::shared_ptr<Texture>(new Texture(decoder->decode(path)));
+  }
+
+  pthread_mutex_lock(&textureCacheMutex);
+  result = findTexture(entries, resolved, info);
+
+  if(result.get() != NULL)
+  {
+    pthread_mutex_unlock(&textureCacheMutex);
+    return result;
+  }
+
+  if(decoder == NULL)
+  {
+    pthread_mutex_unlock(&textureCacheMutex);
+    image.reset(new Image(resolved));
+    pthread_mutex_lock(&textureCacheMutex);
+    result = findTexture(entries, resolved, info);
+
+    if(result.get() != NULL)
+    {
+      pthread_mutex_unlock(&textureCacheMutex);
+      return result;
+    }
+
+    result.reset(new Texture(image));
+  }
+  else
+  {
+    try
+    {
+      result.reset(new Texture(decoder->decode(resolved)));
+    }
+    catch(...)
+    {
+      pthread_mutex_unlock(&textureCacheMutex);
+      throw;
+    }
+  }
+
+  removeExpiredTextures(entries);
+  entry.texture = result;
+  entry.modified = info.st_mtime;
+  entry.size = info.st_size;
+  (*entries)[resolved] = entry;
+  pthread_mutex_unlock(&textureCacheMutex);
+
+  return result;
+}
+
+/// \brief Obtain the number of textures in use
+/// \return The number of cached textures still referenced by a Material
+size_t TextureCache::getCount()
+{
+  size_t result = 0;
+
+  pthread_mutex_lock(&textureCacheMutex);
+  removeExpiredTextures(getTextureEntries());
+  result = getTextureEntries()->size();
+  pthread_mutex_unlock(&textureCacheMutex);
+
+  return result;
+}
+
+/// \brief Forget every cached texture
+///
+/// Textures in use are unaffected but will no longer be shared with models
+/// loaded afterwards.
+void TextureCache::clear()
+{
+  pthread_mutex_lock(&textureCacheMutex);
+  getTextureEntries()->clear();
+  pthread_mutex_unlock(&textureCacheMutex);
+}
+
+}
+
@@ -0,0 +1,271 @@
+/*********************************************************************************
+ *
+ * Copyright (c) 2012, Sanguine Laboratories
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *********************************************************************************/
+
+#include <cstring>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <wavefront.h>
+
+namespace Wavefront
+{
+
+/// \brief Map the specified file into memory
+/// \param path The path of the file to map
+MappedFile::MappedFile(std::string path)
+{
+  int fd = -1;
+  struct stat info;
+  void* mapping = NULL;
+
+  data = NULL;
+  size = 0;
+  fd = open(path.c_str(), O_RDONLY);
+
+  if(fd == -1)
+  {
+    throw WavefrontException("Failed to open \"" + path + "\"");
+  }
+
+  if(fstat(fd, &info) == -1)
+  {
+    close(fd);
+    throw WavefrontException("Failed to stat \"" + path + "\"");
+  }
+
+  // An empty file cannot be mapped but is still a valid (empty) buffer
+  if(info.st_size == 0)
+  {
+    close(fd);
+    return;
+  }
+
+  mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if(mapping == MAP_FAILED)
+  {
+    throw WavefrontException("Failed to map \"" + path + "\"");
+  }
+
+  madvise(mapping, info.st_size, MADV_SEQUENTIAL);
+  data = (const char*)mapping;
+  size = info.st_size;
+}
+
+/// \brief Destructor
+MappedFile::~MappedFile()
+{
+  if(data != NULL)
+  {
+    munmap((void*)data, size);
+  }
+}
+
+/// \brief Obtain the start of the mapped file contents
+/// \return A pointer to the first byte of the file
+const char* MappedFile::getData()
+{
+  return data;
+}
+
+/// \brief Obtain the size of the mapped file
+/// \return The number of bytes in the file
+size_t MappedFile::getSize()
+{
+  return size;
+}
+
+/// \brief Default constructor
+Token::Token()
+{
+  begin = NULL;
+  end = NULL;
+}
+
+/// \brief Constructor
+/// \param begin The first character of the token
+/// \param end One past the last character of the token
+Token::Token(const char* begin, const char* end)
+{
+  this->begin = begin;
+  this->end = end;
+}
+
+/// \brief Obtain the first character of the token
+/// \return A pointer to the first character
+const char* Token::getBegin() const
+{
+  return begin;
+}
+
+/// \brief Obtain the end of the token
+/// \return A pointer one past the last character
+const char* Token::getEnd() const
+{
+  return end;
+}
+
+/// \brief Obtain the number of characters in the token
+/// \return The length of the token
+size_t Token::getLength() const
+{
+  return end - begin;
+}
+
+/// \brief Check whether the token contains any characters
+/// \return True if the token is empty
+bool Token::isEmpty() const
+{
+  return begin == end;
+}
+
+/// \brief Compare the token against a null terminated string
+/// \param text The string to compare against
+/// \return True if the token matches the string exactly
+bool Token::equals(const char* text) const
+{
+  size_t length = strlen(text);
+
+  if(length != getLength())
+  {
+    return false;
+  }
+
+  return memcmp(begin, text, length) == 0;
+}
+
+/// \brief Split the token by the specified delimeter
+/// \param splitter The character to split by
+/// \param output The array to populate
+/// \param max The number of entries available in output
+/// \return The number of entries populated
+///
+/// Unlike Util::split, empty entries are kept so that "1//2" gives three entries.
+int Token::split(char splitter, Token* output, int max) const
+{
+  int count = 0;
+  const char* start = begin;
+
+  for(const char* c = begin; c != end && count < max; c++)
+  {
+    if(*c == splitter)
+    {
+      output[count] = Token(start, c);
+      count++;
+      start = c + 1;
+    }
+  }
+
+  if(count < max)
+  {
+    output[count] = Token(start, end);
+    count++;
+  }
+
+  return count;
+}
+
+/// \brief Copy the token into a string
+/// \return The token as a std::string
+std::string Token::toString() const
+{
+  return std::string(begin, end);
+}
+
+/// \brief Convert the token to a float
+/// \return The parsed value
+float Token::toFloat() const
+{
+  return Util::parseFloat(begin, end);
+}
+
+/// \brief Convert the token to an integer
+/// \return The parsed value
+int Token::toInt() const
+{
+  return Util::parseInt(begin, end);
+}
+
+/// \brief Constructor
+/// \param begin The first character of the buffer to tokenize
+/// \param end One past the last character of the buffer
+Tokenizer::Tokenizer(const char* begin, const char* end)
+{
+  current = begin;
+  this->end = end;
+}
+
+/// \brief Split the next line of the buffer into tokens
+/// \param tokens The array to populate, any previous contents are cleared
+/// \return False once the end of the buffer has been reached
+///
+/// The array is reused between lines so that once it has grown large enough
+/// no further allocations take place.
+bool Tokenizer::nextLine(std::vector<Token>* tokens)
+{
+  const char* start = NULL;
+
+  tokens->clear();
+
+  if(current == end)
+  {
+    return false;
+  }
+
+  while(current != end && *current != '\n')
+  {
+    if(*current == ' ' || *current == '\t' || *current == '\r')
+    {
+      current++;
+      continue;
+    }
+
+    start = current;
+
+    while(current != end && *current != '\n' &&
+      *current != ' ' && *current != '\t' && *current != '\r')
+    {
+      current++;
+    }
+
+    tokens->push_back(Token(start, current));
+  }
+
+  if(current != end)
+  {
+    current++;
+  }
+
+  return true;
+}
+
+}
@@ -25,11 +25,17 @@
  *
  *********************************************************************************/
 
-#include <fstream>
+#include <algorithm>
 #include <iostream>
 #include <cstdlib>
+#include <cstring>
 #include <cmath>
 #include <tr1/functional>
+#include <tr1/unordered_map>
+
+#include <pthread.h>
+#include <sys/time.h>
+#include <unistd.h>
 
 #include <GL/glew.h>
 
@@ -38,863 +44,2729 @@
 namespace Wavefront
 {
 
-/// \brief Load the model from a file
-/// \param path The path of the .obj model to load
-Model::Model(std::string path)
+namespace
 {
-  int fileNameStart = -1;
-  std::string line;
-  std::vector<std::string> splitLine;
-  std::vector<std::string> splitParameter;
-  std::ifstream file(path.c_str());
-
-  std::vector<Vector3> vertices;
-  std::vector<Vector3> vertexTextures;
 
-  std::tr1::shared_ptr<Part> part;
-  std::tr1::shared_ptr<MaterialGroup> materialGroup;
-  std::tr1::shared_ptr<Face> face;
-
-  glewInit();
+/// \brief The position, normal and texture coordinate of a vertex being welded
+struct VertexKey
+{
+  float values[8]; ///< The position, normal then texture coordinate
 
-  if(file.is_open() == false)
+  bool operator==(const VertexKey& other) const
   {
-    throw WavefrontException("Failed to open \"" + path + "\"");
+    return memcmp(values, other.values, sizeof(values)) == 0;
   }
+};
 
-  materials.push_back(std::tr1::shared_ptr<Material>(new Material()));
-  materials.at(0)->setName("Default");
-  materials.at(0)->setDiffuse(Vector3(1, 1, 1));
-
-  while(file.eof() == false)
+/// \brief Hashes the bit pattern of a VertexKey for use in an unordered_map
+struct VertexKeyHash
+{
+  size_t operator()(const VertexKey& key) const
   {
-    getline(file, line);
-    splitLine.clear();
-    Util::splitLineWhitespace(line, &splitLine);
+    unsigned int bits = 0;
+    size_t result = 2166136261u;
 
-    if(splitLine.size() < 1)
+    for(int i = 0; i < 8; i++)
     {
-      continue;
+      memcpy(&bits, &key.values[i], sizeof(bits));
+      result = (result ^ bits) * 16777619u;
     }
 
-    if(splitLine.at(0) == "mtllib")
-    {
-      fileNameStart = -1;
-
-      for(int i = path.length() - 1; i >= 0; i--)
-      {
-        if(path[i] == '\\' || path[i] == '/')
-        {
-          fileNameStart = i;
-          break;
-        }
-      }
+    return result;
+  }
+};
 
-      if(fileNameStart == -1)
-      {
-        _loadMtl("", splitLine.at(1));
-      }
-      else
-      {
-        _loadMtl(path.substr(0, fileNameStart), splitLine.at(1));
-      }
-    }
+/// \brief A g, o, usemtl or mtllib statement found while parsing an ObjChunk
+struct ObjStatement
+{
+  Token keyword; ///< The statement type
+  Token name; ///< The part, material or file name following the keyword
+  size_t face; ///< The number of triangles in the chunk preceding the statement
+};
 
-    if(splitLine.at(0) == "v")
+/// \brief The records parsed from one section of an .obj file
+///
+/// Sections are parsed independently (and possibly concurrently) into the same
+/// arrays a Geometry uses, with indices kept as absolute (zero based) file
+/// indices so that merging the sections is a matter of concatenation.
+struct ObjChunk
+{
+  const char* begin; ///< The first character of the section
+  const char* end; ///< One past the last character of the section
+  Geometry geometry; ///< The v, vt and f records of the section
+  std::vector<ObjStatement> statements; ///< The structural statements in file order
+  int vertexOverrun; ///< The furthest any face index reaches past the vertices parsed so far
+  int textureOverrun; ///< As vertexOverrun but for texture coordinates
+  Token overrunToken; ///< The face reference responsible for the furthest overrun
+  std::string error; ///< Set if the section could not be parsed
+};
+
+/// \brief Parse the .obj records contained in a chunk
+/// \param chunk The chunk to parse
+void parseObjChunk(ObjChunk* chunk)
+{
+  std::vector<Token> tokens;
+  Token parameter[3];
+  int parameterCount = 0;
+  int vertexIndices[4] = { 0 };
+  int textureIndices[4] = { 0 };
+  int corners = 0;
+  int vertexCount = 0;
+  int textureCount = 0;
+  ObjStatement statement;
+  Tokenizer tokenizer(chunk->begin, chunk->end);
+  std::vector<float>& positions = *chunk->geometry.getPositions();
+  std::vector<float>& coords = *chunk->geometry.getCoords();
+  std::vector<unsigned int>& positionIndices = *chunk->geometry.getPositionIndices();
+  std::vector<int>& coordIndices = *chunk->geometry.getCoordIndices();
+  static const int quadTriangles[2][3] = { { 0, 1, 2 }, { 2, 3, 0 } };
+
+  chunk->vertexOverrun = -1;
+  chunk->textureOverrun = -1;
+
+  while(tokenizer.nextLine(&tokens) == true)
+  {
+    if(tokens.size() < 1)
     {
-      //std::cout << "Vertex" << " " << splitLine.at(1) << " " << splitLine.at(2) << " " << splitLine.at(3) << std::endl;
-      vertices.push_back(Vector3());
-      vertices.at(vertices.size() - 1).setX(atof(splitLine.at(1).c_str()));
-      vertices.at(vertices.size() - 1).setY(atof(splitLine.at(2).c_str()));
-      vertices.at(vertices.size() - 1).setZ(atof(splitLine.at(3).c_str()));
+      continue;
     }
-    else if(splitLine.at(0) == "vt")
-    {
-      //std::cout << "VertexTexture" << " " << splitLine.at(1) << " " << splitLine.at(2) << " " << splitLine.at(3) << std::endl;
-      vertexTextures.push_back(Vector3());
-      vertexTextures.at(vertexTextures.size() - 1).setX(atof(splitLine.at(1).c_str()));
-      vertexTextures.at(vertexTextures.size() - 1).setY(-atof(splitLine.at(2).c_str()));
 
-      if(splitLine.size() > 3)
-      {
-        vertexTextures.at(vertexTextures.size() - 1).setZ(atof(splitLine.at(3).c_str()));
-      }
-    }
-    else if(splitLine.at(0) == "g" || splitLine.at(0) == "o")
-    {
-      //std::cout << "New Part: " << splitLine.at(1) << std::endl;
-      part.reset(new Part());
-      part->setName(splitLine.at(1));
-      parts.push_back(part);
-    }
-    else if(splitLine.at(0) == "usemtl")
+    if(tokens.at(0).equals("v"))
     {
-      //std::cout << "Material Group: " << splitLine.at(1) << std::endl;
-      materialGroup.reset(new MaterialGroup());
-
-      for(int i = 0; i < materials.size(); i++)
+      if(tokens.size() < 4)
       {
-        if(materials.at(i)->getName() == splitLine.at(1))
-        {
-          materialGroup->setMaterial(materials.at(i).get());
-        }
+        chunk->error = "Vertex with fewer than 3 coordinates";
+        return;
       }
 
-      part->addMaterialGroup(materialGroup);
+      positions.push_back(tokens.at(1).toFloat());
+      positions.push_back(tokens.at(2).toFloat());
+      positions.push_back(tokens.at(3).toFloat());
+      vertexCount++;
     }
-    else if(splitLine.at(0) == "f")
+    else if(tokens.at(0).equals("vt"))
     {
-      // HACK
-      if(part.get() == NULL)
-      {
-        part = std::tr1::shared_ptr<Part>(new Part());
-        parts.push_back(part);
-      }
-
-      if(materialGroup.get() == NULL)
-      {
-        materialGroup = std::tr1::shared_ptr<MaterialGroup>(new MaterialGroup);
-        materialGroup->setMaterial(materials.at(0).get());
-        part->addMaterialGroup(materialGroup);
-      }
-      // ENDHACK
-
-      face.reset(new Face());
-      splitParameter.clear(); Util::split(splitLine.at(1), '/', &splitParameter);
-      face->setA(vertices.at(atoi(splitParameter.at(0).c_str()) - 1));
-
-      if(splitParameter.size() > 1 && splitParameter.at(1) != "")
-      {
-        face->setTa(vertexTextures.at(atoi(splitParameter.at(1).c_str()) - 1));
-      }
-
-      splitParameter.clear(); Util::split(splitLine.at(2), '/', &splitParameter);
-      face->setB(vertices.at(atoi(splitParameter.at(0).c_str()) - 1));
-
-      if(splitParameter.size() > 1 && splitParameter.at(1) != "")
+      if(tokens.size() < 2)
       {
-        face->setTb(vertexTextures.at(atoi(splitParameter.at(1).c_str()) - 1));
+        chunk->error = "Texture coordinate with no values";
+        return;
       }
 
-      splitParameter.clear(); Util::split(splitLine.at(3), '/', &splitParameter);
-      face->setC(vertices.at(atoi(splitParameter.at(0).c_str()) - 1));
-
-      if(splitParameter.size() > 1 && splitParameter.at(1) != "")
+      // The v coordinate is optional and defaults to 0
+      coords.push_back(tokens.at(1).toFloat());
+      coords.push_back(tokens.size() > 2 ? -tokens.at(2).toFloat() : 0);
+      textureCount++;
+    }
+    else if(tokens.at(0).equals("f"))
+    {
+      if(tokens.size() < 4)
       {
-        face->setTc(vertexTextures.at(atoi(splitParameter.at(1).c_str()) - 1));
+        chunk->error = "Face with fewer than 3 vertices";
+        return;
       }
 
-      materialGroup->addFace(face);
+      corners = tokens.size() > 4 ? 4 : 3;
 
-      if(splitLine.size() > 4)
+      for(int i = 0; i < corners; i++)
       {
-        face.reset(new Face());
-        splitParameter.clear(); Util::split(splitLine.at(3), '/', &splitParameter);
-        face->setA(vertices.at(atoi(splitParameter.at(0).c_str()) - 1));
+        parameterCount = tokens.at(i + 1).split('/', parameter, 3);
+        vertexIndices[i] = parameter[0].toInt();
+        textureIndices[i] = 0;
 
-        if(splitParameter.size() > 1 && splitParameter.at(1) != "")
+        if(parameterCount > 1 && parameter[1].isEmpty() == false)
         {
-          face->setTa(vertexTextures.at(atoi(splitParameter.at(1).c_str()) - 1));
+          textureIndices[i] = parameter[1].toInt();
         }
 
-        splitParameter.clear(); Util::split(splitLine.at(4), '/', &splitParameter);
-        face->setB(vertices.at(atoi(splitParameter.at(0).c_str()) - 1));
-
-        if(splitParameter.size() > 1 && splitParameter.at(1) != "")
+        if(vertexIndices[i] < 1 || textureIndices[i] < 0)
         {
-          face->setTb(vertexTextures.at(atoi(splitParameter.at(1).c_str()) - 1));
+          chunk->error = "Invalid face index \"" + tokens.at(i + 1).toString() + "\"";
+          return;
         }
 
-        splitParameter.clear(); Util::split(splitLine.at(1), '/', &splitParameter);
-        face->setC(vertices.at(atoi(splitParameter.at(0).c_str()) - 1));
+        if(vertexIndices[i] - vertexCount > chunk->vertexOverrun)
+        {
+          chunk->vertexOverrun = vertexIndices[i] - vertexCount;
+          chunk->overrunToken = tokens.at(i + 1);
+        }
 
-        if(splitParameter.size() > 1 && splitParameter.at(1) != "")
+        if(textureIndices[i] - textureCount > chunk->textureOverrun)
         {
-          face->setTc(vertexTextures.at(atoi(splitParameter.at(1).c_str()) - 1));
+          chunk->textureOverrun = textureIndices[i] - textureCount;
+          chunk->overrunToken = tokens.at(i + 1);
         }
+      }
 
-        materialGroup->addFace(face);
+      // Quads are split into the triangles ABC and CDA
+      for(int t = 0; t < corners - 2; t++)
+      {
+        for(int c = 0; c < 3; c++)
+        {
+          positionIndices.push_back(vertexIndices[quadTriangles[t][c]] - 1);
+          coordIndices.push_back(textureIndices[quadTriangles[t][c]] - 1);
+        }
       }
     }
+    else if(tokens.at(0).equals("g") || tokens.at(0).equals("o") ||
+      tokens.at(0).equals("usemtl") || tokens.at(0).equals("mtllib"))
+    {
+      statement.keyword = tokens.at(0);
+      statement.name = tokens.size() > 1 ? tokens.at(1) : Token();
+      statement.face = positionIndices.size() / 3;
+      chunk->statements.push_back(statement);
+    }
   }
+}
 
-  for(int i = 0; i < parts.size(); i++)
+/// \brief Append one array to another, reusing the storage if the destination is empty
+/// \param destination The array to append to
+/// \param source The array to append, left empty afterwards
+template<class T>
+void appendObjChunkArray(std::vector<T>* destination, std::vector<T>* source)
+{
+  if(destination->empty() == true)
   {
-    parts.at(i)->upload();
+    destination->swap(*source);
+    return;
   }
+
+  destination->insert(destination->end(), source->begin(), source->end());
+  std::vector<T>().swap(*source);
 }
 
-/// \brief The model destructor
-Model::~Model(){}
+/// \brief Thread entry point for parseObjChunk
+/// \param chunk The ObjChunk to parse
+///
+/// An exception cannot leave the thread, so any failure is stored in the
+/// chunk's error to be thrown once the chunks are joined.
+void* parseObjChunkThread(void* chunk)
+{
+  try
+  {
+    parseObjChunk((ObjChunk*)chunk);
+  }
+  catch(std::exception& e)
+  {
+    ((ObjChunk*)chunk)->error = e.what();
+  }
 
-/// \brief Load the additional .mtl file from path
-/// \param prefix The directory containing the model
-/// \param fileName The name of the .mtl file
-void Model::_loadMtl(std::string prefix, std::string fileName)
+  return NULL;
+}
+
+/// \brief Run the specified function over every chunk, one thread per chunk
+/// \param chunks The chunks to process
+/// \param function The thread entry point to call with each chunk
+///
+/// The first chunk is processed on the calling thread. If a thread cannot be
+/// created its chunk is also processed on the calling thread.
+void runObjChunks(std::vector<ObjChunk>* chunks, void* (*function)(void*))
 {
-  std::string line;
-  std::ifstream file(std::string(prefix + "/" + fileName).c_str());
-  std::vector<std::string> splitLine;
-  std::tr1::shared_ptr<Material> material;
-  Vector3 vector3;
+  std::vector<pthread_t> threads(chunks->size());
+  std::vector<bool> started(chunks->size(), false);
 
-  if(file.is_open() == false)
+  for(size_t i = 1; i < chunks->size(); i++)
   {
-    throw WavefrontException("Failed to open \"" + fileName + "\"");
+    started.at(i) = pthread_create(&threads.at(i), NULL, function, &chunks->at(i)) == 0;
   }
 
-  while(file.eof() == false)
-  {
-    getline(file, line);
-    splitLine.clear();
-    Util::splitLineWhitespace(line, &splitLine);
+  function(&chunks->at(0));
 
-    if(splitLine.size() < 1)
+  for(size_t i = 1; i < chunks->size(); i++)
+  {
+    if(started.at(i) == true)
     {
-      continue;
+      pthread_join(threads.at(i), NULL);
+    }
+    else
+    {
+      function(&chunks->at(i));
     }
+  }
+}
+
+/// \brief Convert the Z, Y then X rotations of an animation frame to a quaternion
+/// \param rotation The rotations in degrees, applied as performTransformation applies them
+/// \param quaternion The 4 floats to receive the quaternion as W, X, Y then Z
+void eulerToQuaternion(Vector3 rotation, float* quaternion)
+{
+  float halfX = rotation.getX() * (float)M_PI / 360.0f;
+  float halfY = rotation.getY() * (float)M_PI / 360.0f;
+  float halfZ = rotation.getZ() * (float)M_PI / 360.0f;
+  float cx = cosf(halfX);
+  float sx = sinf(halfX);
+  float cy = cosf(halfY);
+  float sy = sinf(halfY);
+  float cz = cosf(halfZ);
+  float sz = sinf(halfZ);
+
+  quaternion[0] = cz * cy * cx + sz * sy * sx;
+  quaternion[1] = cz * cy * sx - sz * sy * cx;
+  quaternion[2] = cz * sy * cx + sz * cy * sx;
+  quaternion[3] = sz * cy * cx - cz * sy * sx;
+}
+
+/// \brief Spherically interpolate between two quaternions along the shortest arc
+/// \param from The quaternion at amount 0
+/// \param to The quaternion at amount 1
+/// \param amount The position between the quaternions
+/// \param quaternion The 4 floats to receive the interpolated quaternion
+void slerpQuaternion(const float* from, const float* to, float amount, float* quaternion)
+{
+  float sign = 1.0f;
+  float fromWeight = 1.0f - amount;
+  float toWeight = amount;
+  float cosine = from[0] * to[0] + from[1] * to[1] + from[2] * to[2] + from[3] * to[3];
+  float angle = 0;
+  float sine = 0;
+  float length = 0;
 
-    if(splitLine.at(0) == "newmtl")
+  if(cosine < 0)
+  {
+    cosine = -cosine;
+    sign = -1.0f;
+  }
+
+  // Nearly parallel quaternions are lerped, as the sine below tends to 0
+  if(cosine < 0.9995f)
+  {
+    angle = acosf(cosine);
+    sine = sinf(angle);
+    fromWeight = sinf(fromWeight * angle) / sine;
+    toWeight = sinf(toWeight * angle) / sine;
+  }
+
+  for(size_t i = 0; i < 4; i++)
+  {
+    quaternion[i] = from[i] * fromWeight + to[i] * toWeight * sign;
+    length += quaternion[i] * quaternion[i];
+  }
+
+  length = sqrtf(length);
+
+  for(size_t i = 0; i < 4; i++)
+  {
+    quaternion[i] /= length;
+  }
+}
+
+}
+
+/// \brief Load the model data from a file
+/// \param path The path of the .obj model to load
+/// \param flags A combination of ModelFlags
+///
+/// With MODEL_CACHE the compiled .wfb file next to the model is used if it is
+/// up to date with the .obj and .mtl files. Otherwise the text files are parsed
+/// and (with MODEL_CACHE) the .wfb file is rewritten. No OpenGL calls are made
+/// so this may be run without a rendering context.
+///
+/// Textures are decoded by an ImageDecoder while the geometry is parsed and
+/// built, and are waited for before the constructor returns.
+ModelData::ModelData(std::string path, int flags)
+{
+  this->flags = flags;
+  decoder.reset(new ImageDecoder());
+
+  if((flags & MODEL_CACHE) == 0 || _loadCache(path + ".wfb") == false)
+  {
+    _loadObj(path);
+
+    for(int i = 0; i < parts.size(); i++)
     {
-      material.reset(new Material());
-      material->setName(splitLine.at(1));
-      materials.push_back(material);
+      parts.at(i)->build(flags);
     }
 
-    if(splitLine.at(0) == "Kd")
+    if((flags & MODEL_CACHE) != 0)
     {
-      vector3 = Vector3();
-      vector3.setX(atof(splitLine.at(1).c_str()));
-      vector3.setY(atof(splitLine.at(2).c_str()));
-      vector3.setZ(atof(splitLine.at(3).c_str()));
-      material->setDiffuse(vector3);
+      _writeCache(path + ".wfb");
     }
+  }
+
+  if((flags & MODEL_LOD) != 0)
+  {
+    simplify();
+  }
 
-    if(splitLine.at(0) == "map_Kd")
+  for(int i = 0; i < materials.size(); i++)
+  {
+    if(materials.at(i)->getTexture() != NULL)
     {
-      material->setTexture(new Texture(prefix + "/" + splitLine.at(1)));
+      materials.at(i)->getTexture()->wait();
     }
   }
+
+  decoder.reset();
 }
 
-/// \brief Obtain a list of parts making up the model
-/// \return A vector of parts
-std::vector<std::tr1::shared_ptr<Part> >* Model::getParts()
+/// \brief Generate simplified levels of detail of every part
+/// \param levels The most levels to generate per MaterialGroup
+/// \param ratio The fraction of the previous level's triangles each level aims for
+///
+/// Must be called before the data is uploaded, and only once (including by
+/// MODEL_LOD). The levels are not written to the model cache; MODEL_LOD
+/// generates them again each time the model is loaded.
+void ModelData::simplify(size_t levels, float ratio)
 {
-  return &parts;
+  // Checked first so a repeated call fails before any part is changed
+  for(int i = 0; i < parts.size(); i++)
+  {
+    if(parts.at(i)->getLevelCount() > 1)
+    {
+      throw WavefrontException("Levels of detail have already been generated");
+    }
+  }
+
+  for(int i = 0; i < parts.size(); i++)
+  {
+    parts.at(i)->simplify(levels, ratio);
+  }
 }
 
-/// \brief Iterate through the parts and draw the model
-void Model::draw()
+/// \brief Obtain the size and error of each level of detail of the whole model
+/// \return The combined LevelStats of every part per level, starting with the original faces
+std::vector<LevelStats> ModelData::getLevelStats()
 {
-  //GLboolean texture2d = false;
-  //GLboolean colorMaterial = false;
-  //GLboolean depthTest = false;
-
-  //glGetBooleanv(GL_TEXTURE_2D, &texture2d);
-  //glEnable(GL_TEXTURE_2D);
-  //glGetBooleanv(GL_COLOR_MATERIAL, &colorMaterial);
-  //glEnable(GL_COLOR_MATERIAL);
-  //glGetBooleanv(GL_DEPTH_TEST, &depthTest);
-  //glEnable(GL_DEPTH_TEST);
+  std::vector<LevelStats> result;
+  LevelStats stats;
+  size_t levels = 1;
 
   for(int i = 0; i < parts.size(); i++)
   {
-    parts.at(i)->draw();
+    levels = std::max(levels, parts.at(i)->getLevelCount());
   }
 
-  //if(texture2d == true) { glEnable(GL_TEXTURE_2D); }
-  //else { glDisable(GL_TEXTURE_2D); }
+  for(size_t l = 0; l < levels; l++)
+  {
+    result.push_back(LevelStats());
 
-  //if(colorMaterial == true) { glEnable(GL_COLOR_MATERIAL); }
-  //else { glDisable(GL_COLOR_MATERIAL); }
+    for(int i = 0; i < parts.size(); i++)
+    {
+      stats = parts.at(i)->getLevelStats(l);
+      result.back().triangles += stats.triangles;
+      result.back().error = std::max(result.back().error, stats.error);
+    }
+  }
 
-  //if(depthTest == true) { glEnable(GL_DEPTH_TEST); }
-  //else { glDisable(GL_DEPTH_TEST); }
+  return result;
 }
 
-/// \brief Default constructor
-Vector3::Vector3()
+/// \brief Obtain the materials used by the model
+/// \return A vector of materials
+std::vector<std::tr1::shared_ptr<Material> >* ModelData::getMaterials()
 {
-  x = 0;
-  y = 0;
-  z = 0;
+  return &materials;
 }
 
-/// \brief Copy constructor
-/// \param source Reference to the Vector3 to be copied
-Vector3::Vector3(const Vector3& source)
+/// \brief Obtain a list of parts making up the model
+/// \return A vector of parts
+std::vector<std::tr1::shared_ptr<Part> >* ModelData::getParts()
 {
-  x = source.x;
-  y = source.y;
-  z = source.z;
+  return &parts;
 }
 
-/// \brief Constructor
-/// \param x The x coordinate of the Vector3
-/// \param y The y coordinate of the Vector3
-/// \param z The z coordinate of the Vector3
-Vector3::Vector3(float x, float y, float z)
+/// \brief Obtain the triangle data shared by all parts of the model
+/// \return A pointer to the Geometry
+Geometry* ModelData::getGeometry()
 {
-  this->x = x;
-  this->y = y;
-  this->z = z;
+  return &geometry;
 }
 
-/// \brief Set the x position
-/// \param x The new x coordinate
-void Vector3::setX(float x)
+/// \brief Obtain the files the model was loaded from
+/// \return A vector of paths to the .obj and .mtl files
+std::vector<std::string>* ModelData::getSources()
 {
-  this->x = x;
+  return &sources;
 }
 
-/// \brief Set the y position
-/// \param y The new y coordinate
-void Vector3::setY(float y)
+/// \brief Obtain the flags the model was loaded with
+/// \return A combination of ModelFlags
+int ModelData::getFlags()
 {
-  this->y = y;
+  return flags;
 }
 
-/// \brief Set the z position
-/// \param z The new z coordinate
-void Vector3::setZ(float z)
+/// \brief Obtain the axis aligned bounding box of the model
+/// \param min Set to the smallest coordinate on each axis
+/// \param max Set to the largest coordinate on each axis
+void ModelData::getBounds(Vector3* min, Vector3* max)
 {
-  this->z = z;
-}
+  std::vector<float>* positions = geometry.getPositions();
+  float low[3] = { 0 };
+  float high[3] = { 0 };
 
-/// \brief Obtain the x position
-/// \return The x position
-float Vector3::getX()
-{
-  return x;
-}
+  for(size_t i = 0; i < positions->size(); i++)
+  {
+    if(i < 3 || positions->at(i) < low[i % 3])
+    {
+      low[i % 3] = positions->at(i);
+    }
 
-/// \brief Obtain the y position
-/// \return The y position
-float Vector3::getY()
-{
-  return y;
-}
+    if(i < 3 || positions->at(i) > high[i % 3])
+    {
+      high[i % 3] = positions->at(i);
+    }
+  }
 
-/// \brief Obtain the z position
-/// \return The z position
-float Vector3::getZ()
-{
-  return z;
+  *min = Vector3(low[0], low[1], low[2]);
+  *max = Vector3(high[0], high[1], high[2]);
 }
 
-/// \brief Default constructor
-Face::Face()
+/// \brief Load the model from a file and upload it to the graphics card
+/// \param path The path of the .obj model to load
+/// \param flags A combination of ModelFlags
+///
+/// A rendering context must be current.
+Model::Model(std::string path, int flags)
 {
-
+  data.reset(new ModelData(path, flags));
+  uploadedMaterials = 0;
+  uploadedParts = 0;
+  selector = NULL;
+  upload();
 }
 
-/// \brief Constructor
-/// \param a The first point of the face
-/// \param b The second point of the face
-/// \param c The third point of the face
-Face::Face(Vector3 a, Vector3 b, Vector3 c)
+/// \brief Create a model from data which has already been loaded
+/// \param data The loaded model data, which may be shared with other models
+///
+/// The data is uploaded by upload or the first call to draw.
+Model::Model(std::tr1::shared_ptr<ModelData> data)
 {
-  this->a = a;
-  this->b = b;
-  this->c = c;
+  this->data = data;
+  uploadedMaterials = 0;
+  uploadedParts = 0;
+  selector = NULL;
 }
 
-/// \brief Destructor
-Face::~Face()
+/// \brief Send the textures and buffers of the model to the graphics card
+///
+/// Must be called with a rendering context current. Calling upload again
+/// does nothing.
+void Model::upload()
 {
-
+  upload(-1);
 }
 
-/// \brief Set the first point
-/// \param a The first point
-void Face::setA(Vector3 a)
+/// \brief Send as much of the model to the graphics card as time allows
+/// \param seconds The time which may be spent, or a negative value for no limit
+/// \return True once the whole model has been uploaded
+///
+/// Textures and parts are uploaded one at a time until the time is used up,
+/// so a large model may be spread over several frames. At least one texture
+/// or part is uploaded per call so the upload always makes progress.
+bool Model::upload(double seconds)
 {
-  this->a = a;
-}
+  std::vector<std::tr1::shared_ptr<Material> >* materials = data->getMaterials();
+  std::vector<std::tr1::shared_ptr<Part> >* parts = data->getParts();
+  double start = Util::getTime();
 
-/// \brief Set the second point
-/// \param b The second point
-void Face::setB(Vector3 b)
-{
-  this->b = b;
-}
+  if(isUploaded() == true)
+  {
+    return true;
+  }
 
-/// \brief Set the third point
-/// \param c The third point
+  if(uploadedMaterials == 0 && uploadedParts == 0)
+  {
+    RenderBackend::get()->initialize();
+  }
+
+  while(uploadedMaterials < materials->size())
+  {
+    if(materials->at(uploadedMaterials)->getTexture() != NULL)
+    {
+      materials->at(uploadedMaterials)->getTexture()->upload();
+    }
+
+    uploadedMaterials++;
+
+    if(seconds >= 0 && Util::getTime() - start >= seconds)
+    {
+      return isUploaded();
+    }
+  }
+
+  while(uploadedParts < parts->size())
+  {
+    parts->at(uploadedParts)->upload(data->getFlags());
+    uploadedParts++;
+
+    if(seconds >= 0 && Util::getTime() - start >= seconds)
+    {
+      return isUploaded();
+    }
+  }
+
+  if(staticPart.get() != NULL)
+  {
+    staticPart->upload(data->getFlags());
+  }
+
+  return true;
+}
+
+/// \brief Check whether the model has been sent to the graphics card
+/// \return True once every texture and part has been uploaded
+bool Model::isUploaded()
+{
+  return uploadedMaterials == data->getMaterials()->size() &&
+    uploadedParts == data->getParts()->size();
+}
+
+/// \brief Obtain the data the model was created from
+/// \return A pointer to the ModelData
+ModelData* Model::getData()
+{
+  return data.get();
+}
+
+/// \brief Parse the model from an .obj file
+/// \param path The path of the .obj model to load
+///
+/// The file is mapped into memory and tokenized in place. With MODEL_PARALLEL
+/// the file is split at line boundaries into one section per processor and the
+/// sections are parsed concurrently. The sections are then merged in file
+/// order so the result is identical to parsing the file serially.
+void ModelData::_loadObj(std::string path)
+{
+  int fileNameStart = -1;
+  std::string prefix;
+  std::vector<std::string> preloaded;
+  long threadCount = 1;
+  size_t splitSize = 0;
+  const char* split = NULL;
+  size_t face = 0;
+  size_t faceCount = 0;
+  size_t runEnd = 0;
+  size_t positionCount = 0;
+  size_t coordCount = 0;
+  size_t indexCount = 0;
+  MappedFile file(path);
+  std::vector<ObjChunk> chunks;
+  std::vector<ObjStatement>* statements = NULL;
+  ObjStatement* current = NULL;
+
+  std::tr1::shared_ptr<Part> part;
+  std::tr1::shared_ptr<MaterialGroup> materialGroup;
+
+  sources.push_back(path);
+  materials.push_back(std::tr1::shared_ptr<Material>(new Material()));
+  materials.at(0)->setName("Default");
+  materials.at(0)->setDiffuse(Vector3(1, 1, 1));
+
+  for(int c = path.length() - 1; c >= 0; c--)
+  {
+    if(path[c] == '\\' || path[c] == '/')
+    {
+      fileNameStart = c;
+      break;
+    }
+  }
+
+  if(fileNameStart != -1)
+  {
+    prefix = path.substr(0, fileNameStart);
+  }
+
+  // Start decoding the textures before the geometry is parsed
+  _preloadMtl(prefix, file.getData(), file.getData() + file.getSize(), &preloaded);
+
+  if((flags & MODEL_PARALLEL) != 0)
+  {
+    threadCount = sysconf(_SC_NPROCESSORS_ONLN);
+
+    // Small files are not worth the cost of starting threads
+    if(threadCount > (long)(file.getSize() / MODEL_PARALLEL_MIN_CHUNK))
+    {
+      threadCount = file.getSize() / MODEL_PARALLEL_MIN_CHUNK;
+    }
+
+    if(threadCount < 1)
+    {
+      threadCount = 1;
+    }
+  }
+
+  chunks.resize(threadCount);
+  splitSize = file.getSize() / threadCount;
+  split = file.getData();
+
+  for(long i = 0; i < threadCount; i++)
+  {
+    chunks.at(i).begin = split;
+    split = file.getData() + file.getSize();
+
+    if(i < threadCount - 1)
+    {
+      split = chunks.at(i).begin + splitSize;
+
+      while(split < file.getData() + file.getSize() && *split != '\n')
+      {
+        split++;
+      }
+
+      if(split < file.getData() + file.getSize())
+      {
+        split++;
+      }
+    }
+
+    chunks.at(i).end = split;
+  }
+
+  runObjChunks(&chunks, parseObjChunkThread);
+
+  for(size_t i = 0; i < chunks.size(); i++)
+  {
+    if(chunks.at(i).error != "")
+    {
+      throw WavefrontException(chunks.at(i).error + " in \"" + path + "\"");
+    }
+
+    positionCount += chunks.at(i).geometry.getPositions()->size();
+    coordCount += chunks.at(i).geometry.getCoords()->size();
+    indexCount += chunks.at(i).geometry.getPositionIndices()->size();
+  }
+
+  if(chunks.size() > 1)
+  {
+    geometry.getPositions()->reserve(positionCount);
+    geometry.getCoords()->reserve(coordCount);
+    geometry.getPositionIndices()->reserve(indexCount);
+    geometry.getCoordIndices()->reserve(indexCount);
+  }
+
+  for(size_t i = 0; i < chunks.size(); i++)
+  {
+    // Indices may only refer to vertices which appear earlier in the file
+    if(chunks.at(i).vertexOverrun > (int)(geometry.getPositions()->size() / 3) ||
+      chunks.at(i).textureOverrun > (int)(geometry.getCoords()->size() / 2))
+    {
+      throw WavefrontException("Invalid face index \"" + chunks.at(i).overrunToken.toString() + "\" in \"" + path + "\"");
+    }
+
+    faceCount = geometry.getFaceCount();
+    statements = &chunks.at(i).statements;
+    face = 0;
+
+    appendObjChunkArray(geometry.getPositions(), chunks.at(i).geometry.getPositions());
+    appendObjChunkArray(geometry.getCoords(), chunks.at(i).geometry.getCoords());
+    appendObjChunkArray(geometry.getPositionIndices(), chunks.at(i).geometry.getPositionIndices());
+    appendObjChunkArray(geometry.getCoordIndices(), chunks.at(i).geometry.getCoordIndices());
+
+    // Replay the statements, handing each run of faces between them to the current group
+    for(size_t s = 0; s <= statements->size(); s++)
+    {
+      if(s < statements->size())
+      {
+        runEnd = statements->at(s).face;
+      }
+      else
+      {
+        runEnd = geometry.getFaceCount() - faceCount;
+      }
+
+      if(runEnd > face)
+      {
+        // HACK
+        if(part.get() == NULL)
+        {
+          part = std::tr1::shared_ptr<Part>(new Part());
+          parts.push_back(part);
+        }
+
+        if(materialGroup.get() == NULL)
+        {
+          materialGroup = std::tr1::shared_ptr<MaterialGroup>(new MaterialGroup);
+          materialGroup->setMaterial(materials.at(0).get());
+          part->addMaterialGroup(materialGroup);
+        }
+        // ENDHACK
+
+        materialGroup->addFaces(&geometry, faceCount + face, runEnd - face);
+        face = runEnd;
+      }
+
+      if(s == statements->size())
+      {
+        break;
+      }
+
+      current = &statements->at(s);
+
+      if(current->keyword.equals("g") || current->keyword.equals("o"))
+      {
+        part.reset(new Part());
+        part->setName(current->name.toString());
+        parts.push_back(part);
+      }
+      else if(current->keyword.equals("usemtl"))
+      {
+        // HACK
+        if(part.get() == NULL)
+        {
+          part = std::tr1::shared_ptr<Part>(new Part());
+          parts.push_back(part);
+        }
+        // ENDHACK
+
+        materialGroup.reset(new MaterialGroup());
+
+        for(int m = 0; m < materials.size(); m++)
+        {
+          if(current->name.equals(materials.at(m)->getName().c_str()))
+          {
+            materialGroup->setMaterial(materials.at(m).get());
+          }
+        }
+
+        part->addMaterialGroup(materialGroup);
+      }
+      else if(current->keyword.equals("mtllib"))
+      {
+        bool found = false;
+
+        for(size_t m = 0; m < preloaded.size(); m++)
+        {
+          if(current->name.equals(preloaded.at(m).c_str()))
+          {
+            preloaded.erase(preloaded.begin() + m);
+            found = true;
+            break;
+          }
+        }
+
+        if(found == false)
+        {
+          _loadMtl(prefix, current->name.toString());
+        }
+      }
+    }
+  }
+}
+
+/// \brief Load the .mtl files named at the start of an .obj file
+/// \param prefix The directory containing the model
+/// \param begin The first character of the .obj file
+/// \param end One past the last character of the .obj file
+/// \param loaded Receives the names of the .mtl files which were loaded
+///
+/// Only the lines before the first vertex or face are read, which is where
+/// mtllib statements are normally placed, so their textures are decoding
+/// while the rest of the file is parsed.
+void ModelData::_preloadMtl(std::string prefix, const char* begin, const char* end, std::vector<std::string>* loaded)
+{
+  std::vector<Token> tokens;
+  Tokenizer tokenizer(begin, end);
+
+  while(tokenizer.nextLine(&tokens) == true)
+  {
+    if(tokens.size() < 1)
+    {
+      continue;
+    }
+
+    if(tokens.at(0).equals("v") || tokens.at(0).equals("vt") ||
+      tokens.at(0).equals("vn") || tokens.at(0).equals("f"))
+    {
+      break;
+    }
+
+    if(tokens.at(0).equals("mtllib") && tokens.size() > 1)
+    {
+      _loadMtl(prefix, tokens.at(1).toString());
+      loaded->push_back(tokens.at(1).toString());
+    }
+  }
+}
+
+/// \brief Obtain the Texture for the specified image
+/// \param path The path of the PNG image
+/// \return The Texture from the TextureCache, decoded by the decoder if the model is still loading
+std::tr1::shared_ptr<Texture> ModelData::_loadTexture(std::string path)
+{
+  return TextureCache::get(path, decoder.get());
+}
+
+/// \brief The model destructor
+Model::~Model(){}
+
+/// \brief Load the additional .mtl file from path
+/// \param prefix The directory containing the model
+/// \param fileName The name of the .mtl file
+void ModelData::_loadMtl(std::string prefix, std::string fileName)
+{
+  std::vector<Token> tokens;
+  std::tr1::shared_ptr<Material> material;
+  std::tr1::shared_ptr<MappedFile> file;
+
+  try
+  {
+    file.reset(new MappedFile(prefix + "/" + fileName));
+  }
+  catch(WavefrontException& e)
+  {
+    throw WavefrontException("Failed to open \"" + fileName + "\"");
+  }
+
+  sources.push_back(prefix + "/" + fileName);
+
+  Tokenizer tokenizer(file->getData(), file->getData() + file->getSize());
+
+  while(tokenizer.nextLine(&tokens) == true)
+  {
+    if(tokens.size() < 1)
+    {
+      continue;
+    }
+
+    if(tokens.at(0).equals("newmtl"))
+    {
+      material.reset(new Material());
+      material->setName(tokens.at(1).toString());
+      materials.push_back(material);
+    }
+
+    if(tokens.at(0).equals("Kd"))
+    {
+      material->setDiffuse(Vector3(tokens.at(1).toFloat(),
+                                   tokens.at(2).toFloat(),
+                                   tokens.at(3).toFloat()));
+    }
+
+    if(tokens.at(0).equals("map_Kd"))
+    {
+      material->setTexture(_loadTexture(prefix + "/" + tokens.at(1).toString()));
+      material->setTexturePath(prefix + "/" + tokens.at(1).toString());
+    }
+  }
+}
+
+/// \brief Obtain a list of parts making up the model
+/// \return A vector of parts
+std::vector<std::tr1::shared_ptr<Part> >* Model::getParts()
+{
+  return data->getParts();
+}
+
+/// \brief Obtain the triangle data shared by all parts of the model
+/// \return A pointer to the Geometry
+Geometry* Model::getGeometry()
+{
+  return data->getGeometry();
+}
+
+/// \brief Iterate through the parts and draw the model
+///
+/// After optimizeStatic the merged groups are drawn in place of the parts.
+/// The model is uploaded first if upload has not been called.
+void Model::draw()
+{
+  std::vector<std::tr1::shared_ptr<Part> >* parts = data->getParts();
+  float matrix[16] = { 0 };
+
+  upload();
+
+  if(staticPart.get() != NULL)
+  {
+    staticPart->render();
+    GLState::restore();
+    return;
+  }
+
+  if(selector != NULL)
+  {
+    CorePipeline::getCurrentMatrix(matrix);
+    boundParts(matrix);
+  }
+
+  //GLboolean texture2d = false;
+  //GLboolean colorMaterial = false;
+  //GLboolean depthTest = false;
+
+  //glGetBooleanv(GL_TEXTURE_2D, &texture2d);
+  //glEnable(GL_TEXTURE_2D);
+  //glGetBooleanv(GL_COLOR_MATERIAL, &colorMaterial);
+  //glEnable(GL_COLOR_MATERIAL);
+  //glGetBooleanv(GL_DEPTH_TEST, &depthTest);
+  //glEnable(GL_DEPTH_TEST);
+
+  for(int i = 0; i < parts->size(); i++)
+  {
+    parts->at(i)->render(selectLevel(i));
+  }
+
+  GLState::restore();
+
+  //if(texture2d == true) { glEnable(GL_TEXTURE_2D); }
+  //else { glDisable(GL_TEXTURE_2D); }
+
+  //if(colorMaterial == true) { glEnable(GL_COLOR_MATERIAL); }
+  //else { glDisable(GL_COLOR_MATERIAL); }
+
+  //if(depthTest == true) { glEnable(GL_DEPTH_TEST); }
+  //else { glDisable(GL_DEPTH_TEST); }
+}
+
+/// \brief Check whether optimizeStatic has merged the parts
+/// \return True if the model is drawn with a MaterialGroup per material
+bool Model::isStatic()
+{
+  return staticPart.get() != NULL;
+}
+
+/// \brief Obtain the groups merged by optimizeStatic
+/// \return The Part holding a MaterialGroup per material, or NULL before optimizeStatic
+Part* Model::getStaticPart()
+{
+  return staticPart.get();
+}
+
+/// \brief Obtain the parts merged into a batch per material for drawing with a matrix palette
+/// \return The MatrixPalette, built and sent to the graphics card on first use
+///
+/// The model is uploaded first if upload has not been called.
+MatrixPalette* Model::getMatrixPalette()
+{
+  if(palette.get() == NULL)
+  {
+    upload();
+    palette.reset(new MatrixPalette(this));
+  }
+
+  return palette.get();
+}
+
+/// \brief Draw or queue only the parts whose bounding spheres are inside a frustum
+/// \param frustum The frustum in eye space, built from the projection matrix
+/// \param queue The queue to add the visible parts to, or NULL to draw them immediately
+///
+/// The bounds are transformed by the current modelview matrix and tested
+/// together. After optimizeStatic the merged groups are drawn if any part is
+/// visible. The model is uploaded first if upload has not been called.
+void Model::drawVisible(Frustum* frustum, RenderQueue* queue)
+{
+  std::vector<std::tr1::shared_ptr<Part> >* parts = data->getParts();
+  float matrix[16] = { 0 };
+
+  upload();
+  CorePipeline::getCurrentMatrix(matrix);
+  boundParts(matrix);
+  spheres.cull(frustum);
+
+  for(int i = 0; i < parts->size(); i++)
+  {
+    if(spheres.isVisible(i) == false)
+    {
+      continue;
+    }
+
+    // The merged groups are drawn whole once any of the parts is visible
+    if(staticPart.get() != NULL)
+    {
+      if(queue == NULL)
+      {
+        staticPart->render();
+      }
+      else
+      {
+        queue->add(staticPart.get(), matrix);
+      }
+
+      break;
+    }
+
+    if(queue == NULL)
+    {
+      parts->at(i)->render(selectLevel(i));
+    }
+    else
+    {
+      queue->add(parts->at(i).get(), matrix, selectLevel(i));
+    }
+  }
+
+  if(queue == NULL)
+  {
+    GLState::restore();
+  }
+}
+
+/// \brief Add the parts of the model to a RenderQueue rather than drawing them
+/// \param queue The queue to add to, using the current modelview matrix
+///
+/// After optimizeStatic the merged groups are queued in place of the parts.
+/// The model is uploaded first if upload has not been called.
+void Model::draw(RenderQueue* queue)
+{
+  std::vector<std::tr1::shared_ptr<Part> >* parts = data->getParts();
+  float matrix[16] = { 0 };
+
+  upload();
+  CorePipeline::getCurrentMatrix(matrix);
+
+  if(staticPart.get() != NULL)
+  {
+    queue->add(staticPart.get(), matrix);
+    return;
+  }
+
+  if(selector != NULL)
+  {
+    boundParts(matrix);
+  }
+
+  for(int i = 0; i < parts->size(); i++)
+  {
+    queue->add(parts->at(i).get(), matrix, selectLevel(i));
+  }
+}
+
+/// \brief Choose the level of detail of each part from the size it covers on screen
+/// \param selector The selector to use, or NULL to always draw the original faces
+///
+/// The levels must have been generated by ModelData::simplify or MODEL_LOD.
+/// The selector is also used by AnimatedModels of the model, except in palette mode.
+void Model::setLodSelector(LodSelector* selector)
+{
+  this->selector = selector;
+}
+
+/// \brief Obtain the selector choosing the level of detail of each part
+/// \return The LodSelector passed to setLodSelector, or NULL
+LodSelector* Model::getLodSelector()
+{
+  return selector;
+}
+
+/// \brief Gather the bounding sphere of each part in eye space
+/// \param matrix The column-major modelview matrix the model is drawn with
+void Model::boundParts(const float* matrix)
+{
+  std::vector<std::tr1::shared_ptr<Part> >* parts = data->getParts();
+  float center[3] = { 0 };
+
+  spheres.clear();
+
+  for(int i = 0; i < parts->size(); i++)
+  {
+    center[0] = parts->at(i)->getCenter()->getX();
+    center[1] = parts->at(i)->getCenter()->getY();
+    center[2] = parts->at(i)->getCenter()->getZ();
+    spheres.add(center, parts->at(i)->getRadius(), matrix);
+  }
+}
+
+/// \brief Choose the level of detail of a part from the spheres gathered by boundParts
+/// \param part The index of the part
+/// \return The level chosen by the LodSelector, or 0 without one
+size_t Model::selectLevel(size_t part)
+{
+  float center[3] = { 0 };
+  float radius = 0;
+
+  if(selector == NULL)
+  {
+    return 0;
+  }
+
+  spheres.getSphere(part, center, &radius);
+
+  return selector->select(center, radius);
+}
+
+/// \brief Default constructor
+Vector3::Vector3()
+{
+  x = 0;
+  y = 0;
+  z = 0;
+}
+
+/// \brief Copy constructor
+/// \param source Reference to the Vector3 to be copied
+Vector3::Vector3(const Vector3& source)
+{
+  x = source.x;
+  y = source.y;
+  z = source.z;
+}
+
+/// \brief Constructor
+/// \param x The x coordinate of the Vector3
+/// \param y The y coordinate of the Vector3
+/// \param z The z coordinate of the Vector3
+Vector3::Vector3(float x, float y, float z)
+{
+  this->x = x;
+  this->y = y;
+  this->z = z;
+}
+
+/// \brief Set the x position
+/// \param x The new x coordinate
+void Vector3::setX(float x)
+{
+  this->x = x;
+}
+
+/// \brief Set the y position
+/// \param y The new y coordinate
+void Vector3::setY(float y)
+{
+  this->y = y;
+}
+
+/// \brief Set the z position
+/// \param z The new z coordinate
+void Vector3::setZ(float z)
+{
+  this->z = z;
+}
+
+/// \brief Obtain the x position
+/// \return The x position
+float Vector3::getX()
+{
+  return x;
+}
+
+/// \brief Obtain the y position
+/// \return The y position
+float Vector3::getY()
+{
+  return y;
+}
+
+/// \brief Obtain the z position
+/// \return The z position
+float Vector3::getZ()
+{
+  return z;
+}
+
+/// \brief Default constructor
+Face::Face()
+{
+
+}
+
+/// \brief Constructor
+/// \param a The first point of the face
+/// \param b The second point of the face
+/// \param c The third point of the face
+Face::Face(Vector3 a, Vector3 b, Vector3 c)
+{
+  this->a = a;
+  this->b = b;
+  this->c = c;
+}
+
+/// \brief Destructor
+Face::~Face()
+{
+
+}
+
+/// \brief Set the first point
+/// \param a The first point
+void Face::setA(Vector3 a)
+{
+  this->a = a;
+}
+
+/// \brief Set the second point
+/// \param b The second point
+void Face::setB(Vector3 b)
+{
+  this->b = b;
+}
+
+/// \brief Set the third point
+/// \param c The third point
 void Face::setC(Vector3 c)
 {
-  this->c = c;
+  this->c = c;
+}
+
+/// \brief Set the first texture coordinate
+/// \param ta The new first texture coordinate
+void Face::setTa(Vector3 ta)
+{
+  this->ta = ta;
+}
+
+/// \brief Set the second texture coordinate
+/// \param tb The new second texture coordinate
+void Face::setTb(Vector3 tb)
+{
+  this->tb = tb;
+}
+
+/// \brief Set the third texture coordinate
+/// \param tc The new third texture coordinate
+void Face::setTc(Vector3 tc)
+{
+  this->tc = tc;
+}
+
+/// \brief Obtain the first texture coordinate
+/// \return The first texture coordinate
+Vector3 Face::getTa()
+{
+  return ta;
+}
+
+/// \brief Obtain the second texture coordinate
+/// \return The second texture coordinate
+Vector3 Face::getTb()
+{
+  return tb;
+}
+
+/// \brief Obtain the third texture coordinate
+/// \return The third texture coordinate
+Vector3 Face::getTc()
+{
+  return tc;
+}
+
+/// \brief Obtain a pointer to the first point
+/// \return A pointer to the first point
+Vector3* Face::getA()
+{
+  return &a;
+}
+
+/// \brief Obtain a pointer to the second point
+/// \return A pointer to the second point
+Vector3* Face::getB()
+{
+  return &b;
+}
+
+/// \brief Obtain a pointer to the third point
+/// \return A pointer to the third point
+Vector3* Face::getC()
+{
+  return &c;
+}
+
+/// \brief Obtain the highest x position in the face
+/// \return The highest x position
+float Face::getMaxX()
+{
+  float maxX = a.getX();
+
+  if(b.getX() > maxX)
+  {
+    maxX = b.getX();
+  }
+
+  if(c.getX() > maxX)
+  {
+    maxX = c.getX();
+  }
+
+  return maxX;
+}
+
+/// \brief Obtain the highest y position in the face
+/// \return The highest y position
+float Face::getMaxY()
+{
+  float maxY = a.getY();
+
+  if(b.getY() > maxY)
+  {
+    maxY = b.getY();
+  }
+
+  if(c.getY() > maxY)
+  {
+    maxY = c.getY();
+  }
+
+  return maxY;
+}
+
+/// \brief Obtain the highest z position in the face
+/// \return The highest z position
+float Face::getMaxZ()
+{
+  float maxZ = a.getZ();
+
+  if(b.getZ() > maxZ)
+  {
+    maxZ = b.getZ();
+  }
+
+  if(c.getZ() > maxZ)
+  {
+    maxZ = c.getZ();
+  }
+
+  return maxZ;
+}
+
+/// \brief Obtain the lowest x position in the face
+/// \return The lowest x position
+float Face::getMinX()
+{
+  float minX = a.getX();
+
+  if(b.getX() < minX)
+  {
+    minX = b.getX();
+  }
+
+  if(c.getX() < minX)
+  {
+    minX = c.getX();
+  }
+
+  return minX;
+}
+
+/// \brief Obtain the lowest y position in the face
+/// \return The lowest y position
+float Face::getMinY()
+{
+  float minY = a.getY();
+
+  if(b.getY() < minY)
+  {
+    minY = b.getY();
+  }
+
+  if(c.getY() < minY)
+  {
+    minY = c.getY();
+  }
+
+  return minY;
+}
+
+/// \brief Obtain the lowest z position in the face
+/// \return The lowest z position
+float Face::getMinZ()
+{
+  float minZ = a.getZ();
+
+  if(b.getZ() < minZ)
+  {
+    minZ = b.getZ();
+  }
+
+  if(c.getZ() < minZ)
+  {
+    minZ = c.getZ();
+  }
+
+  return minZ;
 }
 
-/// \brief Set the first texture coordinate
-/// \param ta The new first texture coordinate
-void Face::setTa(Vector3 ta)
+/// \brief Default constructor
+Part::Part()
 {
-  this->ta = ta;
+  radius = 0;
+  built = false;
+  uploaded = false;
 }
 
-/// \brief Set the second texture coordinate
-/// \param tb The new second texture coordinate
-void Face::setTb(Vector3 tb)
+/// \brief Prepare the part data to be sent to the graphics card
+/// \param flags The ModelFlags the Model was loaded with
+///
+/// Calculates the center and bounds of the part and builds the buffer data
+/// of each of the contained MaterialGroups.
+void Part::build(int flags)
 {
-  this->tb = tb;
+  float minX = 999999;
+  float maxX = -999999;
+  float minY = 999999;
+  float maxY = -999999;
+  float minZ = 999999;
+  float maxZ = -999999;
+  Geometry* geometry = NULL;
+  const float* position = NULL;
+  float distance = 0;
+  size_t first = 0;
+  size_t count = 0;
+
+  for(int i = 0; i < materialGroups.size(); i++)
+  {
+    geometry = materialGroups.at(i)->getGeometry();
+    first = materialGroups.at(i)->getFirstFace();
+    count = materialGroups.at(i)->getFaceCount();
+
+    for(size_t a = first; a < first + count; a++)
+    {
+      for(int c = 0; c < 3; c++)
+      {
+        position = geometry->getPosition(a, c);
+
+        if(position[0] > maxX) { maxX = position[0]; }
+        if(position[1] > maxY) { maxY = position[1]; }
+        if(position[2] > maxZ) { maxZ = position[2]; }
+        if(position[0] < minX) { minX = position[0]; }
+        if(position[1] < minY) { minY = position[1]; }
+        if(position[2] < minZ) { minZ = position[2]; }
+      }
+    }
+  }
+
+  center = Vector3((minX + maxX) / 2,
+                  (minY + maxY) / 2,
+                  (minZ + maxZ) / 2);
+  minimum = Vector3(minX, minY, minZ);
+  maximum = Vector3(maxX, maxY, maxZ);
+  radius = 0;
+
+  // The sphere around the center of the box is usually tighter than the box's own
+  for(int i = 0; i < materialGroups.size(); i++)
+  {
+    geometry = materialGroups.at(i)->getGeometry();
+    first = materialGroups.at(i)->getFirstFace();
+    count = materialGroups.at(i)->getFaceCount();
+
+    for(size_t a = first; a < first + count; a++)
+    {
+      for(int c = 0; c < 3; c++)
+      {
+        position = geometry->getPosition(a, c);
+        distance = (position[0] - center.getX()) * (position[0] - center.getX()) +
+                   (position[1] - center.getY()) * (position[1] - center.getY()) +
+                   (position[2] - center.getZ()) * (position[2] - center.getZ());
+
+        if(distance > radius) { radius = distance; }
+      }
+    }
+  }
+
+  radius = sqrt(radius);
+
+  //std::cout << "Center: " << center.getX() << " " << center.getY() << " " << center.getZ() << std::endl;
+  //std::cout << name << " " << minX << " " << maxX << " " << minY << " " << maxY << " " << minZ << " " << maxZ << std::endl;
+
+  for(int i = 0; i < materialGroups.size(); i++)
+  {
+    materialGroups.at(i)->build(flags);
+  }
+
+  built = true;
 }
 
-/// \brief Set the third texture coordinate
-/// \param tc The new third texture coordinate
-void Face::setTc(Vector3 tc)
+/// \brief Send the part data to the graphics card
+/// \param flags The ModelFlags the Model was loaded with
+///
+/// Iterate through the contained MaterialGroups and call their individual
+/// upload function. If the part has not already been built (or given its
+/// center by setCenter) it is built first. Once uploaded, further calls (such
+/// as from other Models sharing the same ModelData) do nothing. The groups'
+/// data is flushed from the BufferArena before returning.
+void Part::upload(int flags)
 {
-  this->tc = tc;
+  if(uploaded == true)
+  {
+    return;
+  }
+
+  if(built == false)
+  {
+    build(flags);
+  }
+
+  for(int i = 0; i < materialGroups.size(); i++)
+  {
+    materialGroups.at(i)->upload(flags);
+  }
+
+  BufferArena::flush();
+  built = false;
+  uploaded = true;
 }
 
-/// \brief Obtain the first texture coordinate
-/// \return The first texture coordinate
-Vector3 Face::getTa()
+/// \brief Obtain the amount of data the Part's MaterialGroups placed on the graphics card
+/// \return The combined UploadStats of every MaterialGroup
+UploadStats Part::getStats()
+{
+  UploadStats result;
+
+  for(int i = 0; i < materialGroups.size(); i++)
+  {
+    result.add(materialGroups.at(i)->getStats());
+  }
+
+  return result;
+}
+
+/// \brief Obtain the largest quantization errors of the Part's MaterialGroups
+/// \return A Quantization holding only the combined errors
+Quantization Part::getQuantizationError()
+{
+  Quantization result;
+
+  for(int i = 0; i < materialGroups.size(); i++)
+  {
+    result.addError(materialGroups.at(i)->getQuantization());
+  }
+
+  return result;
+}
+
+/// \brief Obtain how well the indices of the Part's MaterialGroups use the vertex cache
+/// \return The combined VertexCacheStats of every MaterialGroup
+VertexCacheStats Part::getVertexCacheStats()
+{
+  VertexCacheStats result;
+
+  for(int i = 0; i < materialGroups.size(); i++)
+  {
+    result.add(materialGroups.at(i)->getVertexCacheStats());
+  }
+
+  return result;
+}
+
+/// \brief Draw the Part
+///
+/// Iterate through the MaterialGroups and call their draw function
+void Part::draw()
+{
+  render();
+  GLState::restore();
+}
+
+/// \brief Draw the MaterialGroups leaving the client arrays and texture set
+/// \param level The level of detail to draw, 0 for the original faces
+///
+/// GLState::restore must be called once the last part has been drawn.
+void Part::render(size_t level)
+{
+  for(int i = 0; i < materialGroups.size(); i++)
+  {
+    materialGroups.at(i)->getLevel(level)->render();
+  }
+}
+
+/// \brief Generate simplified levels of detail of each MaterialGroup
+/// \param levels The most levels to generate
+/// \param ratio The fraction of the previous level's triangles each level aims for
+///
+/// Must be called before the part is uploaded, and only once. The name, center
+/// and bounds are unchanged so animations and culling apply to every level.
+void Part::simplify(size_t levels, float ratio)
+{
+  if(uploaded == true)
+  {
+    throw WavefrontException("Parts must be simplified before they are uploaded");
+  }
+
+  if(getLevelCount() > 1)
+  {
+    throw WavefrontException("Levels of detail have already been generated");
+  }
+
+  for(int i = 0; i < materialGroups.size(); i++)
+  {
+    materialGroups.at(i)->simplify(levels, ratio);
+  }
+}
+
+/// \brief Obtain the number of levels of detail of the part
+/// \return The most levels of any of the MaterialGroups, including the original faces
+size_t Part::getLevelCount()
+{
+  size_t result = 1;
+
+  for(int i = 0; i < materialGroups.size(); i++)
+  {
+    result = std::max(result, materialGroups.at(i)->getLevelCount());
+  }
+
+  return result;
+}
+
+/// \brief Obtain the size and error of a level of detail
+/// \param level The level, 0 for the original faces
+/// \return The triangles drawn by render(level) and the largest error of its groups
+LevelStats Part::getLevelStats(size_t level)
+{
+  LevelStats result;
+  MaterialGroup* group = NULL;
+
+  for(int i = 0; i < materialGroups.size(); i++)
+  {
+    group = materialGroups.at(i)->getLevel(level);
+    result.triangles += group->getFaceCount();
+    result.error = std::max(result.error, group->getError());
+  }
+
+  return result;
+}
+
+/// \brief Obtain the collection of MaterialGroups
+/// \return A pointer to the MaterialGroups
+std::vector<std::tr1::shared_ptr<MaterialGroup> >* Part::getMaterialGroups()
+{
+  return &materialGroups;
+}
+
+/// \brief Obtain the center of the Part
+/// \return A pointer to the center Vector3
+Vector3* Part::getCenter()
+{
+  return &center;
+}
+
+/// \brief Specify the center of the Part rather than calculating it
+/// \param center The new center
+///
+/// Used when the part data has been prepared elsewhere (such as a model cache),
+/// in which case the MaterialGroups must be given their data by MaterialGroup::setStreams.
+void Part::setCenter(Vector3 center)
+{
+  this->center = center;
+  built = true;
+}
+
+/// \brief Obtain the smallest corner of the Part's axis aligned bounding box
+/// \return A pointer to the minimum Vector3
+Vector3* Part::getMinimum()
+{
+  return &minimum;
+}
+
+/// \brief Obtain the largest corner of the Part's axis aligned bounding box
+/// \return A pointer to the maximum Vector3
+Vector3* Part::getMaximum()
+{
+  return &maximum;
+}
+
+/// \brief Obtain the radius of the Part's bounding sphere
+/// \return The distance from the center to the furthest vertex
+float Part::getRadius()
+{
+  return radius;
+}
+
+/// \brief Specify the bounds of the Part rather than calculating them
+/// \param minimum The smallest corner of the bounding box
+/// \param maximum The largest corner of the bounding box
+/// \param radius The radius of the bounding sphere around the center
+///
+/// Used alongside setCenter when the part data has been prepared elsewhere.
+void Part::setBounds(Vector3 minimum, Vector3 maximum, float radius)
+{
+  this->minimum = minimum;
+  this->maximum = maximum;
+  this->radius = radius;
+}
+
+/// \brief Specify the name of the Part
+/// \param name The new name of the Part
+void Part::setName(std::string name)
+{
+  this->name = name;
+}
+
+/// \brief Obtain the name of the Part
+/// \return The name of the Part
+std::string Part::getName()
+{
+  return name;
+}
+
+/// \brief Add a new MaterialGroup to the Part
+/// \param materialGroup The MaterialGroup to add
+void Part::addMaterialGroup(std::tr1::shared_ptr<MaterialGroup> materialGroup)
+{
+  materialGroups.push_back(materialGroup);
+}
+
+/// \brief Default constructor
+MaterialGroup::MaterialGroup()
+{
+  material = NULL;
+  geometry = NULL;
+  firstFace = 0;
+  faceCount = 0;
+  vertexArray = 0;
+  indexType = GL_UNSIGNED_SHORT;
+  interleaved = false;
+  quantized = false;
+  built = false;
+  error = 0;
+}
+
+/// \brief Set the Material for the MaterialGroup
+/// \param material The new Material for the group
+void MaterialGroup::setMaterial(Material* material)
+{
+  this->material = material;
+}
+
+/// \brief Obtain the Material used by the MaterialGroup
+/// \return A pointer to the Material
+Material* MaterialGroup::getMaterial()
+{
+  return material;
+}
+
+/// \brief Add a run of faces to the MaterialGroup
+/// \param geometry The Geometry containing the faces
+/// \param first The index of the first face to add
+/// \param count The number of consecutive faces to add
+///
+/// A group refers to a single range of its Model's Geometry, so the faces
+/// added must directly follow any added previously.
+void MaterialGroup::addFaces(Geometry* geometry, size_t first, size_t count)
+{
+  if(faceCount == 0)
+  {
+    this->geometry = geometry;
+    firstFace = first;
+  }
+  else if(this->geometry != geometry || firstFace + faceCount != first)
+  {
+    throw WavefrontException("Faces added to a MaterialGroup must be consecutive");
+  }
+
+  faceCount += count;
+}
+
+/// \brief Obtain the Geometry the faces of the group are stored in
+/// \return A pointer to the Geometry (NULL if the group is empty)
+Geometry* MaterialGroup::getGeometry()
+{
+  return geometry;
+}
+
+/// \brief Obtain the index of the group's first face within its Geometry
+/// \return The index of the first face
+size_t MaterialGroup::getFirstFace()
+{
+  return firstFace;
+}
+
+/// \brief Obtain the number of faces in the group
+/// \return The number of faces
+size_t MaterialGroup::getFaceCount()
 {
-  return ta;
+  return faceCount;
 }
 
-/// \brief Obtain the second texture coordinate
-/// \return The second texture coordinate
-Vector3 Face::getTb()
+/// \brief Build a copy of one of the group's faces
+/// \param index The index of the face within the group
+/// \return The Face
+Face MaterialGroup::getFace(size_t index)
 {
-  return tb;
+  if(index >= faceCount)
+  {
+    throw WavefrontException("Face index out of range");
+  }
+
+  return geometry->getFace(firstFace + index);
 }
 
-/// \brief Obtain the third texture coordinate
-/// \return The third texture coordinate
-Vector3 Face::getTc()
+/// \brief Convenience function to delete an OpenGL buffer
+/// \param buffer The OpenGL buffer to delete
+///
+/// On Windows platforms, it seems that glDeleteBufferARB is implemented as
+/// a macro and thus does not work with std::tr1::shared_ptr. The name is bound
+/// by value so the deleter still deletes it if the member is later overwritten.
+void MaterialGroup::deleteBuffer(GLuint buffer)
 {
-  return tc;
+  GLState::deleteBuffer(buffer);
 }
 
-/// \brief Obtain a pointer to the first point
-/// \return A pointer to the first point
-Vector3* Face::getA()
+/// \brief Convenience function to delete an OpenGL vertex array object
+/// \param array The vertex array object to delete
+void MaterialGroup::deleteVertexArray(GLuint array)
 {
-  return &a;
+  GLState::deleteVertexArray(array);
 }
 
-/// \brief Obtain a pointer to the second point
-/// \return A pointer to the second point
-Vector3* Face::getB()
+/// \brief Build the buffer data to be sent to the graphics card
+/// \param flags The ModelFlags the Model was loaded with
+///
+/// Every face is expanded into three vertices with a face normal. With
+/// MODEL_INDEXED, corners sharing the same position, normal and texture
+/// coordinate are then welded into a single vertex and an index array is
+/// built alongside. The result is kept until upload is called.
+void MaterialGroup::build(int flags)
+{
+  float triangle[3][3] = { { 0 } };
+  float normal[3] = { 0 };
+  const float* coord = NULL;
+
+  vertexData.clear();
+  colorData.clear();
+  normalData.clear();
+  coordData.clear();
+  interleavedData.clear();
+  indexData.clear();
+  shortIndexData.clear();
+
+  vertexData.reserve(faceCount * 9);
+  normalData.reserve(faceCount * 9);
+  coordData.reserve(faceCount * 6);
+
+  if((flags & (MODEL_INTERLEAVED | MODEL_QUANTIZED)) == 0)
+  {
+    colorData.reserve(faceCount * 12);
+  }
+  for(size_t i = firstFace; i < firstFace + faceCount; i++)
+  {
+    for(int c = 0; c < 3; c++)
+    {
+      memcpy(triangle[c], geometry->getPosition(i, c), sizeof(triangle[c]));
+    }
+
+    Util::calcNormal(triangle, normal);
+
+    for(int c = 0; c < 3; c++)
+    {
+      coord = geometry->getCoord(i, c);
+      vertexData.insert(vertexData.end(), triangle[c], triangle[c] + 3);
+      normalData.insert(normalData.end(), normal, normal + 3);
+      coordData.push_back(coord[0]);
+      coordData.push_back(coord[1]);
+    }
+  }
+
+  // With MODEL_INTERLEAVED the diffuse color is set once per group when drawn
+  if((flags & (MODEL_INTERLEAVED | MODEL_QUANTIZED)) == 0)
+  {
+    for(size_t i = 0; i < faceCount * 3; i++)
+    {
+      colorData.push_back(material->getDiffuse().getX());
+      colorData.push_back(material->getDiffuse().getY());
+      colorData.push_back(material->getDiffuse().getZ());
+      colorData.push_back(1);
+    }
+  }
+
+  if((flags & MODEL_SMOOTH_NORMALS) != 0)
+  {
+    smoothNormals(&vertexData, &normalData);
+  }
+
+  buildStreams(flags);
+}
+
+/// \brief Turn the expanded vertices into the streams to upload
+/// \param flags The ModelFlags the Model was loaded with
+///
+/// Used by build and merge once vertexData, normalData, coordData and,
+/// without MODEL_INTERLEAVED or MODEL_QUANTIZED, colorData hold three
+/// vertices per face.
+void MaterialGroup::buildStreams(int flags)
 {
-  return &b;
+  streams = StreamData();
+
+  if((flags & MODEL_INDEXED) != 0)
+  {
+    weldVertices(&vertexData, &colorData, &normalData, &coordData, &indexData);
+    streams.vertexCache.triangles = indexData.size() / 3;
+    streams.vertexCache.vertices = vertexData.size() / 3;
+    streams.vertexCache.missesBefore = countCacheMisses(&indexData);
+
+    if((flags & MODEL_OPTIMIZED) != 0)
+    {
+      optimizeVertices(&vertexData, &colorData, &normalData, &coordData, &indexData);
+    }
+
+    streams.vertexCache.missesAfter = countCacheMisses(&indexData);
+    streams.indexCount = indexData.size();
+
+    if(vertexData.size() / 3 <= 65536)
+    {
+      shortIndexData.assign(indexData.begin(), indexData.end());
+      std::vector<unsigned int>().swap(indexData);
+      streams.indexType = GL_UNSIGNED_SHORT;
+      streams.indices = &shortIndexData[0];
+    }
+    else
+    {
+      streams.indexType = GL_UNSIGNED_INT;
+      streams.indices = &indexData[0];
+    }
+  }
+
+  streams.vertexCount = vertexData.size() / 3;
+
+  if((flags & MODEL_QUANTIZED) != 0)
+  {
+    quantizeVertices(&vertexData, &normalData, &coordData, &quantizedData, &streams.quantization);
+    std::vector<float>().swap(vertexData);
+    std::vector<float>().swap(normalData);
+    std::vector<float>().swap(coordData);
+    streams.quantized = &quantizedData[0];
+  }
+  else if((flags & MODEL_INTERLEAVED) != 0)
+  {
+    interleavedData.reserve(streams.vertexCount * 8);
+
+    for(size_t i = 0; i < streams.vertexCount; i++)
+    {
+      interleavedData.insert(interleavedData.end(), vertexData.begin() + i * 3, vertexData.begin() + i * 3 + 3);
+      interleavedData.insert(interleavedData.end(), normalData.begin() + i * 3, normalData.begin() + i * 3 + 3);
+      interleavedData.insert(interleavedData.end(), coordData.begin() + i * 2, coordData.begin() + i * 2 + 2);
+    }
+
+    std::vector<float>().swap(vertexData);
+    std::vector<float>().swap(normalData);
+    std::vector<float>().swap(coordData);
+    streams.interleaved = &interleavedData[0];
+  }
+  else
+  {
+    streams.vertices = &vertexData[0];
+    streams.colors = &colorData[0];
+    streams.normals = &normalData[0];
+    streams.coords = &coordData[0];
+  }
+
+  setStreams(streams);
 }
 
-/// \brief Obtain a pointer to the third point
-/// \return A pointer to the third point
-Vector3* Face::getC()
+/// \brief Use buffer data prepared elsewhere rather than building it from the faces
+/// \param streams The arrays to upload, which must remain valid until upload is called
+void MaterialGroup::setStreams(StreamData streams)
 {
-  return &c;
+  this->streams = streams;
+  quantization = streams.quantization;
+  vertexCache = streams.vertexCache;
+  built = true;
+
+  stats = UploadStats();
+  stats.triangles = faceCount;
+  stats.expandedVertices = faceCount * 3;
+  stats.expandedBytes = stats.expandedVertices * streams.getVertexSize();
+  stats.vertices = streams.vertexCount;
+  stats.indices = streams.indexCount;
+  stats.bytes = streams.vertexCount * streams.getVertexSize() + streams.getIndexSize();
 }
 
-/// \brief Obtain the highest x position in the face
-/// \return The highest x position
-float Face::getMaxX()
+/// \brief Obtain the buffer data waiting to be uploaded
+/// \return The arrays set by build or setStreams
+StreamData MaterialGroup::getStreams()
 {
-  float maxX = a.getX();
+  return streams;
+}
 
-  if(b.getX() > maxX)
+/// \brief Upload the buffer data to the graphics card
+/// \param flags The ModelFlags the Model was loaded with
+///
+/// The buffer data stored in memory needs to be uploaded to the graphics card
+/// so it can be used very quickly. If it has not been prepared by build or
+/// setStreams it is built first. Once uploaded, the memory copy is released
+/// and further calls do nothing, so the ranges are never reallocated over
+/// the ones their releasers refer to.
+/// The ranges are allocated from the BufferArena, which must be flushed
+/// before the group is drawn; Part::upload does so for its groups.
+void MaterialGroup::upload(int flags)
+{
+  if(_vertexRange.get() != NULL)
   {
-    maxX = b.getX();
+    return;
   }
 
-  if(c.getX() > maxX)
+  if(built == false)
   {
-    maxX = c.getX();
+    build(flags);
   }
 
-  return maxX;
+  interleaved = streams.interleaved != NULL;
+  quantized = streams.quantized != NULL;
+
+  if(quantized == true)
+  {
+    vertexRange = BufferArena::allocate(GL_ARRAY_BUFFER_ARB, streams.vertexCount*StreamData::QUANTIZED_VERTEX_SIZE);
+  }
+  else if(interleaved == true)
+  {
+    vertexRange = BufferArena::allocate(GL_ARRAY_BUFFER_ARB, streams.vertexCount*StreamData::INTERLEAVED_VERTEX_SIZE);
+  }
+  else
+  {
+    vertexRange = BufferArena::allocate(GL_ARRAY_BUFFER_ARB, streams.vertexCount*3*sizeof(float));
+  }
+
+  _vertexRange.reset(&vertexRange, std::tr1::bind(BufferArena::release, &vertexRange));
+
+  if(streams.indices != NULL)
+  {
+    indexRange = BufferArena::allocate(GL_ELEMENT_ARRAY_BUFFER_ARB, streams.getIndexSize());
+    _indexRange.reset(&indexRange, std::tr1::bind(BufferArena::release, &indexRange));
+    BufferArena::write(&indexRange, streams.indices);
+    indexType = streams.indexType;
+  }
+
+  if(quantized == true)
+  {
+    BufferArena::write(&vertexRange, streams.quantized);
+  }
+  else if(interleaved == true)
+  {
+    BufferArena::write(&vertexRange, streams.interleaved);
+  }
+  else
+  {
+    colorRange = BufferArena::allocate(GL_ARRAY_BUFFER_ARB, streams.vertexCount*4*sizeof(float));
+    _colorRange.reset(&colorRange, std::tr1::bind(BufferArena::release, &colorRange));
+    normalRange = BufferArena::allocate(GL_ARRAY_BUFFER_ARB, streams.vertexCount*3*sizeof(float));
+    _normalRange.reset(&normalRange, std::tr1::bind(BufferArena::release, &normalRange));
+    coordRange = BufferArena::allocate(GL_ARRAY_BUFFER_ARB, streams.vertexCount*2*sizeof(float));
+    _coordRange.reset(&coordRange, std::tr1::bind(BufferArena::release, &coordRange));
+
+    BufferArena::write(&vertexRange, streams.vertices);
+    BufferArena::write(&colorRange, streams.colors);
+    BufferArena::write(&normalRange, streams.normals);
+    BufferArena::write(&coordRange, streams.coords);
+  }
+
+  std::vector<float>().swap(vertexData);
+  std::vector<float>().swap(colorData);
+  std::vector<float>().swap(normalData);
+  std::vector<float>().swap(coordData);
+  std::vector<float>().swap(interleavedData);
+  std::vector<unsigned char>().swap(quantizedData);
+  std::vector<unsigned int>().swap(indexData);
+  std::vector<unsigned short>().swap(shortIndexData);
+  streams = StreamData();
+  built = false;
+
+  for(size_t i = 0; i < levels.size(); i++)
+  {
+    levels.at(i)->upload(flags);
+  }
 }
 
-/// \brief Obtain the highest y position in the face
-/// \return The highest y position
-float Face::getMaxY()
+/// \brief Replace the face normals with the average normal at each position
+/// \param vertices The positions, three per vertex
+/// \param normals The face normals, three per vertex, replaced by the averaged normals
+///
+/// Without this, the normals of neighbouring faces differ so MODEL_INDEXED can
+/// only weld the corners of faces lying in the same plane.
+void MaterialGroup::smoothNormals(std::vector<float>* vertices, std::vector<float>* normals)
 {
-  float maxY = a.getY();
+  size_t count = vertices->size() / 3;
+  std::tr1::unordered_map<VertexKey, Vector3, VertexKeyHash> sums;
+  Vector3* sum = NULL;
+  VertexKey key;
+  float normal[3] = { 0 };
 
-  if(b.getY() > maxY)
+  memset(&key, 0, sizeof(key));
+  sums.rehash(count);
+
+  for(size_t i = 0; i < count; i++)
   {
-    maxY = b.getY();
+    memcpy(&key.values[0], &vertices->at(i * 3), sizeof(float) * 3);
+    sum = &sums[key];
+    sum->setX(sum->getX() + normals->at(i * 3));
+    sum->setY(sum->getY() + normals->at(i * 3 + 1));
+    sum->setZ(sum->getZ() + normals->at(i * 3 + 2));
   }
 
-  if(c.getY() > maxY)
+  for(size_t i = 0; i < count; i++)
   {
-    maxY = c.getY();
+    memcpy(&key.values[0], &vertices->at(i * 3), sizeof(float) * 3);
+    sum = &sums[key];
+    normal[0] = sum->getX();
+    normal[1] = sum->getY();
+    normal[2] = sum->getZ();
+    Util::reduceToUnit(normal);
+    memcpy(&normals->at(i * 3), normal, sizeof(normal));
   }
+}
 
-  return maxY;
+/// \brief Merge identical vertices of the expanded streams
+/// \param vertices The positions, three per vertex, replaced by the unique positions
+/// \param colors The colors, four per vertex, replaced by the unique colors
+/// \param normals The normals, three per vertex, replaced by the unique normals
+/// \param coords The texture coordinates, two per vertex, replaced by the unique coordinates
+/// \param indices Populated with an index into the unique vertices for every original vertex
+///
+/// Vertices are considered identical when their position, normal and texture
+/// coordinate match exactly. The color is the same for the whole group so is
+/// not compared.
+void MaterialGroup::weldVertices(std::vector<float>* vertices, std::vector<float>* colors,
+  std::vector<float>* normals, std::vector<float>* coords, std::vector<unsigned int>* indices)
+{
+  size_t count = vertices->size() / 3;
+  std::vector<float> uniqueVertices;
+  std::vector<float> uniqueColors;
+  std::vector<float> uniqueNormals;
+  std::vector<float> uniqueCoords;
+  std::tr1::unordered_map<VertexKey, unsigned int, VertexKeyHash> lookup;
+  std::tr1::unordered_map<VertexKey, unsigned int, VertexKeyHash>::iterator existing;
+  VertexKey key;
+  unsigned int next = 0;
+
+  lookup.rehash(count);
+  indices->reserve(count);
+
+  for(size_t i = 0; i < count; i++)
+  {
+    memcpy(&key.values[0], &vertices->at(i * 3), sizeof(float) * 3);
+    memcpy(&key.values[3], &normals->at(i * 3), sizeof(float) * 3);
+    memcpy(&key.values[6], &coords->at(i * 2), sizeof(float) * 2);
+    existing = lookup.find(key);
+
+    if(existing != lookup.end())
+    {
+      indices->push_back(existing->second);
+      continue;
+    }
+
+    lookup[key] = next;
+    indices->push_back(next);
+    next++;
+    uniqueVertices.insert(uniqueVertices.end(), vertices->begin() + i * 3, vertices->begin() + i * 3 + 3);
+
+    if(colors->empty() == false)
+    {
+      uniqueColors.insert(uniqueColors.end(), colors->begin() + i * 4, colors->begin() + i * 4 + 4);
+    }
+
+    uniqueNormals.insert(uniqueNormals.end(), normals->begin() + i * 3, normals->begin() + i * 3 + 3);
+    uniqueCoords.insert(uniqueCoords.end(), coords->begin() + i * 2, coords->begin() + i * 2 + 2);
+  }
+
+  vertices->swap(uniqueVertices);
+  colors->swap(uniqueColors);
+  normals->swap(uniqueNormals);
+  coords->swap(uniqueCoords);
 }
 
-/// \brief Obtain the highest z position in the face
-/// \return The highest z position
-float Face::getMaxZ()
-{
-  float maxZ = a.getZ();
+/// \brief Pack the vertices into the MODEL_QUANTIZED format
+/// \param vertices The positions, three per vertex
+/// \param normals The normals, three per vertex
+/// \param coords The texture coordinates, two per vertex
+/// \param output Receives QUANTIZED_VERTEX_SIZE bytes per vertex
+/// \param quantization Receives the scale and center used and the errors introduced
+///
+/// Positions share one scale on every axis so that the normals are only
+/// rescaled, not skewed, by the matrix which restores them.
+void MaterialGroup::quantizeVertices(std::vector<float>* vertices, std::vector<float>* normals,
+  std::vector<float>* coords, std::vector<unsigned char>* output, Quantization* quantization)
+{
+  size_t count = vertices->size() / 3;
+  float low[3] = { 0 };
+  float high[3] = { 0 };
+  float extent = 0;
+  float value = 0;
+  float length = 0;
+  float distance = 0;
+  float dot = 0;
+  short position[3] = { 0 };
+  signed char normal[3] = { 0 };
+  short coord[2] = { 0 };
+  unsigned char* vertex = NULL;
 
-  if(b.getZ() > maxZ)
+  *quantization = Quantization();
+  output->assign(count * StreamData::QUANTIZED_VERTEX_SIZE, 0);
+
+  if(count < 1)
   {
-    maxZ = b.getZ();
+    return;
   }
 
-  if(c.getZ() > maxZ)
+  for(int c = 0; c < 3; c++)
   {
-    maxZ = c.getZ();
+    low[c] = high[c] = vertices->at(c);
+
+    for(size_t i = 0; i < count; i++)
+    {
+      low[c] = std::min(low[c], vertices->at(i * 3 + c));
+      high[c] = std::max(high[c], vertices->at(i * 3 + c));
+    }
+
+    quantization->positionCenter[c] = (low[c] + high[c]) / 2;
+    extent = std::max(extent, high[c] - low[c]);
   }
 
-  return maxZ;
+  quantization->positionScale = extent > 0 ? extent / 65534 : 1;
+
+  for(int c = 0; c < 2; c++)
+  {
+    low[c] = high[c] = coords->at(c);
+
+    for(size_t i = 0; i < count; i++)
+    {
+      low[c] = std::min(low[c], coords->at(i * 2 + c));
+      high[c] = std::max(high[c], coords->at(i * 2 + c));
+    }
+
+    quantization->coordCenter[c] = (low[c] + high[c]) / 2;
+    quantization->coordScale[c] = high[c] > low[c] ? (high[c] - low[c]) / 65534 : 1;
+  }
+
+  for(size_t i = 0; i < count; i++)
+  {
+    vertex = &output->at(i * StreamData::QUANTIZED_VERTEX_SIZE);
+    distance = 0;
+    length = 0;
+    dot = 0;
+
+    for(int c = 0; c < 3; c++)
+    {
+      value = (vertices->at(i * 3 + c) - quantization->positionCenter[c]) / quantization->positionScale;
+      position[c] = (short)std::max(-32767.0f, std::min(32767.0f, floorf(value + 0.5f)));
+      value = quantization->positionCenter[c] + position[c] * quantization->positionScale - vertices->at(i * 3 + c);
+      distance += value * value;
+
+      value = normals->at(i * 3 + c) * 127;
+      normal[c] = (signed char)std::max(-127.0f, std::min(127.0f, floorf(value + 0.5f)));
+      length += normal[c] * normal[c];
+      dot += normal[c] * normals->at(i * 3 + c);
+    }
+
+    quantization->maxPositionError = std::max(quantization->maxPositionError, sqrtf(distance));
+
+    // Zero length normals come from degenerate faces and have no direction to lose
+    if(length > 0)
+    {
+      value = dot / sqrtf(length) / sqrtf(normals->at(i * 3) * normals->at(i * 3) +
+        normals->at(i * 3 + 1) * normals->at(i * 3 + 1) + normals->at(i * 3 + 2) * normals->at(i * 3 + 2));
+      value = acosf(std::max(-1.0f, std::min(1.0f, value))) * 180.0f / (float)M_PI;
+      quantization->maxNormalError = std::max(quantization->maxNormalError, value);
+    }
+
+    for(int c = 0; c < 2; c++)
+    {
+      value = (coords->at(i * 2 + c) - quantization->coordCenter[c]) / quantization->coordScale[c];
+      coord[c] = (short)std::max(-32767.0f, std::min(32767.0f, floorf(value + 0.5f)));
+      value = quantization->coordCenter[c] + coord[c] * quantization->coordScale[c] - coords->at(i * 2 + c);
+      quantization->maxCoordError = std::max(quantization->maxCoordError, fabsf(value));
+    }
+
+    memcpy(vertex, position, sizeof(position));
+    memcpy(vertex + 8, normal, sizeof(normal));
+    memcpy(vertex + 12, coord, sizeof(coord));
+  }
 }
 
-/// \brief Obtain the lowest x position in the face
-/// \return The lowest x position
-float Face::getMinX()
+/// \brief Obtain the amount of data placed on the graphics card by upload
+/// \return The UploadStats of the last upload
+UploadStats MaterialGroup::getStats()
 {
-  float minX = a.getX();
+  return stats;
+}
 
-  if(b.getX() < minX)
+/// \brief Obtain how the vertices were quantized with MODEL_QUANTIZED
+/// \return The Quantization, with zero errors if the group is not quantized
+Quantization MaterialGroup::getQuantization()
+{
+  return quantization;
+}
+
+/// \brief Obtain how well the indices use the post-transform vertex cache
+/// \return The simulated cache misses before and after MODEL_OPTIMIZED, all zero when not indexed
+VertexCacheStats MaterialGroup::getVertexCacheStats()
+{
+  return vertexCache;
+}
+
+/// \brief Obtain the number of levels of detail, including the original faces
+/// \return One more than the number of levels generated by simplify
+size_t MaterialGroup::getLevelCount()
+{
+  return levels.size() + 1;
+}
+
+/// \brief Obtain a level of detail of the group
+/// \param level 0 for the original faces, otherwise the level generated by simplify
+/// \return The group drawing the level, or the most simplified level if there are fewer
+MaterialGroup* MaterialGroup::getLevel(size_t level)
+{
+  if(level == 0 || levels.empty() == true)
   {
-    minX = b.getX();
+    return this;
   }
 
-  if(c.getX() < minX)
+  return levels.at(std::min(level, levels.size()) - 1).get();
+}
+
+/// \brief Obtain the error introduced by simplifying the group's faces
+/// \return The square root of the largest mean squared distance of a collapse, in model units
+float MaterialGroup::getError()
+{
+  return error;
+}
+
+/// \brief Draw the previously uploaded data on the graphics card
+void MaterialGroup::draw()
+{
+  render();
+  GLState::restore();
+}
+
+/// \brief Draw the group leaving the client arrays and texture set
+///
+/// Consecutive groups only change the state which differs between them.
+/// GLState::restore must be called once the last group has been drawn.
+void MaterialGroup::render()
+{
+  RenderBackend* backend = RenderBackend::get();
+  bool rescaleNormal = false;
+
+  if(CorePipeline::isEnabled() == true)
   {
-    minX = c.getX();
+    CorePipeline::render(this);
+    return;
   }
 
-  return minX;
+  GLState::enableClientState(GL_VERTEX_ARRAY);
+  GLState::enableClientState(GL_NORMAL_ARRAY);
+  GLState::enableClientState(GL_TEXTURE_COORD_ARRAY);
+
+  if(usesColorArray() == true)
+  {
+    GLState::enableClientState(GL_COLOR_ARRAY);
+  }
+  else
+  {
+    GLState::disableClientState(GL_COLOR_ARRAY);
+  }
+
+  if(material->getTexture() != NULL)
+  {
+    material->getTexture()->bind();
+  }
+  else
+  {
+    Texture::unbind();
+  }
+
+  if(quantized == true)
+  {
+    rescaleNormal = GLState::isEnabled(GL_RESCALE_NORMAL);
+    GLState::enable(GL_RESCALE_NORMAL);
+    backend->matrixMode(GL_TEXTURE);
+    backend->pushMatrix();
+    transformCoords();
+    backend->matrixMode(GL_MODELVIEW);
+    backend->pushMatrix();
+    transform();
+  }
+
+  setArrays();
+  drawElements();
+
+  if(quantized == true)
+  {
+    backend->popMatrix();
+    backend->matrixMode(GL_TEXTURE);
+    backend->popMatrix();
+    backend->matrixMode(GL_MODELVIEW);
+
+    if(rescaleNormal == false)
+    {
+      GLState::disable(GL_RESCALE_NORMAL);
+    }
+  }
 }
 
-/// \brief Obtain the lowest y position in the face
-/// \return The lowest y position
-float Face::getMinY()
+/// \brief Point the enabled vertex arrays at the group's buffers
+/// \param bufferStart True to point the arrays at the start of the buffers
+/// rather than the group's ranges, for indirect commands addressing the
+/// group's vertices by their index within the buffer
+///
+/// With MODEL_INTERLEAVED or MODEL_QUANTIZED this also sets the current color
+/// to the material's diffuse color.
+void MaterialGroup::setArrays(bool bufferStart)
 {
-  float minY = a.getY();
+  BufferRange vertices = vertexRange;
+  BufferRange colors = colorRange;
+  BufferRange normals = normalRange;
+  BufferRange coords = coordRange;
 
-  if(b.getY() < minY)
+  if(bufferStart == true)
   {
-    minY = b.getY();
+    vertices.offset = 0;
+    colors.offset = 0;
+    normals.offset = 0;
+    coords.offset = 0;
+  }
+
+  if(quantized == true)
+  {
+    GLState::color(material->getDiffuse().getX(), material->getDiffuse().getY(), material->getDiffuse().getZ(), 1);
+    GLState::bindBuffer(GL_ARRAY_BUFFER_ARB, vertexRange.buffer);
+    GLState::vertexPointer(3, GL_SHORT, StreamData::QUANTIZED_VERTEX_SIZE, vertices.getPointer(0));
+    GLState::normalPointer(GL_BYTE, StreamData::QUANTIZED_VERTEX_SIZE, vertices.getPointer(8));
+    GLState::texCoordPointer(2, GL_SHORT, StreamData::QUANTIZED_VERTEX_SIZE, vertices.getPointer(12));
+  }
+  else if(interleaved == true)
+  {
+    GLState::color(material->getDiffuse().getX(), material->getDiffuse().getY(), material->getDiffuse().getZ(), 1);
+    GLState::bindBuffer(GL_ARRAY_BUFFER_ARB, vertexRange.buffer);
+    GLState::vertexPointer(3, GL_FLOAT, StreamData::INTERLEAVED_VERTEX_SIZE, vertices.getPointer(0));
+    GLState::normalPointer(GL_FLOAT, StreamData::INTERLEAVED_VERTEX_SIZE, vertices.getPointer(3 * sizeof(float)));
+    GLState::texCoordPointer(2, GL_FLOAT, StreamData::INTERLEAVED_VERTEX_SIZE, vertices.getPointer(6 * sizeof(float)));
+  }
+  else
+  {
+    GLState::bindBuffer(GL_ARRAY_BUFFER_ARB, colorRange.buffer);
+    GLState::colorPointer(4, GL_FLOAT, 0, colors.getPointer(0));
+
+    GLState::bindBuffer(GL_ARRAY_BUFFER_ARB, normalRange.buffer);
+    GLState::normalPointer(GL_FLOAT, 0, normals.getPointer(0));
+
+    GLState::bindBuffer(GL_ARRAY_BUFFER_ARB, coordRange.buffer);
+    GLState::texCoordPointer(2, GL_FLOAT, 0, coords.getPointer(0));
+
+    GLState::bindBuffer(GL_ARRAY_BUFFER_ARB, vertexRange.buffer);
+    GLState::vertexPointer(3, GL_FLOAT, 0, vertices.getPointer(0));
   }
+}
 
-  if(c.getY() < minY)
+/// \brief Bind the group's vertex array object, creating it on first use
+///
+/// Used by the CorePipeline in place of setArrays. The position, normal,
+/// texture coordinate and color are generic attributes 0 to 3, the color
+/// being left disabled for groups without a color array. Quantized positions
+/// and texture coordinates are passed unnormalized for the pipeline to restore.
+void MaterialGroup::bindVertexArray()
+{
+  if(vertexArray != 0)
   {
-    minY = c.getY();
+    GLState::bindVertexArray(vertexArray);
+    return;
   }
 
-  return minY;
-}
+  glGenVertexArrays(1, &vertexArray);
+  _vertexArray.reset(&vertexArray, std::tr1::bind(MaterialGroup::deleteVertexArray, vertexArray));
+  GLState::bindVertexArray(vertexArray);
 
-/// \brief Obtain the lowest z position in the face
-/// \return The lowest z position
-float Face::getMinZ()
-{
-  float minZ = a.getZ();
+  glEnableVertexAttribArray(0);
+  glEnableVertexAttribArray(1);
+  glEnableVertexAttribArray(2);
 
-  if(b.getZ() < minZ)
+  if(quantized == true)
   {
-    minZ = b.getZ();
+    GLState::bindBuffer(GL_ARRAY_BUFFER_ARB, vertexRange.buffer);
+    glVertexAttribPointer(0, 3, GL_SHORT, GL_FALSE, StreamData::QUANTIZED_VERTEX_SIZE, vertexRange.getPointer(0));
+    glVertexAttribPointer(1, 3, GL_BYTE, GL_TRUE, StreamData::QUANTIZED_VERTEX_SIZE, vertexRange.getPointer(8));
+    glVertexAttribPointer(2, 2, GL_SHORT, GL_FALSE, StreamData::QUANTIZED_VERTEX_SIZE, vertexRange.getPointer(12));
   }
-
-  if(c.getZ() < minZ)
+  else if(interleaved == true)
   {
-    minZ = c.getZ();
+    GLState::bindBuffer(GL_ARRAY_BUFFER_ARB, vertexRange.buffer);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, StreamData::INTERLEAVED_VERTEX_SIZE, vertexRange.getPointer(0));
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, StreamData::INTERLEAVED_VERTEX_SIZE, vertexRange.getPointer(3 * sizeof(float)));
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, StreamData::INTERLEAVED_VERTEX_SIZE, vertexRange.getPointer(6 * sizeof(float)));
+  }
+  else
+  {
+    GLState::bindBuffer(GL_ARRAY_BUFFER_ARB, vertexRange.buffer);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, vertexRange.getPointer(0));
+    GLState::bindBuffer(GL_ARRAY_BUFFER_ARB, normalRange.buffer);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, normalRange.getPointer(0));
+    GLState::bindBuffer(GL_ARRAY_BUFFER_ARB, coordRange.buffer);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, coordRange.getPointer(0));
+    GLState::bindBuffer(GL_ARRAY_BUFFER_ARB, colorRange.buffer);
+    glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, 0, colorRange.getPointer(0));
+    glEnableVertexAttribArray(3);
   }
 
-  return minZ;
+  if(indexRange.buffer != 0)
+  {
+    GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB, indexRange.buffer);
+  }
 }
 
-/// \brief Default constructor
-Part::Part()
+/// \brief Apply the scale restoring quantized positions to the current matrix
+///
+/// Does nothing unless the group was uploaded with MODEL_QUANTIZED.
+void MaterialGroup::transform()
 {
+  if(quantized == false)
+  {
+    return;
+  }
 
+  RenderBackend::get()->translate(quantization.positionCenter[0], quantization.positionCenter[1], quantization.positionCenter[2]);
+  RenderBackend::get()->scale(quantization.positionScale, quantization.positionScale, quantization.positionScale);
 }
 
-/// \brief Send the part data to the graphics card
+/// \brief Apply the scale restoring quantized texture coordinates to the current matrix
 ///
-/// Iterate through the contained MaterialGroups and call their individual
-/// upload function. Also the center of the part is calculated at this stage.
-void Part::upload()
+/// Intended for the texture matrix. Does nothing unless the group was uploaded
+/// with MODEL_QUANTIZED.
+void MaterialGroup::transformCoords()
 {
-  float minX = 999999;
-  float maxX = -999999;
-  float minY = 999999;
-  float maxY = -999999;
-  float minZ = 999999;
-  float maxZ = -999999;
-  std::vector<std::tr1::shared_ptr<Face> >* faces;
-
-  for(int i = 0; i < materialGroups.size(); i++)
+  if(quantized == false)
   {
-    faces = materialGroups.at(i)->getFaces();
-
-    for(int a = 0; a < faces->size(); a++)
-    {
-      // HACK: getMaxX called more than needed
-      if(faces->at(a)->getMaxX() > maxX)
-      {
-        maxX = faces->at(a)->getMaxX();
-      }
-      if(faces->at(a)->getMaxY() > maxY)
-      {
-        maxY = faces->at(a)->getMaxY();
-      }
-      if(faces->at(a)->getMaxZ() > maxZ)
-      {
-        maxZ = faces->at(a)->getMaxZ();
-      }
-
-      if(faces->at(a)->getMinX() < minX)
-      {
-        minX = faces->at(a)->getMinX();
-      }
-      if(faces->at(a)->getMinY() < minY)
-      {
-        minY = faces->at(a)->getMinY();
-      }
-      if(faces->at(a)->getMinZ() < minZ)
-      {
-        minZ = faces->at(a)->getMinZ();
-      }
-    }
+    return;
   }
 
-  center = Vector3((minX + maxX) / 2,
-                  (minY + maxY) / 2,
-                  (minZ + maxZ) / 2);
-
-  //std::cout << "Center: " << center.getX() << " " << center.getY() << " " << center.getZ() << std::endl;
-  //std::cout << name << " " << minX << " " << maxX << " " << minY << " " << maxY << " " << minZ << " " << maxZ << std::endl;
+  RenderBackend::get()->translate(quantization.coordCenter[0], quantization.coordCenter[1], 0);
+  RenderBackend::get()->scale(quantization.coordScale[0], quantization.coordScale[1], 1);
+}
 
-  for(int i = 0; i < materialGroups.size(); i++)
+/// \brief Issue the draw call for the arrays set by setArrays
+///
+/// The index buffer is left bound for the next group; GLState::restore unbinds it.
+void MaterialGroup::drawElements()
+{
+  if(indexRange.buffer != 0)
   {
-    materialGroups.at(i)->upload();
+    GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB, indexRange.buffer);
+    RenderBackend::get()->drawElements(GL_TRIANGLES, stats.indices, indexType, indexRange.getPointer(0));
+  }
+  else
+  {
+    RenderBackend::get()->drawArrays(GL_TRIANGLES, 0, faceCount * 3);
   }
 }
 
-/// \brief Draw the Part
+/// \brief Issue one draw call drawing the arrays set by setArrays many times
+/// \param instances The number of instances to draw
 ///
-/// Iterate through the MaterialGroups and call their draw function
-void Part::draw()
+/// Requires ARB_draw_instanced. The instances are told apart by the vertex
+/// attributes with a divisor set by the caller.
+void MaterialGroup::drawInstanced(GLsizei instances)
 {
-  for(int i = 0; i < materialGroups.size(); i++)
+  if(indexRange.buffer != 0)
+  {
+    GLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB, indexRange.buffer);
+    RenderBackend::get()->drawElementsInstanced(GL_TRIANGLES, stats.indices, indexType, indexRange.getPointer(0), instances);
+  }
+  else
   {
-    materialGroups.at(i)->draw();
+    RenderBackend::get()->drawArraysInstanced(GL_TRIANGLES, 0, faceCount * 3, instances);
   }
 }
 
-/// \brief Obtain the collection of MaterialGroups
-/// \return A pointer to the MaterialGroups
-std::vector<std::tr1::shared_ptr<MaterialGroup> >* Part::getMaterialGroups()
+/// \brief Check whether the group draws with a per-vertex color array
+/// \return False for groups uploaded with MODEL_INTERLEAVED or MODEL_QUANTIZED
+bool MaterialGroup::usesColorArray()
 {
-  return &materialGroups;
+  return interleaved == false && quantized == false;
 }
 
-/// \brief Obtain the center of the Part
-/// \return A pointer to the center Vector3
-Vector3* Part::getCenter()
+/// \brief Check whether the group was uploaded with MODEL_QUANTIZED
+/// \return True if transform and transformCoords must be applied when drawing
+bool MaterialGroup::isQuantized()
 {
-  return &center;
+  return quantized;
 }
 
-/// \brief Specify the name of the Part
-/// \param name The new name of the Part
-void Part::setName(std::string name)
+/// \brief Obtain the buffer holding the group's vertex positions
+/// \return The name of the buffer, or 0 if not uploaded
+GLuint MaterialGroup::getVertexBuffer()
 {
-  this->name = name;
+  return vertexRange.buffer;
 }
 
-/// \brief Obtain the name of the Part
-/// \return The name of the Part
-std::string Part::getName()
+/// \brief Obtain the buffer holding the group's indices
+/// \return The name of the buffer, or 0 if not uploaded with MODEL_INDEXED
+GLuint MaterialGroup::getIndexBuffer()
 {
-  return name;
+  return indexRange.buffer;
 }
 
-/// \brief Add a new MaterialGroup to the Part
-/// \param materialGroup The MaterialGroup to add
-void Part::addMaterialGroup(std::tr1::shared_ptr<MaterialGroup> materialGroup)
+/// \brief Obtain the type of the group's indices
+/// \return GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+GLenum MaterialGroup::getIndexType()
 {
-  materialGroups.push_back(materialGroup);
+  return indexType;
 }
 
 /// \brief Default constructor
-MaterialGroup::MaterialGroup()
+UploadStats::UploadStats()
 {
-  material = NULL;
+  triangles = 0;
+  vertices = 0;
+  indices = 0;
+  bytes = 0;
+  expandedVertices = 0;
+  expandedBytes = 0;
 }
 
-/// \brief Set the Material for the MaterialGroup
-/// \param material The new Material for the group
-void MaterialGroup::setMaterial(Material* material)
+/// \brief Accumulate the figures of another UploadStats
+/// \param other The stats to add
+void UploadStats::add(const UploadStats& other)
 {
-  this->material = material;
+  triangles += other.triangles;
+  vertices += other.vertices;
+  indices += other.indices;
+  bytes += other.bytes;
+  expandedVertices += other.expandedVertices;
+  expandedBytes += other.expandedBytes;
 }
 
-/// \brief Add a new Face to the MaterialGroup
-/// \param face The new Face to add
-void MaterialGroup::addFace(std::tr1::shared_ptr<Face> face)
+/// \brief Default constructor
+Quantization::Quantization()
 {
-  faces.push_back(face);
+  positionCenter[0] = positionCenter[1] = positionCenter[2] = 0;
+  positionScale = 1;
+  coordCenter[0] = coordCenter[1] = 0;
+  coordScale[0] = coordScale[1] = 1;
+  maxPositionError = 0;
+  maxNormalError = 0;
+  maxCoordError = 0;
 }
 
-/// \brief Obtain a list of Faces contained within the group
-/// \return A pointer to the list of faces
-std::vector<std::tr1::shared_ptr<Face> >* MaterialGroup::getFaces()
+/// \brief Combine the errors of another Quantization, keeping the largest
+/// \param other The Quantization whose errors to include
+void Quantization::addError(const Quantization& other)
 {
-  return &faces;
+  maxPositionError = std::max(maxPositionError, other.maxPositionError);
+  maxNormalError = std::max(maxNormalError, other.maxNormalError);
+  maxCoordError = std::max(maxCoordError, other.maxCoordError);
 }
 
-/// \brief Convenience function to delete an OpenGL buffer
-/// \param buffer The OpenGL buffer to delete
-///
-/// On Windows platforms, it seems that glDeleteBufferARB is implemented as
-/// a macro and thus does not work with std::tr1::shared_ptr
-void MaterialGroup::deleteBuffer(GLuint* buffer)
+/// \brief Default constructor
+StreamData::StreamData()
 {
-  glDeleteBuffersARB(1, buffer);
-}
-
-/// \brief Upload the buffer data to the graphics card
-///
-/// The buffer data stored in memory needs to be uploaded to the graphics card
-/// so it can be used very quickly.
-void MaterialGroup::upload()
-{
-  std::vector<float> vertices;
-  std::vector<float> colors;
-  std::vector<float> normals;
-  std::vector<float> coords;
-  Vector3 normal;
-
-  glGenBuffersARB(1, &vertexBuffer);
-  _vertexBuffer.reset(&vertexBuffer, std::tr1::bind(MaterialGroup::deleteBuffer, &vertexBuffer));
-  glGenBuffersARB(1, &colorBuffer);
-  _colorBuffer.reset(&colorBuffer, std::tr1::bind(MaterialGroup::deleteBuffer, &colorBuffer));
-  glGenBuffersARB(1, &normalBuffer);
-  _normalBuffer.reset(&normalBuffer, std::tr1::bind(MaterialGroup::deleteBuffer, &normalBuffer));
-  glGenBuffersARB(1, &coordBuffer);
-  _coordBuffer.reset(&coordBuffer, std::tr1::bind(MaterialGroup::deleteBuffer, &coordBuffer));
-
-  for(int i = 0; i < faces.size(); i++)
-  {
-    normal = Util::calcNormal(*faces.at(i)->getA(), *faces.at(i)->getB(), *faces.at(i)->getC());
-    vertices.push_back(faces.at(i)->getA()->getX());
-    vertices.push_back(faces.at(i)->getA()->getY());
-    vertices.push_back(faces.at(i)->getA()->getZ());
-    colors.push_back(material->getDiffuse().getX());
-    colors.push_back(material->getDiffuse().getY());
-    colors.push_back(material->getDiffuse().getZ());
-    colors.push_back(1);
-    normals.push_back(normal.getX());
-    normals.push_back(normal.getY());
-    normals.push_back(normal.getZ());
-    coords.push_back(faces.at(i)->getTa().getX());
-    coords.push_back(faces.at(i)->getTa().getY());
-    //coords.push_back(faces.at(i)->getTa().getZ());
-
-    /*
-    std::cout << "verts.push_back(" << faces.at(i)->getA().getX() << "); ";
-    std::cout << "verts.push_back(" << faces.at(i)->getA().getY() << "); ";
-    std::cout << "verts.push_back(" << faces.at(i)->getA().getZ() << ");" << std::endl;
-
-    std::cout << "verts.push_back(" << faces.at(i)->getB().getX() << "); ";
-    std::cout << "verts.push_back(" << faces.at(i)->getB().getY() << "); ";
-    std::cout << "verts.push_back(" << faces.at(i)->getB().getZ() << ");" << std::endl;
-
-    std::cout << "verts.push_back(" << faces.at(i)->getC().getX() << "); ";
-    std::cout << "verts.push_back(" << faces.at(i)->getC().getY() << "); ";
-    std::cout << "verts.push_back(" << faces.at(i)->getC().getZ() << ");" << std::endl;
-
-    std::cout << "coords.push_back(" << faces.at(i)->getTa().getX() << "); ";
-    std::cout << "coords.push_back(" << faces.at(i)->getTa().getY() << "); ";
-    std::cout << "coords.push_back(" << faces.at(i)->getTa().getZ() << ");" << std::endl;
-
-    std::cout << "coords.push_back(" << faces.at(i)->getTb().getX() << "); ";
-    std::cout << "coords.push_back(" << faces.at(i)->getTb().getY() << "); ";
-    std::cout << "coords.push_back(" << faces.at(i)->getTb().getZ() << ");" << std::endl;
-
-    std::cout << "coords.push_back(" << faces.at(i)->getTc().getX() << "); ";
-    std::cout << "coords.push_back(" << faces.at(i)->getTc().getY() << "); ";
-    std::cout << "coords.push_back(" << faces.at(i)->getTc().getZ() << ");" << std::endl;
-    */
-
-    vertices.push_back(faces.at(i)->getB()->getX());
-    vertices.push_back(faces.at(i)->getB()->getY());
-    vertices.push_back(faces.at(i)->getB()->getZ());
-    colors.push_back(material->getDiffuse().getX());
-    colors.push_back(material->getDiffuse().getY());
-    colors.push_back(material->getDiffuse().getZ());
-    colors.push_back(1);
-    normals.push_back(normal.getX());
-    normals.push_back(normal.getY());
-    normals.push_back(normal.getZ());
-    coords.push_back(faces.at(i)->getTb().getX());
-    coords.push_back(faces.at(i)->getTb().getY());
-    //coords.push_back(faces.at(i)->getTb().getZ());
-
-    vertices.push_back(faces.at(i)->getC()->getX());
-    vertices.push_back(faces.at(i)->getC()->getY());
-    vertices.push_back(faces.at(i)->getC()->getZ());
-    colors.push_back(material->getDiffuse().getX());
-    colors.push_back(material->getDiffuse().getY());
-    colors.push_back(material->getDiffuse().getZ());
-    colors.push_back(1);
-    normals.push_back(normal.getX());
-    normals.push_back(normal.getY());
-    normals.push_back(normal.getZ());
-    coords.push_back(faces.at(i)->getTc().getX());
-    coords.push_back(faces.at(i)->getTc().getY());
-    //coords.push_back(faces.at(i)->getTc().getZ());
-  }
-
-  glBindBufferARB(GL_ARRAY_BUFFER_ARB, vertexBuffer);
-  glBufferDataARB(GL_ARRAY_BUFFER_ARB, vertices.size()*sizeof(float), &vertices[0], GL_STATIC_DRAW_ARB);
-  glBindBufferARB(GL_ARRAY_BUFFER_ARB, colorBuffer);
-  glBufferDataARB(GL_ARRAY_BUFFER_ARB, colors.size()*sizeof(float), &colors[0], GL_STATIC_DRAW_ARB);
-  glBindBufferARB(GL_ARRAY_BUFFER_ARB, normalBuffer);
-  glBufferDataARB(GL_ARRAY_BUFFER_ARB, normals.size()*sizeof(float), &normals[0], GL_STATIC_DRAW_ARB);
-  glBindBufferARB(GL_ARRAY_BUFFER_ARB, coordBuffer);
-  glBufferDataARB(GL_ARRAY_BUFFER_ARB, coords.size()*sizeof(float), &coords[0], GL_STATIC_DRAW_ARB);
+  vertices = NULL;
+  colors = NULL;
+  normals = NULL;
+  coords = NULL;
+  interleaved = NULL;
+  quantized = NULL;
+  indices = NULL;
+  vertexCount = 0;
+  indexCount = 0;
+  indexType = GL_UNSIGNED_SHORT;
 }
 
-/// \brief Draw the previously uploaded data on the graphics card
-void MaterialGroup::draw()
+/// \brief Obtain the size of one vertex across the arrays in use
+/// \return QUANTIZED_VERTEX_SIZE or INTERLEAVED_VERTEX_SIZE if those arrays are set, otherwise VERTEX_SIZE
+size_t StreamData::getVertexSize() const
 {
-  glEnableClientState(GL_VERTEX_ARRAY);
-  glEnableClientState(GL_COLOR_ARRAY);
-  glEnableClientState(GL_NORMAL_ARRAY);
-  glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-
-  if(material->getTexture() != NULL)
+  if(quantized != NULL)
   {
-    material->getTexture()->bind();
+    return QUANTIZED_VERTEX_SIZE;
   }
-  else
+
+  if(interleaved != NULL)
   {
-    Texture::unbind();
+    return INTERLEAVED_VERTEX_SIZE;
   }
 
-  glBindBufferARB(GL_ARRAY_BUFFER_ARB, colorBuffer);
-  glColorPointer(4, GL_FLOAT, 0, NULL);
-
-  glBindBufferARB(GL_ARRAY_BUFFER_ARB, normalBuffer);
-  glNormalPointer(GL_FLOAT, 0, NULL);
-
-  glBindBufferARB(GL_ARRAY_BUFFER_ARB, coordBuffer);
-  glTexCoordPointer(2, GL_FLOAT, 0, NULL);
-
-  glBindBufferARB(GL_ARRAY_BUFFER_ARB, vertexBuffer);
-  glVertexPointer(3, GL_FLOAT, 0, NULL);
+  return VERTEX_SIZE;
+}
 
-  glDrawArrays(GL_TRIANGLES, 0, faces.size() * 3);
+/// \brief Obtain the size of the index array
+/// \return The size in bytes (0 when not indexed)
+size_t StreamData::getIndexSize() const
+{
+  if(indices == NULL)
+  {
+    return 0;
+  }
 
-  glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-  glDisableClientState(GL_NORMAL_ARRAY);
-  glDisableClientState(GL_COLOR_ARRAY);
-  glDisableClientState(GL_VERTEX_ARRAY);
+  if(indexType == GL_UNSIGNED_INT)
+  {
+    return indexCount * sizeof(unsigned int);
+  }
 
-  Texture::unbind();
+  return indexCount * sizeof(unsigned short);
 }
 
 /// \brief Default constructor
@@ -942,6 +2814,13 @@ void Material::setTexture(Texture* texture)
   this->texture.reset(texture);
 }
 
+/// \brief Set the texture referenced by the Material
+/// \param texture The new texture to reference, which may be shared with other materials
+void Material::setTexture(std::tr1::shared_ptr<Texture> texture)
+{
+  this->texture = texture;
+}
+
 /// \brief Obtain the name of the material
 /// \return The name of the material
 std::string Material::getName()
@@ -949,6 +2828,20 @@ std::string Material::getName()
   return name;
 }
 
+/// \brief Obtain the path of the texture referenced by the Material
+/// \return The path (empty if the material has no texture)
+std::string Material::getTexturePath()
+{
+  return texturePath;
+}
+
+/// \brief Set the path of the texture referenced by the Material
+/// \param texturePath The path the texture was loaded from
+void Material::setTexturePath(std::string texturePath)
+{
+  this->texturePath = texturePath;
+}
+
 /// \brief Split the specified string by the specified delimeter
 /// \param input The string to split
 /// \param splitter The character to split by
@@ -1015,6 +2908,241 @@ void Util::splitLineWhitespace(std::string line, std::vector<std::string>* split
   }
 }
 
+/// \brief Convert the specified characters to a float
+/// \param begin The first character of the number
+/// \param end One past the last character of the number
+/// \return The parsed value (0 if no number could be read)
+///
+/// Unlike atof this does not depend on the current locale and does not
+/// require a null terminated copy of the text. The digits are accumulated as
+/// an integer and scaled by an exact power of ten so the result matches atof
+/// for all typical .obj values. Anything which cannot be represented this way
+/// falls back to strtod.
+float Util::parseFloat(const char* begin, const char* end)
+{
+  static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+    1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19,
+    1e20, 1e21, 1e22 };
+
+  const char* c = begin;
+  bool negative = false;
+  unsigned long long mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+  int explicitExponent = 0;
+  bool exponentNegative = false;
+  double result = 0;
+
+  if(c != end && (*c == '-' || *c == '+'))
+  {
+    negative = (*c == '-');
+    c++;
+  }
+
+  while(c != end && *c == '0')
+  {
+    c++;
+  }
+
+  while(c != end && *c >= '0' && *c <= '9')
+  {
+    mantissa = mantissa * 10 + (*c - '0');
+    digits++;
+    c++;
+  }
+
+  if(c != end && *c == '.')
+  {
+    c++;
+
+    if(digits == 0)
+    {
+      while(c != end && *c == '0')
+      {
+        exponent--;
+        c++;
+      }
+    }
+
+    while(c != end && *c >= '0' && *c <= '9')
+    {
+      mantissa = mantissa * 10 + (*c - '0');
+      digits++;
+      exponent--;
+      c++;
+    }
+  }
+
+  if(c != end && (*c == 'e' || *c == 'E'))
+  {
+    c++;
+
+    if(c != end && (*c == '-' || *c == '+'))
+    {
+      exponentNegative = (*c == '-');
+      c++;
+    }
+
+    while(c != end && *c >= '0' && *c <= '9')
+    {
+      if(explicitExponent < 10000)
+      {
+        explicitExponent = explicitExponent * 10 + (*c - '0');
+      }
+
+      c++;
+    }
+
+    exponent += exponentNegative ? -explicitExponent : explicitExponent;
+  }
+
+  if(digits == 0)
+  {
+    return negative ? -0.0f : 0.0f;
+  }
+
+  // 2^53 is the largest integer a double holds exactly
+  if(digits > 15 || exponent < -22 || exponent > 22)
+  {
+    return (float)strtod(std::string(begin, end).c_str(), NULL);
+  }
+
+  if(exponent < 0)
+  {
+    result = (double)mantissa / powers[-exponent];
+  }
+  else
+  {
+    result = (double)mantissa * powers[exponent];
+  }
+
+  return (float)(negative ? -result : result);
+}
+
+/// \brief Convert the specified characters to an integer
+/// \param begin The first character of the number
+/// \param end One past the last character of the number
+/// \return The parsed value (0 if no number could be read)
+int Util::parseInt(const char* begin, const char* end)
+{
+  const char* c = begin;
+  bool negative = false;
+  int result = 0;
+
+  if(c != end && (*c == '-' || *c == '+'))
+  {
+    negative = (*c == '-');
+    c++;
+  }
+
+  while(c != end && *c >= '0' && *c <= '9')
+  {
+    result = result * 10 + (*c - '0');
+    c++;
+  }
+
+  return negative ? -result : result;
+}
+
+/// \brief Obtain the current time for measuring intervals
+/// \return The time in seconds from an arbitrary starting point
+double Util::getTime()
+{
+  timeval now;
+
+  gettimeofday(&now, NULL);
+
+  return now.tv_sec + now.tv_usec / 1000000.0;
+}
+
+/// \brief Multiply two column-major 4x4 matrices as OpenGL does
+/// \param a The left hand matrix
+/// \param b The right hand matrix
+/// \param result The 16 floats to receive a * b, which may be a or b
+void Util::multiplyMatrix(const float* a, const float* b, float* result)
+{
+  float product[16] = { 0 };
+
+  for(int column = 0; column < 4; column++)
+  {
+    for(int row = 0; row < 4; row++)
+    {
+      for(int i = 0; i < 4; i++)
+      {
+        product[column * 4 + row] += a[i * 4 + row] * b[column * 4 + i];
+      }
+    }
+  }
+
+  memcpy(result, product, sizeof(product));
+}
+
+/// \brief Multiply a matrix by a translation, the equivalent of glTranslatef
+/// \param matrix The column-major matrix to modify
+/// \param x The translation along the x axis
+/// \param y The translation along the y axis
+/// \param z The translation along the z axis
+void Util::translateMatrix(float* matrix, float x, float y, float z)
+{
+  for(int row = 0; row < 4; row++)
+  {
+    matrix[12 + row] += matrix[row] * x + matrix[4 + row] * y + matrix[8 + row] * z;
+  }
+}
+
+/// \brief Multiply a matrix by a scale, the equivalent of glScalef
+/// \param matrix The column-major matrix to modify
+/// \param x The scale along the x axis
+/// \param y The scale along the y axis
+/// \param z The scale along the z axis
+void Util::scaleMatrix(float* matrix, float x, float y, float z)
+{
+  for(int row = 0; row < 4; row++)
+  {
+    matrix[row] *= x;
+    matrix[4 + row] *= y;
+    matrix[8 + row] *= z;
+  }
+}
+
+/// \brief Multiply a matrix by a rotation, the equivalent of glRotatef
+/// \param matrix The column-major matrix to modify
+/// \param angle The angle in degrees
+/// \param x The x component of the unit axis
+/// \param y The y component of the unit axis
+/// \param z The z component of the unit axis
+void Util::rotateMatrix(float* matrix, float angle, float x, float y, float z)
+{
+  float radians = angle * (float)M_PI / 180.0f;
+  float c = (float)cos(radians);
+  float s = (float)sin(radians);
+  float rotation[16] =
+  {
+    x * x * (1 - c) + c, y * x * (1 - c) + z * s, x * z * (1 - c) - y * s, 0,
+    x * y * (1 - c) - z * s, y * y * (1 - c) + c, y * z * (1 - c) + x * s, 0,
+    x * z * (1 - c) + y * s, y * z * (1 - c) - x * s, z * z * (1 - c) + c, 0,
+    0, 0, 0, 1
+  };
+
+  multiplyMatrix(matrix, rotation, matrix);
+}
+
+/// \brief Calculate a 64-bit FNV-1a hash of the specified data
+/// \param data The data to hash
+/// \param size The number of bytes to hash
+/// \return The hash value
+unsigned long long Util::hash(const char* data, size_t size)
+{
+  unsigned long long result = 14695981039346656037ULL;
+
+  for(size_t i = 0; i < size; i++)
+  {
+    result = (result ^ (unsigned char)data[i]) * 1099511628211ULL;
+  }
+
+  return result;
+}
+
 /// \brief Normalize the specified Vector3
 /// \param vector The Vector3 to normalize
 void Util::reduceToUnit(float vector[3])
@@ -1084,85 +3212,46 @@ Vector3 Util::calcNormal(Vector3 a, Vector3 b, Vector3 c)
   calcNormal(v, o);
 
   result.setX(o[0]);
-  result.setY(o[1]);
-  result.setZ(o[2]);
-
-  return result;
-}
-
-/// \brief Clear the data from the character array
-/// \param data The pointer to the character array to clear
-///
-/// Because using c-style arrays, shared_ptr had difficulties with the deleter function
-void Texture::freeData(unsigned char* data)
-{
-  delete[] data;
-}
-
-/// \brief Delete the texture stored on the graphics card
-/// \param texture Reference of the texture to free
-///
-/// Because Windows seems to implement this function as a typedef or macro it
-/// gave shared_ptr issues
-void Texture::freeTexture(GLuint* texture)
-{
-  glDeleteTextures(1, texture);
+  result.setY(o[1]);
+  result.setZ(o[2]);
+
+  return result;
 }
 
 /// \brief Free the specified PNG struct (from the heap)
 /// \param png_ptr The pointer to the struct
-void Texture::freePngStruct(png_structp png_ptr)
+void Image::freePngStruct(png_structp png_ptr)
 {
   png_destroy_read_struct(&png_ptr, NULL, NULL);
 }
 
 /// \brief Free the specified PNG info struct
 /// \param info_ptr The pointer to free
-void Texture::freeInfoStruct(png_infop info_ptr)
+void Image::freeInfoStruct(png_infop info_ptr)
 {
   png_structp temp = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
   png_destroy_read_struct(&temp, &info_ptr, NULL);
 }
 
-/// \brief Free the specified PNG byte rows
-/// \param rows The pointer to rows to free
-void Texture::freeRows(png_bytep* rows)
-{
-  int y = 0;
-
-  while(true)
-  {
-    if(rows[y] == NULL)
-    {
-      break;
-    }
-
-    free(rows[y]);
-    y++;
-  }
-
-  free(rows);
-}
-
 /// \brief Constructor
-/// \param path The path of the texture to load
-Texture::Texture(std::string path)
+/// \param path The path of the PNG image to decode
+Image::Image(std::string path)
 {
   int ctype = 0;
-  int width = 0;
-  int height = 0;
-  int counter = 0;
+  width = 0;
+  height = 0;
+  channels = 0;
+  size_t rowBytes = 0;
   int number_of_passes = 0;
   png_byte color_type = 0;
   png_byte bit_depth = 0;
   png_byte header[8] = { 0 };
-  std::tr1::shared_ptr<unsigned char> data;
 
   ctype = 3;
   FILE* _fp = NULL; std::tr1::shared_ptr<FILE> fp;
   png_structp _png_ptr; std::tr1::shared_ptr<png_structp> png_ptr;
   png_infop _info_ptr; std::tr1::shared_ptr<png_infop> info_ptr;
-  std::tr1::shared_ptr<png_bytep> row_pointers;
+  std::vector<png_bytep> row_pointers;
 
   _fp = fopen(path.c_str(), "rb");
 
@@ -1186,7 +3275,7 @@ Texture::Texture(std::string path)
     throw WavefrontException("Failed to create PNG read struct");
   }
 
-  png_ptr.reset(&_png_ptr, std::tr1::bind(Texture::freePngStruct, _png_ptr));
+  png_ptr.reset(&_png_ptr, std::tr1::bind(Image::freePngStruct, _png_ptr));
   _info_ptr = png_create_info_struct(_png_ptr);
 
   if(_info_ptr == NULL)
@@ -1194,7 +3283,7 @@ Texture::Texture(std::string path)
     throw WavefrontException("Failed to create PNG info struct");
   }
 
-  info_ptr.reset(&_info_ptr, std::tr1::bind(Texture::freeInfoStruct, _info_ptr));
+  info_ptr.reset(&_info_ptr, std::tr1::bind(Image::freeInfoStruct, _info_ptr));
 
   if(setjmp(png_jmpbuf(*png_ptr.get())))
   {
@@ -1222,74 +3311,197 @@ Texture::Texture(std::string path)
   }
 
   bit_depth = png_get_bit_depth(*png_ptr.get(), *info_ptr.get());
+
+  if(bit_depth == 16)
+  {
+    png_set_strip_16(*png_ptr.get());
+  }
+
   number_of_passes = png_set_interlace_handling(*png_ptr.get());
   png_read_update_info(*png_ptr.get(), *info_ptr.get());
 
   //std::cout << width << " " << height << std::endl;
 
-  row_pointers.reset((png_bytep*)calloc(height + 1, sizeof(png_bytep)), std::tr1::bind(freeRows, std::tr1::placeholders::_1));
+  // Decode every row straight into its place in the pixel buffer
+  rowBytes = png_get_rowbytes(*png_ptr.get(), *info_ptr.get());
+  pixels.resize(rowBytes * height);
+  row_pointers.resize(height);
 
   for(int y = 0; y < height; y++)
   {
-    row_pointers.get()[y] = (png_byte*)malloc(png_get_rowbytes(*png_ptr.get(), *info_ptr.get()));
+    row_pointers.at(y) = &pixels[y * rowBytes];
   }
 
-  //std::cout << "Debug: " << png_get_rowbytes(*png_ptr.get(), *info_ptr.get()) << std::endl;
-  //std::cout << "Debug: " << width * 4 << std::endl;
+  if(height > 0)
+  {
+    png_read_image(*png_ptr.get(), &row_pointers[0]);
+  }
 
-  png_read_image(*png_ptr.get(), row_pointers.get());
-  //data.reset(new unsigned char[width*height*4], std::tr1::bind(freeData, std::tr1::placeholders::_1));
-  data.reset(new unsigned char[width*height*ctype], std::tr1::bind(freeData, std::tr1::placeholders::_1));
+  channels = ctype;
+}
 
-  for(int y = 0; y < height; y++)
-  {
-    //for(int x = 0; x < width*4; x++)
-    for(int x = 0; x < width*ctype; x++)
-    {
-      data.get()[counter] = (unsigned char)row_pointers.get()[y][x];
-      //std::cout << (int)data.get()[counter] << " ";
-      counter++;
-    }
+/// \brief Obtain the width of the image
+/// \return The width in pixels
+int Image::getWidth()
+{
+  return width;
+}
 
-    //std::cout << std::endl;
-  }
+/// \brief Obtain the height of the image
+/// \return The height in pixels
+int Image::getHeight()
+{
+  return height;
+}
 
-  glGenTextures(1, &texture);
-  _texture.reset(&texture, std::tr1::bind(Texture::freeTexture, &texture));
-  glBindTexture(GL_TEXTURE_2D, texture);
-  glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
-  //glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  //glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+/// \brief Obtain the number of channels per pixel
+/// \return 3 for RGB or 4 for RGBA
+int Image::getChannels()
+{
+  return channels;
+}
+
+/// \brief Obtain the decoded pixel data
+/// \return A pointer to the first byte of the top row
+unsigned char* Image::getPixels()
+{
+  return &pixels[0];
+}
+
+/// \brief Obtain the size of the decoded pixel data
+/// \return The size in bytes
+size_t Image::getSize()
+{
+  return pixels.size();
+}
+
+/// \brief Delete the texture stored on the graphics card
+/// \param texture Reference of the texture to free
+///
+/// Because Windows seems to implement this function as a typedef or macro it
+/// gave shared_ptr issues
+void Texture::freeTexture(GLuint* texture)
+{
+  GLState::deleteTexture(*texture);
+}
+
+/// \brief Constructor
+/// \param path The path of the texture to load
+///
+/// The image is decoded and uploaded to the graphics card immediately so a
+/// rendering context must be current.
+Texture::Texture(std::string path)
+{
+  texture = 0;
+  pthread_mutex_init(&mutex, NULL);
+  image.reset(new Image(path));
+  upload();
+}
+
+/// \brief Constructor
+/// \param image The decoded image to upload when upload is called
+///
+/// No rendering context is needed until upload is called.
+Texture::Texture(std::tr1::shared_ptr<Image> image)
+{
+  texture = 0;
+  pthread_mutex_init(&mutex, NULL);
+  this->image = image;
+}
+
+/// \brief Constructor
+/// \param request The image being decoded by an ImageDecoder
+///
+/// The image is waited for by wait or upload.
+Texture::Texture(std::tr1::shared_ptr<ImageRequest> request)
+{
+  texture = 0;
+  pthread_mutex_init(&mutex, NULL);
+  this->request = request;
+}
 
-  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+/// \brief Wait for the image to finish decoding
+///
+/// Throws a WavefrontException if the image could not be decoded. Does nothing
+/// if the Texture was given a decoded image.
+void Texture::wait()
+{
+  std::tr1::shared_ptr<ImageRequest> waiting;
 
-  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  pthread_mutex_lock(&mutex);
+  waiting = request;
+  pthread_mutex_unlock(&mutex);
 
-  if(ctype == 3)
+  if(waiting.get() == NULL)
   {
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data.get());
+    return;
   }
-  else
+
+  // Throws without changing the Texture if decoding failed
+  waiting->getImage();
+
+  pthread_mutex_lock(&mutex);
+
+  if(request.get() != NULL)
+  {
+    image = request->getImage();
+    request.reset();
+  }
+
+  pthread_mutex_unlock(&mutex);
+}
+
+/// \brief Send the decoded image to the graphics card
+///
+/// Waits for the image if it is still being decoded. The decoded image is
+/// released afterwards. Calling upload on a Texture which
+/// has already been uploaded does nothing.
+void Texture::upload()
+{
+  if(_texture.get() != NULL)
   {
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data.get());
+    return;
   }
+
+  wait();
+  texture = RenderBackend::get()->genTexture();
+  _texture.reset(&texture, std::tr1::bind(Texture::freeTexture, &texture));
+  GLState::bindTexture(texture);
+  RenderBackend::get()->texImage(image->getWidth(), image->getHeight(), image->getChannels(), image->getPixels());
+
+  image.reset();
+}
+
+/// \brief Check whether the texture has been sent to the graphics card
+/// \return True once upload has been called
+bool Texture::isUploaded()
+{
+  return _texture.get() != NULL;
 }
 
 /// \brief Destructor
-Texture::~Texture(){}
+Texture::~Texture()
+{
+  pthread_mutex_destroy(&mutex);
+}
 
 /// \brief Bind the texture so that the shader's sampler can use it
 void Texture::bind()
 {
-  glBindTexture(GL_TEXTURE_2D, texture);
+  GLState::bindTexture(texture);
+}
+
+/// \brief Obtain the name of the texture on the graphics card
+/// \return The texture name, or 0 if not uploaded
+GLuint Texture::getId()
+{
+  return texture;
 }
 
 /// \brief Unbind the texture so that subsequent draws do not use the texture
 void Texture::unbind()
 {
-  glBindTexture(GL_TEXTURE_2D, 0);
+  GLState::bindTexture(0);
 }
 
 /// \brief Constructor
@@ -1297,140 +3509,201 @@ void Texture::unbind()
 Animation::Animation(std::string path)
 {
   Frame* frame = NULL;
-  std::ifstream file;
-  std::string line;
-  std::vector<std::string> splitLine;
+  std::vector<Token> tokens;
+  std::tr1::shared_ptr<MappedFile> file;
 
-  file.open(path.c_str());
+  steps = 1;
+  join = false;
 
-  if(file.is_open() == false)
+  try
+  {
+    file.reset(new MappedFile(path));
+  }
+  catch(WavefrontException& e)
   {
     throw WavefrontException("Failed to open '" + path + "'");
   }
 
-  while(file.eof() == false)
-  {
-    getline(file, line);
-    splitLine.clear();
-    Util::splitLineWhitespace(line, &splitLine);
+  Tokenizer tokenizer(file->getData(), file->getData() + file->getSize());
 
-    if(splitLine.size() < 1)
+  while(tokenizer.nextLine(&tokens) == true)
+  {
+    if(tokens.size() < 1)
     {
       continue;
     }
 
-    if(splitLine.at(0) == "f")
+    if(tokens.at(0).equals("f"))
     {
       frames.push_back(std::tr1::shared_ptr<Frame>(new Frame()));
       frame = frames.at(frames.size() - 1).get();
-      //std::cout << "Added frame" << std::endl;
     }
 
-    if(splitLine.at(0) == "t")
+    if(tokens.at(0).equals("t"))
     {
-      frame->add(splitLine.at(1),
-                 Vector3(atof(splitLine.at(2).c_str()), atof(splitLine.at(3).c_str()), atof(splitLine.at(4).c_str())),
-                 Vector3(atof(splitLine.at(5).c_str()), atof(splitLine.at(6).c_str()), atof(splitLine.at(7).c_str())));
-      //std::cout << "Added transition" << std::endl;
+      frame->add(tokens.at(1).toString(),
+                 Vector3(tokens.at(2).toFloat(), tokens.at(3).toFloat(), tokens.at(4).toFloat()),
+                 Vector3(tokens.at(5).toFloat(), tokens.at(6).toFloat(), tokens.at(7).toFloat()));
     }
   }
 }
 
-/// \brief Smooths and slows down the animation by interpolating rotations and positions between frames.
-/// \param passes The number of new interpolated frames added between each of the original frames
+/// \brief Slows down the animation by sampling it between the original frames
+/// \param passes The number of times to double the frame positions between each of the original frames
 /// \param join Set to true to smooth the translation between last and first frame
+///
+/// No frames are added; the extra frame positions are sampled by transform and
+/// performTransformation, so getFrameCount grows as it would have had each pass
+/// inserted a frame between every pair of frames.
 void Animation::interpolate(int passes, bool join)
 {
-  Frame* frame = NULL;
-  Frame* nextFrame = NULL;
-  Frame* newFrame = NULL;
-  Vector3* rotation = NULL;
-  Vector3* translation = NULL;
-  Vector3* nextRotation = NULL;
-  Vector3* nextTranslation = NULL;
-
   for(int p = 0; p < passes; p++)
   {
+    steps *= 2;
+  }
+
+  this->join = join;
+}
 
-  for(int i = 0; i < frames.size(); i++)
+/// \brief Find the translation and rotation of a part at a frame position
+/// \param partName The name of the part
+/// \param frame The frame position, which may fall between two frames
+/// \param translation The translation to set
+/// \param rotation The 4 floats to receive the rotation as an angle in degrees followed by its axis
+/// \return False if the part is not in the animation
+///
+/// The translation is lerped and the rotation slerped between the original frames
+/// either side of the position.
+bool Animation::sample(std::string partName, double frame, Vector3* translation, float* rotation)
+{
+  double position = std::max(0.0, frame / steps);
+  size_t index = (size_t)position;
+  size_t nextIndex = index + 1;
+  float amount = (float)(position - index);
+  Frame* current = frames.at(index).get();
+  Frame* next = current;
+  int partIndex = current->getIndexOfPart(partName);
+  int nextPartIndex = partIndex;
+  Vector3 from;
+  Vector3 to;
+  float fromQuaternion[4] = { 0 };
+  float toQuaternion[4] = { 0 };
+  float quaternion[4] = { 0 };
+  float w = 0;
+  float sine = 0;
+
+  if(partIndex == -1)
   {
-    frame = frames.at(i).get();
+    return false;
+  }
 
-    if(i == frames.size() - 1)
-    {
-      if(join == false)
-      {
-        break;
-        //continue;
-      }
+  if(nextIndex >= frames.size() && join == true)
+  {
+    nextIndex = 0;
+  }
 
-      nextFrame = frames.at(0).get();
-    }
-    else
+  if(amount > 0 && nextIndex < frames.size())
+  {
+    next = frames.at(nextIndex).get();
+    nextPartIndex = next->getIndexOfPart(partName);
+
+    if(nextPartIndex == -1)
     {
-      nextFrame = frames.at(i + 1).get();
+      next = current;
+      nextPartIndex = partIndex;
     }
+  }
 
-    newFrame = new Frame();
+  from = current->getTranslation(partIndex);
+  to = next->getTranslation(nextPartIndex);
+  *translation = Vector3(from.getX() + (to.getX() - from.getX()) * amount,
+                         from.getY() + (to.getY() - from.getY()) * amount,
+                         from.getZ() + (to.getZ() - from.getZ()) * amount);
 
-    for(int j = 0; j < frame->partNames.size(); j++)
-    {
-      rotation = &frame->rotations.at(j);
-      translation = &frame->translations.at(j);
-      nextRotation = &nextFrame->rotations.at(j);
-      nextTranslation = &nextFrame->translations.at(j);
-      Vector3 newRotation((rotation->getX() + nextRotation->getX()) / 2,
-                          (rotation->getY() + nextRotation->getY()) / 2,
-                          (rotation->getZ() + nextRotation->getZ()) / 2);
+  eulerToQuaternion(current->getRotation(partIndex), fromQuaternion);
+  eulerToQuaternion(next->getRotation(nextPartIndex), toQuaternion);
+  slerpQuaternion(fromQuaternion, toQuaternion, amount, quaternion);
 
-      Vector3 newTranslation((translation->getX() + nextTranslation->getX()) / 2,
-                             (translation->getY() + nextTranslation->getY()) / 2,
-                             (translation->getZ() + nextTranslation->getZ()) / 2);
+  w = std::max(-1.0f, std::min(1.0f, quaternion[0]));
+  sine = sqrtf(1.0f - w * w);
 
-      newFrame->partNames.push_back(frame->partNames.at(j));
-      newFrame->rotations.push_back(newRotation);
-      newFrame->translations.push_back(newTranslation);
-    }
+  if(sine < 0.000001f)
+  {
+    rotation[0] = 0;
+    rotation[1] = 1;
+    rotation[2] = 0;
+    rotation[3] = 0;
 
-    frames.insert(frames.begin() + i + 1, std::tr1::shared_ptr<Frame>(newFrame));
-    i++;
+    return true;
   }
 
-  }
+  rotation[0] = 2.0f * acosf(w) * 180.0f / (float)M_PI;
+  rotation[1] = quaternion[1] / sine;
+  rotation[2] = quaternion[2] / sine;
+  rotation[3] = quaternion[3] / sine;
+
+  return true;
 }
 
 /// \brief Use the specified part name and perform the matching translations and rotations on it
 /// \param partName The name of the part to translate / rotate
-/// \param frame The frame index of the translations and rotations
+/// \param frame The frame position of the translations and rotations, which may fall between frames
 /// \param undo Unused
-void Animation::performTransformation(std::string partName, int frame, bool undo)
+void Animation::performTransformation(std::string partName, double frame, bool undo)
 {
-  int partIndex = -1;
   Vector3 translation;
-  Vector3 rotation;
+  float rotation[4] = { 0 };
 
-  partIndex = frames.at(frame)->getIndexOfPart(partName);
+  if(sample(partName, frame, &translation, rotation) == false)
+  {
+    return;
+  }
 
-  if(partIndex == -1)
+  RenderBackend::get()->translate(translation.getX(), translation.getY(), translation.getZ());
+
+  if(rotation[0] != 0)
+  {
+    RenderBackend::get()->rotate(rotation[0], rotation[1], rotation[2], rotation[3]);
+  }
+}
+
+/// \brief Apply the translation and rotation of a part to a matrix
+/// \param partName The name of the part to transform
+/// \param frame The frame position to take the transformation from, which may fall between frames
+/// \param matrix The column-major matrix to multiply, as performTransformation does the current matrix
+void Animation::transform(std::string partName, double frame, float* matrix)
+{
+  Vector3 translation;
+  float rotation[4] = { 0 };
+
+  if(sample(partName, frame, &translation, rotation) == false)
   {
     return;
   }
 
-  translation = frames.at(frame)->getTranslation(partIndex);
-  rotation = frames.at(frame)->getRotation(partIndex);
+  Util::translateMatrix(matrix, translation.getX(), translation.getY(), translation.getZ());
 
-  glTranslatef(translation.getX(), translation.getY(), translation.getZ());
-  glRotatef(rotation.getZ(), 0, 0, 1);
-  glRotatef(rotation.getY(), 0, 1, 0);
-  glRotatef(rotation.getX(), 1, 0, 0);
-  //usleep(50000);
+  if(rotation[0] != 0)
+  {
+    Util::rotateMatrix(matrix, rotation[0], rotation[1], rotation[2], rotation[3]);
+  }
 }
 
 /// \brief Obtain the amount of frames this Animation contains
-/// \return The number of frames
+/// \return The number of frame positions, including those added by interpolate
 int Animation::getFrameCount()
 {
-  return frames.size();
+  if(frames.size() < 1)
+  {
+    return 0;
+  }
+
+  if(join == true)
+  {
+    return frames.size() * steps;
+  }
+
+  return (frames.size() - 1) * steps + 1;
 }
 
 /// \brief Constructor
@@ -1438,6 +3711,7 @@ int Animation::getFrameCount()
 AnimatedModel::AnimatedModel(Model* model)
 {
   this->model = model;
+  paletteMode = false;
 }
 
 /// \brief Destructor
@@ -1476,12 +3750,122 @@ void AnimatedModel::draw()
   //glGetBooleanv(GL_DEPTH_TEST, &depthTest);
   //glEnable(GL_DEPTH_TEST);
 
+  if(paletteMode == true && MatrixPalette::isSupported() == true)
+  {
+    model->getMatrixPalette()->draw(this);
+  }
+  else
+  {
+    drawParts(NULL, NULL);
+  }
+
+  //if(texture2d == true) { glEnable(GL_TEXTURE_2D); }
+  //else { glDisable(GL_TEXTURE_2D); }
+
+  //if(colorMaterial == true) { glEnable(GL_COLOR_MATERIAL); }
+  //else { glDisable(GL_COLOR_MATERIAL); }
+
+  //if(depthTest == true) { glEnable(GL_DEPTH_TEST); }
+  //else { glDisable(GL_DEPTH_TEST); }
+}
+
+/// \brief Add the animated parts to a RenderQueue rather than drawing them
+/// \param queue The queue to add to, using the current modelview matrix
+void AnimatedModel::draw(RenderQueue* queue)
+{
+  drawParts(queue, NULL);
+}
+
+/// \brief Draw or queue only the parts whose animated bounding spheres are inside a frustum
+/// \param frustum The frustum in eye space, built from the projection matrix
+/// \param queue The queue to add the visible parts to, or NULL to draw them immediately
+///
+/// Each part's sphere is transformed by the matrix the part is drawn with
+/// and all of them are tested together. In palette mode the parts are drawn
+/// by the MatrixPalette in one call per material unless none is visible.
+void AnimatedModel::drawVisible(Frustum* frustum, RenderQueue* queue)
+{
+  if(queue == NULL && paletteMode == true && MatrixPalette::isSupported() == true)
+  {
+    model->upload();
+    boundParts();
+
+    if(spheres.cull(frustum) > 0)
+    {
+      model->getMatrixPalette()->draw(this);
+    }
+
+    return;
+  }
+
+  drawParts(queue, frustum);
+}
+
+/// \brief Transform each part by the animation state and draw it
+/// \param queue The queue to add the parts to, or NULL to draw them immediately
+/// \param frustum The frustum to skip the parts outside of, or NULL to draw every part
+void AnimatedModel::drawParts(RenderQueue* queue, Frustum* frustum)
+{
+  RenderBackend* backend = RenderBackend::get();
+  MatrixStack* modelview = CorePipeline::getModelview();
+  float matrix[16] = { 0 };
+
+  model->upload();
+
+  if(frustum != NULL || model->getLodSelector() != NULL)
+  {
+    boundParts();
+  }
+
+  if(frustum != NULL)
+  {
+    spheres.cull(frustum);
+  }
+
+  // Without the fixed function matrix stack the part matrices are calculated instead
+  if(CorePipeline::isEnabled() == true)
+  {
+    for(int i = 0; i < model->getParts()->size(); i++)
+    {
+      if(frustum != NULL && spheres.isVisible(i) == false)
+      {
+        continue;
+      }
+
+      getPartMatrix(i, modelview->get(), matrix);
+
+      if(queue == NULL)
+      {
+        modelview->push();
+        modelview->load(matrix);
+        model->getParts()->at(i)->render(selectLevel(i));
+        modelview->pop();
+      }
+      else
+      {
+        queue->add(model->getParts()->at(i).get(), matrix, selectLevel(i));
+      }
+    }
+
+    if(queue == NULL)
+    {
+      GLState::restore();
+    }
+
+    return;
+  }
+
   for(int i = 0; i < model->getParts()->size(); i++)
   {
-    glPushMatrix();
-    glTranslatef(model->getParts()->at(i)->getCenter()->getX(),
-                 model->getParts()->at(i)->getCenter()->getY(),
-                 model->getParts()->at(i)->getCenter()->getZ());
+    if(frustum != NULL && spheres.isVisible(i) == false)
+    {
+      continue;
+    }
+
+    backend->pushMatrix();
+    backend->translate(model->getParts()->at(i)->getCenter()->getX(),
+                       model->getParts()->at(i)->getCenter()->getY(),
+                       model->getParts()->at(i)->getCenter()->getZ());
 
     for(int a = 0; a < animations.size(); a++)
     {
@@ -1490,22 +3874,123 @@ void AnimatedModel::draw()
                                               false);
     }
 
-    glTranslatef(-model->getParts()->at(i)->getCenter()->getX(),
-                 -model->getParts()->at(i)->getCenter()->getY(),
-                 -model->getParts()->at(i)->getCenter()->getZ());
+    backend->translate(-model->getParts()->at(i)->getCenter()->getX(),
+                       -model->getParts()->at(i)->getCenter()->getY(),
+                       -model->getParts()->at(i)->getCenter()->getZ());
+
+    if(queue == NULL)
+    {
+      model->getParts()->at(i)->render(selectLevel(i));
+    }
+    else
+    {
+      CorePipeline::getCurrentMatrix(matrix);
+      queue->add(model->getParts()->at(i).get(), matrix, selectLevel(i));
+    }
 
-    model->getParts()->at(i)->draw();
-    glPopMatrix();
+    backend->popMatrix();
   }
 
-  //if(texture2d == true) { glEnable(GL_TEXTURE_2D); }
-  //else { glDisable(GL_TEXTURE_2D); }
+  if(queue == NULL)
+  {
+    GLState::restore();
+  }
+}
 
-  //if(colorMaterial == true) { glEnable(GL_COLOR_MATERIAL); }
-  //else { glDisable(GL_COLOR_MATERIAL); }
+/// \brief Gather the bounding sphere of each part as drawn in the current animation state
+///
+/// The spheres are transformed by the current modelview matrix and each
+/// part's animation, ready to be culled in eye space.
+void AnimatedModel::boundParts()
+{
+  Part* part = NULL;
+  float modelview[16] = { 0 };
+  float matrix[16] = { 0 };
+  float center[3] = { 0 };
 
-  //if(depthTest == true) { glEnable(GL_DEPTH_TEST); }
-  //else { glDisable(GL_DEPTH_TEST); }
+  CorePipeline::getCurrentMatrix(modelview);
+  spheres.clear();
+
+  for(size_t i = 0; i < model->getParts()->size(); i++)
+  {
+    part = model->getParts()->at(i).get();
+    getPartMatrix(i, modelview, matrix);
+    center[0] = part->getCenter()->getX();
+    center[1] = part->getCenter()->getY();
+    center[2] = part->getCenter()->getZ();
+    spheres.add(center, part->getRadius(), matrix);
+  }
+}
+
+/// \brief Choose the level of detail of a part with the Model's LodSelector
+/// \param part The index of the part
+/// \return The level chosen from the animated sphere gathered by boundParts, or 0 without a selector
+size_t AnimatedModel::selectLevel(size_t part)
+{
+  LodSelector* selector = model->getLodSelector();
+  float center[3] = { 0 };
+  float radius = 0;
+
+  if(selector == NULL)
+  {
+    return 0;
+  }
+
+  spheres.getSphere(part, center, &radius);
+
+  return selector->select(center, radius);
+}
+
+/// \brief Calculate the matrix a part is drawn with in the current animation state
+/// \param part The index of the part within the Model
+/// \param modelview The column-major matrix the whole model is drawn with
+/// \param matrix The 16 floats to receive the part's matrix
+///
+/// Gives the same result as the transformations drawParts applies to the
+/// current matrix, without requiring a rendering context.
+void AnimatedModel::getPartMatrix(size_t part, const float* modelview, float* matrix)
+{
+  Part* current = model->getParts()->at(part).get();
+
+  memcpy(matrix, modelview, 16 * sizeof(float));
+
+  Util::translateMatrix(matrix, current->getCenter()->getX(),
+                                current->getCenter()->getY(),
+                                current->getCenter()->getZ());
+
+  for(int a = 0; a < animations.size(); a++)
+  {
+    animations.at(a)->transform(current->getName(), framePositions.at(a), matrix);
+  }
+
+  Util::translateMatrix(matrix, -current->getCenter()->getX(),
+                                -current->getCenter()->getY(),
+                                -current->getCenter()->getZ());
+}
+
+/// \brief Draw the parts with a per-part matrix palette rather than the matrix stack
+/// \param enabled True to draw each material of the Model with a single call
+///
+/// Requires OpenGL 2.0; without it draw continues to transform each part in turn.
+/// The Model's MatrixPalette is built on the first draw.
+/// The palette always draws the original faces, ignoring the Model's LodSelector.
+void AnimatedModel::setPaletteMode(bool enabled)
+{
+  paletteMode = enabled;
+}
+
+/// \brief Check whether the parts are drawn with a matrix palette
+/// \return True if setPaletteMode(true) was called
+bool AnimatedModel::getPaletteMode()
+{
+  return paletteMode;
+}
+
+/// \brief Obtain the Model the animations are applied to
+/// \return The Model passed to the constructor
+Model* AnimatedModel::getModel()
+{
+  return model;
 }
 
 /// \brief Check to see whether the specified animation has already been added to the AnimatedModel